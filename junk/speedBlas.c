@@ -0,0 +1,68 @@
+
+#include "../src/fw_dod.h"
+#include <time.h>
+
+
+f64 wallTime( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + 1E-9 * ts.tv_nsec;
+}
+
+
+int main(int argn, const char ** argv) {
+
+    InitializeFV( 4, 'l' );
+
+    u32 S = 2000;
+
+    f64Mat a = f64MatMake( DefaultAllocator, S, S );
+    f64Mat b = f64MatMake( DefaultAllocator, S, S );
+    f64Mat c = f64MatZeroMake( DefaultAllocator, S, S );
+
+    Xorshift1024 x = Xorshift1024Init( 37473 );
+
+    for ( u32 i=0; i<S*S; ++i ) {
+        a.data[i] = rngXorshift1024NextFloat( &x );
+        b.data[i] = rngXorshift1024NextFloat( &x ) * 2;
+    }
+
+    for ( u32 type=0; type<BLAS_NUM_BACKENDS; ++type ) {
+
+        if ( ! BlasSetBackend( type ) ) {
+            continue;
+        }
+
+        f64 begin0 = wallTime();
+
+        f64BlasMul( a, b, c );
+
+        f64 time_spent0 = wallTime() - begin0;
+
+        printf("dump = %.4f\n", c.data[0]);
+        printf("Time of %s gemm: %.4f sec. (%.2f GFLOP/s)\n",
+               BlasBackendName(), time_spent0, 2.0 * S * S * S / time_spent0 * 1E-9);
+
+
+        f64 dump = 0;
+        begin0 = wallTime();
+
+        for ( u32 i=0; i<100; ++i ) {
+            dump += f64MatDot( a, b );
+        }
+
+        time_spent0 = wallTime() - begin0;
+
+        printf("dump = %.4f\n", dump);
+        printf("Time of %s dot: %.4f sec.\n", BlasBackendName(), time_spent0);
+    }
+
+    f64MatFree( DefaultAllocator, &a );
+    f64MatFree( DefaultAllocator, &b );
+    f64MatFree( DefaultAllocator, &c );
+
+    TerminateFV();
+
+    return 0;
+}
@@ -1,4 +1,16 @@
 #!/bin/bash
+#
+# usage: gen_test_main.sh [main] [files...]
+#
+# Writes a test runner that includes main (default src/main.c) and calls the
+# tests of the given files (default the dod sources), e.g.
+#
+#     gen_test_main.sh src/forward_normal/main.c src/forward_normal/*
+#
+
+MAIN=${1:-src/main.c}
+shift
+SOURCES=${*:-src/* src/reverse/* src/optimization/*}
 
 cat <<- EOF
 
@@ -72,7 +84,7 @@ if (!(cond)) { \\
     return; \\
 }
 
-#include "src/main.c"
+#include "$MAIN"
 
 void setSignalHandlerCheckingError(int sig) {
     struct sigaction sa_new = {0};
@@ -132,7 +144,10 @@ int main() {
 EOF
 
 totalTests=0
-for file in src/*; do
+for file in $SOURCES; do
+    if [ ! -f "$file" ]; then
+        continue
+    fi
     nTests=$(grep -c '#if TEST' $file)
     matches=$(awk '/^#if TEST/ {getline; print}' $file)
     if [ -z "$matches" ]; then
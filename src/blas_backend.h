@@ -0,0 +1,859 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Dense linear algebra backend. The external library is chosen at build time
+// (make BLAS=mkl|openblas|cblas|native), the built-in kernels are always
+// available and either one can be selected at runtime through BlasSetBackend
+// or the FV_BLAS environment variable.
+//
+// All routines work on row-major storage with explicit leading dimensions.
+//
+
+#include <float.h>
+
+#include "parallel.h"
+#include "simd_kernels.h"
+
+#if defined(BLAS_MKL)
+    #include <mkl.h>
+    #define BLAS_HAS_CBLAS 1
+#elif defined(BLAS_OPENBLAS) || defined(BLAS_CBLAS)
+    #include <cblas.h>
+    #define BLAS_HAS_CBLAS 1
+#else
+    #define BLAS_HAS_CBLAS 0
+#endif
+
+
+typedef enum BlasBackendType BlasBackendType;
+enum BlasBackendType {
+    BLAS_NATIVE,
+    BLAS_EXTERNAL,
+    BLAS_NUM_BACKENDS,
+};
+
+
+/* C = alpha * op(A) * op(B) + beta * C, op(A) is n x m, op(B) is m x p */
+typedef void BlasGemmFun(
+    b32 transA, b32 transB, u32 n, u32 p, u32 m,
+    f64 alpha, const f64 *a, u32 lda, const f64 *b, u32 ldb,
+    f64 beta, f64 *c, u32 ldc
+);
+
+/* y = alpha * op(A) * x + beta * y, A is n x m */
+typedef void BlasGemvFun(
+    b32 transA, u32 n, u32 m,
+    f64 alpha, const f64 *a, u32 lda, const f64 *x,
+    f64 beta, f64 *y
+);
+
+/* y = alpha * x + y */
+typedef void BlasAxpyFun( u32 n, f64 alpha, const f64 *x, f64 *y );
+
+/* x' * y */
+typedef f64 BlasDotFun( u32 n, const f64 *x, const f64 *y );
+
+/* lower triangle of C = alpha * op(A) * op(A)' + beta * C, op(A) is n x k,
+ * op(A) = A' if trans, the strict upper triangle of C is not referenced */
+typedef void BlasSyrkFun(
+    b32 trans, u32 n, u32 k,
+    f64 alpha, const f64 *a, u32 lda,
+    f64 beta, f64 *c, u32 ldc
+);
+
+
+typedef struct BlasBackend BlasBackend;
+struct BlasBackend {
+    const char  *name;
+    BlasGemmFun *gemm;
+    BlasGemvFun *gemv;
+    BlasAxpyFun *axpy;
+    BlasDotFun  *dot;
+    BlasSyrkFun *syrk;
+};
+
+static BlasBackend FVBlas;
+
+
+/* built-in kernels */
+
+#define BLAS_MIN_PARALLEL_FLOPS 1000000
+
+
+void blasNativeGemm(
+    b32 transA, b32 transB, u32 n, u32 p, u32 m,
+    f64 alpha, const f64 *a, u32 lda, const f64 *b, u32 ldb,
+    f64 beta, f64 *c, u32 ldc
+)
+{
+    for ( u32 i = 0; i < n; ++i ) {
+        f64 *rc = c + i * ldc;
+        if ( beta == 0.0 ) {
+            memset( rc, 0, p * sizeof(f64) );
+        }
+        else if ( beta != 1.0 ) {
+            for ( u32 j = 0; j < p; ++j ) {
+                rc[j] *= beta;
+            }
+        }
+    }
+
+    if ( alpha == 0.0 || m == 0 ) {
+        return;
+    }
+
+    blasGemmArgs args = {
+        .transA = transA,
+        .transB = transB,
+        .p      = p,
+        .m      = m,
+        .alpha  = alpha,
+        .a      = a,
+        .lda    = lda,
+        .b      = b,
+        .ldb    = ldb,
+        .c      = c,
+        .ldc    = ldc,
+    };
+
+    f64 flops = 2.0 * n * m * p;
+
+    simdEnsureKernels();
+
+    if ( flops < BLAS_MIN_PARALLEL_FLOPS ) {
+        FVSimd.gemmRows( &args, 0, n );
+    }
+    else {
+        ParallelFor( n, ParallelChunkSize( n, 4, 4 ), FVSimd.gemmRows, &args );
+    }
+}
+
+
+void blasNativeGemv(
+    b32 transA, u32 n, u32 m,
+    f64 alpha, const f64 *a, u32 lda, const f64 *x,
+    f64 beta, f64 *y
+)
+{
+    u32 dimY = transA ? m : n;
+
+    for ( u32 i = 0; i < dimY; ++i ) {
+        y[i] = beta == 0.0 ? 0.0 : beta * y[i];
+    }
+
+    simdEnsureKernels();
+
+    if ( ! transA ) {
+        for ( u32 i = 0; i < n; ++i ) {
+            y[i] += alpha * FVSimd.dot( m, a + i * lda, x );
+        }
+    }
+    else {
+        for ( u32 i = 0; i < n; ++i ) {
+            FVSimd.axpy( m, alpha * x[i], a + i * lda, y );
+        }
+    }
+}
+
+
+void blasNativeAxpy( u32 n, f64 alpha, const f64 *x, f64 *y )
+{
+    simdEnsureKernels();
+    FVSimd.axpy( n, alpha, x, y );
+}
+
+
+f64 blasNativeDot( u32 n, const f64 *x, const f64 *y )
+{
+    simdEnsureKernels();
+    return FVSimd.dot( n, x, y );
+}
+
+
+typedef struct blasSyrkArgs blasSyrkArgs;
+struct blasSyrkArgs {
+    b32        trans;
+    u32        k;
+    f64        alpha;
+    const f64 *a;
+    u32        lda;
+    f64        beta;
+    f64       *c;
+    u32        ldc;
+};
+
+/* rows [start, end) of the lower triangle */
+void blasSyrkRows( void *args, u32 start, u32 end )
+{
+    blasSyrkArgs *s = (blasSyrkArgs *) args;
+
+    for ( u32 i=start; i<end; ++i ) {
+        f64 *rc = s->c + (u64) i * s->ldc;
+
+        for ( u32 j=0; j<=i; ++j ) {
+            rc[j] = s->beta == 0.0 ? 0.0 : s->beta * rc[j];
+        }
+
+        if ( s->alpha == 0.0 ) {
+            continue;
+        }
+
+        if ( ! s->trans ) {
+            const f64 *ai = s->a + (u64) i * s->lda;
+            for ( u32 j=0; j<=i; ++j ) {
+                rc[j] += s->alpha * FVSimd.dot( s->k, ai, s->a + (u64) j * s->lda );
+            }
+        }
+        else {
+            /* row i of A'A accumulates the rows of A weighted by column i */
+            for ( u32 r=0; r<s->k; ++r ) {
+                const f64 *ar = s->a + (u64) r * s->lda;
+                if ( ar[i] != 0.0 ) {
+                    FVSimd.axpy( i + 1, s->alpha * ar[i], ar, rc );
+                }
+            }
+        }
+    }
+}
+
+void blasNativeSyrk(
+    b32 trans, u32 n, u32 k,
+    f64 alpha, const f64 *a, u32 lda,
+    f64 beta, f64 *c, u32 ldc
+)
+{
+    blasSyrkArgs args = {
+        .trans = trans,
+        .k     = k,
+        .alpha = alpha,
+        .a     = a,
+        .lda   = lda,
+        .beta  = beta,
+        .c     = c,
+        .ldc   = ldc,
+    };
+
+    f64 flops = (f64) n * n * k;
+
+    simdEnsureKernels();
+
+    if ( flops < BLAS_MIN_PARALLEL_FLOPS ) {
+        blasSyrkRows( &args, 0, n );
+    }
+    else {
+        ParallelFor( n, ParallelChunkSize( n, 4, 8 ), blasSyrkRows, &args );
+    }
+}
+
+
+/* external CBLAS library (MKL, OpenBLAS, reference CBLAS) */
+
+#if BLAS_HAS_CBLAS
+
+void blasCblasGemm(
+    b32 transA, b32 transB, u32 n, u32 p, u32 m,
+    f64 alpha, const f64 *a, u32 lda, const f64 *b, u32 ldb,
+    f64 beta, f64 *c, u32 ldc
+)
+{
+    cblas_dgemm(
+        CblasRowMajor,
+        transA ? CblasTrans : CblasNoTrans,
+        transB ? CblasTrans : CblasNoTrans,
+        n, p, m, alpha, a, lda, b, ldb, beta, c, ldc
+    );
+}
+
+void blasCblasGemv(
+    b32 transA, u32 n, u32 m,
+    f64 alpha, const f64 *a, u32 lda, const f64 *x,
+    f64 beta, f64 *y
+)
+{
+    cblas_dgemv(
+        CblasRowMajor, transA ? CblasTrans : CblasNoTrans,
+        n, m, alpha, a, lda, x, 1, beta, y, 1
+    );
+}
+
+void blasCblasAxpy( u32 n, f64 alpha, const f64 *x, f64 *y )
+{
+    cblas_daxpy( n, alpha, x, 1, y, 1 );
+}
+
+f64 blasCblasDot( u32 n, const f64 *x, const f64 *y )
+{
+    return cblas_ddot( n, x, 1, y, 1 );
+}
+
+void blasCblasSyrk(
+    b32 trans, u32 n, u32 k,
+    f64 alpha, const f64 *a, u32 lda,
+    f64 beta, f64 *c, u32 ldc
+)
+{
+    cblas_dsyrk(
+        CblasRowMajor, CblasLower, trans ? CblasTrans : CblasNoTrans,
+        n, k, alpha, a, lda, beta, c, ldc
+    );
+}
+
+#endif
+
+
+b32 BlasBackendAvailable( BlasBackendType type )
+{
+    switch ( type ) {
+        case BLAS_NATIVE:
+            return 1;
+        case BLAS_EXTERNAL:
+#if BLAS_HAS_CBLAS
+            return 1;
+#else
+            return 0;
+#endif
+        default:
+            return 0;
+    }
+}
+
+
+/* returns 0 and keeps the current backend if type was not compiled in */
+b32 BlasSetBackend( BlasBackendType type )
+{
+    if ( ! BlasBackendAvailable( type ) ) {
+        return 0;
+    }
+
+    if ( type == BLAS_NATIVE ) {
+        FVBlas = (BlasBackend) {
+            .name = "native",
+            .gemm = blasNativeGemm,
+            .gemv = blasNativeGemv,
+            .axpy = blasNativeAxpy,
+            .dot  = blasNativeDot,
+            .syrk = blasNativeSyrk,
+        };
+    }
+#if BLAS_HAS_CBLAS
+    else {
+        FVBlas = (BlasBackend) {
+    #if defined(BLAS_MKL)
+            .name = "mkl",
+    #elif defined(BLAS_OPENBLAS)
+            .name = "openblas",
+    #else
+            .name = "cblas",
+    #endif
+            .gemm = blasCblasGemm,
+            .gemv = blasCblasGemv,
+            .axpy = blasCblasAxpy,
+            .dot  = blasCblasDot,
+            .syrk = blasCblasSyrk,
+        };
+    }
+#endif
+
+    return 1;
+}
+
+
+const char *BlasBackendName( void )
+{
+    return FVBlas.name;
+}
+
+
+/* threadScope 'l' limits MKL's thread count to the calling thread */
+void InitializeBlas( u32 numThreads, char threadScope )
+{
+#if defined(BLAS_MKL)
+    if ( threadScope == 'l' ) {
+        mkl_set_num_threads_local( numThreads );
+    }
+    else {
+        mkl_set_num_threads( numThreads );
+    }
+#elif defined(BLAS_OPENBLAS)
+    openblas_set_num_threads( numThreads );
+#endif
+
+    BlasSetBackend( BLAS_HAS_CBLAS ? BLAS_EXTERNAL : BLAS_NATIVE );
+
+    const char *env = getenv( "FV_BLAS" );
+    if ( env && strcmp( env, "native" ) == 0 ) {
+        BlasSetBackend( BLAS_NATIVE );
+    }
+}
+
+
+void TerminateBlas( void )
+{
+    memset( &FVBlas, 0, sizeof(BlasBackend) );
+}
+
+
+Inline
+void blasEnsureBackend( void )
+{
+    if ( ! FVBlas.gemm ) {
+        BlasSetBackend( BLAS_NATIVE );
+    }
+}
+
+
+/* matrix interface */
+
+void f64MatGemm( b32 transA, b32 transB, f64 alpha, f64Mat a, f64Mat b, f64 beta, f64Mat c )
+{
+    u32 n  = transA ? a.dim1 : a.dim0;
+    u32 m  = transA ? a.dim0 : a.dim1;
+    u32 mB = transB ? b.dim1 : b.dim0;
+    u32 p  = transB ? b.dim0 : b.dim1;
+
+    ASSERT( m == mB && n == c.dim0 && p == c.dim1 );
+
+    blasEnsureBackend();
+
+    FVBlas.gemm(
+        transA, transB, n, p, m,
+        alpha, a.data, a.dim1, b.data, b.dim1,
+        beta, c.data, c.dim1
+    );
+}
+
+/* y = alpha * op(A) * x + beta * y */
+void f64MatGemv( b32 transA, f64 alpha, f64Mat a, f64Mat x, f64 beta, f64Mat y )
+{
+    ASSERT( x.dim0 * x.dim1 == (transA ? a.dim0 : a.dim1) );
+    ASSERT( y.dim0 * y.dim1 == (transA ? a.dim1 : a.dim0) );
+
+    blasEnsureBackend();
+
+    FVBlas.gemv( transA, a.dim0, a.dim1, alpha, a.data, a.dim1, x.data, beta, y.data );
+}
+
+/* y = alpha * x + y */
+void f64MatAxpy( f64 alpha, f64Mat x, f64Mat y )
+{
+    ASSERT( x.dim0 * x.dim1 == y.dim0 * y.dim1 );
+
+    blasEnsureBackend();
+
+    FVBlas.axpy( x.dim0 * x.dim1, alpha, x.data, y.data );
+}
+
+f64 f64MatDot( f64Mat x, f64Mat y )
+{
+    ASSERT( x.dim0 * x.dim1 == y.dim0 * y.dim1 );
+
+    blasEnsureBackend();
+
+    return FVBlas.dot( x.dim0 * x.dim1, x.data, y.data );
+}
+
+/* BLAS-1 kernels. These are memory bound, so they always run the SIMD
+ * kernels instead of the external library, elementwise updates of at least
+ * BLAS1_MIN_PARALLEL elements are split over the thread pool. Norms and sums
+ * go through the deterministic blasReduce, f64MatDot stays with the
+ * backend. */
+
+#define BLAS1_MIN_PARALLEL (1 << 16)
+#define BLAS1_MIN_CHUNK    (1 << 13)
+
+/* y = alpha * x + beta * y on (yv, yd), x == NULL scales y by beta */
+typedef struct blas1Args blas1Args;
+struct blas1Args {
+    f64        alpha;
+    f64        beta;
+    const f64 *xv;
+    const f64 *xd;
+    f64       *yv;
+    f64       *yd;
+};
+
+void blas1Range( void *args, u32 start, u32 end )
+{
+    blas1Args *a = (blas1Args *) args;
+
+    u32 n = end - start;
+
+    if ( ! a->xv ) {
+        FVSimd.scal( n, a->beta, a->yv + start );
+        if ( a->yd ) {
+            FVSimd.scal( n, a->beta, a->yd + start );
+        }
+    }
+    else if ( a->yd ) {
+        FVSimd.dualAxpby(
+            n, a->alpha, a->xv + start, a->xd + start, a->beta, a->yv + start, a->yd + start
+        );
+    }
+    else {
+        FVSimd.axpby( n, a->alpha, a->xv + start, a->beta, a->yv + start );
+    }
+}
+
+void blas1Run( blas1Args *args, u32 n )
+{
+    simdEnsureKernels();
+
+    if ( n < BLAS1_MIN_PARALLEL ) {
+        blas1Range( args, 0, n );
+    }
+    else {
+        ParallelFor( n, ParallelChunkSize( n, BLAS1_MIN_CHUNK, 1 ), blas1Range, args );
+    }
+}
+
+
+/* Deterministic reductions. The range is cut into blocks whose size
+ * depends only on n, every block is reduced by the SIMD kernel and the
+ * block results are combined by pairwise summation in a fixed order. The
+ * threads only decide who computes which block, so the result is bitwise
+ * identical for any number of threads. */
+
+#define REDUCE_BLOCK       4096
+#define REDUCE_MAX_BLOCKS  1024
+#define REDUCE_MIN_PARALLEL (1 << 16)
+
+typedef enum ReduceOp ReduceOp;
+enum ReduceOp {
+    REDUCE_SUM,
+    REDUCE_ASUM,
+    REDUCE_DOT,
+};
+
+/* xd and yd may be NULL for plain arrays */
+typedef struct blasReduceArgs blasReduceArgs;
+struct blasReduceArgs {
+    ReduceOp   op;
+    u32        n;
+    u32        block;
+    const f64 *x;
+    const f64 *xd;
+    const f64 *y;
+    const f64 *yd;
+    f64       *val;
+    f64       *dot;
+};
+
+void blasReduceBlocks( void *args, u32 start, u32 end )
+{
+    blasReduceArgs *r = (blasReduceArgs *) args;
+
+    for ( u32 b=start; b<end; ++b ) {
+        u32 off = b * r->block;
+        u32 len = MIN( r->block, r->n - off );
+
+        const f64 *x = r->x + off;
+
+        f64 dot = 0;
+        f64 val;
+
+        switch ( r->op ) {
+            case REDUCE_SUM:
+                val = r->xd ? FVSimd.dualSum( len, x, r->xd + off, &dot ) : FVSimd.sum( len, x );
+                break;
+            case REDUCE_ASUM:
+                val = r->xd ? FVSimd.dualAsum( len, x, r->xd + off, &dot ) : FVSimd.asum( len, x );
+                break;
+            default:
+                val = r->xd
+                    ? FVSimd.dualDot( len, x, r->xd + off, r->y + off, r->yd + off, &dot )
+                    : FVSimd.dot( len, x, r->y + off );
+                break;
+        }
+
+        r->val[b] = val;
+        r->dot[b] = dot;
+    }
+}
+
+/* fixed-order pairwise sum of p[0..n) */
+f64 blasPairwiseSum( const f64 *p, u32 n )
+{
+    if ( n == 0 ) {
+        return 0;
+    }
+    if ( n == 1 ) {
+        return p[0];
+    }
+
+    u32 m = n / 2;
+
+    return blasPairwiseSum( p, m ) + blasPairwiseSum( p + m, n - m );
+}
+
+/* reduces n elements with op, the derivative of a dual reduction goes to
+ * dot if it is not NULL */
+f64 blasReduce( ReduceOp op, u32 n, const f64 *x, const f64 *xd, const f64 *y, const f64 *yd, f64 *dot )
+{
+    f64 val[REDUCE_MAX_BLOCKS];
+    f64 der[REDUCE_MAX_BLOCKS];
+
+    u32 block = MAX( REDUCE_BLOCK, (n + REDUCE_MAX_BLOCKS - 1) / REDUCE_MAX_BLOCKS );
+    block     = (block + 7) & ~7u;
+
+    u32 numBlocks = (n + block - 1) / block;
+
+    blasReduceArgs args = {
+        .op    = op,
+        .n     = n,
+        .block = block,
+        .x     = x,
+        .xd    = xd,
+        .y     = y,
+        .yd    = yd,
+        .val   = val,
+        .dot   = der,
+    };
+
+    simdEnsureKernels();
+
+    if ( n < REDUCE_MIN_PARALLEL ) {
+        blasReduceBlocks( &args, 0, numBlocks );
+    }
+    else {
+        ParallelFor( numBlocks, ParallelChunkSize( numBlocks, 1, 2 ), blasReduceBlocks, &args );
+    }
+
+    if ( dot ) {
+        *dot = blasPairwiseSum( der, numBlocks );
+    }
+
+    return blasPairwiseSum( val, numBlocks );
+}
+
+
+/* y = alpha * x + beta * y */
+void f64MatAxpby( f64 alpha, f64Mat x, f64 beta, f64Mat y )
+{
+    ASSERT( x.dim0 * x.dim1 == y.dim0 * y.dim1 );
+
+    blas1Args args = { .alpha = alpha, .beta = beta, .xv = x.data, .yv = y.data };
+    blas1Run( &args, y.dim0 * y.dim1 );
+}
+
+/* x *= a */
+void f64MatScal( f64 a, f64Mat x )
+{
+    blas1Args args = { .beta = a, .yv = x.data };
+    blas1Run( &args, x.dim0 * x.dim1 );
+}
+
+/* sum |x_i| */
+f64 f64MatAsum( f64Mat x )
+{
+    return blasReduce( REDUCE_ASUM, x.dim0 * x.dim1, x.data, NULL, NULL, NULL, NULL );
+}
+
+/* sum x_i */
+f64 f64MatSum( f64Mat x )
+{
+    return blasReduce( REDUCE_SUM, x.dim0 * x.dim1, x.data, NULL, NULL, NULL, NULL );
+}
+
+/* Euclidean norm, rescaled by max |x_i| only if the sum of squares
+ * overflows or underflows, a zero sum may be all squares underflowing */
+f64 f64MatNrm2( f64Mat x )
+{
+    u32 n = x.dim0 * x.dim1;
+
+    f64 ss = blasReduce( REDUCE_DOT, n, x.data, NULL, x.data, NULL, NULL );
+
+    if ( isfinite( ss ) && ss >= DBL_MIN ) {
+        return sqrt( ss );
+    }
+
+    f64 scale = 0;
+    for ( u32 i=0; i<n; ++i ) {
+        scale = MAX( scale, fabs( x.data[i] ) );
+    }
+    if ( scale == 0 || ! isfinite( scale ) ) {
+        return scale;
+    }
+
+    ss = 0;
+    for ( u32 i=0; i<n; ++i ) {
+        f64 t = x.data[i] / scale;
+        ss += t * t;
+    }
+
+    return scale * sqrt( ss );
+}
+
+
+/* lower triangle of c = alpha * op(a) * op(a)' + beta * c, op(a) = a' if
+ * trans, so trans gives the Gram matrix a'a of the columns of a */
+void f64MatSyrk( b32 trans, f64 alpha, f64Mat a, f64 beta, f64Mat c )
+{
+    u32 n = trans ? a.dim1 : a.dim0;
+    u32 k = trans ? a.dim0 : a.dim1;
+
+    ASSERT( c.dim0 == n && c.dim1 == n );
+
+    blasEnsureBackend();
+
+    FVBlas.syrk( trans, n, k, alpha, a.data, a.dim1, beta, c.data, c.dim1 );
+}
+
+/* copies the lower triangle of c to the upper one */
+void f64MatSymmetrize( f64Mat c )
+{
+    ASSERT( c.dim0 == c.dim1 );
+
+    u32 n = c.dim0;
+
+    for ( u32 i=0; i<n; ++i ) {
+        for ( u32 j=i+1; j<n; ++j ) {
+            c.data[i*n + j] = c.data[j*n + i];
+        }
+    }
+}
+
+/* c = a * b */
+Inline
+void f64BlasMul( f64Mat a, f64Mat b, f64Mat c )
+{
+    f64MatGemm( 0, 0, 1.0, a, b, 0.0, c );
+}
+
+/* c += a * b */
+Inline
+void f64BlasMulIP( f64Mat a, f64Mat b, f64Mat c )
+{
+    f64MatGemm( 0, 0, 1.0, a, b, 1.0, c );
+}
+
+
+#if TEST
+void test_blas_native()
+{
+#define EPS 1E-10
+
+    BlasSetBackend( BLAS_NATIVE );
+
+    f64Mat a = f64MatMake( DefaultAllocator, 3, 2 );
+    f64Mat b = f64MatMake( DefaultAllocator, 2, 3 );
+    f64Mat c = f64MatMake( DefaultAllocator, 3, 3 );
+    f64Mat e = f64MatMake( DefaultAllocator, 3, 3 );
+
+    for ( u32 i=0; i<6; ++i ) {
+        a.data[i] = (f64) i;
+        b.data[i] = (f64) 2*i;
+    }
+
+    /* a * b */
+    f64BlasMul( a, b, c );
+
+    e.data[0] = 6;  e.data[1] = 8;   e.data[2] = 10;
+    e.data[3] = 18; e.data[4] = 28;  e.data[5] = 38;
+    e.data[6] = 30; e.data[7] = 48;  e.data[8] = 66;
+
+    TEST_ASSERT( f64MatEqual( c, e, EPS ) );
+
+    /* c + a * b */
+    f64BlasMulIP( a, b, c );
+
+    for ( u32 i=0; i<9; ++i ) {
+        e.data[i] *= 2;
+    }
+
+    TEST_ASSERT( f64MatEqual( c, e, EPS ) );
+
+    /* b' * a' = (a * b)' */
+    f64MatGemm( 1, 1, 0.5, b, a, 0.0, c );
+
+    for ( u32 i=0; i<3; ++i ) {
+        for ( u32 j=0; j<3; ++j ) {
+            TEST_ASSERT( f64Equal( c.data[i*3 + j], e.data[j*3 + i] / 4, EPS ) );
+        }
+    }
+
+    /* vector routines */
+    f64Mat x = f64MatMake( DefaultAllocator, 2, 1 );
+    f64Mat y = f64MatMake( DefaultAllocator, 3, 1 );
+
+    x.data[0] = 1.0;
+    x.data[1] = -1.0;
+
+    f64MatGemv( 0, 1.0, a, x, 0.0, y );
+
+    TEST_ASSERT( f64Equal( y.data[0], -1.0, EPS ) );
+    TEST_ASSERT( f64Equal( y.data[2], -1.0, EPS ) );
+
+    TEST_ASSERT( f64Equal( f64MatDot( x, x ), 2.0, EPS ) );
+
+    /* x += 2 w, axpy does not allow x and y to overlap */
+    f64Mat w = f64MatMake( DefaultAllocator, 2, 1 );
+
+    w.data[0] = x.data[0];
+    w.data[1] = x.data[1];
+
+    f64MatAxpy( 2.0, w, x );
+
+    TEST_ASSERT( f64Equal( x.data[1], -3.0, EPS ) );
+
+    f64MatFree( DefaultAllocator, &w );
+
+    /* a' a and a a' against the full products */
+    f64Mat g = f64MatMake( DefaultAllocator, 2, 2 );
+    f64Mat h = f64MatMake( DefaultAllocator, 2, 2 );
+
+    f64MatSyrk( 1, 1.0, a, 0.0, g );
+    f64MatSymmetrize( g );
+    f64MatGemm( 1, 0, 1.0, a, a, 0.0, h );
+
+    TEST_ASSERT( f64MatEqual( g, h, EPS ) );
+
+    f64MatGemm( 0, 1, 1.0, a, a, 0.0, e );
+    f64MatGemm( 0, 1, 2.0, a, a, 0.0, c );
+    f64MatSyrk( 0, -1.0, a, 1.0, c );
+    f64MatSymmetrize( c );
+
+    TEST_ASSERT( f64MatEqual( c, e, EPS ) );
+
+    f64MatFree( DefaultAllocator, &g );
+    f64MatFree( DefaultAllocator, &h );
+
+    /* BLAS-1, x = (3, -3) */
+    f64Mat z = f64MatMake( DefaultAllocator, 2, 1 );
+
+    z.data[0] = 1.0;
+    z.data[1] = 2.0;
+
+    f64MatAxpby( 1.0, x, -2.0, z );
+    TEST_ASSERT( f64Equal( z.data[0], 1.0, EPS ) );
+    TEST_ASSERT( f64Equal( z.data[1], -7.0, EPS ) );
+
+    f64MatScal( -2.0, z );
+    TEST_ASSERT( f64Equal( z.data[1], 14.0, EPS ) );
+
+    TEST_ASSERT( f64Equal( f64MatAsum( z ), 16.0, EPS ) );
+    TEST_ASSERT( f64Equal( f64MatNrm2( z ), sqrt( 200.0 ), EPS ) );
+
+    z.data[0] = 3E200;
+    z.data[1] = 4E200;
+    TEST_ASSERT( f64Equal( f64MatNrm2( z ) / 5E200, 1.0, EPS ) );
+
+    z.data[0] = 3E-200;
+    z.data[1] = 4E-200;
+    TEST_ASSERT( f64Equal( f64MatNrm2( z ) / 5E-200, 1.0, EPS ) );
+
+    z.data[0] = 0;
+    z.data[1] = 0;
+    TEST_ASSERT( f64MatNrm2( z ) == 0 );
+
+    f64MatFree( DefaultAllocator, &z );
+
+    f64MatFree( DefaultAllocator, &a );
+    f64MatFree( DefaultAllocator, &b );
+    f64MatFree( DefaultAllocator, &c );
+    f64MatFree( DefaultAllocator, &e );
+    f64MatFree( DefaultAllocator, &x );
+    f64MatFree( DefaultAllocator, &y );
+
+#undef EPS
+}
+#endif
@@ -165,6 +165,82 @@
     }
 
 
+// NOTE(jonas): increments matrix c: c = a' * b + c, without transposing a
+#define MAT_TMUL(type, addFun, mulFun) void \
+    type##MatTMul(type##Mat a, type##Mat b, type##Mat c) \
+    { \
+        ASSERT(a.dim1 == c.dim0 && a.dim0 == b.dim0 && b.dim1 == c.dim1); \
+         \
+        /* A is m x n */ \
+        /* B is m x p */ \
+        /* C is n x p */ \
+         \
+        u32 m = a.dim0; \
+        u32 n = a.dim1; \
+        u32 p = b.dim1; \
+         \
+        for ( u32 k = 0; k < m; ++k ) { \
+            type *ra = a.data + k * n; \
+            type *rb = b.data + k * p; \
+            for ( u32 i = 0; i < n; ++i ) { \
+                type *rc = c.data + i * p; \
+                for ( u32 j = 0; j < p; ++j ) { \
+                    /* C(i, j) += A(k, i) * B(k, j); */ \
+                    rc[j] = addFun( rc[j], mulFun( ra[i], rb[j] ) ); \
+                } \
+            } \
+        } \
+    }
+
+// NOTE(jonas): increments matrix c: c = a * b' + c, without transposing b
+#define MAT_MULT(type, addFun, mulFun) void \
+    type##MatMulT(type##Mat a, type##Mat b, type##Mat c) \
+    { \
+        ASSERT(a.dim0 == c.dim0 && a.dim1 == b.dim1 && b.dim0 == c.dim1); \
+         \
+        /* A is n x m */ \
+        /* B is p x m */ \
+        /* C is n x p */ \
+         \
+        u32 n = a.dim0; \
+        u32 m = a.dim1; \
+        u32 p = b.dim0; \
+         \
+        for ( u32 i = 0; i < n; ++i ) { \
+            type *ra = a.data + i * m; \
+            for ( u32 j = 0; j < p; ++j ) { \
+                type *rb  = b.data + j * m; \
+                type  val = c.data[i * p + j]; \
+                for ( u32 k = 0; k < m; ++k ) { \
+                    val = addFun( val, mulFun( ra[k], rb[k] ) ); \
+                } \
+                c.data[i * p + j] = val; \
+            } \
+        } \
+    }
+
+// NOTE(jonas): increments the lower triangle of c: c = a' * a + c, the
+// strict upper triangle is not touched
+#define MAT_SYRK(type, addFun, mulFun) void \
+    type##MatSyrk(type##Mat a, type##Mat c) \
+    { \
+        ASSERT(a.dim1 == c.dim0 && c.dim0 == c.dim1); \
+         \
+        u32 m = a.dim0; \
+        u32 n = a.dim1; \
+         \
+        for ( u32 k = 0; k < m; ++k ) { \
+            type *ra = a.data + k * n; \
+            for ( u32 i = 0; i < n; ++i ) { \
+                type *rc = c.data + i * n; \
+                for ( u32 j = 0; j <= i; ++j ) { \
+                    rc[j] = addFun( rc[j], mulFun( ra[i], ra[j] ) ); \
+                } \
+            } \
+        } \
+    }
+
+
 // NOTE(jonas): naive implementation, to check against
 #define MAT_MUL_NAIVE(type, addFun, mulFun) void \
     type##MatMul_Naive(type##Mat a, type##Mat b, type##Mat c) \
@@ -203,6 +279,9 @@ MAT_GETCOL(f64);
 MAT_ADD(f64, f64Add);
 MAT_SUB(f64, f64Sub);
 MAT_MUL(f64, f64Add, f64Mul);
+MAT_TMUL(f64, f64Add, f64Mul);
+MAT_MULT(f64, f64Add, f64Mul);
+MAT_SYRK(f64, f64Add, f64Mul);
 MAT_MUL_NAIVE(f64, f64Add, f64Mul);
 
 
@@ -294,6 +373,40 @@ void test_f64Matrices()
     TEST_ASSERT( f64MatEqual( c, e, EPS ) );
     
     
+    /* transposed multiplication, a' b and a b' against explicit transposes */
+    for ( u32 i=0; i<3; ++i ) {
+        for ( u32 j=0; j<3; ++j ) {
+            d.data[i*3 + j] = a.data[j*3 + i];
+        }
+    }
+    
+    memset( c.data, 0, c.dim0 * c.dim1 * sizeof(f64) );
+    memset( e.data, 0, e.dim0 * e.dim1 * sizeof(f64) );
+    f64MatTMul( a, b, c );
+    f64MatMul( d, b, e );
+    
+    TEST_ASSERT( f64MatEqual( c, e, EPS ) );
+    
+    memset( c.data, 0, c.dim0 * c.dim1 * sizeof(f64) );
+    memset( e.data, 0, e.dim0 * e.dim1 * sizeof(f64) );
+    f64MatMulT( b, a, c );
+    f64MatMul( b, d, e );
+    
+    TEST_ASSERT( f64MatEqual( c, e, EPS ) );
+    
+    /* a' a, lower triangle only */
+    memset( c.data, 0, c.dim0 * c.dim1 * sizeof(f64) );
+    memset( e.data, 0, e.dim0 * e.dim1 * sizeof(f64) );
+    f64MatSyrk( a, c );
+    f64MatMul( d, a, e );
+    
+    for ( u32 i=0; i<3; ++i ) {
+        for ( u32 j=0; j<3; ++j ) {
+            TEST_ASSERT( f64Equal( c.data[i*3 + j], j <= i ? e.data[i*3 + j] : 0, EPS ) );
+        }
+    }
+    
+    
     f64MatFree( DefaultAllocator, &a );
     f64MatFree( DefaultAllocator, &b );
     f64MatFree( DefaultAllocator, &c );
@@ -0,0 +1,115 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Compressed sparse row matrices of the scalar dual f64FVar, instantiated
+// from the SPMAT_* macros of spmat.h. Every stored entry carries its own
+// value and tangent, so an entry is structurally nonzero if either part is.
+//
+
+#import "../parallel.h"
+#import "../spmat.h"
+
+
+SPMAT_DECL(f64FVar);
+SPMAT_MAKE(f64FVar);
+SPMAT_FREE(f64FVar);
+SPMAT_FROM_DENSE(f64FVar);
+SPMAT_TO_DENSE(f64FVar);
+SPMAT_TRANSPOSE(f64FVar);
+SPMAT_MUL(f64FVar, f64FVAdd, f64FVMul);
+SPMAT_TMUL(f64FVar, f64FVAdd, f64FVMul);
+
+
+#if TEST
+void test_fw_sparse()
+{
+#define EPS 1E-10
+
+    u32 N = 300;
+    u32 M = 200;
+    u32 P = 24;
+
+    b32 ownPool = FVThreadPool.numThreads == 0;
+    if ( ownPool ) {
+        InitializeParallel( 4 );
+    }
+
+    Xorshift1024 rng = Xorshift1024Init( 17 );
+
+    f64FVarMat dense = f64FVarMatZeroMake( DefaultAllocator, N, M );
+    for ( u32 i=0; i<N*M; ++i ) {
+        if ( rngXorshift1024NextFloat( &rng ) < 0.05 ) {
+            dense.data[i] = f64FVMake(
+                rngXorshift1024NextFloat( &rng ) - 0.5,
+                rngXorshift1024NextFloat( &rng ) - 0.5
+            );
+        }
+    }
+    /* a tangent without a value still belongs to the pattern */
+    dense.data[1] = f64FVMake( 0, 1 );
+
+    f64FVarSpMat a  = f64FVarSpMatFromDense( DefaultAllocator, dense );
+    f64FVarSpMat at = f64FVarSpMatTranspose( DefaultAllocator, a );
+
+    f64FVarMat back = f64FVarMatMake( DefaultAllocator, N, M );
+    f64FVarSpMatToDense( a, back );
+    TEST_ASSERT( f64FVarMatEqual( back, dense, EPS ) );
+
+    f64FVarMat b  = f64FVarMatMake( DefaultAllocator, M, P );
+    f64FVarMat bt = f64FVarMatMake( DefaultAllocator, N, P );
+    for ( u32 i=0; i<M*P; ++i ) {
+        b.data[i] = f64FVMake( rngXorshift1024NextFloat( &rng ), rngXorshift1024NextFloat( &rng ) );
+    }
+    for ( u32 i=0; i<N*P; ++i ) {
+        bt.data[i] = f64FVMake( rngXorshift1024NextFloat( &rng ), rngXorshift1024NextFloat( &rng ) );
+    }
+
+    /* nnz * P is above SPMAT_MIN_PARALLEL_NNZ and rows and columns split
+     * into several chunks, so the products run on the pool */
+    TEST_ASSERT( (u64) a.nnz * P >= SPMAT_MIN_PARALLEL_NNZ );
+    TEST_ASSERT( ParallelNumChunks( N, ParallelChunkSize( N, 16, 8 ) ) > 1 );
+    TEST_ASSERT( ParallelNumChunks( P, ParallelChunkSize( P, 8, 1 ) ) > 1 );
+
+    /* the dense products increment their output */
+    f64FVarMat c   = f64FVarMatMake( DefaultAllocator, N, P );
+    f64FVarMat ref = f64FVarMatZeroMake( DefaultAllocator, N, P );
+
+    f64FVarSpMatMul( a, b, c );
+    f64FVarMatMul( dense, b, ref );
+    TEST_ASSERT( f64FVarMatEqual( c, ref, EPS ) );
+
+    f64FVarSpMatMulIP( a, b, c );
+    f64FVarMatMul( dense, b, ref );
+    TEST_ASSERT( f64FVarMatEqual( c, ref, EPS ) );
+
+    /* a' b directly, through the transposed pattern and densely */
+    f64FVarMat ct = f64FVarMatMake( DefaultAllocator, M, P );
+    f64FVarMat rt = f64FVarMatMake( DefaultAllocator, M, P );
+    f64FVarMat dt = f64FVarMatZeroMake( DefaultAllocator, M, P );
+
+    f64FVarSpMatTMul( a, bt, ct );
+    f64FVarSpMatMul( at, bt, rt );
+    TEST_ASSERT( f64FVarMatEqual( ct, rt, EPS ) );
+
+    f64FVarMatTMul( dense, bt, dt );
+    TEST_ASSERT( f64FVarMatEqual( ct, dt, EPS ) );
+
+    f64FVarMatFree( DefaultAllocator, &dense );
+    f64FVarMatFree( DefaultAllocator, &back );
+    f64FVarMatFree( DefaultAllocator, &b );
+    f64FVarMatFree( DefaultAllocator, &bt );
+    f64FVarMatFree( DefaultAllocator, &c );
+    f64FVarMatFree( DefaultAllocator, &ref );
+    f64FVarMatFree( DefaultAllocator, &ct );
+    f64FVarMatFree( DefaultAllocator, &rt );
+    f64FVarMatFree( DefaultAllocator, &dt );
+    f64FVarSpMatFree( DefaultAllocator, &a );
+    f64FVarSpMatFree( DefaultAllocator, &at );
+
+    if ( ownPool ) {
+        TerminateParallel();
+    }
+
+#undef EPS
+}
+#endif
@@ -497,6 +497,9 @@ MAT_GETCOL(f64FVar);
 MAT_ADD(f64FVar, f64FVAdd);
 MAT_SUB(f64FVar, f64FVSub);
 MAT_MUL(f64FVar, f64FVAdd, f64FVMul);
+MAT_TMUL(f64FVar, f64FVAdd, f64FVMul);
+MAT_MULT(f64FVar, f64FVAdd, f64FVMul);
+MAT_SYRK(f64FVar, f64FVAdd, f64FVMul);
 
 
 
@@ -550,6 +553,9 @@ MAT_GETCOL(f64FVarFVar);
 MAT_ADD(f64FVarFVar, f64FVarFVAdd);
 MAT_SUB(f64FVarFVar, f64FVarFVSub);
 MAT_MUL(f64FVarFVar, f64FVarFVAdd, f64FVarFVMul);
+MAT_TMUL(f64FVarFVar, f64FVarFVAdd, f64FVarFVMul);
+MAT_MULT(f64FVarFVar, f64FVarFVAdd, f64FVarFVMul);
+MAT_SYRK(f64FVarFVar, f64FVarFVAdd, f64FVarFVMul);
 
 
 
@@ -1,4 +1,5 @@
 #import "fw_univariate.h"
+#import "objective.h"
 
 
 /* Finite Difference */
@@ -71,12 +72,68 @@ void f64FVarCDiff( Allocator al, f64FVar f( f64FVarMat ), f64Mat input, f64Mat g
 }
 
 
-/* AD gradient */
-void f64FVarGradient( Allocator al, f64FVar f( f64FVarMat ), f64Mat input, f64Mat grad )
+/* Finite Difference on the plain f64 instantiation of an objective */
+void f64FDiff( Allocator al, f64 f( f64Mat ), f64Mat input, f64Mat grad, f64 h )
 {
     ASSERT( input.dim0 == grad.dim0 && input.dim1 == grad.dim1 && input.dim1 == 1 );
 
-    f64FVar tmp;
+    u32 N = input.dim0;
+
+    f64Mat xCpy = f64MatMake( al, N, 1 );
+
+    for ( u32 i=0; i<N; ++i ) {
+        xCpy.data[i] = input.data[i];
+    }
+
+    f64 fx = f( xCpy );
+
+    for ( u32 i=0; i<N; ++i ) {
+        xCpy.data[i] += h;
+
+        grad.data[i] = (f( xCpy ) - fx) / h;
+
+        xCpy.data[i] = input.data[i];
+    }
+
+    f64MatFree( al, &xCpy );
+}
+
+
+/* Central Difference on the plain f64 instantiation of an objective */
+void f64CDiff( Allocator al, f64 f( f64Mat ), f64Mat input, f64Mat grad, f64 h )
+{
+    ASSERT( input.dim0 == grad.dim0 && input.dim1 == grad.dim1 && input.dim1 == 1 );
+
+    u32 N = input.dim0;
+
+    f64Mat xCpy = f64MatMake( al, N, 1 );
+
+    for ( u32 i=0; i<N; ++i ) {
+        xCpy.data[i] = input.data[i];
+    }
+
+    for ( u32 i=0; i<N; ++i ) {
+        xCpy.data[i] = input.data[i] + h;
+        f64 fUp      = f( xCpy );
+
+        xCpy.data[i] = input.data[i] - h;
+        f64 fDown    = f( xCpy );
+
+        grad.data[i] = (fUp - fDown) / (2*h);
+
+        xCpy.data[i] = input.data[i];
+    }
+
+    f64MatFree( al, &xCpy );
+}
+
+
+/* AD gradient, returns f(input) */
+f64 f64FVarGradient( Allocator al, f64FVar f( f64FVarMat ), f64Mat input, f64Mat grad )
+{
+    ASSERT( input.dim0 == grad.dim0 && input.dim1 == grad.dim1 && input.dim1 == 1 );
+
+    f64FVar tmp = f64FVConst( 0 );
     u32 N = input.dim0;
 
     f64FVarMat xCpy = f64FVarMatMake( al, N, 1 );
@@ -95,6 +152,8 @@ void f64FVarGradient( Allocator al, f64FVar f( f64FVarMat ), f64Mat input, f64Ma
     }
 
     f64FVarMatFree( al, &xCpy );
+
+    return tmp.val;
 }
 
 
@@ -197,8 +256,9 @@ void f64FVarNumHess( Allocator al, f64FVarFVar f( f64FVarFVarMat ), f64Mat input
 }
 
 
-/* hessian and gradient with second-order forward AD variables */
-void f64FVarHessian( Allocator al, f64FVarFVar f( f64FVarFVarMat ), f64Mat input, f64Mat grad, f64Mat hess )
+/* hessian and gradient with second-order forward AD variables, returns
+ * f(input) */
+f64 f64FVarHessian( Allocator al, f64FVarFVar f( f64FVarFVarMat ), f64Mat input, f64Mat grad, f64Mat hess )
 {
 #define Hess(i,j) hess.data[i*hess.dim1 + j]
 
@@ -206,6 +266,7 @@ void f64FVarHessian( Allocator al, f64FVarFVar f( f64FVarFVarMat ), f64Mat input
     ASSERT( hess.dim0 == hess.dim1 && hess.dim0 == MAX(grad.dim0, grad.dim1) );
 
     f64FVarFVar tmp;
+    f64 val = 0;
     u32 N = input.dim0;
 
     f64FVarFVarMat xCpy = f64FVarFVarMatMake( al, N, 1 );
@@ -226,6 +287,7 @@ void f64FVarHessian( Allocator al, f64FVarFVar f( f64FVarFVarMat ), f64Mat input
 
             if ( i == j ) {
                 grad.data[i] = tmp.dot.val;
+                val          = tmp.val.val;
             }
 
             Hess(i, j) = tmp.dot.dot;
@@ -236,10 +298,53 @@ void f64FVarHessian( Allocator al, f64FVarFVar f( f64FVarFVarMat ), f64Mat input
 
     f64FVarFVarMatFree( al, &xCpy );
 
+    return val;
+
 #undef Hess
 }
 
 
+/* Hessian-vector product H(input) v without forming H. Pass i seeds the
+ * inner tangent with v and the outer one with e_i, so tmp.dot.val is the
+ * i-th gradient entry and tmp.dot.dot the i-th entry of H v. Takes O(N)
+ * memory but N passes per product, the same passes as f64FVarHessian, so
+ * N products cost O(N^2) evaluations of f. Forward-over-reverse on the
+ * scalar tape (f64RVHessVec) does a product in a fixed number of sweeps.
+ * Returns f(input). */
+f64 f64FVarHessVec( Allocator al, f64FVarFVar f( f64FVarFVarMat ), f64Mat input, f64Mat v, f64Mat grad, f64Mat hv )
+{
+    ASSERT( input.dim0 == grad.dim0 && input.dim1 == grad.dim1 && input.dim1 == 1 );
+    ASSERT( input.dim0 == v.dim0 && input.dim0 == hv.dim0 );
+
+    f64FVarFVar tmp;
+    f64 val = 0;
+    u32 N = input.dim0;
+
+    f64FVarFVarMat xCpy = f64FVarFVarMatMake( al, N, 1 );
+
+    for ( u32 i=0; i<N; ++i ) {
+        xCpy.data[i] = f64FVarFVMake( f64FVConst( input.data[i] ), f64FVConst( 0 ) );
+        xCpy.data[i].val.dot = v.data[i];
+    }
+
+    for ( u32 i=0; i<N; ++i ) {
+        xCpy.data[i].dot.val = 1.0;
+
+        tmp = f( xCpy );
+
+        grad.data[i] = tmp.dot.val;
+        hv.data[i]   = tmp.dot.dot;
+        val          = tmp.val.val;
+
+        xCpy.data[i].dot.val = 0.0;
+    }
+
+    f64FVarFVarMatFree( al, &xCpy );
+
+    return val;
+}
+
+
 
 /* test function, will be refactored once the test tool is updated */
 f64FVarFVar test_f2( f64FVarFVarMat input )
@@ -280,10 +385,113 @@ void test_hessian()
     f64MatFree( DefaultAllocator, &hess );
 
 #undef P
+#undef EPS
+}
+#endif
+
+
+#if TEST
+void test_hessvec()
+{
+#define EPS 1E-12
+
+    u32 N = 2;
+
+    f64Mat input = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat v     = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat grad  = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat gradH = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat hess  = f64MatMake( DefaultAllocator, N, N );
+    f64Mat hv    = f64MatMake( DefaultAllocator, N, 1 );
+
+    input.data[0] = 0.5;
+    input.data[1] = 2.0;
+    v.data[0]     = -1.5;
+    v.data[1]     = 0.25;
+
+    f64 val  = f64FVarHessVec( DefaultAllocator, test_f2, input, v, grad, hv );
+    f64 valH = f64FVarHessian( DefaultAllocator, test_f2, input, gradH, hess );
+
+    TEST_ASSERT( val == valH );
+    TEST_ASSERT( f64MatEqual( grad, gradH, EPS ) );
+
+    for ( u32 i=0; i<N; ++i ) {
+        f64 ref = hess.data[i*N] * v.data[0] + hess.data[i*N + 1] * v.data[1];
+        TEST_ASSERT( fabs( hv.data[i] - ref ) < EPS );
+    }
+
+    f64MatFree( DefaultAllocator, &input );
+    f64MatFree( DefaultAllocator, &v );
+    f64MatFree( DefaultAllocator, &grad );
+    f64MatFree( DefaultAllocator, &gradH );
+    f64MatFree( DefaultAllocator, &hess );
+    f64MatFree( DefaultAllocator, &hv );
+
+#undef EPS
 }
 #endif
 
 
 
+/* tanh(x0) + x0 x1^2, written once and instantiated for f64, f64FVar and
+   f64FVarFVar */
+#define TEST_OBJ(OP, x) \
+    OP(Add)( \
+        OP(Tanh)( x.data[0] ), \
+        OP(Mul)( x.data[0], OP(Pow)( x.data[1], 2 ) ) \
+    )
+
+OBJECTIVE(test_obj, TEST_OBJ)
+
+
+#if TEST
+void test_objective()
+{
+#define EPS 1E-5
+
+    u32 N = 2;
+
+    f64Mat input  = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat gradC  = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat gradF  = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat gradAD = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat gradH  = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat hess   = f64MatMake( DefaultAllocator, N, N );
+    f64Mat gradR  = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat hessR  = f64MatMake( DefaultAllocator, N, N );
+
+    input.data[0] = 0.5;
+    input.data[1] = 2.0;
+
+    f64FDiff( DefaultAllocator, test_objf64, input, gradF, 1E-7 );
+    f64CDiff( DefaultAllocator, test_objf64, input, gradC, 1E-6 );
+
+    f64 val  = f64FVarGradient( DefaultAllocator, test_objf64FVar, input, gradAD );
+    f64 valH = f64FVarHessian( DefaultAllocator, test_objf64FVarFVar, input, gradH, hess );
+
+    /* test_f2 is the same function written for the second-order type only */
+    f64FVarHessian( DefaultAllocator, test_f2, input, gradR, hessR );
+
+    TEST_ASSERT( f64Equal( val, test_objf64( input ), EPS ) );
+    TEST_ASSERT( f64Equal( valH, val, EPS ) );
+
+    TEST_ASSERT( f64MatEqual( gradF, gradAD, EPS ) );
+    TEST_ASSERT( f64MatEqual( gradC, gradAD, EPS ) );
+    TEST_ASSERT( f64MatEqual( gradH, gradAD, EPS ) );
+    TEST_ASSERT( f64MatEqual( hess, hessR, EPS ) );
+
+    f64MatFree( DefaultAllocator, &input );
+    f64MatFree( DefaultAllocator, &gradC );
+    f64MatFree( DefaultAllocator, &gradF );
+    f64MatFree( DefaultAllocator, &gradAD );
+    f64MatFree( DefaultAllocator, &gradH );
+    f64MatFree( DefaultAllocator, &hess );
+    f64MatFree( DefaultAllocator, &gradR );
+    f64MatFree( DefaultAllocator, &hessR );
+
+#undef EPS
+}
+#endif
 
 
+#import "mapreduce.h"
@@ -0,0 +1,34 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Entry point of the scalar forward mode. It brings its own matrix type
+// (fw_matrix.h) and is built and tested separately from src/main.c, see the
+// tests_normal target of the Makefile.
+//
+
+#include "../dependencies/utilities.h"
+#include "grad.h"
+#include "fw_sparse.h"
+
+
+
+
+#ifndef TEST
+int main(int argc, const char * argv[]) {
+
+    f64Mat input = f64MatMake( DefaultAllocator, 2, 1 );
+    f64Mat grad  = f64MatMake( DefaultAllocator, 2, 1 );
+
+    input.data[0] = 0.5;
+    input.data[1] = 2.0;
+
+    f64 val = f64FVarGradient( DefaultAllocator, test_f, input, grad );
+
+    printf("%.4f (%.4f, %.4f)\n", val, grad.data[0], grad.data[1]);
+
+    f64MatFree( DefaultAllocator, &input );
+    f64MatFree( DefaultAllocator, &grad );
+
+    return 0;
+}
+#endif
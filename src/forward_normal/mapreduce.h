@@ -0,0 +1,300 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Map-reduce driver for objectives of the form
+//
+//     f(theta) = sum_i g( theta, data_i )
+//
+// g is evaluated on one observation at a time, the observations are
+// numObs records of obsSize bytes. The records are cut into tasks of whole
+// cache-sized chunks, every task owns a copy of theta and accumulates the
+// value and the tangent sums of its chunks. Within a chunk all seed
+// directions are run before moving on, so each chunk is read from memory
+// once per evaluation. Task boundaries depend only on numObs and obsSize and
+// the task sums are combined pairwise in a fixed order, so results are
+// bitwise identical for any number of threads.
+//
+
+#import "../parallel.h"
+
+
+#define MAPREDUCE_CHUNK_BYTES (128 * 1024)
+#define MAPREDUCE_MAX_TASKS   256
+
+
+/* per-observation kernel, obs points to one record of the data array */
+typedef f64FVar MapReduceFun( f64FVarMat theta, const void *obs );
+
+
+typedef struct mapReduceArgs mapReduceArgs;
+struct mapReduceArgs {
+    MapReduceFun *g;
+    const u8     *data;
+    u32           obsSize;
+    u32           numObs;
+    u32           chunkObs;  /* observations per chunk */
+    u32           taskObs;   /* observations per task, a multiple of chunkObs */
+
+    f64Mat        input;
+    f64Mat        dir;       /* NULL data: unit directions, i.e. the gradient */
+    u32           numSeeds;
+
+    f64FVarMat   *theta;     /* one per task */
+    f64          *val;       /* numTasks */
+    f64          *dot;       /* numSeeds x numTasks */
+    u32           numTasks;
+};
+
+void mapReduceTasks( void *args, u32 start, u32 end )
+{
+    mapReduceArgs *a = (mapReduceArgs *) args;
+
+    u32 n = a->input.dim0;
+
+    for ( u32 t=start; t<end; ++t ) {
+        f64FVarMat theta = a->theta[t];
+
+        u32 first = t * a->taskObs;
+        u32 last  = MIN( first + a->taskObs, a->numObs );
+
+        f64 val = 0;
+
+        for ( u32 s=0; s<a->numSeeds; ++s ) {
+            a->dot[s * a->numTasks + t] = 0;
+        }
+
+        for ( u32 c=first; c<last; c+=a->chunkObs ) {
+            u32 cEnd = MIN( c + a->chunkObs, last );
+
+            for ( u32 s=0; s<a->numSeeds; ++s ) {
+                for ( u32 i=0; i<n; ++i ) {
+                    theta.data[i].val = a->input.data[i];
+                    theta.data[i].dot = a->dir.data ? a->dir.data[i] : (f64) (i == s);
+                }
+
+                f64 dot = 0;
+                for ( u32 k=c; k<cEnd; ++k ) {
+                    f64FVar r = a->g( theta, a->data + (u64) k * a->obsSize );
+                    dot += r.dot;
+                    if ( s == 0 ) {
+                        val += r.val;
+                    }
+                }
+                a->dot[s * a->numTasks + t] += dot;
+            }
+        }
+
+        a->val[t] = val;
+    }
+}
+
+/* fixed-order pairwise sum of p[0..n) */
+f64 mapReducePairwise( const f64 *p, u32 n )
+{
+    if ( n == 0 ) {
+        return 0;
+    }
+    if ( n == 1 ) {
+        return p[0];
+    }
+
+    u32 m = n / 2;
+
+    return mapReducePairwise( p, m ) + mapReducePairwise( p + m, n - m );
+}
+
+/* runs numSeeds directions, tangent sums go to out */
+f64 mapReduceRun(
+    Allocator al, MapReduceFun *g, const void *data, u32 numObs, u32 obsSize,
+    f64Mat input, f64Mat dir, u32 numSeeds, f64 *out
+)
+{
+    ASSERT( obsSize > 0 && input.dim1 == 1 );
+
+    u32 n = input.dim0;
+
+    u32 chunkObs = MAX( 1, MAPREDUCE_CHUNK_BYTES / obsSize );
+    u32 taskObs  = MAX( chunkObs, (numObs + MAPREDUCE_MAX_TASKS - 1) / MAPREDUCE_MAX_TASKS );
+    taskObs      = (taskObs + chunkObs - 1) / chunkObs * chunkObs;
+
+    u32 numTasks = MAX( 1, (numObs + taskObs - 1) / taskObs );
+
+    mapReduceArgs args = {
+        .g        = g,
+        .data     = (const u8 *) data,
+        .obsSize  = obsSize,
+        .numObs   = numObs,
+        .chunkObs = chunkObs,
+        .taskObs  = taskObs,
+        .input    = input,
+        .dir      = dir,
+        .numSeeds = numSeeds,
+        .numTasks = numTasks,
+    };
+
+    args.theta = (f64FVarMat *) Alloc( al, numTasks * sizeof(f64FVarMat) );
+    args.val   = (f64 *) Alloc( al, numTasks * sizeof(f64) );
+    args.dot   = (f64 *) Alloc( al, (u64) numSeeds * numTasks * sizeof(f64) );
+
+    for ( u32 t=0; t<numTasks; ++t ) {
+        args.theta[t] = f64FVarMatMake( al, n, 1 );
+    }
+
+    ParallelFor( numTasks, 1, mapReduceTasks, &args );
+
+    for ( u32 s=0; s<numSeeds; ++s ) {
+        out[s] = mapReducePairwise( args.dot + (u64) s * numTasks, numTasks );
+    }
+    f64 val = mapReducePairwise( args.val, numTasks );
+
+    for ( u32 t=0; t<numTasks; ++t ) {
+        f64FVarMatFree( al, &args.theta[t] );
+    }
+    Free( al, args.theta );
+    Free( al, args.val );
+    Free( al, args.dot );
+
+    return val;
+}
+
+
+/* gradient of sum_i g( input, data_i ), returns the sum */
+f64 f64FVarSumGradient(
+    Allocator al, MapReduceFun *g, const void *data, u32 numObs, u32 obsSize,
+    f64Mat input, f64Mat grad
+)
+{
+    ASSERT( input.dim0 == grad.dim0 && input.dim1 == grad.dim1 );
+
+    f64Mat unit = { 0 };
+    unit.dim0 = input.dim0;
+    unit.dim1 = 1;
+
+    return mapReduceRun( al, g, data, numObs, obsSize, input, unit, input.dim0, grad.data );
+}
+
+/* derivative of sum_i g( input, data_i ) along dir into deriv, returns the sum */
+f64 f64FVarSumDirectional(
+    Allocator al, MapReduceFun *g, const void *data, u32 numObs, u32 obsSize,
+    f64Mat input, f64Mat dir, f64 *deriv
+)
+{
+    ASSERT( input.dim0 == dir.dim0 && input.dim1 == dir.dim1 );
+
+    return mapReduceRun( al, g, data, numObs, obsSize, input, dir, 1, deriv );
+}
+
+
+/* one observation of the logistic regression test: covariates and label */
+typedef struct test_mr_obs test_mr_obs;
+struct test_mr_obs {
+    f64 x[3];
+    f64 y;
+};
+
+static const test_mr_obs *test_mr_data;
+static u32                test_mr_count;
+
+/* softplus(theta' x) - y theta' x */
+f64FVar test_mr_g( f64FVarMat theta, const void *obs )
+{
+    const test_mr_obs *o = (const test_mr_obs *) obs;
+
+    f64FVar eta = f64FVConst( 0 );
+    for ( u32 j=0; j<3; ++j ) {
+        eta = f64FVAdd( eta, f64FVMul( theta.data[j], f64FVConst( o->x[j] ) ) );
+    }
+
+    return f64FVSub(
+        f64FVLog( f64FVAdd( f64FVConst( 1 ), f64FVExp( eta ) ) ),
+        f64FVMul( f64FVConst( o->y ), eta )
+    );
+}
+
+/* the same sum over all observations in a single sequential pass, the
+   reference for the map-reduce result */
+f64FVar test_mr_full( f64FVarMat theta )
+{
+    f64FVar res = f64FVConst( 0 );
+    for ( u32 i=0; i<test_mr_count; ++i ) {
+        res = f64FVAdd( res, test_mr_g( theta, test_mr_data + i ) );
+    }
+    return res;
+}
+
+#if TEST
+void test_mapreduce()
+{
+#define EPS 1E-8
+
+    u32 N = 50000;
+
+    b32 ownPool = FVThreadPool.numThreads == 0;
+    if ( ownPool ) {
+        InitializeParallel( 4 );
+    }
+
+    test_mr_obs *data = (test_mr_obs *) Alloc( DefaultAllocator, N * sizeof(test_mr_obs) );
+
+    for ( u32 i=0; i<N; ++i ) {
+        data[i].x[0] = 1.0;
+        data[i].x[1] = sin( 0.37 * i );
+        data[i].x[2] = cos( 1.3 * i ) * 0.5;
+        data[i].y    = (i % 3) == 0;
+    }
+
+    test_mr_data  = data;
+    test_mr_count = N;
+
+    f64Mat theta = f64MatMake( DefaultAllocator, 3, 1 );
+    f64Mat grad  = f64MatMake( DefaultAllocator, 3, 1 );
+    f64Mat ref   = f64MatMake( DefaultAllocator, 3, 1 );
+
+    theta.data[0] = -0.2;
+    theta.data[1] = 0.7;
+    theta.data[2] = -1.1;
+
+    f64 val  = f64FVarSumGradient( DefaultAllocator, test_mr_g, data, N, sizeof(test_mr_obs), theta, grad );
+    f64 vRef = f64FVarGradient( DefaultAllocator, test_mr_full, theta, ref );
+
+    TEST_ASSERT( fabs( val - vRef ) < EPS * fabs( vRef ) );
+    for ( u32 j=0; j<3; ++j ) {
+        TEST_ASSERT( fabs( grad.data[j] - ref.data[j] ) < EPS * MAX( 1.0, fabs( ref.data[j] ) ) );
+    }
+
+    /* directional derivative is the projected gradient */
+    f64 deriv;
+    f64MatFree( DefaultAllocator, &ref );
+    ref = f64MatMake( DefaultAllocator, 3, 1 );
+    ref.data[0] = 1.0;
+    ref.data[1] = -2.0;
+    ref.data[2] = 0.5;
+
+    f64 val2 = f64FVarSumDirectional( DefaultAllocator, test_mr_g, data, N, sizeof(test_mr_obs), theta, ref, &deriv );
+
+    TEST_ASSERT( val2 == val );
+    TEST_ASSERT( fabs( deriv - (grad.data[0] - 2 * grad.data[1] + 0.5 * grad.data[2]) ) < EPS * fabs( deriv ) );
+
+    /* bitwise identical on one thread */
+    f64Mat grad1 = f64MatMake( DefaultAllocator, 3, 1 );
+
+    InParallelRegion = 1;
+    f64 val1 = f64FVarSumGradient( DefaultAllocator, test_mr_g, data, N, sizeof(test_mr_obs), theta, grad1 );
+    InParallelRegion = 0;
+
+    TEST_ASSERT( memcmp( &val, &val1, sizeof(f64) ) == 0 );
+    TEST_ASSERT( memcmp( grad.data, grad1.data, 3 * sizeof(f64) ) == 0 );
+
+    Free( DefaultAllocator, data );
+    f64MatFree( DefaultAllocator, &theta );
+    f64MatFree( DefaultAllocator, &grad );
+    f64MatFree( DefaultAllocator, &grad1 );
+    f64MatFree( DefaultAllocator, &ref );
+
+    if ( ownPool ) {
+        TerminateParallel();
+    }
+
+#undef EPS
+}
+#endif
@@ -0,0 +1,76 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Single-source objectives. The body is written once as a macro over an
+// operation mapper OP and the input matrix x,
+//
+//     #define MY_F(OP, x) OP(Add)( OP(Tanh)( x.data[0] ), OP(Lift)( 2 ) )
+//
+//     OBJECTIVE(myF, MY_F)
+//
+// and OBJECTIVE instantiates it as
+//
+//     f64         myFf64(         f64Mat         x )
+//     f64FVar     myFf64FVar(     f64FVarMat     x )
+//     f64FVarFVar myFf64FVarFVar( f64FVarFVarMat x )
+//
+// so each driver calls the cheapest one it needs, e.g. finite differences
+// the plain f64 version and f64FVarHessian the second-order one.
+//
+// Available operations: Add, Sub, Mul, Div, Neg, Sqrt, Pow (f64 exponent),
+// Sin, Cos, Tan, Atan, Exp, Log, Sinh, Cosh, Tanh, Atanh and Lift, which
+// turns an f64 constant into the type of the instantiation.
+//
+
+
+/* operation mappers of the three instantiations */
+#define OBJ_F64(op)  f64Obj##op
+#define OBJ_FV(op)   f64FV##op
+#define OBJ_FVFV(op) f64FVarFV##op
+
+
+/* plain f64 level */
+Inline f64 f64ObjAdd( f64 x, f64 y ) { return x + y; }
+Inline f64 f64ObjSub( f64 x, f64 y ) { return x - y; }
+Inline f64 f64ObjMul( f64 x, f64 y ) { return x * y; }
+Inline f64 f64ObjDiv( f64 x, f64 y ) { return x / y; }
+Inline f64 f64ObjNeg( f64 x )        { return -x; }
+Inline f64 f64ObjSqrt( f64 x )       { return sqrt( x ); }
+Inline f64 f64ObjPow( f64 x, f64 a ) { return pow( x, a ); }
+Inline f64 f64ObjSin( f64 x )        { return sin( x ); }
+Inline f64 f64ObjCos( f64 x )        { return cos( x ); }
+Inline f64 f64ObjTan( f64 x )        { return tan( x ); }
+Inline f64 f64ObjAtan( f64 x )       { return atan( x ); }
+Inline f64 f64ObjExp( f64 x )        { return exp( x ); }
+Inline f64 f64ObjLog( f64 x )        { return log( x ); }
+Inline f64 f64ObjSinh( f64 x )       { return sinh( x ); }
+Inline f64 f64ObjCosh( f64 x )       { return cosh( x ); }
+Inline f64 f64ObjTanh( f64 x )       { return tanh( x ); }
+Inline f64 f64ObjAtanh( f64 x )      { return atanh( x ); }
+Inline f64 f64ObjLift( f64 c )       { return c; }
+
+/* constants of the AD levels */
+Inline f64FVar f64FVLift( f64 c )
+{
+    return f64FVConst( c );
+}
+
+Inline f64FVarFVar f64FVarFVLift( f64 c )
+{
+    return f64FVarFVConst( f64FVConst( c ) );
+}
+
+
+#define OBJECTIVE(name, body) \
+    f64 name##f64( f64Mat x ) \
+    { \
+        return body( OBJ_F64, x ); \
+    } \
+    f64FVar name##f64FVar( f64FVarMat x ) \
+    { \
+        return body( OBJ_FV, x ); \
+    } \
+    f64FVarFVar name##f64FVarFVar( f64FVarFVarMat x ) \
+    { \
+        return body( OBJ_FVFV, x ); \
+    }
@@ -3,6 +3,8 @@
 //
 
 #include "dependencies/utilities.h"
+#include "blas_backend.h"
+#include "linalg.h"
 
 static Arena     FVScratchArena;
 static Allocator FVScratchBuffer;
@@ -13,7 +15,9 @@ void InitializeFV( u32 numThreads, char threadScope )
     ArenaInit( &FVScratchArena, DefaultAllocator, KB(1) );
     FVScratchBuffer = ArenaAllocatorMake( &FVScratchArena );
     
-    InitializeMatrices( numThreads, threadScope );
+    InitializeSimd();
+    InitializeParallel( numThreads );
+    InitializeBlas( numThreads, threadScope );
     
 }
 
@@ -22,7 +26,8 @@ void TerminateFV( void )
 {
     ArenaDestroy( &FVScratchArena );
     
-    TerminateMatrices();
+    TerminateBlas();
+    TerminateParallel();
 }
 
 
@@ -249,6 +254,27 @@ void TerminateFV( void )
     }
 
 
+/* element-wise operation through the dispatched array kernels, see simd_kernels.h */
+#define FVAR_SIMD(type, name, kernel) void \
+    type##FV##name( type##FVar src, type##FVar dst ) \
+    { \
+        ASSERT( src.dim0 == dst.dim0 ); \
+        ASSERT( src.dim1 == dst.dim1 ); \
+        \
+        simdEnsureKernels(); \
+        FVSimd.kernel( \
+            src.dim0*src.dim1, src.val.data, src.dot.data, dst.val.data, dst.dot.data \
+        ); \
+    }
+
+#define FVAR_SIMD_TYPE(type, name, kernel) void \
+    type##FV##name( type##FVar fv, type val ) \
+    { \
+        simdEnsureKernels(); \
+        FVSimd.kernel( fv.dim0*fv.dim1, val, fv.val.data, fv.dot.data ); \
+    }
+
+
 /* elementary element-wise functions */
 
 #define FVAR_EXP(type, mulFun, expFun) void \
@@ -308,6 +334,40 @@ void TerminateFV( void )
         mulFun( a.val, b.val, dst.val ); \
     }
 
+/* dst = op(a) * op(b) with transpose flags, no transposes are materialised */
+#define FVAR_GEMM(type, gemmFun) void \
+    type##FVGemm( b32 transA, b32 transB, type##FVar a, type##FVar b, type##FVar dst )\
+    { \
+        gemmFun( transA, transB, 1, a.dot, b.val, 0, dst.dot ); \
+        gemmFun( transA, transB, 1, a.val, b.dot, 1, dst.dot ); \
+        \
+        gemmFun( transA, transB, 1, a.val, b.val, 0, dst.val ); \
+    }
+
+/* dst = a'a if trans and a a' otherwise, as a full symmetric matrix. The
+ * value is a SYRK, the tangent d(a'a) = s + s' with s = a' da needs only
+ * one GEMM. */
+#define FVAR_SYRK(type, syrkFun, gemmFun, symFun) void \
+    type##FVSyrk( b32 trans, type##FVar a, type##FVar dst )\
+    { \
+        ASSERT( dst.dim0 == dst.dim1 ); \
+        ASSERT( dst.dim0 == (trans ? a.dim1 : a.dim0) ); \
+        \
+        u32 n = dst.dim0; \
+        \
+        syrkFun( trans, 1, a.val, 0, dst.val ); \
+        symFun( dst.val ); \
+        \
+        gemmFun( trans, !trans, 1, a.val, a.dot, 0, dst.dot ); \
+        for ( u32 i=0; i<n; ++i ) { \
+            for ( u32 j=0; j<i; ++j ) { \
+                dst.dot.data[i*n + j] += dst.dot.data[j*n + i]; \
+                dst.dot.data[j*n + i]  = dst.dot.data[i*n + j]; \
+            } \
+            dst.dot.data[i*n + i] *= 2; \
+        } \
+    }
+
 
 FVAR_DECL(f64);
 FVAR_MAKE(f64);
@@ -360,12 +420,12 @@ void test_fvar_basics()
 #endif
 
 
-FVAR_ADD(f64, f64Add);
+FVAR_SIMD(f64, Add, dualAdd);
 FVAR_ADD_TYPE(f64, f64Add);
-FVAR_SUB(f64, f64Sub);
-FVAR_MUL(f64, f64Add, f64Mul);
-FVAR_MUL_TYPE(f64, f64Mul);
-FVAR_DIV(f64, f64Sub, f64Mul, f64Div);
+FVAR_SIMD(f64, Sub, dualSub);
+FVAR_SIMD(f64, Mul, dualMul);
+FVAR_SIMD_TYPE(f64, Mulf64, dualScale);
+FVAR_SIMD(f64, Div, dualDiv);
 FVAR_DIV_TYPE(f64, f64Div);
 FVAR_NEG(f64, f64Neg);
 
@@ -554,7 +614,353 @@ void test_fvar_log()
 
 FVAR_MATADD(f64, f64MatAdd);
 FVAR_MATSUB(f64, f64MatSub);
-FVAR_MATMUL(f64, f64MatMul, f64MatMulIP);
+FVAR_MATMUL(f64, f64BlasMul, f64BlasMulIP);
+FVAR_GEMM(f64, f64MatGemm);
+FVAR_SYRK(f64, f64MatSyrk, f64MatGemm, f64MatSymmetrize);
+
+
+/* BLAS-1 on dual matrices, val and dot are updated in the same pass and the
+ * reductions return the value and write the derivative to dot. Reductions
+ * are threaded and bitwise reproducible for any thread count, see
+ * blasReduce. */
+
+/* y = alpha * x + y */
+void f64FVAxpy( f64 alpha, f64FVar x, f64FVar y )
+{
+    ASSERT( x.dim0 * x.dim1 == y.dim0 * y.dim1 );
+
+    blas1Args args = {
+        .alpha = alpha, .beta = 1.0,
+        .xv = x.val.data, .xd = x.dot.data, .yv = y.val.data, .yd = y.dot.data
+    };
+    blas1Run( &args, y.dim0 * y.dim1 );
+}
+
+/* y = alpha * x + beta * y */
+void f64FVAxpby( f64 alpha, f64FVar x, f64 beta, f64FVar y )
+{
+    ASSERT( x.dim0 * x.dim1 == y.dim0 * y.dim1 );
+
+    blas1Args args = {
+        .alpha = alpha, .beta = beta,
+        .xv = x.val.data, .xd = x.dot.data, .yv = y.val.data, .yd = y.dot.data
+    };
+    blas1Run( &args, y.dim0 * y.dim1 );
+}
+
+/* x *= a */
+void f64FVScal( f64 a, f64FVar x )
+{
+    blas1Args args = { .beta = a, .yv = x.val.data, .yd = x.dot.data };
+    blas1Run( &args, x.dim0 * x.dim1 );
+}
+
+/* x' y, d(x' y) = dx' y + x' dy */
+f64 f64FVDot( f64FVar x, f64FVar y, f64 *dot )
+{
+    ASSERT( x.dim0 * x.dim1 == y.dim0 * y.dim1 );
+
+    return blasReduce(
+        REDUCE_DOT, x.dim0 * x.dim1, x.val.data, x.dot.data, y.val.data, y.dot.data, dot
+    );
+}
+
+/* |x|_2, d|x|_2 = x' dx / |x|_2 and 0 at x = 0 */
+f64 f64FVNrm2( f64FVar x, f64 *dot )
+{
+    u32 n = x.dim0 * x.dim1;
+
+    f64 dss;
+    f64 ss = blasReduce( REDUCE_DOT, n, x.val.data, x.dot.data, x.val.data, x.dot.data, &dss );
+
+    if ( isfinite( ss ) && ss >= DBL_MIN ) {
+        f64 nrm = sqrt( ss );
+        if ( dot ) {
+            *dot = 0.5 * dss / nrm;
+        }
+        return nrm;
+    }
+
+    /* x' dx would under- or overflow as well, sum (x_i / |x|) dx_i instead */
+    f64 nrm = f64MatNrm2( x.val );
+
+    if ( dot ) {
+        f64 d = 0;
+        if ( nrm > 0 && isfinite( nrm ) ) {
+            for ( u32 i=0; i<n; ++i ) {
+                d += x.val.data[i] / nrm * x.dot.data[i];
+            }
+        }
+        *dot = d;
+    }
+
+    return nrm;
+}
+
+/* sum |x_i|, the derivative takes sign(0) = 1 */
+f64 f64FVAsum( f64FVar x, f64 *dot )
+{
+    return blasReduce( REDUCE_ASUM, x.dim0 * x.dim1, x.val.data, x.dot.data, NULL, NULL, dot );
+}
+
+/* sum x_i */
+f64 f64FVSum( f64FVar x, f64 *dot )
+{
+    return blasReduce( REDUCE_SUM, x.dim0 * x.dim1, x.val.data, x.dot.data, NULL, NULL, dot );
+}
+
+/* sum x_i / n */
+f64 f64FVMean( f64FVar x, f64 *dot )
+{
+    f64 n   = (f64) x.dim0 * x.dim1;
+    f64 val = f64FVSum( x, dot ) / n;
+
+    if ( dot ) {
+        *dot /= n;
+    }
+
+    return val;
+}
+
+
+/* Fused, overflow-safe logsumexp, softmax, log-softmax and log-sigmoid. The
+ * row kernels shift by the row maximum, evaluate exp with the in-house SIMD
+ * kernel and carry the tangent in the same pass. Rows are distributed over
+ * the thread pool for large matrices, dst may be x. */
+
+typedef enum FVRowOp FVRowOp;
+enum FVRowOp {
+    FV_ROW_LSE,
+    FV_ROW_SOFTMAX,
+    FV_ROW_LOGSOFTMAX,
+    FV_ROW_LOGSIGMOID,
+};
+
+typedef struct fvRowArgs fvRowArgs;
+struct fvRowArgs {
+    FVRowOp op;
+    f64FVar x;
+    f64FVar dst;
+};
+
+void fvRowRange( void *args, u32 start, u32 end )
+{
+    fvRowArgs *a = (fvRowArgs *) args;
+
+    u32 m = a->x.dim1;
+
+    for ( u32 i=start; i<end; ++i ) {
+        const f64 *v  = a->x.val.data + (u64) i * m;
+        const f64 *d  = a->x.dot.data + (u64) i * m;
+        f64       *ov = a->dst.val.data + (u64) i * m;
+        f64       *od = a->dst.dot.data + (u64) i * m;
+
+        switch ( a->op ) {
+            case FV_ROW_LSE:
+                a->dst.val.data[i] = FVSimd.dualLse( m, v, d, &a->dst.dot.data[i] );
+                break;
+            case FV_ROW_SOFTMAX:
+                FVSimd.dualSoftmax( m, v, d, ov, od );
+                break;
+            case FV_ROW_LOGSOFTMAX:
+                FVSimd.dualLogSoftmax( m, v, d, ov, od );
+                break;
+            default:
+                FVSimd.dualLogSigmoid( m, v, d, ov, od );
+                break;
+        }
+    }
+}
+
+void fvRowRun( FVRowOp op, f64FVar x, f64FVar dst )
+{
+    fvRowArgs args = { .op = op, .x = x, .dst = dst };
+
+    simdEnsureKernels();
+
+    if ( (u64) x.dim0 * x.dim1 < BLAS1_MIN_PARALLEL ) {
+        fvRowRange( &args, 0, x.dim0 );
+    }
+    else {
+        ParallelFor( x.dim0, ParallelChunkSize( x.dim0, 1, 4 ), fvRowRange, &args );
+    }
+}
+
+
+/* log sum_j exp(x_ij) of every row into dst (dim0 x 1) */
+void f64FVLogSumExpRows( f64FVar x, f64FVar dst )
+{
+    ASSERT( dst.dim0 == x.dim0 && dst.dim1 == 1 );
+
+    fvRowRun( FV_ROW_LSE, x, dst );
+}
+
+/* log sum_ij exp(x_ij), the derivative goes to dot */
+f64 f64FVLogSumExp( f64FVar x, f64 *dot )
+{
+    simdEnsureKernels();
+
+    return FVSimd.dualLse( x.dim0 * x.dim1, x.val.data, x.dot.data, dot );
+}
+
+/* row-wise softmax */
+void f64FVSoftmaxRows( f64FVar x, f64FVar dst )
+{
+    ASSERT( dst.dim0 == x.dim0 && dst.dim1 == x.dim1 );
+
+    fvRowRun( FV_ROW_SOFTMAX, x, dst );
+}
+
+/* row-wise log-softmax, x_ij - logsumexp_j x_ij */
+void f64FVLogSoftmaxRows( f64FVar x, f64FVar dst )
+{
+    ASSERT( dst.dim0 == x.dim0 && dst.dim1 == x.dim1 );
+
+    fvRowRun( FV_ROW_LOGSOFTMAX, x, dst );
+}
+
+/* elementwise log(1 / (1 + exp(-x))) */
+void f64FVLogSigmoid( f64FVar x, f64FVar dst )
+{
+    ASSERT( dst.dim0 == x.dim0 && dst.dim1 == x.dim1 );
+
+    fvRowRun( FV_ROW_LOGSIGMOID, x, dst );
+}
+
+
+/* Matrix exponential by scaling and squaring with the [13/13] Pade
+ * approximant (Higham 2005). The tangent is the Frechet derivative
+ * L(A, dA), i.e. the upper right block of exp([A dA; 0 A]). Running the
+ * algorithm on (val, dot) pairs evaluates exactly that block-triangular
+ * product, every product goes through f64FVMatMul and the block matrix is
+ * never formed. Workspace comes from al. */
+
+#define FVAR_EXPM_THETA 5.371920351148152
+
+/* dst (+)= c6 a6 + c4 a4 + c2 a2 + c0 I on val and dot */
+void fvExpmPoly(
+    f64FVar dst, b32 accumulate,
+    f64 c6, f64FVar a6, f64 c4, f64FVar a4, f64 c2, f64FVar a2, f64 c0
+)
+{
+    u32 n = dst.dim0;
+
+    for ( u32 i=0; i<n*n; ++i ) {
+        f64 v = c6 * a6.val.data[i] + c4 * a4.val.data[i] + c2 * a2.val.data[i];
+        f64 d = c6 * a6.dot.data[i] + c4 * a4.dot.data[i] + c2 * a2.dot.data[i];
+
+        dst.val.data[i] = accumulate ? dst.val.data[i] + v : v;
+        dst.dot.data[i] = accumulate ? dst.dot.data[i] + d : d;
+    }
+    for ( u32 i=0; i<n; ++i ) {
+        dst.val.data[i*n + i] += c0;
+    }
+}
+
+b32 f64FVMatExp( Allocator al, f64FVar a, f64FVar dst )
+{
+    ASSERT( a.dim0 == a.dim1 && dst.dim0 == a.dim0 && dst.dim1 == a.dim1 );
+
+    static const f64 b[14] = {
+        64764752532480000.0, 32382376266240000.0, 7771770303897600.0,
+        1187353796428800.0, 129060195264000.0, 10559470521600.0,
+        670442572800.0, 33522128640.0, 1323241920.0, 40840800.0,
+        960960.0, 16380.0, 182.0, 1.0
+    };
+
+    u32 n = a.dim0;
+
+    /* 1-norm */
+    f64 norm = 0;
+    for ( u32 j=0; j<n; ++j ) {
+        f64 col = 0;
+        for ( u32 i=0; i<n; ++i ) {
+            col += fabs( a.val.data[i*n + j] );
+        }
+        norm = MAX( norm, col );
+    }
+
+    u32 s = 0;
+    if ( norm > FVAR_EXPM_THETA ) {
+        s = (u32) ceil( log2( norm / FVAR_EXPM_THETA ) );
+    }
+    f64 scale = ldexp( 1.0, -(i32) s );
+
+    f64FVar x  = f64FVMake( al, n, n );
+    f64FVar x2 = f64FVMake( al, n, n );
+    f64FVar x4 = f64FVMake( al, n, n );
+    f64FVar x6 = f64FVMake( al, n, n );
+    f64FVar t  = f64FVMake( al, n, n );
+    f64FVar u  = f64FVMake( al, n, n );
+    f64FVar v  = f64FVMake( al, n, n );
+
+    for ( u32 i=0; i<n*n; ++i ) {
+        x.val.data[i] = scale * a.val.data[i];
+        x.dot.data[i] = scale * a.dot.data[i];
+    }
+
+    f64FVMatMul( x, x, x2 );
+    f64FVMatMul( x2, x2, x4 );
+    f64FVMatMul( x4, x2, x6 );
+
+    /* u = x [x6 (b13 x6 + b11 x4 + b9 x2) + b7 x6 + b5 x4 + b3 x2 + b1 I] */
+    fvExpmPoly( t, 0, b[13], x6, b[11], x4, b[9], x2, 0 );
+    f64FVMatMul( x6, t, v );
+    fvExpmPoly( v, 1, b[7], x6, b[5], x4, b[3], x2, b[1] );
+    f64FVMatMul( x, v, u );
+
+    /* v = x6 (b12 x6 + b10 x4 + b8 x2) + b6 x6 + b4 x4 + b2 x2 + b0 I */
+    fvExpmPoly( t, 0, b[12], x6, b[10], x4, b[8], x2, 0 );
+    f64FVMatMul( x6, t, v );
+    fvExpmPoly( v, 1, b[6], x6, b[4], x4, b[2], x2, b[0] );
+
+    /* r = (v - u)^-1 (v + u), the LU of v - u serves val and dot */
+    for ( u32 i=0; i<n*n; ++i ) {
+        t.val.data[i]  = v.val.data[i] + u.val.data[i];
+        t.dot.data[i]  = v.dot.data[i] + u.dot.data[i];
+        v.val.data[i] -= u.val.data[i];
+        v.dot.data[i] -= u.dot.data[i];
+    }
+
+    u32 *piv = (u32 *) Alloc( al, n * sizeof(u32) );
+
+    b32 ok = f64MatLU( v.val, piv );
+
+    if ( ok ) {
+        f64FVar r = x;
+        f64FVar w = x2;
+
+        memcpy( r.val.data, t.val.data, (u64) n * n * sizeof(f64) );
+        f64MatLUSolve( v.val, piv, r.val );
+
+        memcpy( r.dot.data, t.dot.data, (u64) n * n * sizeof(f64) );
+        f64MatGemm( 0, 0, -1.0, v.dot, r.val, 1.0, r.dot );
+        f64MatLUSolve( v.val, piv, r.dot );
+
+        for ( u32 k=0; k<s; ++k ) {
+            f64FVMatMul( r, r, w );
+
+            f64FVar tmp = r;
+            r = w;
+            w = tmp;
+        }
+
+        memcpy( dst.val.data, r.val.data, (u64) n * n * sizeof(f64) );
+        memcpy( dst.dot.data, r.dot.data, (u64) n * n * sizeof(f64) );
+    }
+
+    Free( al, piv );
+
+    f64FVFree( al, &x );
+    f64FVFree( al, &x2 );
+    f64FVFree( al, &x4 );
+    f64FVFree( al, &x6 );
+    f64FVFree( al, &t );
+    f64FVFree( al, &u );
+    f64FVFree( al, &v );
+
+    return ok;
+}
 
 
 #if TEST
@@ -634,6 +1040,353 @@ void test_fvar_matmul()
 }
 #endif
 
+#if TEST
+void test_fvar_gemm_syrk()
+{
+    u32 N = 5;
+    u32 M = 3;
+
+    f64FVar a  = f64FVMake( DefaultAllocator, N, M );
+    f64FVar at = f64FVMake( DefaultAllocator, M, N );
+    f64FVar b  = f64FVMake( DefaultAllocator, N, M );
+    f64FVar c  = f64FVMake( DefaultAllocator, M, M );
+    f64FVar e  = f64FVMake( DefaultAllocator, M, M );
+    f64FVar g  = f64FVMake( DefaultAllocator, N, N );
+    f64FVar h  = f64FVMake( DefaultAllocator, N, N );
+
+    for ( u32 i=0; i<N; ++i ) {
+        for ( u32 j=0; j<M; ++j ) {
+            f64 x = (f64) (i+0.5) / (j+1);
+            f64 y = (f64) (i*j) - 1.5;
+            f64FVSetElement( a, i, j, x, y );
+            f64FVSetElement( at, j, i, x, y );
+            f64FVSetElement( b, i, j, y, -x );
+        }
+    }
+
+    /* a' b */
+    f64FVGemm( 1, 0, a, b, c );
+    f64FVMatMul( at, b, e );
+    TEST_ASSERT( f64FVEqual( c, e, EPS ) );
+
+    /* a' a */
+    f64FVSyrk( 1, a, c );
+    f64FVMatMul( at, a, e );
+    TEST_ASSERT( f64FVEqual( c, e, EPS ) );
+
+    /* a a' */
+    f64FVSyrk( 0, a, g );
+    f64FVMatMul( a, at, h );
+    TEST_ASSERT( f64FVEqual( g, h, EPS ) );
+
+    /* b a' */
+    f64FVGemm( 0, 1, b, a, g );
+    f64FVMatMul( b, at, h );
+    TEST_ASSERT( f64FVEqual( g, h, EPS ) );
+
+    f64FVFree( DefaultAllocator, &a );
+    f64FVFree( DefaultAllocator, &at );
+    f64FVFree( DefaultAllocator, &b );
+    f64FVFree( DefaultAllocator, &c );
+    f64FVFree( DefaultAllocator, &e );
+    f64FVFree( DefaultAllocator, &g );
+    f64FVFree( DefaultAllocator, &h );
+}
+#endif
+
+#if TEST
+void test_fvar_blas1()
+{
+    u32 N = 21;
+
+    f64FVar x = f64FVMake( DefaultAllocator, N, 1 );
+    f64FVar y = f64FVMake( DefaultAllocator, N, 1 );
+
+    for ( u32 i=0; i<N; ++i ) {
+        f64FVSetElement( x, i, 0, (f64) i - 10.0, 1.0 );
+        f64FVSetElement( y, i, 0, 0.5, (f64) i );
+    }
+
+    f64 d;
+    f64 v = f64FVDot( x, y, &d );
+
+    /* sum (i - 10) / 2 = 0, d = sum 0.5 + (i - 10) i */
+    TEST_ASSERT( f64Equal( v, 0.0, EPS ) );
+    TEST_ASSERT( f64Equal( d, 10.5 + 770.0, EPS ) );
+
+    v = f64FVAsum( x, &d );
+    TEST_ASSERT( f64Equal( v, 110.0, EPS ) );
+    TEST_ASSERT( f64Equal( d, 1.0, EPS ) );
+
+    v = f64FVNrm2( x, &d );
+    TEST_ASSERT( f64Equal( v, sqrt( 770.0 ), EPS ) );
+    TEST_ASSERT( f64Equal( d, 0.0, EPS ) );
+
+    /* every square underflows, (3 4) 1E-200 with tangent (1 2) */
+    f64FVar t = f64FVMake( DefaultAllocator, 2, 1 );
+    f64FVSetElement( t, 0, 0, 3E-200, 1.0 );
+    f64FVSetElement( t, 1, 0, 4E-200, 2.0 );
+
+    v = f64FVNrm2( t, &d );
+    TEST_ASSERT( f64Equal( v / 5E-200, 1.0, EPS ) );
+    TEST_ASSERT( f64Equal( d, 11.0 / 5.0, EPS ) );
+
+    f64FVFree( DefaultAllocator, &t );
+
+    /* y = 2 x - y, then scaled by -1 */
+    f64FVAxpby( 2.0, x, -1.0, y );
+    f64FVScal( -1.0, y );
+    f64FVAxpy( 2.0, x, y );
+
+    for ( u32 i=0; i<N; ++i ) {
+        TEST_ASSERT( f64Equal( y.val.data[i], 0.5, EPS ) );
+        TEST_ASSERT( f64Equal( y.dot.data[i], (f64) i, EPS ) );
+    }
+
+    f64FVFree( DefaultAllocator, &x );
+    f64FVFree( DefaultAllocator, &y );
+
+    /* threaded elementwise path */
+    N = 3 * BLAS1_MIN_PARALLEL + 5;
+
+    x = f64FVMake( DefaultAllocator, N, 1 );
+    y = f64FVMake( DefaultAllocator, N, 1 );
+
+    for ( u32 i=0; i<N; ++i ) {
+        f64FVSetElement( x, i, 0, (f64) i, 1.0 );
+        f64FVSetElement( y, i, 0, 1.0, (f64) i );
+    }
+
+    f64FVAxpby( 0.5, x, 2.0, y );
+
+    for ( u32 i=0; i<N; ++i ) {
+        TEST_ASSERT( y.val.data[i] == 0.5 * i + 2.0 );
+        TEST_ASSERT( y.dot.data[i] == 0.5 + 2.0 * i );
+    }
+
+    f64FVFree( DefaultAllocator, &x );
+    f64FVFree( DefaultAllocator, &y );
+}
+#endif
+
+#if TEST
+void test_fvar_reduce()
+{
+    u32 N = 1000003;
+
+    b32 ownPool = FVThreadPool.numThreads == 0;
+    if ( ownPool ) {
+        InitializeParallel( 4 );
+    }
+
+    f64FVar x = f64FVMake( DefaultAllocator, N, 1 );
+    f64FVar y = f64FVMake( DefaultAllocator, N, 1 );
+
+    Xorshift1024 rng = Xorshift1024Init( 29 );
+
+    /* wide dynamic range so that any change of summation order shows */
+    for ( u32 i=0; i<N; ++i ) {
+        f64 u = rngXorshift1024NextFloat( &rng ) - 0.5;
+        f64FVSetElement( x, i, 0, u * pow( 10.0, (f64) (i % 13) ), 1.0 / (i + 1) );
+        f64FVSetElement( y, i, 0, 1.0 + u, u );
+    }
+
+    f64 d4[4], v4[4];
+    v4[0] = f64FVSum( x, &d4[0] );
+    v4[1] = f64FVDot( x, y, &d4[1] );
+    v4[2] = f64FVNrm2( x, &d4[2] );
+    v4[3] = f64FVMean( y, &d4[3] );
+
+    /* the same reductions on one thread */
+    InParallelRegion = 1;
+
+    f64 d1[4], v1[4];
+    v1[0] = f64FVSum( x, &d1[0] );
+    v1[1] = f64FVDot( x, y, &d1[1] );
+    v1[2] = f64FVNrm2( x, &d1[2] );
+    v1[3] = f64FVMean( y, &d1[3] );
+
+    InParallelRegion = 0;
+
+    for ( u32 k=0; k<4; ++k ) {
+        TEST_ASSERT( memcmp( &v1[k], &v4[k], sizeof(f64) ) == 0 );
+        TEST_ASSERT( memcmp( &d1[k], &d4[k], sizeof(f64) ) == 0 );
+    }
+
+    /* value only */
+    TEST_ASSERT( f64FVNrm2( x, NULL ) == v4[2] );
+    TEST_ASSERT( f64FVMean( y, NULL ) == v4[3] );
+
+    /* against a long double reference */
+    long double ref = 0, refDot = 0;
+    for ( u32 i=0; i<N; ++i ) {
+        ref    += x.val.data[i];
+        refDot += x.dot.data[i];
+    }
+    TEST_ASSERT( fabs( v4[0] - (f64) ref ) <= 1E-10 * MAX( 1.0, fabs( (f64) ref ) ) );
+    TEST_ASSERT( f64Equal( d4[0], (f64) refDot, 1E-10 ) );
+
+    /* y = 1 + u with dy = u */
+    TEST_ASSERT( fabs( v4[3] - 1.0 ) < 1E-2 );
+    TEST_ASSERT( f64Equal( d4[3], v4[3] - 1.0, 1E-12 ) );
+
+    f64FVFree( DefaultAllocator, &x );
+    f64FVFree( DefaultAllocator, &y );
+
+    if ( ownPool ) {
+        TerminateParallel();
+    }
+}
+#endif
+
+#if TEST
+void test_fvar_softmax()
+{
+    u32 R = 3;
+    u32 C = 13;
+
+    f64FVar x = f64FVMake( DefaultAllocator, R, C );
+    f64FVar y = f64FVMake( DefaultAllocator, R, C );
+    f64FVar l = f64FVMake( DefaultAllocator, R, 1 );
+
+    /* the last row would overflow a naive implementation */
+    for ( u32 i=0; i<R; ++i ) {
+        for ( u32 j=0; j<C; ++j ) {
+            f64 v = 0.3 * j - 1.0 * i + (i == R - 1 ? 1000.0 : 0.0);
+            f64FVSetElement( x, i, j, v, (f64) j / C - 0.5 * i );
+        }
+    }
+
+    f64FVLogSumExpRows( x, l );
+    f64FVSoftmaxRows( x, y );
+
+    for ( u32 i=0; i<R; ++i ) {
+        f64 shift = i == R - 1 ? 1000.0 : 0.0;
+
+        long double s = 0, t = 0;
+        for ( u32 j=0; j<C; ++j ) {
+            f64 e = exp( x.val.data[i*C + j] - shift );
+            s += e;
+            t += e * x.dot.data[i*C + j];
+        }
+
+        TEST_ASSERT( f64Equal( l.val.data[i], shift + log( (f64) s ), EPS ) );
+        TEST_ASSERT( f64Equal( l.dot.data[i], (f64) (t / s), EPS ) );
+
+        f64 sum = 0;
+        for ( u32 j=0; j<C; ++j ) {
+            f64 p = exp( x.val.data[i*C + j] - shift ) / (f64) s;
+            TEST_ASSERT( f64Equal( y.val.data[i*C + j], p, EPS ) );
+            TEST_ASSERT( f64Equal( y.dot.data[i*C + j], p * (x.dot.data[i*C + j] - (f64) (t / s)), EPS ) );
+            sum += y.dot.data[i*C + j];
+        }
+        TEST_ASSERT( f64Equal( sum, 0.0, EPS ) );
+    }
+
+    /* log-softmax in place */
+    f64FVCopy( x, y );
+    f64FVLogSoftmaxRows( y, y );
+    for ( u32 i=0; i<R; ++i ) {
+        for ( u32 j=0; j<C; ++j ) {
+            TEST_ASSERT( f64Equal( y.val.data[i*C + j], x.val.data[i*C + j] - l.val.data[i], EPS ) );
+            TEST_ASSERT( f64Equal( y.dot.data[i*C + j], x.dot.data[i*C + j] - l.dot.data[i], EPS ) );
+        }
+    }
+
+    /* full logsumexp */
+    f64 d;
+    f64 v = f64FVLogSumExp( x, &d );
+    TEST_ASSERT( f64Equal( v, l.val.data[R-1] + log1p( exp( l.val.data[0] - l.val.data[R-1] ) + exp( l.val.data[1] - l.val.data[R-1] ) ), EPS ) );
+
+    /* log-sigmoid for both signs and large |x| */
+    f64FVLogSigmoid( x, y );
+    for ( u32 i=0; i<R*C; ++i ) {
+        f64 xv = x.val.data[i];
+        f64 ls = xv > 0 ? -log1p( exp( -xv ) ) : xv - log1p( exp( xv ) );
+        TEST_ASSERT( f64Equal( y.val.data[i], ls, EPS ) );
+        TEST_ASSERT( f64Equal( y.dot.data[i], x.dot.data[i] / (1 + exp( xv )), EPS ) );
+    }
+
+    f64FVFree( DefaultAllocator, &x );
+    f64FVFree( DefaultAllocator, &y );
+    f64FVFree( DefaultAllocator, &l );
+}
+#endif
+
+#if TEST
+void test_fvar_matexp()
+{
+    u32 N = 2;
+
+    f64FVar a = f64FVMake( DefaultAllocator, N, N );
+    f64FVar e = f64FVMake( DefaultAllocator, N, N );
+
+    /* rotation generator, a and dA commute */
+    f64 th = 2.5;
+
+    f64FVSetElement( a, 0, 0, 0.0, 0.0 );
+    f64FVSetElement( a, 0, 1, th, 1.0 );
+    f64FVSetElement( a, 1, 0, -th, -1.0 );
+    f64FVSetElement( a, 1, 1, 0.0, 0.0 );
+
+    TEST_ASSERT( f64FVMatExp( DefaultAllocator, a, e ) );
+
+    TEST_ASSERT( f64Equal( e.val.data[0], cos( th ), EPS ) );
+    TEST_ASSERT( f64Equal( e.val.data[1], sin( th ), EPS ) );
+    TEST_ASSERT( f64Equal( e.val.data[2], -sin( th ), EPS ) );
+    TEST_ASSERT( f64Equal( e.val.data[3], cos( th ), EPS ) );
+
+    TEST_ASSERT( f64Equal( e.dot.data[0], -sin( th ), EPS ) );
+    TEST_ASSERT( f64Equal( e.dot.data[1], cos( th ), EPS ) );
+    TEST_ASSERT( f64Equal( e.dot.data[2], -cos( th ), EPS ) );
+    TEST_ASSERT( f64Equal( e.dot.data[3], -sin( th ), EPS ) );
+
+    f64FVFree( DefaultAllocator, &a );
+    f64FVFree( DefaultAllocator, &e );
+
+    /* non-commuting direction against central differences, the 1-norm is
+     * above theta_13 so one squaring step is taken */
+    N = 20;
+
+    f64 H = 1E-6;
+
+    a = f64FVMake( DefaultAllocator, N, N );
+    e = f64FVMake( DefaultAllocator, N, N );
+
+    f64FVar ap = f64FVMake( DefaultAllocator, N, N );
+    f64FVar am = f64FVMake( DefaultAllocator, N, N );
+    f64FVar ep = f64FVMake( DefaultAllocator, N, N );
+    f64FVar em = f64FVMake( DefaultAllocator, N, N );
+
+    Xorshift1024 rng = Xorshift1024Init( 23 );
+
+    for ( u32 i=0; i<N*N; ++i ) {
+        a.val.data[i]  = 1.5 * (rngXorshift1024NextFloat( &rng ) - 0.5);
+        a.dot.data[i]  = rngXorshift1024NextFloat( &rng ) - 0.5;
+        ap.val.data[i] = a.val.data[i] + H * a.dot.data[i];
+        am.val.data[i] = a.val.data[i] - H * a.dot.data[i];
+        ap.dot.data[i] = 0;
+        am.dot.data[i] = 0;
+    }
+
+    TEST_ASSERT( f64FVMatExp( DefaultAllocator, a, e ) );
+    f64FVMatExp( DefaultAllocator, ap, ep );
+    f64FVMatExp( DefaultAllocator, am, em );
+
+    for ( u32 i=0; i<N*N; ++i ) {
+        f64 fd = (ep.val.data[i] - em.val.data[i]) / (2 * H);
+        TEST_ASSERT( f64Equal( fd, e.dot.data[i], 1E-6 ) );
+    }
+
+    f64FVFree( DefaultAllocator, &a );
+    f64FVFree( DefaultAllocator, &e );
+    f64FVFree( DefaultAllocator, &ap );
+    f64FVFree( DefaultAllocator, &am );
+    f64FVFree( DefaultAllocator, &ep );
+    f64FVFree( DefaultAllocator, &em );
+}
+#endif
+
 
 #undef EPS
 
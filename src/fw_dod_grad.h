@@ -73,12 +73,13 @@
 //    f64FVarMatFree( al, &xCpy2 );
 //}
 
-/* AD gradient */
-void f64FVGradient( Allocator al, f64FVar f( f64FVar ), f64Mat input, f64Mat grad )
+/* AD gradient, returns f(input) */
+f64 f64FVGradient( Allocator al, f64FVar f( f64FVar ), f64Mat input, f64Mat grad )
 {
     ASSERT( input.dim0 == grad.dim0 && input.dim1 == grad.dim1 && input.dim1 == 1 );
     
     f64FVar tmp;
+    f64 val = 0;
     u32 N = input.dim0;
     
     f64FVar xCpy = f64FVMake( al, N, 1 );
@@ -96,7 +97,37 @@ void f64FVGradient( Allocator al, f64FVar f( f64FVar ), f64Mat input, f64Mat gra
         xCpy.dot.data[i] = 0.0;
     }
     
+    if ( N > 0 ) {
+        val = tmp.val.data[0];
+    }
+    
+    f64FVFree( al, &xCpy );
+    
+    return val;
+}
+
+/* AD directional derivative grad f(input)' dir from a single pass with the
+ * seed dot = dir, returns f(input) */
+f64 f64FVDirectional( Allocator al, f64FVar f( f64FVar ), f64Mat input, f64Mat dir, f64 *deriv )
+{
+    ASSERT( input.dim0 == dir.dim0 && input.dim1 == dir.dim1 && input.dim1 == 1 );
+    
+    u32 N = input.dim0;
+    
+    f64FVar xCpy = f64FVMake( al, N, 1 );
+    
+    for ( u32 i=0; i<N; ++i ) {
+        f64FVSetElement( xCpy, i, 0, input.data[i], dir.data[i] );
+    }
+    
+    f64FVar tmp = f( xCpy );
+    
+    *deriv  = tmp.dot.data[0];
+    f64 val = tmp.val.data[0];
+    
     f64FVFree( al, &xCpy );
+    
+    return val;
 }
 
 //
@@ -0,0 +1,340 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Differentiation through nonlinear solves by the implicit function theorem.
+// For x(theta) defined by g(x, theta) = 0 the tangent is
+//
+//     dx = -g_x^-1 g_theta dtheta,
+//
+// so the solver iterates on x.val only and the tangent costs one LU
+// factorization of g_x at the solution plus one forward pass for
+// g_theta dtheta, independent of the number of iterations. g_x is
+// assembled column by column from forward passes with unit seeds on x. Fixed
+// points x = T(x, theta) are the case g = x - T.
+//
+// The functions write out = F(x, theta) with the tangent
+// F_x x.dot + F_theta theta.dot into a caller owned n x 1 FVar. Workspaces
+// come from al. A return value of 0 means the iteration did not converge
+// or g_x was singular, x.val then holds the last iterate and x.dot is not
+// written.
+//
+
+/* writes F(x, theta) and its tangent to out, x and out are n x 1 */
+typedef void FVImplicitFun( void *args, f64FVar x, f64FVar theta, f64FVar out );
+
+
+typedef struct fvImplicit fvImplicit;
+struct fvImplicit {
+    FVImplicitFun *f;
+    void          *args;
+    f64FVar        x;      /* seed on x, val holds the iterate */
+    f64FVar        theta;  /* theta.val with zero tangent */
+    f64FVar        out;
+    f64Mat         jac;    /* n x n, F_x */
+    u32           *piv;
+};
+
+fvImplicit fvImplicitMake( Allocator al, FVImplicitFun *f, void *args, f64FVar theta, u32 n )
+{
+    fvImplicit w;
+
+    w.f     = f;
+    w.args  = args;
+    w.x     = f64FVMake( al, n, 1 );
+    w.theta = f64FVMake( al, theta.dim0, theta.dim1 );
+    w.out   = f64FVMake( al, n, 1 );
+    w.jac   = f64MatMake( al, n, n );
+    w.piv   = (u32 *) Alloc( al, n * sizeof(u32) );
+
+    memcpy( w.theta.val.data, theta.val.data, (u64) theta.dim0 * theta.dim1 * sizeof(f64) );
+    memset( w.theta.dot.data, 0, (u64) theta.dim0 * theta.dim1 * sizeof(f64) );
+
+    return w;
+}
+
+void fvImplicitFree( Allocator al, fvImplicit *w )
+{
+    f64FVFree( al, &w->x );
+    f64FVFree( al, &w->theta );
+    f64FVFree( al, &w->out );
+    f64MatFree( al, &w->jac );
+    Free( al, w->piv );
+}
+
+/* out = F(x.val, theta.val) from a pass with zero seeds */
+void fvImplicitEval( fvImplicit *w )
+{
+    memset( w->x.dot.data, 0, w->x.dim0 * sizeof(f64) );
+    w->f( w->args, w->x, w->theta, w->out );
+}
+
+/* jac = F_x at x.val, out.val = F(x.val, theta.val) */
+void fvImplicitJacobian( fvImplicit *w )
+{
+    u32 n = w->x.dim0;
+
+    memset( w->x.dot.data, 0, n * sizeof(f64) );
+
+    for ( u32 j=0; j<n; ++j ) {
+        w->x.dot.data[j] = 1.0;
+        w->f( w->args, w->x, w->theta, w->out );
+        w->x.dot.data[j] = 0.0;
+
+        for ( u32 i=0; i<n; ++i ) {
+            w->jac.data[i*n + j] = w->out.dot.data[i];
+        }
+    }
+}
+
+/* x.dot = sign * jac^-1 F_theta theta.dot with jac already factored */
+void fvImplicitTangent( fvImplicit *w, f64FVar theta, f64FVar x, f64 sign )
+{
+    u32 n = x.dim0;
+
+    memset( w->x.dot.data, 0, n * sizeof(f64) );
+    w->f( w->args, w->x, theta, w->out );
+
+    for ( u32 i=0; i<n; ++i ) {
+        x.dot.data[i] = sign * w->out.dot.data[i];
+    }
+    f64MatLUSolve( w->jac, w->piv, x.dot );
+}
+
+f64 fvImplicitNorm( f64Mat v )
+{
+    f64 m = 0;
+    for ( u32 i=0; i<v.dim0 * v.dim1; ++i ) {
+        m = MAX( m, fabs( v.data[i] ) );
+    }
+    return m;
+}
+
+
+/* Solves g(x, theta) = 0 by damped Newton from the guess in x.val until
+ * max |g_i| <= tol, then writes dx/dtheta theta.dot to x.dot. */
+b32 f64FVImplicitSolve(
+    Allocator al, FVImplicitFun *g, void *args, f64FVar theta, f64FVar x, u32 maxIter, f64 tol
+)
+{
+    ASSERT( x.dim1 == 1 );
+
+    u32 n = x.dim0;
+
+    fvImplicit w    = fvImplicitMake( al, g, args, theta, n );
+    f64Mat     step = f64MatMake( al, n, 1 );
+    f64Mat     x0   = f64MatMake( al, n, 1 );
+
+    memcpy( w.x.val.data, x.val.data, n * sizeof(f64) );
+
+    b32 ok = 0;
+
+    for ( u32 it=0; ; ++it ) {
+        fvImplicitJacobian( &w );
+
+        f64 norm = fvImplicitNorm( w.out.val );
+
+        if ( norm <= tol ) {
+            ok = f64MatLU( w.jac, w.piv );
+            break;
+        }
+        if ( it == maxIter || ! f64MatLU( w.jac, w.piv ) ) {
+            break;
+        }
+
+        for ( u32 i=0; i<n; ++i ) {
+            step.data[i] = -w.out.val.data[i];
+        }
+        f64MatLUSolve( w.jac, w.piv, step );
+        memcpy( x0.data, w.x.val.data, n * sizeof(f64) );
+
+        /* backtracking on max |g_i| */
+        for ( f64 t=1; t>1E-10; t*=0.5 ) {
+            for ( u32 i=0; i<n; ++i ) {
+                w.x.val.data[i] = x0.data[i] + t * step.data[i];
+            }
+            fvImplicitEval( &w );
+
+            if ( fvImplicitNorm( w.out.val ) <= (1 - 1E-4 * t) * norm ) {
+                break;
+            }
+        }
+    }
+
+    memcpy( x.val.data, w.x.val.data, n * sizeof(f64) );
+
+    if ( ok ) {
+        fvImplicitTangent( &w, theta, x, -1.0 );
+    }
+
+    f64MatFree( al, &x0 );
+    f64MatFree( al, &step );
+    fvImplicitFree( al, &w );
+
+    return ok;
+}
+
+/* Iterates x = T(x, theta) from the guess in x.val until the update is at
+ * most tol * (1 + max |x_i|), then writes dx/dtheta theta.dot from
+ * (I - T_x) dx = T_theta dtheta to x.dot. */
+b32 f64FVFixedPoint(
+    Allocator al, FVImplicitFun *t, void *args, f64FVar theta, f64FVar x, u32 maxIter, f64 tol
+)
+{
+    ASSERT( x.dim1 == 1 );
+
+    u32 n = x.dim0;
+
+    fvImplicit w = fvImplicitMake( al, t, args, theta, n );
+
+    memcpy( w.x.val.data, x.val.data, n * sizeof(f64) );
+
+    b32 ok = 0;
+
+    for ( u32 it=0; it<maxIter; ++it ) {
+        fvImplicitEval( &w );
+
+        f64 diff = 0;
+        for ( u32 i=0; i<n; ++i ) {
+            diff = MAX( diff, fabs( w.out.val.data[i] - w.x.val.data[i] ) );
+        }
+        memcpy( w.x.val.data, w.out.val.data, n * sizeof(f64) );
+
+        if ( diff <= tol * (1 + fvImplicitNorm( w.x.val )) ) {
+            ok = 1;
+            break;
+        }
+    }
+
+    memcpy( x.val.data, w.x.val.data, n * sizeof(f64) );
+
+    if ( ok ) {
+        fvImplicitJacobian( &w );
+
+        for ( u32 i=0; i<n*n; ++i ) {
+            w.jac.data[i] = -w.jac.data[i];
+        }
+        for ( u32 i=0; i<n; ++i ) {
+            w.jac.data[i*n + i] += 1;
+        }
+
+        ok = f64MatLU( w.jac, w.piv );
+
+        if ( ok ) {
+            fvImplicitTangent( &w, theta, x, 1.0 );
+        }
+    }
+
+    fvImplicitFree( al, &w );
+
+    return ok;
+}
+
+
+/* intersection of a circle and a line through the origin, as g(x, theta) = 0 */
+void test_fvi_circle( void *args, f64FVar x, f64FVar theta, f64FVar g )
+{
+    /* x0^2 + x1^2 = theta0, x0 = theta1 x1 */
+    f64 x0 = x.val.data[0], dx0 = x.dot.data[0];
+    f64 x1 = x.val.data[1], dx1 = x.dot.data[1];
+    f64 t0 = theta.val.data[0], dt0 = theta.dot.data[0];
+    f64 t1 = theta.val.data[1], dt1 = theta.dot.data[1];
+
+    f64FVSetElement( g, 0, 0, x0 * x0 + x1 * x1 - t0, 2 * x0 * dx0 + 2 * x1 * dx1 - dt0 );
+    f64FVSetElement( g, 1, 0, x0 - t1 * x1, dx0 - t1 * dx1 - dt1 * x1 );
+}
+
+/* contraction with a cyclic coupling, as a fixed point map */
+void test_fvi_cos( void *args, f64FVar x, f64FVar theta, f64FVar t )
+{
+    /* t_i = theta_i cos(x_i+1 mod n) / 2 */
+    u32 n = x.dim0;
+
+    for ( u32 i=0; i<n; ++i ) {
+        u32 j = (i + 1) % n;
+        f64 c = cos( x.val.data[j] );
+        f64 s = sin( x.val.data[j] );
+        f64FVSetElement(
+            t, i, 0, 0.5 * theta.val.data[i] * c,
+            0.5 * (theta.dot.data[i] * c - theta.val.data[i] * s * x.dot.data[j])
+        );
+    }
+}
+
+#if TEST
+void test_fvar_implicit()
+{
+#define EPS 1E-12
+
+    f64 H = 1E-6;
+
+    f64FVar theta = f64FVMake( DefaultAllocator, 2, 1 );
+    f64FVar x     = f64FVMake( DefaultAllocator, 2, 1 );
+
+    f64FVSetElement( theta, 0, 0, 4.0, 0.3 );
+    f64FVSetElement( theta, 1, 0, 0.5, -1.0 );
+    f64FVSetElement( x, 0, 0, 1.0, 0.0 );
+    f64FVSetElement( x, 1, 0, 1.0, 0.0 );
+
+    TEST_ASSERT( f64FVImplicitSolve( DefaultAllocator, test_fvi_circle, NULL, theta, x, 50, 1E-14 ) );
+
+    /* x1 = sqrt( theta0 / (1 + theta1^2) ), x0 = theta1 x1 */
+    f64 q   = 1 + 0.25;
+    f64 x1  = sqrt( 4.0 / q );
+    f64 dx1 = 0.5 / x1 * (0.3 / q + 4.0 * 2 * 0.5 / (q * q));
+
+    TEST_ASSERT( fabs( x.val.data[1] - x1 ) < EPS );
+    TEST_ASSERT( fabs( x.val.data[0] - 0.5 * x1 ) < EPS );
+    TEST_ASSERT( fabs( x.dot.data[1] - dx1 ) < 1E-10 );
+    TEST_ASSERT( fabs( x.dot.data[0] - (-x1 + 0.5 * dx1) ) < 1E-10 );
+
+    /* fixed point against central differences of the val iteration */
+    f64FVar th3 = f64FVMake( DefaultAllocator, 3, 1 );
+    f64FVar y   = f64FVMake( DefaultAllocator, 3, 1 );
+    f64FVar yp  = f64FVMake( DefaultAllocator, 3, 1 );
+    f64FVar ym  = f64FVMake( DefaultAllocator, 3, 1 );
+
+    f64 t3[3] = { 0.9, -0.7, 1.1 };
+    f64 d3[3] = { 1.0, 0.5, -2.0 };
+
+    for ( u32 i=0; i<3; ++i ) {
+        f64FVSetElement( y, i, 0, 0.0, 0.0 );
+        f64FVSetElement( yp, i, 0, 0.0, 0.0 );
+        f64FVSetElement( ym, i, 0, 0.0, 0.0 );
+        f64FVSetElement( th3, i, 0, t3[i], d3[i] );
+    }
+
+    TEST_ASSERT( f64FVFixedPoint( DefaultAllocator, test_fvi_cos, NULL, th3, y, 200, 1E-15 ) );
+
+    for ( u32 i=0; i<3; ++i ) {
+        f64FVSetElement( th3, i, 0, t3[i] + H * d3[i], 0.0 );
+    }
+    TEST_ASSERT( f64FVFixedPoint( DefaultAllocator, test_fvi_cos, NULL, th3, yp, 200, 1E-15 ) );
+
+    for ( u32 i=0; i<3; ++i ) {
+        f64FVSetElement( th3, i, 0, t3[i] - H * d3[i], 0.0 );
+    }
+    TEST_ASSERT( f64FVFixedPoint( DefaultAllocator, test_fvi_cos, NULL, th3, ym, 200, 1E-15 ) );
+
+    for ( u32 i=0; i<3; ++i ) {
+        u32 j = (i + 1) % 3;
+        TEST_ASSERT( fabs( y.val.data[i] - 0.5 * t3[i] * cos( y.val.data[j] ) ) < EPS );
+        TEST_ASSERT( fabs( y.dot.data[i] - (yp.val.data[i] - ym.val.data[i]) / (2 * H) ) < 1E-8 );
+        TEST_ASSERT( yp.dot.data[i] == 0.0 );
+    }
+
+    /* no root, no tangent */
+    f64FVSetElement( theta, 0, 0, -1.0, 0.0 );
+    f64FVSetElement( x, 0, 0, 1.0, 7.0 );
+    TEST_ASSERT( ! f64FVImplicitSolve( DefaultAllocator, test_fvi_circle, NULL, theta, x, 20, 1E-14 ) );
+    TEST_ASSERT( x.dot.data[0] == 7.0 );
+
+    f64FVFree( DefaultAllocator, &theta );
+    f64FVFree( DefaultAllocator, &x );
+    f64FVFree( DefaultAllocator, &th3 );
+    f64FVFree( DefaultAllocator, &y );
+    f64FVFree( DefaultAllocator, &yp );
+    f64FVFree( DefaultAllocator, &ym );
+
+#undef EPS
+}
+#endif
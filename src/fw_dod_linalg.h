@@ -0,0 +1,567 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Differentiable dense linear algebra for f64FVar matrices. Every function
+// factors a.val once with the blocked Cholesky or LU of linalg.h and obtains
+// the tangent from the same factors via the matrix-calculus identities
+//
+//     A = L L'        dL       = L Phi( L^-1 dA L^-T )
+//     x = A^-1 b      dx       = A^-1 (db - dA x)
+//     B = A^-1        dB       = -A^-1 dA A^-1
+//                     d log|A| = tr( A^-1 dA )
+//     A = V W V'      dw_i     = (V' dA V)_ii
+//                     dV       = V ( F o V' dA V ),  F_ij = 1 / (w_j - w_i)
+//
+// where Phi takes the lower triangle and halves the diagonal and o is the
+// elementwise product. The workspaces come from al. A return value of 0
+// means the factorization failed (not positive definite or singular) and
+// dst was not written, only f64FVDet reports a zero determinant in that
+// case.
+//
+
+
+/* lower triangle of x with halved diagonal */
+void fvLinalgPhi( f64Mat x )
+{
+    u32 n = x.dim0;
+
+    for ( u32 i=0; i<n; ++i ) {
+        x.data[i*n + i] *= 0.5;
+        for ( u32 j=i+1; j<n; ++j ) {
+            x.data[i*n + j] = 0;
+        }
+    }
+}
+
+/* log|det| from the factors of f64MatLU, the sign is written to sign */
+f64 fvLinalgLUDet( f64Mat lu, const u32 *piv, f64 *sign )
+{
+    u32 n = lu.dim0;
+
+    f64 s   = 1;
+    f64 res = 0;
+
+    for ( u32 i=0; i<n; ++i ) {
+        f64 u = lu.data[i*n + i];
+        if ( u < 0 ) {
+            s = -s;
+        }
+        if ( piv[i] != i ) {
+            s = -s;
+        }
+        res += log( fabs( u ) );
+    }
+
+    *sign = s;
+    return res;
+}
+
+/* tr( A^-1 dA ) from the factors of f64MatLU */
+f64 fvLinalgLUTrace( Allocator al, f64Mat lu, const u32 *piv, f64Mat da )
+{
+    u32 n = lu.dim0;
+
+    f64Mat z = f64MatMake( al, n, n );
+    memcpy( z.data, da.data, (u64) n * n * sizeof(f64) );
+
+    f64MatLUSolve( lu, piv, z );
+
+    f64 res = 0;
+    for ( u32 i=0; i<n; ++i ) {
+        res += z.data[i*n + i];
+    }
+
+    f64MatFree( al, &z );
+
+    return res;
+}
+
+
+/* l = chol(a), a.dot is symmetrised before use */
+b32 f64FVCholesky( Allocator al, f64FVar a, f64FVar l )
+{
+    ASSERT( a.dim0 == a.dim1 && l.dim0 == a.dim0 && l.dim1 == a.dim1 );
+
+    u32 n = a.dim0;
+
+    memcpy( l.val.data, a.val.data, (u64) n * n * sizeof(f64) );
+    if ( !f64MatCholesky( l.val ) ) {
+        return 0;
+    }
+
+    f64Mat w = f64MatMake( al, n, n );
+
+    for ( u32 i=0; i<n; ++i ) {
+        for ( u32 j=0; j<n; ++j ) {
+            w.data[i*n + j] = 0.5 * (a.dot.data[i*n + j] + a.dot.data[j*n + i]);
+        }
+    }
+
+    /* (L^-1 dA)' = dA L^-T, so two left solves give L^-1 dA L^-T */
+    f64MatLowerSolve( l.val, w );
+    for ( u32 i=0; i<n; ++i ) {
+        for ( u32 j=i+1; j<n; ++j ) {
+            f64 tmp         = w.data[i*n + j];
+            w.data[i*n + j] = w.data[j*n + i];
+            w.data[j*n + i] = tmp;
+        }
+    }
+    f64MatLowerSolve( l.val, w );
+
+    fvLinalgPhi( w );
+    f64MatGemm( 0, 0, 1.0, l.val, w, 0.0, l.dot );
+
+    f64MatFree( al, &w );
+
+    return 1;
+}
+
+/* solves L L' x = b for l from f64FVCholesky, b and x are n x k */
+void f64FVCholeskySolve( Allocator al, f64FVar l, f64FVar b, f64FVar x )
+{
+    ASSERT( l.dim0 == l.dim1 && b.dim0 == l.dim0 );
+    ASSERT( x.dim0 == b.dim0 && x.dim1 == b.dim1 );
+
+    u32 n = b.dim0;
+    u32 k = b.dim1;
+
+    memcpy( x.val.data, b.val.data, (u64) n * k * sizeof(f64) );
+    f64MatCholeskySolve( l.val, x.val );
+
+    /* dA x = dL (L' x) + L (dL' x) */
+    f64Mat t = f64MatMake( al, n, k );
+
+    memcpy( x.dot.data, b.dot.data, (u64) n * k * sizeof(f64) );
+
+    f64MatGemm( 1, 0, 1.0, l.val, x.val, 0.0, t );
+    f64MatGemm( 0, 0, -1.0, l.dot, t, 1.0, x.dot );
+    f64MatGemm( 1, 0, 1.0, l.dot, x.val, 0.0, t );
+    f64MatGemm( 0, 0, -1.0, l.val, t, 1.0, x.dot );
+
+    f64MatCholeskySolve( l.val, x.dot );
+
+    f64MatFree( al, &t );
+}
+
+/* log det(a) = 2 sum log L_ii for l from f64FVCholesky, dst is 1 x 1 */
+void f64FVCholeskyLogDet( f64FVar l, f64FVar dst )
+{
+    ASSERT( l.dim0 == l.dim1 );
+    ASSERT( dst.dim0 == 1 && dst.dim1 == 1 );
+
+    u32 n = l.dim0;
+
+    f64 val = 0;
+    f64 dot = 0;
+
+    for ( u32 i=0; i<n; ++i ) {
+        val += log( l.val.data[i*n + i] );
+        dot += l.dot.data[i*n + i] / l.val.data[i*n + i];
+    }
+
+    dst.val.data[0] = 2 * val;
+    dst.dot.data[0] = 2 * dot;
+}
+
+
+/* solves a x = b with one LU factorization, b and x are n x k */
+b32 f64FVSolve( Allocator al, f64FVar a, f64FVar b, f64FVar x )
+{
+    ASSERT( a.dim0 == a.dim1 && b.dim0 == a.dim0 );
+    ASSERT( x.dim0 == b.dim0 && x.dim1 == b.dim1 );
+
+    u32 n = b.dim0;
+    u32 k = b.dim1;
+
+    f64Mat lu  = f64MatMake( al, n, n );
+    u32   *piv = (u32 *) Alloc( al, n * sizeof(u32) );
+
+    memcpy( lu.data, a.val.data, (u64) n * n * sizeof(f64) );
+
+    b32 ok = f64MatLU( lu, piv );
+
+    if ( ok ) {
+        memcpy( x.val.data, b.val.data, (u64) n * k * sizeof(f64) );
+        f64MatLUSolve( lu, piv, x.val );
+
+        memcpy( x.dot.data, b.dot.data, (u64) n * k * sizeof(f64) );
+        f64MatGemm( 0, 0, -1.0, a.dot, x.val, 1.0, x.dot );
+        f64MatLUSolve( lu, piv, x.dot );
+    }
+
+    Free( al, piv );
+    f64MatFree( al, &lu );
+
+    return ok;
+}
+
+/* inv = a^-1 */
+b32 f64FVInverse( Allocator al, f64FVar a, f64FVar inv )
+{
+    ASSERT( a.dim0 == a.dim1 && inv.dim0 == a.dim0 && inv.dim1 == a.dim1 );
+
+    u32 n = a.dim0;
+
+    f64Mat lu  = f64MatMake( al, n, n );
+    u32   *piv = (u32 *) Alloc( al, n * sizeof(u32) );
+
+    memcpy( lu.data, a.val.data, (u64) n * n * sizeof(f64) );
+
+    b32 ok = f64MatLU( lu, piv );
+
+    if ( ok ) {
+        memset( inv.val.data, 0, (u64) n * n * sizeof(f64) );
+        for ( u32 i=0; i<n; ++i ) {
+            inv.val.data[i*n + i] = 1;
+        }
+        f64MatLUSolve( lu, piv, inv.val );
+
+        f64Mat t = f64MatMake( al, n, n );
+
+        f64MatGemm( 0, 0, 1.0, a.dot, inv.val, 0.0, t );
+        f64MatGemm( 0, 0, -1.0, inv.val, t, 0.0, inv.dot );
+
+        f64MatFree( al, &t );
+    }
+
+    Free( al, piv );
+    f64MatFree( al, &lu );
+
+    return ok;
+}
+
+/* dst = log|det(a)|, dst is 1 x 1 and the sign of det(a) is written to sign */
+b32 f64FVLogDet( Allocator al, f64FVar a, f64FVar dst, f64 *sign )
+{
+    ASSERT( a.dim0 == a.dim1 );
+    ASSERT( dst.dim0 == 1 && dst.dim1 == 1 );
+
+    u32 n = a.dim0;
+
+    f64Mat lu  = f64MatMake( al, n, n );
+    u32   *piv = (u32 *) Alloc( al, n * sizeof(u32) );
+
+    memcpy( lu.data, a.val.data, (u64) n * n * sizeof(f64) );
+
+    b32 ok = f64MatLU( lu, piv );
+
+    if ( ok ) {
+        f64 s;
+        dst.val.data[0] = fvLinalgLUDet( lu, piv, &s );
+        dst.dot.data[0] = fvLinalgLUTrace( al, lu, piv, a.dot );
+
+        if ( sign ) {
+            *sign = s;
+        }
+    }
+
+    Free( al, piv );
+    f64MatFree( al, &lu );
+
+    return ok;
+}
+
+/* dst = det(a), dst is 1 x 1 */
+b32 f64FVDet( Allocator al, f64FVar a, f64FVar dst )
+{
+    f64 sign;
+
+    if ( !f64FVLogDet( al, a, dst, &sign ) ) {
+        dst.val.data[0] = 0;
+        dst.dot.data[0] = 0;
+        return 0;
+    }
+
+    f64 det = sign * exp( dst.val.data[0] );
+
+    dst.val.data[0] = det;
+    dst.dot.data[0] = det * dst.dot.data[0];
+
+    return 1;
+}
+
+
+/* Eigendecomposition a = V diag(w) V' of the symmetric matrix a, w is n x 1
+ * and ascending, the eigenvectors are the columns of v. Eigenvector
+ * tangents are only defined for distinct eigenvalues, pairs closer than
+ * FVLINALG_EIG_GAP relative to the spectrum get no mixing term. */
+#define FVLINALG_EIG_GAP 1E-12
+
+b32 f64FVSymEig( Allocator al, f64FVar a, f64FVar w, f64FVar v )
+{
+    ASSERT( a.dim0 == a.dim1 && v.dim0 == a.dim0 && v.dim1 == a.dim1 );
+    ASSERT( w.dim0 * w.dim1 == a.dim0 );
+
+    u32 n = a.dim0;
+
+    if ( !f64MatSymEig( al, a.val, w.val, v.val ) ) {
+        return 0;
+    }
+
+    f64Mat t = f64MatMake( al, n, n );
+    f64Mat m = f64MatMake( al, n, n );
+
+    /* m = V' dA V, symmetrised */
+    f64MatGemm( 0, 0, 1.0, a.dot, v.val, 0.0, t );
+    f64MatGemm( 1, 0, 1.0, v.val, t, 0.0, m );
+
+    f64 gap = FVLINALG_EIG_GAP * MAX( fabs( w.val.data[0] ), fabs( w.val.data[n-1] ) );
+
+    for ( u32 i=0; i<n; ++i ) {
+        w.dot.data[i]   = m.data[i*n + i];
+        m.data[i*n + i] = 0;
+        for ( u32 j=i+1; j<n; ++j ) {
+            f64 mij = 0.5 * (m.data[i*n + j] + m.data[j*n + i]);
+            f64 d   = w.val.data[j] - w.val.data[i];
+
+            if ( fabs( d ) > gap ) {
+                m.data[i*n + j] =  mij / d;
+                m.data[j*n + i] = -mij / d;
+            }
+            else {
+                m.data[i*n + j] = 0;
+                m.data[j*n + i] = 0;
+            }
+        }
+    }
+
+    f64MatGemm( 0, 0, 1.0, v.val, m, 0.0, v.dot );
+
+    f64MatFree( al, &t );
+    f64MatFree( al, &m );
+
+    return 1;
+}
+
+
+/* dst = a + h da, as a constant */
+void test_fvl_perturb( f64FVar a, f64 h, f64FVar dst )
+{
+    u32 n = a.dim0 * a.dim1;
+
+    for ( u32 i=0; i<n; ++i ) {
+        dst.val.data[i] = a.val.data[i] + h * a.dot.data[i];
+        dst.dot.data[i] = 0;
+    }
+}
+
+/* central difference (p - m) / 2h against the tangent of fv */
+b32 test_fvl_fdiff( f64FVar p, f64FVar m, f64FVar fv, f64 h, f64 eps )
+{
+    u32 n = fv.dim0 * fv.dim1;
+
+    for ( u32 i=0; i<n; ++i ) {
+        f64 fd = (p.val.data[i] - m.val.data[i]) / (2 * h);
+        if ( !f64Equal( fd, fv.dot.data[i], eps ) ) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#if TEST
+void test_fvar_linalg()
+{
+#define EPS 1E-6
+
+    u32 N = 70;
+    f64 H = 1E-5;
+
+    Xorshift1024 rng = Xorshift1024Init( 11 );
+
+    f64FVar a   = f64FVMake( DefaultAllocator, N, N );
+    f64FVar spd = f64FVMake( DefaultAllocator, N, N );
+    f64FVar b   = f64FVMake( DefaultAllocator, N, 2 );
+    f64FVar ap  = f64FVMake( DefaultAllocator, N, N );
+    f64FVar am  = f64FVMake( DefaultAllocator, N, N );
+    f64FVar r   = f64FVMake( DefaultAllocator, N, N );
+    f64FVar rp  = f64FVMake( DefaultAllocator, N, N );
+    f64FVar rm  = f64FVMake( DefaultAllocator, N, N );
+    f64FVar l   = f64FVMake( DefaultAllocator, N, N );
+    f64FVar x   = f64FVMake( DefaultAllocator, N, 2 );
+    f64FVar xp  = f64FVMake( DefaultAllocator, N, 2 );
+    f64FVar xm  = f64FVMake( DefaultAllocator, N, 2 );
+    f64FVar s   = f64FVMake( DefaultAllocator, 1, 1 );
+    f64FVar sp  = f64FVMake( DefaultAllocator, 1, 1 );
+    f64FVar sm  = f64FVMake( DefaultAllocator, 1, 1 );
+
+    for ( u32 i=0; i<N*N; ++i ) {
+        a.val.data[i] = rngXorshift1024NextFloat( &rng ) - 0.5;
+        a.dot.data[i] = rngXorshift1024NextFloat( &rng ) - 0.5;
+    }
+    for ( u32 i=0; i<N; ++i ) {
+        a.val.data[i*N + i] += 4;
+    }
+    for ( u32 i=0; i<2*N; ++i ) {
+        b.val.data[i] = rngXorshift1024NextFloat( &rng );
+        b.dot.data[i] = rngXorshift1024NextFloat( &rng );
+    }
+
+    /* spd = a a' / N + I with a symmetric direction */
+    f64MatGemm( 0, 1, 1.0 / N, a.val, a.val, 0.0, spd.val );
+    for ( u32 i=0; i<N; ++i ) {
+        spd.val.data[i*N + i] += 1;
+        for ( u32 j=0; j<N; ++j ) {
+            spd.dot.data[i*N + j] = a.dot.data[i*N + j] + a.dot.data[j*N + i];
+        }
+    }
+
+    /* Cholesky */
+    TEST_ASSERT( f64FVCholesky( DefaultAllocator, spd, l ) );
+    f64MatGemm( 0, 1, 1.0, l.val, l.val, 0.0, r.val );
+    TEST_ASSERT( f64MatEqual( r.val, spd.val, 1E-10 ) );
+
+    test_fvl_perturb( spd, H, ap );
+    test_fvl_perturb( spd, -H, am );
+    f64FVCholesky( DefaultAllocator, ap, rp );
+    f64FVCholesky( DefaultAllocator, am, rm );
+    TEST_ASSERT( test_fvl_fdiff( rp, rm, l, H, EPS ) );
+
+    /* Cholesky solve and log-det, with b perturbed along */
+    f64FVCholeskySolve( DefaultAllocator, l, b, x );
+
+    f64FVar bp = f64FVMake( DefaultAllocator, N, 2 );
+    f64FVar bm = f64FVMake( DefaultAllocator, N, 2 );
+    test_fvl_perturb( b, H, bp );
+    test_fvl_perturb( b, -H, bm );
+
+    f64FVCholeskySolve( DefaultAllocator, rp, bp, xp );
+    f64FVCholeskySolve( DefaultAllocator, rm, bm, xm );
+    TEST_ASSERT( test_fvl_fdiff( xp, xm, x, H, EPS ) );
+
+    f64FVCholeskyLogDet( l, s );
+    f64FVCholeskyLogDet( rp, sp );
+    f64FVCholeskyLogDet( rm, sm );
+    TEST_ASSERT( test_fvl_fdiff( sp, sm, s, H, EPS ) );
+
+    /* the LU path agrees on the SPD matrix */
+    f64FVar s2 = f64FVMake( DefaultAllocator, 1, 1 );
+    f64 sign;
+    TEST_ASSERT( f64FVLogDet( DefaultAllocator, spd, s2, &sign ) );
+    TEST_ASSERT( sign == 1 );
+    TEST_ASSERT( f64FVEqual( s, s2, EPS ) );
+
+    /* LU solve, inverse, det on the non-symmetric matrix */
+    test_fvl_perturb( a, H, ap );
+    test_fvl_perturb( a, -H, am );
+
+    TEST_ASSERT( f64FVSolve( DefaultAllocator, a, b, x ) );
+    f64FVSolve( DefaultAllocator, ap, bp, xp );
+    f64FVSolve( DefaultAllocator, am, bm, xm );
+    TEST_ASSERT( test_fvl_fdiff( xp, xm, x, H, EPS ) );
+
+    TEST_ASSERT( f64FVInverse( DefaultAllocator, a, r ) );
+    f64FVInverse( DefaultAllocator, ap, rp );
+    f64FVInverse( DefaultAllocator, am, rm );
+    TEST_ASSERT( test_fvl_fdiff( rp, rm, r, H, EPS ) );
+
+    f64MatGemm( 0, 0, 1.0, a.val, r.val, 0.0, l.val );
+    for ( u32 i=0; i<N; ++i ) {
+        l.val.data[i*N + i] -= 1;
+    }
+    for ( u32 i=0; i<N*N; ++i ) {
+        TEST_ASSERT( fabs( l.val.data[i] ) < 1E-10 );
+    }
+
+    TEST_ASSERT( f64FVLogDet( DefaultAllocator, a, s, &sign ) );
+    TEST_ASSERT( f64FVDet( DefaultAllocator, a, s2 ) );
+    TEST_ASSERT( f64Equal( s2.val.data[0], sign * exp( s.val.data[0] ), EPS * fabs( s2.val.data[0] ) ) );
+
+    f64FVLogDet( DefaultAllocator, ap, sp, NULL );
+    f64FVLogDet( DefaultAllocator, am, sm, NULL );
+    TEST_ASSERT( test_fvl_fdiff( sp, sm, s, H, EPS ) );
+
+    f64FVFree( DefaultAllocator, &a );
+    f64FVFree( DefaultAllocator, &spd );
+    f64FVFree( DefaultAllocator, &b );
+    f64FVFree( DefaultAllocator, &bp );
+    f64FVFree( DefaultAllocator, &bm );
+    f64FVFree( DefaultAllocator, &ap );
+    f64FVFree( DefaultAllocator, &am );
+    f64FVFree( DefaultAllocator, &r );
+    f64FVFree( DefaultAllocator, &rp );
+    f64FVFree( DefaultAllocator, &rm );
+    f64FVFree( DefaultAllocator, &l );
+    f64FVFree( DefaultAllocator, &x );
+    f64FVFree( DefaultAllocator, &xp );
+    f64FVFree( DefaultAllocator, &xm );
+    f64FVFree( DefaultAllocator, &s );
+    f64FVFree( DefaultAllocator, &s2 );
+    f64FVFree( DefaultAllocator, &sp );
+    f64FVFree( DefaultAllocator, &sm );
+
+#undef EPS
+}
+#endif
+
+
+#if TEST
+void test_fvar_symeig()
+{
+#define EPS 1E-6
+
+    u32 N = 40;
+    f64 H = 1E-6;
+
+    Xorshift1024 rng = Xorshift1024Init( 17 );
+
+    f64FVar a  = f64FVMake( DefaultAllocator, N, N );
+    f64FVar ap = f64FVMake( DefaultAllocator, N, N );
+    f64FVar am = f64FVMake( DefaultAllocator, N, N );
+    f64FVar w  = f64FVMake( DefaultAllocator, N, 1 );
+    f64FVar wp = f64FVMake( DefaultAllocator, N, 1 );
+    f64FVar wm = f64FVMake( DefaultAllocator, N, 1 );
+    f64FVar v  = f64FVMake( DefaultAllocator, N, N );
+    f64FVar vp = f64FVMake( DefaultAllocator, N, N );
+    f64FVar vm = f64FVMake( DefaultAllocator, N, N );
+
+    for ( u32 i=0; i<N; ++i ) {
+        for ( u32 j=0; j<=i; ++j ) {
+            f64 x = rngXorshift1024NextFloat( &rng ) - 0.5;
+            f64 y = rngXorshift1024NextFloat( &rng ) - 0.5;
+            f64FVSetElement( a, i, j, x, y );
+            f64FVSetElement( a, j, i, x, y );
+        }
+    }
+
+    TEST_ASSERT( f64FVSymEig( DefaultAllocator, a, w, v ) );
+
+    test_fvl_perturb( a, H, ap );
+    test_fvl_perturb( a, -H, am );
+    f64FVSymEig( DefaultAllocator, ap, wp, vp );
+    f64FVSymEig( DefaultAllocator, am, wm, vm );
+
+    TEST_ASSERT( test_fvl_fdiff( wp, wm, w, H, EPS ) );
+
+    /* eigenvectors are unique up to sign */
+    for ( u32 j=0; j<N; ++j ) {
+        f64 sp = 0, sm = 0;
+        for ( u32 i=0; i<N; ++i ) {
+            sp += v.val.data[i*N + j] * vp.val.data[i*N + j];
+            sm += v.val.data[i*N + j] * vm.val.data[i*N + j];
+        }
+        for ( u32 i=0; i<N; ++i ) {
+            if ( sp < 0 ) {
+                vp.val.data[i*N + j] = -vp.val.data[i*N + j];
+            }
+            if ( sm < 0 ) {
+                vm.val.data[i*N + j] = -vm.val.data[i*N + j];
+            }
+        }
+    }
+
+    TEST_ASSERT( test_fvl_fdiff( vp, vm, v, H, EPS ) );
+
+    f64FVFree( DefaultAllocator, &a );
+    f64FVFree( DefaultAllocator, &ap );
+    f64FVFree( DefaultAllocator, &am );
+    f64FVFree( DefaultAllocator, &w );
+    f64FVFree( DefaultAllocator, &wp );
+    f64FVFree( DefaultAllocator, &wm );
+    f64FVFree( DefaultAllocator, &v );
+    f64FVFree( DefaultAllocator, &vp );
+    f64FVFree( DefaultAllocator, &vm );
+
+#undef EPS
+}
+#endif
@@ -0,0 +1,403 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Adaptive Runge-Kutta integration of y' = f(t, y) together with k tangent
+// directions dy' = f_y dy + f_theta dtheta, i.e. forward sensitivities
+// with respect to initial values or to parameters the right hand side
+// takes from args. The right hand side is called once per stage for all
+// directions, val and the n x k tangents share one step size.
+//
+// The scheme is the embedded 5(4) pair of Dormand & Prince (1980) with
+// first-same-as-last, the local error estimate runs over val and all
+// tangents with the weights atol + rtol max(|z_i|, |zNew_i|). State and
+// stage buffers are laid out as [val (n), dot (n x k)] and allocated once in
+// ODEMake, integrating does not allocate. A dod state y is the case k = 1
+// with y.dot as the tangent, see f64FVODEIntegrate.
+//
+// A call that continues where the previous one stopped, with the same f,
+// args, time and state, reuses the last stage of the previous call as its
+// first. Anything else evaluates f at the initial state again. f and args
+// are compared by address only, call ODEReset after changing what args
+// points to.
+//
+
+/* writes f(t, y) to f and f_y dy + f_theta dtheta to df, y and f are
+ * n x 1, dy and df n x k */
+typedef void ODEFun( void *args, f64 t, f64Mat y, f64Mat dy, f64Mat f, f64Mat df );
+
+
+typedef struct ODEOptions ODEOptions;
+struct ODEOptions {
+    f64 rtol;
+    f64 atol;
+    f64 h0;         /* initial step, 0 picks one */
+    f64 hMax;       /* 0 for no limit */
+    u32 maxSteps;   /* per call of ODEIntegrate */
+};
+
+ODEOptions ODEDefaultOptions( void )
+{
+    ODEOptions o;
+    o.rtol     = 1E-8;
+    o.atol     = 1E-10;
+    o.h0       = 0;
+    o.hMax     = 0;
+    o.maxSteps = 100000;
+    return o;
+}
+
+
+typedef struct ODE ODE;
+struct ODE {
+    u32     n;
+    u32     k;
+    u32     size;        /* n (1 + k) */
+
+    f64     h;           /* last proposed step size, reused by the next call */
+    b32     fsal;        /* stage[0] holds f at the state in z ... */
+    f64     t;           /* ... at time t, for fun and args */
+    ODEFun *fun;
+    void   *args;
+
+    f64Mat  stage[7];    /* size x 1 each */
+    f64Mat  z, zNew, err;
+
+    u32     steps;
+    u32     rejected;
+    u32     evaluations;
+};
+
+
+ODE ODEMake( Allocator al, u32 n, u32 k )
+{
+    ASSERT( n > 0 );
+
+    ODE ode;
+    memset( &ode, 0, sizeof(ode) );
+
+    ode.n    = n;
+    ode.k    = k;
+    ode.size = n * (1 + k);
+
+    for ( u32 s=0; s<7; ++s ) {
+        ode.stage[s] = f64MatZeroMake( al, ode.size, 1 );
+    }
+    ode.z    = f64MatZeroMake( al, ode.size, 1 );
+    ode.zNew = f64MatZeroMake( al, ode.size, 1 );
+    ode.err  = f64MatZeroMake( al, ode.size, 1 );
+
+    return ode;
+}
+
+void ODEFree( Allocator al, ODE *ode )
+{
+    for ( u32 s=0; s<7; ++s ) {
+        f64MatFree( al, &ode->stage[s] );
+    }
+    f64MatFree( al, &ode->z );
+    f64MatFree( al, &ode->zNew );
+    f64MatFree( al, &ode->err );
+}
+
+/* forgets the step size and the stored stage, e.g. after args changed */
+void ODEReset( ODE *ode )
+{
+    ode->h    = 0;
+    ode->fsal = 0;
+}
+
+
+/* f at the state z into dst, both laid out as [val, dot] */
+void odeEval( ODE *ode, ODEFun *f, void *args, f64 t, f64Mat z, f64Mat dst )
+{
+    u32 n = ode->n;
+
+    f64Mat y  = { .dim0 = n, .dim1 = 1,      .data = z.data };
+    f64Mat dy = { .dim0 = n, .dim1 = ode->k, .data = z.data + n };
+    f64Mat g  = { .dim0 = n, .dim1 = 1,      .data = dst.data };
+    f64Mat dg = { .dim0 = n, .dim1 = ode->k, .data = dst.data + n };
+
+    f( args, t, y, dy, g, dg );
+    ode->evaluations += 1;
+}
+
+/* weighted RMS norm of err */
+f64 odeErrorNorm( ODE *ode, ODEOptions opts )
+{
+    f64 sum = 0;
+
+    for ( u32 i=0; i<ode->size; ++i ) {
+        f64 sc = opts.atol + opts.rtol * MAX( fabs( ode->z.data[i] ), fabs( ode->zNew.data[i] ) );
+        f64 e  = ode->err.data[i] / sc;
+        sum += e * e;
+    }
+
+    return sqrt( sum / ode->size );
+}
+
+/* Hairer, Norsett & Wanner, II.4, from f at z in stage[0] */
+f64 odeInitialStep( ODE *ode, ODEOptions opts )
+{
+    f64 d0 = 0, d1 = 0;
+
+    for ( u32 i=0; i<ode->size; ++i ) {
+        f64 sc = opts.atol + opts.rtol * fabs( ode->z.data[i] );
+        d0 += (ode->z.data[i] / sc) * (ode->z.data[i] / sc);
+        d1 += (ode->stage[0].data[i] / sc) * (ode->stage[0].data[i] / sc);
+    }
+
+    d0 = sqrt( d0 / ode->size );
+    d1 = sqrt( d1 / ode->size );
+
+    return d0 < 1E-5 || d1 < 1E-5 ? 1E-6 : 0.01 * d0 / d1;
+}
+
+
+static const f64 ODE_C[7] = { 0, 1.0/5, 3.0/10, 4.0/5, 8.0/9, 1, 1 };
+
+static const f64 ODE_A[7][6] = {
+    { 0 },
+    { 1.0/5 },
+    { 3.0/40, 9.0/40 },
+    { 44.0/45, -56.0/15, 32.0/9 },
+    { 19372.0/6561, -25360.0/2187, 64448.0/6561, -212.0/729 },
+    { 9017.0/3168, -355.0/33, 46732.0/5247, 49.0/176, -5103.0/18656 },
+    { 35.0/384, 0, 500.0/1113, 125.0/192, -2187.0/6784, 11.0/84 },
+};
+
+/* difference of the 5th and 4th order weights */
+static const f64 ODE_E[7] = {
+    71.0/57600, 0, -71.0/16695, 71.0/1920, -17253.0/339200, 22.0/525, -1.0/40
+};
+
+
+/* Integrates from t0 to t1 (either direction), y (n x 1) and dy (n x k)
+ * hold the initial values and are overwritten by the values at t1. Returns
+ * 0 if maxSteps were not enough or the step size underflowed, y and dy then
+ * hold the last accepted state. */
+b32 ODEIntegrate(
+    ODE *ode, ODEFun *f, void *args, f64 t0, f64 t1, f64Mat y, f64Mat dy, ODEOptions opts
+)
+{
+    u32 n = ode->n;
+
+    ASSERT( y.dim0 * y.dim1 == n );
+    ASSERT( ode->k == 0 || (dy.dim0 == n && dy.dim1 == ode->k) );
+
+    simdEnsureKernels();
+
+    /* stage[0] is f at the end of the previous call, z still holds that state */
+    b32 reuse = ode->fsal && ode->fun == f && ode->args == args && ode->t == t0
+             && memcmp( ode->z.data, y.data, n * sizeof(f64) ) == 0
+             && (ode->k == 0 || memcmp( ode->z.data + n, dy.data, (u64) n * ode->k * sizeof(f64) ) == 0);
+
+    memcpy( ode->z.data, y.data, n * sizeof(f64) );
+    if ( ode->k ) {
+        memcpy( ode->z.data + n, dy.data, (u64) n * ode->k * sizeof(f64) );
+    }
+
+    f64 dir  = t1 >= t0 ? 1.0 : -1.0;
+    f64 span = fabs( t1 - t0 );
+    f64 hMax = opts.hMax > 0 ? MIN( opts.hMax, span ) : span;
+
+    if ( ! reuse ) {
+        odeEval( ode, f, args, t0, ode->z, ode->stage[0] );
+        ode->fsal = 1;
+        ode->fun  = f;
+        ode->args = args;
+    }
+
+    f64 h = opts.h0 > 0 ? opts.h0 : (ode->h > 0 ? ode->h : odeInitialStep( ode, opts ));
+    h = MIN( h, hMax );
+
+    f64 t  = t0;
+    b32 ok = span == 0;
+    b32 lastRejected = 0;
+
+    for ( u32 step=0; step<opts.maxSteps && ! ok; ++step ) {
+        b32 last = 0;
+        f64 hs   = h;
+
+        if ( fabs( t1 - t ) <= 1.01 * hs ) {
+            hs   = fabs( t1 - t );
+            last = 1;
+        }
+        if ( hs <= 16 * DBL_EPSILON * MAX( fabs( t ), 1.0 ) ) {
+            break;
+        }
+
+        f64 hd = dir * hs;
+
+        for ( u32 s=1; s<7; ++s ) {
+            memcpy( ode->zNew.data, ode->z.data, ode->size * sizeof(f64) );
+            for ( u32 j=0; j<s; ++j ) {
+                if ( ODE_A[s][j] != 0 ) {
+                    FVSimd.axpy( ode->size, hd * ODE_A[s][j], ode->stage[j].data, ode->zNew.data );
+                }
+            }
+            odeEval( ode, f, args, t + ODE_C[s] * hd, ode->zNew, ode->stage[s] );
+        }
+
+        /* zNew is the 5th order solution (stage 6's argument), stage[6] is
+         * f there */
+        memset( ode->err.data, 0, ode->size * sizeof(f64) );
+        for ( u32 s=0; s<7; ++s ) {
+            if ( ODE_E[s] != 0 ) {
+                FVSimd.axpy( ode->size, hd * ODE_E[s], ode->stage[s].data, ode->err.data );
+            }
+        }
+
+        f64 e = odeErrorNorm( ode, opts );
+
+        if ( e <= 1 ) {
+            t = last ? t1 : t + hd;
+
+            f64Mat tmp;
+            tmp = ode->z; ode->z = ode->zNew; ode->zNew = tmp;
+            tmp = ode->stage[0]; ode->stage[0] = ode->stage[6]; ode->stage[6] = tmp;
+
+            ode->steps += 1;
+            ok = last;
+
+            f64 fac = e > 0 ? 0.9 * pow( e, -0.2 ) : 5.0;
+            fac = MIN( fac, lastRejected ? 1.0 : 5.0 );
+            h   = MIN( hs * MAX( fac, 0.2 ), hMax );
+
+            /* keep the proposal for the next call, not the clipped last step */
+            if ( ! last || hs >= ode->h ) {
+                ode->h = h;
+            }
+            lastRejected = 0;
+        }
+        else {
+            ode->rejected += 1;
+            h = hs * MAX( 0.9 * pow( e, -0.2 ), 0.2 );
+            lastRejected = 1;
+        }
+    }
+
+    ode->t = t;
+
+    memcpy( y.data, ode->z.data, n * sizeof(f64) );
+    if ( ode->k ) {
+        memcpy( dy.data, ode->z.data + n, (u64) n * ode->k * sizeof(f64) );
+    }
+
+    return ok;
+}
+
+/* dod state, y.val and y.dot (n x 1) with one direction, needs an ODE made
+ * with k = 1 */
+b32 f64FVODEIntegrate( ODE *ode, ODEFun *f, void *args, f64 t0, f64 t1, f64FVar y, ODEOptions opts )
+{
+    ASSERT( ode->k == 1 && y.dim1 == 1 );
+
+    return ODEIntegrate( ode, f, args, t0, t1, y.val, y.dot, opts );
+}
+
+
+/* exponential decay with its sensitivity to the rate theta in args */
+void test_ode_decay( void *args, f64 t, f64Mat y, f64Mat dy, f64Mat f, f64Mat df )
+{
+    /* y' = -theta y, tangent along dtheta = 1 */
+    f64 theta = *(f64 *) args;
+
+    f.data[0]  = -theta * y.data[0];
+    df.data[0] = -theta * dy.data[0] - y.data[0];
+}
+
+/* harmonic oscillator with frequency w in args */
+void test_ode_oscillator( void *args, f64 t, f64Mat y, f64Mat dy, f64Mat f, f64Mat df )
+{
+    /* x' = v, v' = -w^2 x, directions x0, v0 and w */
+    f64 w = *(f64 *) args;
+    u32 k = dy.dim1;
+
+    f.data[0] = y.data[1];
+    f.data[1] = -w * w * y.data[0];
+
+    for ( u32 j=0; j<k; ++j ) {
+        df.data[j]     = dy.data[k + j];
+        df.data[k + j] = -w * w * dy.data[j] - (j == 2 ? 2 * w * y.data[0] : 0);
+    }
+}
+
+#if TEST
+void test_fvar_ode()
+{
+    ODEOptions opts = ODEDefaultOptions();
+    opts.rtol = 1E-10;
+    opts.atol = 1E-12;
+
+    /* dual state, parameter sensitivity of the decay */
+    f64 theta = 0.7;
+
+    ODE ode = ODEMake( DefaultAllocator, 1, 1 );
+    f64FVar y = f64FVMake( DefaultAllocator, 1, 1 );
+    f64FVSetElement( y, 0, 0, 1.0, 0.0 );
+
+    for ( u32 i=1; i<=4; ++i ) {
+        f64 t = 0.5 * i;
+
+        TEST_ASSERT( f64FVODEIntegrate( &ode, test_ode_decay, &theta, t - 0.5, t, y, opts ) );
+
+        TEST_ASSERT( fabs( y.val.data[0] - exp( -theta * t ) ) < 1E-9 );
+        TEST_ASSERT( fabs( y.dot.data[0] + t * exp( -theta * t ) ) < 1E-9 );
+    }
+
+    /* only the first call evaluates f at its initial state */
+    TEST_ASSERT( ode.evaluations == 1 + 6 * (ode.steps + ode.rejected) );
+
+    /* a new initial value does not reuse the stored stage */
+    f64FVSetElement( y, 0, 0, 1.0, 0.0 );
+
+    TEST_ASSERT( f64FVODEIntegrate( &ode, test_ode_decay, &theta, 0, 0.5, y, opts ) );
+    TEST_ASSERT( fabs( y.val.data[0] - exp( -0.5 * theta ) ) < 1E-9 );
+    TEST_ASSERT( fabs( y.dot.data[0] + 0.5 * exp( -0.5 * theta ) ) < 1E-9 );
+    TEST_ASSERT( ode.evaluations == 2 + 6 * (ode.steps + ode.rejected) );
+
+    ODEFree( DefaultAllocator, &ode );
+    f64FVFree( DefaultAllocator, &y );
+
+    /* vector mode, 3 directions, forward and back */
+    f64 w  = 2.0;
+    f64 T  = 3.0;
+
+    ode = ODEMake( DefaultAllocator, 2, 3 );
+
+    f64Mat x  = f64MatMake( DefaultAllocator, 2, 1 );
+    f64Mat dx = f64MatZeroMake( DefaultAllocator, 2, 3 );
+
+    x.data[0]  = 1.0;
+    x.data[1]  = 0.0;
+    dx.data[0] = 1.0;
+    dx.data[4] = 1.0;
+
+    TEST_ASSERT( ODEIntegrate( &ode, test_ode_oscillator, &w, 0, T, x, dx, opts ) );
+
+    f64 c = cos( w * T );
+    f64 s = sin( w * T );
+
+    TEST_ASSERT( fabs( x.data[0] - c ) < 1E-8 );
+    TEST_ASSERT( fabs( x.data[1] + w * s ) < 1E-8 );
+    TEST_ASSERT( fabs( dx.data[0] - c ) < 1E-8 );
+    TEST_ASSERT( fabs( dx.data[1] - s / w ) < 1E-8 );
+    TEST_ASSERT( fabs( dx.data[2] + T * s ) < 1E-8 );
+    TEST_ASSERT( fabs( dx.data[3] + w * s ) < 1E-8 );
+    TEST_ASSERT( fabs( dx.data[4] - c ) < 1E-8 );
+    TEST_ASSERT( fabs( dx.data[5] + s + w * T * c ) < 1E-8 );
+
+    ODEReset( &ode );
+    TEST_ASSERT( ODEIntegrate( &ode, test_ode_oscillator, &w, T, 0, x, dx, opts ) );
+    TEST_ASSERT( fabs( x.data[0] - 1 ) < 1E-7 && fabs( x.data[1] ) < 1E-7 );
+
+    /* the step budget is honoured */
+    ODEReset( &ode );
+    opts.maxSteps = 3;
+    TEST_ASSERT( ! ODEIntegrate( &ode, test_ode_oscillator, &w, 0, T, x, dx, opts ) );
+
+    f64MatFree( DefaultAllocator, &x );
+    f64MatFree( DefaultAllocator, &dx );
+    ODEFree( DefaultAllocator, &ode );
+}
+#endif
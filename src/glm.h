@@ -0,0 +1,296 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Generalized linear model log-likelihoods sum_i l( y_i, x_i' beta ) over a
+// design matrix x (N x p) with canonical links,
+//
+//     GLM_GAUSSIAN  l = -(y - eta)^2 / 2            dl = (y - eta) deta
+//     GLM_LOGISTIC  l = y eta - log(1 + e^eta)      dl = (y - sigmoid(eta)) deta
+//     GLM_POISSON   l = y eta - e^eta               dl = (y - e^eta) deta
+//
+// up to terms that do not depend on beta. Each evaluation streams x once:
+// a block of rows that fits in L2 gets eta = x beta and deta = x dbeta from
+// one pass per row, then link and loss run over the block with the SIMD exp.
+// Blocks are grouped into at most GLM_MAX_TASKS tasks whose size depends
+// only on N and p, task results are combined pairwise, so the result is
+// bitwise reproducible for any number of threads.
+//
+
+#define GLM_CACHE_BYTES (256 * 1024)
+#define GLM_MAX_ROWS    512
+#define GLM_MAX_TASKS   1024
+
+
+typedef enum GLMFamily GLMFamily;
+enum GLMFamily {
+    GLM_GAUSSIAN,
+    GLM_LOGISTIC,
+    GLM_POISSON,
+};
+
+
+typedef struct glmArgs glmArgs;
+struct glmArgs {
+    GLMFamily  family;
+    f64Mat     x;
+    const f64 *y;
+    const f64 *b;
+    const f64 *db;       /* NULL for the value only */
+    u32        rows;     /* rows per cache block */
+    u32        taskRows; /* rows per task, a multiple of rows */
+    f64       *val;
+    f64       *dot;
+};
+
+/* log-likelihood of the rows [start, end), at most GLM_MAX_ROWS */
+f64 glmBlock( const glmArgs *a, u32 start, u32 end, f64 *dot )
+{
+    f64 eta[GLM_MAX_ROWS];
+    f64 deta[GLM_MAX_ROWS];
+    f64 e[GLM_MAX_ROWS];
+    f64 m[GLM_MAX_ROWS];    /* -|eta|, the exp kernel does not run in place */
+
+    u32 n = end - start;
+    u32 p = a->x.dim1;
+
+    const f64 *y = a->y + start;
+
+    /* also tells the compiler that eta and m are written before exp reads them */
+    if ( n == 0 ) {
+        *dot = 0;
+        return 0;
+    }
+
+    for ( u32 k=0; k<n; ++k ) {
+        const f64 *row = a->x.data + (u64) (start + k) * p;
+        if ( a->db ) {
+            eta[k] = FVSimd.dot2( p, row, a->b, a->db, &deta[k] );
+        }
+        else {
+            eta[k]  = FVSimd.dot( p, row, a->b );
+            deta[k] = 0;
+        }
+    }
+
+    f64 val = 0;
+    f64 der = 0;
+
+    switch ( a->family ) {
+        case GLM_GAUSSIAN:
+            for ( u32 k=0; k<n; ++k ) {
+                f64 r = y[k] - eta[k];
+                val  -= 0.5 * r * r;
+                der  += r * deta[k];
+            }
+            break;
+
+        case GLM_LOGISTIC:
+            for ( u32 k=0; k<n; ++k ) {
+                m[k] = -fabs( eta[k] );
+            }
+            FVSimd.exp( n, m, e );
+            for ( u32 k=0; k<n; ++k ) {
+                f64 q  = 1.0 / (1.0 + e[k]);
+                f64 mu = eta[k] >= 0 ? q : e[k] * q;
+                val   += y[k] * eta[k] - MAX( eta[k], 0.0 ) - log1p( e[k] );
+                der   += (y[k] - mu) * deta[k];
+            }
+            break;
+
+        default:
+            FVSimd.exp( n, eta, e );
+            for ( u32 k=0; k<n; ++k ) {
+                val += y[k] * eta[k] - e[k];
+                der += (y[k] - e[k]) * deta[k];
+            }
+            break;
+    }
+
+    *dot = der;
+    return val;
+}
+
+void glmTasks( void *args, u32 start, u32 end )
+{
+    glmArgs *a = (glmArgs *) args;
+
+    u32 N = a->x.dim0;
+
+    for ( u32 t=start; t<end; ++t ) {
+        u32 first = t * a->taskRows;
+        u32 last  = MIN( first + a->taskRows, N );
+
+        f64 val = 0;
+        f64 dot = 0;
+
+        for ( u32 r=first; r<last; r+=a->rows ) {
+            f64 d;
+            val += glmBlock( a, r, MIN( r + a->rows, last ), &d );
+            dot += d;
+        }
+
+        a->val[t] = val;
+        a->dot[t] = dot;
+    }
+}
+
+f64 glmLogLik( GLMFamily family, f64Mat x, f64Mat y, const f64 *b, const f64 *db, f64 *dot )
+{
+    f64 val[GLM_MAX_TASKS];
+    f64 der[GLM_MAX_TASKS];
+
+    u32 N = x.dim0;
+    u32 p = x.dim1;
+
+    ASSERT( y.dim0 * y.dim1 == N );
+
+    u32 rows = GLM_CACHE_BYTES / (sizeof(f64) * MAX( p, 1 ));
+    rows     = MAX( 8, MIN( rows, GLM_MAX_ROWS ) );
+
+    u32 taskRows = MAX( rows, (N + GLM_MAX_TASKS - 1) / GLM_MAX_TASKS );
+    taskRows     = (taskRows + rows - 1) / rows * rows;
+
+    u32 numTasks = (N + taskRows - 1) / taskRows;
+
+    glmArgs args = {
+        .family   = family,
+        .x        = x,
+        .y        = y.data,
+        .b        = b,
+        .db       = db,
+        .rows     = rows,
+        .taskRows = taskRows,
+        .val      = val,
+        .dot      = der,
+    };
+
+    simdEnsureKernels();
+
+    if ( (u64) N * p < BLAS1_MIN_PARALLEL ) {
+        glmTasks( &args, 0, numTasks );
+    }
+    else {
+        ParallelFor( numTasks, 1, glmTasks, &args );
+    }
+
+    if ( dot ) {
+        *dot = blasPairwiseSum( der, numTasks );
+    }
+
+    return blasPairwiseSum( val, numTasks );
+}
+
+
+/* log-likelihood at beta (p x 1) and its derivative along beta.dot */
+f64 f64FVGLMLogLik( GLMFamily family, f64Mat x, f64Mat y, f64FVar beta, f64 *dot )
+{
+    ASSERT( beta.dim0 * beta.dim1 == x.dim1 );
+
+    return glmLogLik( family, x, y, beta.val.data, beta.dot.data, dot );
+}
+
+/* log-likelihood at beta (p x 1) */
+f64 f64GLMLogLik( GLMFamily family, f64Mat x, f64Mat y, f64Mat beta )
+{
+    ASSERT( beta.dim0 * beta.dim1 == x.dim1 );
+
+    return glmLogLik( family, x, y, beta.data, NULL, NULL );
+}
+
+
+#if TEST
+void test_glm()
+{
+#define EPS 1E-9
+
+    u32 N = 20011;
+    u32 P = 7;
+    f64 H = 1E-6;
+
+    b32 ownPool = FVThreadPool.numThreads == 0;
+    if ( ownPool ) {
+        InitializeParallel( 4 );
+    }
+
+    f64Mat  x    = f64MatMake( DefaultAllocator, N, P );
+    f64Mat  y    = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat  bp   = f64MatMake( DefaultAllocator, P, 1 );
+    f64Mat  bm   = f64MatMake( DefaultAllocator, P, 1 );
+    f64FVar beta = f64FVMake( DefaultAllocator, P, 1 );
+
+    Xorshift1024 rng = Xorshift1024Init( 31 );
+
+    for ( u32 i=0; i<N*P; ++i ) {
+        x.data[i] = rngXorshift1024NextFloat( &rng ) - 0.5;
+    }
+    for ( u32 j=0; j<P; ++j ) {
+        f64FVSetElement( beta, j, 0, 0.5 * j - 1.0, 1.0 / (j + 1) );
+        bp.data[j] = beta.val.data[j] + H * beta.dot.data[j];
+        bm.data[j] = beta.val.data[j] - H * beta.dot.data[j];
+    }
+
+    for ( GLMFamily fam=GLM_GAUSSIAN; fam<=GLM_POISSON; ++fam ) {
+
+        long double ref = 0, refDot = 0;
+
+        for ( u32 i=0; i<N; ++i ) {
+            f64 eta = 0, deta = 0;
+            for ( u32 j=0; j<P; ++j ) {
+                eta  += x.data[i*P + j] * beta.val.data[j];
+                deta += x.data[i*P + j] * beta.dot.data[j];
+            }
+
+            f64 u = rngXorshift1024NextFloat( &rng );
+
+            if ( fam == GLM_GAUSSIAN ) {
+                y.data[i] = eta + u - 0.5;
+                ref      -= 0.5 * (y.data[i] - eta) * (y.data[i] - eta);
+                refDot   += (y.data[i] - eta) * deta;
+            }
+            else if ( fam == GLM_LOGISTIC ) {
+                f64 mu    = 1 / (1 + exp( -eta ));
+                y.data[i] = u < mu;
+                ref      += y.data[i] * eta - log( 1 + exp( eta ) );
+                refDot   += (y.data[i] - mu) * deta;
+            }
+            else {
+                y.data[i] = floor( 3 * u );
+                ref      += y.data[i] * eta - exp( eta );
+                refDot   += (y.data[i] - exp( eta )) * deta;
+            }
+        }
+
+        f64 dot;
+        f64 val = f64FVGLMLogLik( fam, x, y, beta, &dot );
+
+        TEST_ASSERT( fabs( val - (f64) ref ) < EPS * fabs( (f64) ref ) );
+        TEST_ASSERT( fabs( dot - (f64) refDot ) < EPS * MAX( 1.0, fabs( (f64) refDot ) ) );
+        TEST_ASSERT( f64GLMLogLik( fam, x, y, beta.val ) == val );
+
+        /* central differences */
+        f64 fd = (f64GLMLogLik( fam, x, y, bp ) - f64GLMLogLik( fam, x, y, bm )) / (2 * H);
+        TEST_ASSERT( fabs( fd - dot ) < 1E-5 * MAX( 1.0, fabs( dot ) ) );
+
+        /* bitwise identical on one thread */
+        InParallelRegion = 1;
+        f64 dot1;
+        f64 val1 = f64FVGLMLogLik( fam, x, y, beta, &dot1 );
+        InParallelRegion = 0;
+
+        TEST_ASSERT( memcmp( &val, &val1, sizeof(f64) ) == 0 );
+        TEST_ASSERT( memcmp( &dot, &dot1, sizeof(f64) ) == 0 );
+    }
+
+    f64MatFree( DefaultAllocator, &x );
+    f64MatFree( DefaultAllocator, &y );
+    f64MatFree( DefaultAllocator, &bp );
+    f64MatFree( DefaultAllocator, &bm );
+    f64FVFree( DefaultAllocator, &beta );
+
+    if ( ownPool ) {
+        TerminateParallel();
+    }
+
+#undef EPS
+}
+#endif
@@ -0,0 +1,703 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Dense factorizations on top of the BLAS backend. The blocked algorithms
+// spend their time in GEMM updates of the trailing matrix, so they run at
+// the speed of whatever backend is selected. The symmetric eigensolver is
+// Householder tridiagonalisation followed by implicit QL.
+//
+
+#define LINALG_NB 64
+#define LINALG_MAX_QL 60
+
+
+/* unblocked lower Cholesky of the n x n block at a with leading dimension lda */
+b32 linalgCholeskyUnblocked( f64 *a, u32 n, u32 lda )
+{
+    for ( u32 j=0; j<n; ++j ) {
+        f64 d = a[j*lda + j];
+        for ( u32 k=0; k<j; ++k ) {
+            d -= a[j*lda + k] * a[j*lda + k];
+        }
+        if ( !(d > 0) ) {
+            return 0;
+        }
+        d = sqrt( d );
+        a[j*lda + j] = d;
+
+        for ( u32 i=j+1; i<n; ++i ) {
+            f64 s = a[i*lda + j];
+            for ( u32 k=0; k<j; ++k ) {
+                s -= a[i*lda + k] * a[j*lda + k];
+            }
+            a[i*lda + j] = s / d;
+        }
+    }
+    return 1;
+}
+
+
+/* In-place Cholesky factorization a = L L' of a symmetric positive definite
+ * matrix, only the lower triangle is read. On success L is stored in the
+ * lower triangle and the strict upper triangle is zeroed, returns 0 if a is
+ * not positive definite. */
+b32 f64MatCholesky( f64Mat a )
+{
+    ASSERT( a.dim0 == a.dim1 );
+
+    u32 n   = a.dim0;
+    u32 lda = a.dim1;
+
+    blasEnsureBackend();
+
+    for ( u32 k=0; k<n; k+=LINALG_NB ) {
+        u32 b = MIN( LINALG_NB, n - k );
+        u32 r = n - k - b;
+
+        f64 *a11 = a.data + k*lda + k;
+        f64 *a21 = a11 + b*lda;
+        f64 *a22 = a21 + b;
+
+        if ( !linalgCholeskyUnblocked( a11, b, lda ) ) {
+            return 0;
+        }
+
+        /* A21 = A21 L11^-T */
+        for ( u32 i=0; i<r; ++i ) {
+            f64 *row = a21 + i*lda;
+            for ( u32 j=0; j<b; ++j ) {
+                f64 s = row[j];
+                for ( u32 m=0; m<j; ++m ) {
+                    s -= row[m] * a11[j*lda + m];
+                }
+                row[j] = s / a11[j*lda + j];
+            }
+        }
+
+        /* A22 -= A21 A21' */
+        if ( r > 0 ) {
+            FVBlas.gemm( 0, 1, r, r, b, -1.0, a21, lda, a21, lda, 1.0, a22, lda );
+        }
+    }
+
+    for ( u32 i=0; i<n; ++i ) {
+        for ( u32 j=i+1; j<n; ++j ) {
+            a.data[i*lda + j] = 0;
+        }
+    }
+
+    return 1;
+}
+
+
+/* b = L^-1 b for lower triangular l, row by row over all columns of b */
+void f64MatLowerSolve( f64Mat l, f64Mat b )
+{
+    ASSERT( l.dim0 == l.dim1 && l.dim0 == b.dim0 );
+
+    u32 n = l.dim0;
+    u32 k = b.dim1;
+
+    for ( u32 i=0; i<n; ++i ) {
+        f64 *ri = b.data + (u64) i * k;
+        for ( u32 m=0; m<i; ++m ) {
+            f64 lim = l.data[i*n + m];
+            if ( lim != 0 ) {
+                const f64 *rm = b.data + (u64) m * k;
+                for ( u32 c=0; c<k; ++c ) {
+                    ri[c] -= lim * rm[c];
+                }
+            }
+        }
+        f64 inv = 1 / l.data[i*n + i];
+        for ( u32 c=0; c<k; ++c ) {
+            ri[c] *= inv;
+        }
+    }
+}
+
+/* b = L^-T b for lower triangular l */
+void f64MatLowerTSolve( f64Mat l, f64Mat b )
+{
+    ASSERT( l.dim0 == l.dim1 && l.dim0 == b.dim0 );
+
+    u32 n = l.dim0;
+    u32 k = b.dim1;
+
+    for ( u32 i=n; i-- > 0; ) {
+        f64 *ri = b.data + (u64) i * k;
+        for ( u32 m=i+1; m<n; ++m ) {
+            f64 lmi = l.data[m*n + i];
+            if ( lmi != 0 ) {
+                const f64 *rm = b.data + (u64) m * k;
+                for ( u32 c=0; c<k; ++c ) {
+                    ri[c] -= lmi * rm[c];
+                }
+            }
+        }
+        f64 inv = 1 / l.data[i*n + i];
+        for ( u32 c=0; c<k; ++c ) {
+            ri[c] *= inv;
+        }
+    }
+}
+
+
+/* solves L L' x = b in place for every column of b */
+void f64MatCholeskySolve( f64Mat l, f64Mat b )
+{
+    f64MatLowerSolve( l, b );
+    f64MatLowerTSolve( l, b );
+}
+
+
+/* unblocked LU with partial pivoting of the columns [k, k + b) of the
+ * n x n matrix a, whole rows are swapped */
+b32 linalgLUPanel( f64 *a, u32 n, u32 k, u32 b, u32 *piv )
+{
+    for ( u32 j=k; j<k+b; ++j ) {
+        u32 p   = j;
+        f64 max = fabs( a[j*n + j] );
+        for ( u32 i=j+1; i<n; ++i ) {
+            if ( fabs( a[i*n + j] ) > max ) {
+                max = fabs( a[i*n + j] );
+                p   = i;
+            }
+        }
+
+        piv[j] = p;
+
+        if ( max == 0 ) {
+            return 0;
+        }
+
+        if ( p != j ) {
+            for ( u32 c=0; c<n; ++c ) {
+                f64 tmp     = a[j*n + c];
+                a[j*n + c]  = a[p*n + c];
+                a[p*n + c]  = tmp;
+            }
+        }
+
+        f64 inv = 1 / a[j*n + j];
+        for ( u32 i=j+1; i<n; ++i ) {
+            f64 lij = a[i*n + j] * inv;
+            a[i*n + j] = lij;
+            for ( u32 c=j+1; c<k+b; ++c ) {
+                a[i*n + c] -= lij * a[j*n + c];
+            }
+        }
+    }
+    return 1;
+}
+
+/* In-place LU factorization P a = L U with partial pivoting, L has a unit
+ * diagonal and is stored below it. Row j was swapped with row piv[j] >= j.
+ * Returns 0 if a is singular. */
+b32 f64MatLU( f64Mat a, u32 *piv )
+{
+    ASSERT( a.dim0 == a.dim1 );
+
+    u32 n = a.dim0;
+
+    blasEnsureBackend();
+
+    for ( u32 k=0; k<n; k+=LINALG_NB ) {
+        u32 b = MIN( LINALG_NB, n - k );
+        u32 r = n - k - b;
+
+        if ( !linalgLUPanel( a.data, n, k, b, piv ) ) {
+            return 0;
+        }
+
+        if ( r == 0 ) {
+            break;
+        }
+
+        f64 *a11 = a.data + k*n + k;
+        f64 *a12 = a11 + b;
+        f64 *a21 = a11 + b*n;
+        f64 *a22 = a21 + b;
+
+        /* A12 = L11^-1 A12 */
+        for ( u32 i=1; i<b; ++i ) {
+            for ( u32 m=0; m<i; ++m ) {
+                f64 lim = a11[i*n + m];
+                for ( u32 c=0; c<r; ++c ) {
+                    a12[i*n + c] -= lim * a12[m*n + c];
+                }
+            }
+        }
+
+        /* A22 -= A21 A12 */
+        FVBlas.gemm( 0, 0, r, r, b, -1.0, a21, n, a12, n, 1.0, a22, n );
+    }
+
+    return 1;
+}
+
+/* solves A x = b in place for every column of b from the factors of f64MatLU */
+void f64MatLUSolve( f64Mat lu, const u32 *piv, f64Mat b )
+{
+    ASSERT( lu.dim0 == lu.dim1 && lu.dim0 == b.dim0 );
+
+    u32 n = lu.dim0;
+    u32 k = b.dim1;
+
+    for ( u32 j=0; j<n; ++j ) {
+        if ( piv[j] != j ) {
+            f64 *r0 = b.data + (u64) j * k;
+            f64 *r1 = b.data + (u64) piv[j] * k;
+            for ( u32 c=0; c<k; ++c ) {
+                f64 tmp = r0[c];
+                r0[c]   = r1[c];
+                r1[c]   = tmp;
+            }
+        }
+    }
+
+    for ( u32 i=0; i<n; ++i ) {
+        f64 *ri = b.data + (u64) i * k;
+        for ( u32 m=0; m<i; ++m ) {
+            f64 lim = lu.data[i*n + m];
+            const f64 *rm = b.data + (u64) m * k;
+            for ( u32 c=0; c<k; ++c ) {
+                ri[c] -= lim * rm[c];
+            }
+        }
+    }
+
+    for ( u32 i=n; i-- > 0; ) {
+        f64 *ri = b.data + (u64) i * k;
+        for ( u32 m=i+1; m<n; ++m ) {
+            f64 uim = lu.data[i*n + m];
+            const f64 *rm = b.data + (u64) m * k;
+            for ( u32 c=0; c<k; ++c ) {
+                ri[c] -= uim * rm[c];
+            }
+        }
+        f64 inv = 1 / lu.data[i*n + i];
+        for ( u32 c=0; c<k; ++c ) {
+            ri[c] *= inv;
+        }
+    }
+}
+
+
+/* Householder reduction of the symmetric matrix in v to tridiagonal form,
+ * the diagonal goes to d, the subdiagonal to e[1..n-1] and v is replaced by
+ * the accumulated orthogonal transformation (EISPACK tred2) */
+void linalgTridiag( f64 *v, f64 *d, f64 *e, u32 n )
+{
+    for ( u32 j=0; j<n; ++j ) {
+        d[j] = v[(n-1)*n + j];
+    }
+
+    for ( u32 i=n-1; i>0; --i ) {
+        f64 scale = 0;
+        f64 h     = 0;
+
+        for ( u32 k=0; k<i; ++k ) {
+            scale += fabs( d[k] );
+        }
+
+        if ( scale == 0 ) {
+            e[i] = d[i-1];
+            for ( u32 j=0; j<i; ++j ) {
+                d[j]       = v[(i-1)*n + j];
+                v[i*n + j] = 0;
+                v[j*n + i] = 0;
+            }
+        }
+        else {
+            for ( u32 k=0; k<i; ++k ) {
+                d[k] /= scale;
+                h    += d[k] * d[k];
+            }
+
+            f64 f = d[i-1];
+            f64 g = f > 0 ? -sqrt( h ) : sqrt( h );
+
+            e[i]   = scale * g;
+            h     -= f * g;
+            d[i-1] = f - g;
+
+            for ( u32 j=0; j<i; ++j ) {
+                e[j] = 0;
+            }
+
+            for ( u32 j=0; j<i; ++j ) {
+                f          = d[j];
+                v[j*n + i] = f;
+                g          = e[j] + v[j*n + j] * f;
+                for ( u32 k=j+1; k<i; ++k ) {
+                    g    += v[k*n + j] * d[k];
+                    e[k] += v[k*n + j] * f;
+                }
+                e[j] = g;
+            }
+
+            f = 0;
+            for ( u32 j=0; j<i; ++j ) {
+                e[j] /= h;
+                f    += e[j] * d[j];
+            }
+
+            f64 hh = f / (h + h);
+            for ( u32 j=0; j<i; ++j ) {
+                e[j] -= hh * d[j];
+            }
+
+            for ( u32 j=0; j<i; ++j ) {
+                f = d[j];
+                g = e[j];
+                for ( u32 k=j; k<i; ++k ) {
+                    v[k*n + j] -= f * e[k] + g * d[k];
+                }
+                d[j]       = v[(i-1)*n + j];
+                v[i*n + j] = 0;
+            }
+        }
+        d[i] = h;
+    }
+
+    for ( u32 i=0; i+1<n; ++i ) {
+        v[(n-1)*n + i] = v[i*n + i];
+        v[i*n + i]     = 1;
+
+        f64 h = d[i+1];
+        if ( h != 0 ) {
+            for ( u32 k=0; k<=i; ++k ) {
+                d[k] = v[k*n + i + 1] / h;
+            }
+            for ( u32 j=0; j<=i; ++j ) {
+                f64 g = 0;
+                for ( u32 k=0; k<=i; ++k ) {
+                    g += v[k*n + i + 1] * v[k*n + j];
+                }
+                for ( u32 k=0; k<=i; ++k ) {
+                    v[k*n + j] -= g * d[k];
+                }
+            }
+        }
+        for ( u32 k=0; k<=i; ++k ) {
+            v[k*n + i + 1] = 0;
+        }
+    }
+
+    for ( u32 j=0; j<n; ++j ) {
+        d[j]           = v[(n-1)*n + j];
+        v[(n-1)*n + j] = 0;
+    }
+    v[n*n - 1] = 1;
+    e[0]       = 0;
+}
+
+/* implicit QL iterations on the tridiagonal matrix (d, e) from
+ * linalgTridiag, rotations are applied to the columns of v (EISPACK tql2) */
+b32 linalgTridiagQL( f64 *v, f64 *d, f64 *e, u32 n )
+{
+    for ( u32 i=1; i<n; ++i ) {
+        e[i-1] = e[i];
+    }
+    e[n-1] = 0;
+
+    f64 f    = 0;
+    f64 tst1 = 0;
+    f64 eps  = 2.220446049250313E-16;
+
+    for ( u32 l=0; l<n; ++l ) {
+        tst1 = MAX( tst1, fabs( d[l] ) + fabs( e[l] ) );
+
+        u32 m = l;
+        while ( m < n - 1 && fabs( e[m] ) > eps * tst1 ) {
+            ++m;
+        }
+
+        u32 iter = 0;
+        while ( m > l && fabs( e[l] ) > eps * tst1 ) {
+            if ( ++iter > LINALG_MAX_QL ) {
+                return 0;
+            }
+
+            f64 g = d[l];
+            f64 p = (d[l+1] - g) / (2 * e[l]);
+            f64 r = hypot( p, 1.0 );
+            if ( p < 0 ) {
+                r = -r;
+            }
+
+            d[l]     = e[l] / (p + r);
+            d[l+1]   = e[l] * (p + r);
+            f64 dl1  = d[l+1];
+            f64 h    = g - d[l];
+
+            for ( u32 i=l+2; i<n; ++i ) {
+                d[i] -= h;
+            }
+            f += h;
+
+            p = d[m];
+            f64 c = 1, c2 = 1, c3 = 1;
+            f64 s = 0, s2 = 0;
+            f64 el1 = e[l+1];
+
+            for ( u32 i=m; i-- > l; ) {
+                c3 = c2;
+                c2 = c;
+                s2 = s;
+                g  = c * e[i];
+                h  = c * p;
+                r  = hypot( p, e[i] );
+
+                e[i+1] = s * r;
+                s      = e[i] / r;
+                c      = p / r;
+                p      = c * d[i] - s * g;
+                d[i+1] = h + s * (c * g + s * d[i]);
+
+                for ( u32 k=0; k<n; ++k ) {
+                    h              = v[k*n + i + 1];
+                    v[k*n + i + 1] = s * v[k*n + i] + c * h;
+                    v[k*n + i]     = c * v[k*n + i] - s * h;
+                }
+            }
+
+            p    = -s * s2 * c3 * el1 * e[l] / dl1;
+            e[l] = s * p;
+            d[l] = c * p;
+        }
+
+        d[l] += f;
+        e[l]  = 0;
+    }
+
+    return 1;
+}
+
+/* Eigendecomposition a = V diag(w) V' of the symmetric n x n matrix a. The
+ * eigenvalues in w (n x 1) are ascending, v receives the eigenvectors as
+ * columns. Returns 0 if the QL iterations did not converge. */
+b32 f64MatSymEig( Allocator al, f64Mat a, f64Mat w, f64Mat v )
+{
+    ASSERT( a.dim0 == a.dim1 && v.dim0 == a.dim0 && v.dim1 == a.dim1 );
+    ASSERT( w.dim0 * w.dim1 == a.dim0 );
+
+    u32 n = a.dim0;
+    f64 *d = w.data;
+    f64 *e = (f64 *) Alloc( al, n * sizeof(f64) );
+
+    memcpy( v.data, a.data, (u64) n * n * sizeof(f64) );
+
+    linalgTridiag( v.data, d, e, n );
+    b32 ok = linalgTridiagQL( v.data, d, e, n );
+
+    Free( al, e );
+
+    if ( !ok ) {
+        return 0;
+    }
+
+    /* selection sort, swaps are O(n) column exchanges */
+    for ( u32 i=0; i+1<n; ++i ) {
+        u32 k = i;
+        for ( u32 j=i+1; j<n; ++j ) {
+            if ( d[j] < d[k] ) {
+                k = j;
+            }
+        }
+        if ( k != i ) {
+            f64 tmp = d[i];
+            d[i]    = d[k];
+            d[k]    = tmp;
+            for ( u32 r=0; r<n; ++r ) {
+                tmp             = v.data[r*n + i];
+                v.data[r*n + i] = v.data[r*n + k];
+                v.data[r*n + k] = tmp;
+            }
+        }
+    }
+
+    return 1;
+}
+
+
+#if TEST
+void test_cholesky()
+{
+#define EPS 1E-9
+
+    u32 N = 150;
+
+    f64Mat x = f64MatMake( DefaultAllocator, N, N );
+    f64Mat a = f64MatMake( DefaultAllocator, N, N );
+    f64Mat l = f64MatMake( DefaultAllocator, N, N );
+    f64Mat r = f64MatMake( DefaultAllocator, N, N );
+    f64Mat b = f64MatMake( DefaultAllocator, N, 2 );
+    f64Mat y = f64MatMake( DefaultAllocator, N, 2 );
+
+    Xorshift1024 rng = Xorshift1024Init( 7 );
+
+    for ( u32 i=0; i<N*N; ++i ) {
+        x.data[i] = rngXorshift1024NextFloat( &rng ) - 0.5;
+    }
+    for ( u32 i=0; i<2*N; ++i ) {
+        b.data[i] = rngXorshift1024NextFloat( &rng );
+    }
+
+    /* a = x x' + N I */
+    f64MatGemm( 0, 1, 1.0, x, x, 0.0, a );
+    for ( u32 i=0; i<N; ++i ) {
+        a.data[i*N + i] += N;
+    }
+
+    memcpy( l.data, a.data, N * N * sizeof(f64) );
+    TEST_ASSERT( f64MatCholesky( l ) );
+
+    f64MatGemm( 0, 1, 1.0, l, l, 0.0, r );
+    TEST_ASSERT( f64MatEqual( r, a, EPS ) );
+
+    /* a y = b */
+    f64Mat ay = f64MatMake( DefaultAllocator, N, 2 );
+
+    memcpy( y.data, b.data, 2 * N * sizeof(f64) );
+    f64MatCholeskySolve( l, y );
+    f64MatGemm( 0, 0, 1.0, a, y, 0.0, ay );
+    TEST_ASSERT( f64MatEqual( ay, b, EPS ) );
+
+    f64MatFree( DefaultAllocator, &ay );
+
+    /* not positive definite */
+    a.data[0] = -1;
+    memcpy( l.data, a.data, N * N * sizeof(f64) );
+    TEST_ASSERT( !f64MatCholesky( l ) );
+
+    f64MatFree( DefaultAllocator, &x );
+    f64MatFree( DefaultAllocator, &a );
+    f64MatFree( DefaultAllocator, &l );
+    f64MatFree( DefaultAllocator, &r );
+    f64MatFree( DefaultAllocator, &b );
+    f64MatFree( DefaultAllocator, &y );
+
+#undef EPS
+}
+#endif
+
+
+#if TEST
+void test_lu()
+{
+#define EPS 1E-9
+
+    u32 N = 150;
+
+    f64Mat a  = f64MatMake( DefaultAllocator, N, N );
+    f64Mat lu = f64MatMake( DefaultAllocator, N, N );
+    f64Mat b  = f64MatMake( DefaultAllocator, N, 3 );
+    f64Mat x  = f64MatMake( DefaultAllocator, N, 3 );
+    f64Mat ax = f64MatMake( DefaultAllocator, N, 3 );
+
+    u32 *piv = (u32 *) Alloc( DefaultAllocator, N * sizeof(u32) );
+
+    Xorshift1024 rng = Xorshift1024Init( 5 );
+
+    for ( u32 i=0; i<N*N; ++i ) {
+        a.data[i] = rngXorshift1024NextFloat( &rng ) - 0.5;
+    }
+    for ( u32 i=0; i<3*N; ++i ) {
+        b.data[i] = rngXorshift1024NextFloat( &rng );
+    }
+
+    memcpy( lu.data, a.data, N * N * sizeof(f64) );
+    TEST_ASSERT( f64MatLU( lu, piv ) );
+
+    memcpy( x.data, b.data, 3 * N * sizeof(f64) );
+    f64MatLUSolve( lu, piv, x );
+    f64MatGemm( 0, 0, 1.0, a, x, 0.0, ax );
+    TEST_ASSERT( f64MatEqual( ax, b, EPS ) );
+
+    /* singular, a zero row stays exactly zero under elimination and leaves
+     * no pivot for the last column */
+    for ( u32 j=0; j<N; ++j ) {
+        a.data[(N/2)*N + j] = 0;
+    }
+    memcpy( lu.data, a.data, N * N * sizeof(f64) );
+    TEST_ASSERT( !f64MatLU( lu, piv ) );
+
+    /* the same for a zero column in the first panel */
+    memcpy( lu.data, a.data, N * N * sizeof(f64) );
+    for ( u32 i=0; i<N; ++i ) {
+        lu.data[i*N + 1] = 0;
+    }
+    TEST_ASSERT( !f64MatLU( lu, piv ) );
+
+    Free( DefaultAllocator, piv );
+    f64MatFree( DefaultAllocator, &a );
+    f64MatFree( DefaultAllocator, &lu );
+    f64MatFree( DefaultAllocator, &b );
+    f64MatFree( DefaultAllocator, &x );
+    f64MatFree( DefaultAllocator, &ax );
+
+#undef EPS
+}
+#endif
+
+
+#if TEST
+void test_symeig()
+{
+#define EPS 1E-10
+
+    u32 N = 90;
+
+    f64Mat a  = f64MatMake( DefaultAllocator, N, N );
+    f64Mat w  = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat v  = f64MatMake( DefaultAllocator, N, N );
+    f64Mat av = f64MatMake( DefaultAllocator, N, N );
+    f64Mat vv = f64MatMake( DefaultAllocator, N, N );
+
+    Xorshift1024 rng = Xorshift1024Init( 13 );
+
+    for ( u32 i=0; i<N; ++i ) {
+        for ( u32 j=0; j<=i; ++j ) {
+            a.data[i*N + j] = rngXorshift1024NextFloat( &rng ) - 0.5;
+            a.data[j*N + i] = a.data[i*N + j];
+        }
+    }
+
+    TEST_ASSERT( f64MatSymEig( DefaultAllocator, a, w, v ) );
+
+    for ( u32 i=0; i+1<N; ++i ) {
+        TEST_ASSERT( w.data[i] <= w.data[i+1] );
+    }
+
+    /* a V = V diag(w) and V' V = I */
+    f64MatGemm( 0, 0, 1.0, a, v, 0.0, av );
+    f64MatGemm( 1, 0, 1.0, v, v, 0.0, vv );
+
+    for ( u32 i=0; i<N; ++i ) {
+        for ( u32 j=0; j<N; ++j ) {
+            TEST_ASSERT( fabs( av.data[i*N + j] - w.data[j] * v.data[i*N + j] ) < EPS );
+            TEST_ASSERT( fabs( vv.data[i*N + j] - (i == j) ) < EPS );
+        }
+    }
+
+    /* diagonal input */
+    memset( a.data, 0, N * N * sizeof(f64) );
+    for ( u32 i=0; i<N; ++i ) {
+        a.data[i*N + i] = (f64) (N - i);
+    }
+    TEST_ASSERT( f64MatSymEig( DefaultAllocator, a, w, v ) );
+    for ( u32 i=0; i<N; ++i ) {
+        TEST_ASSERT( f64Equal( w.data[i], i + 1, EPS ) );
+    }
+
+    f64MatFree( DefaultAllocator, &a );
+    f64MatFree( DefaultAllocator, &w );
+    f64MatFree( DefaultAllocator, &v );
+    f64MatFree( DefaultAllocator, &av );
+    f64MatFree( DefaultAllocator, &vv );
+
+#undef EPS
+}
+#endif
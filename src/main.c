@@ -1,4 +1,14 @@
 #include "fw_dod_grad.h"
+#include "fw_dod_linalg.h"
+#include "fw_dod_implicit.h"
+#include "fw_dod_ode.h"
+#include "sparse.h"
+#include "glm.h"
+#include "reverse/rv_univariate.h"
+#include "reverse/rv_linear.h"
+#include "reverse/rv_hessian.h"
+#include "reverse/rv_dod.h"
+#include "optimization/optim.h"
 
 
 
@@ -0,0 +1,319 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Nonlinear conjugate gradients
+//
+//     d_k+1 = -g_k+1 + beta_k d_k
+//
+// with beta from Polak-Ribiere+ or Hager-Zhang. Only a handful of n-vectors
+// are kept, so it scales to problems where even the L-BFGS history does not
+// fit.
+//
+// If a directional function is given, the trial steps of the line search
+// cost one evaluation of f and grad f' d each (one dual pass for dod
+// objectives), the full gradient is only computed at the accepted point.
+//
+
+typedef enum CGMethod CGMethod;
+enum CGMethod {
+    CG_PR_PLUS,
+    CG_HAGER_ZHANG,
+};
+
+
+typedef struct CG CG;
+struct CG {
+    u32      n;
+    CGMethod method;
+    u32      restart;   /* iterations between steepest descent restarts */
+
+    f64Mat x, g, d, xNew, gNew, y;
+
+    /* state of the current line search */
+    OptimFun    *f;
+    OptimDirFun *dir;
+    void        *args;
+    f64          fNew;
+    b32          haveGrad;  /* gNew belongs to the last trial point */
+    u32          evaluations;
+};
+
+
+CG CGMake( Allocator al, u32 n, CGMethod method )
+{
+    ASSERT( n > 0 );
+
+    CG opt;
+    memset( &opt, 0, sizeof(opt) );
+
+    opt.n       = n;
+    opt.method  = method;
+    opt.restart = n;
+    opt.x       = f64MatZeroMake( al, n, 1 );
+    opt.g       = f64MatZeroMake( al, n, 1 );
+    opt.d       = f64MatZeroMake( al, n, 1 );
+    opt.xNew    = f64MatZeroMake( al, n, 1 );
+    opt.gNew    = f64MatZeroMake( al, n, 1 );
+    opt.y       = f64MatZeroMake( al, n, 1 );
+
+    return opt;
+}
+
+void CGFree( Allocator al, CG *opt )
+{
+    f64MatFree( al, &opt->x );
+    f64MatFree( al, &opt->g );
+    f64MatFree( al, &opt->d );
+    f64MatFree( al, &opt->xNew );
+    f64MatFree( al, &opt->gNew );
+    f64MatFree( al, &opt->y );
+}
+
+
+f64 cgLine( void *args, f64 alpha, f64 *dphi )
+{
+    CG *opt = (CG *) args;
+
+    optimCopy( opt->x, opt->xNew );
+    f64MatAxpy( alpha, opt->d, opt->xNew );
+
+    if ( opt->dir ) {
+        opt->fNew     = opt->dir( opt->args, opt->xNew, opt->d, dphi );
+        opt->haveGrad = 0;
+    }
+    else {
+        opt->fNew     = opt->f( opt->args, opt->xNew, opt->gNew );
+        opt->haveGrad = 1;
+        *dphi         = f64MatDot( opt->gNew, opt->d );
+    }
+    opt->evaluations += 1;
+
+    return opt->fNew;
+}
+
+/* beta_k, y = g_k+1 - g_k is expected in opt->y */
+f64 cgBeta( CG *opt, f64 gg )
+{
+    f64 gy = f64MatDot( opt->gNew, opt->y );
+
+    if ( opt->method == CG_PR_PLUS ) {
+        return MAX( 0.0, gy / gg );
+    }
+
+    /* Hager & Zhang (2005), with their lower bound eta_k */
+    f64 dy = f64MatDot( opt->d, opt->y );
+    f64 yy = f64MatDot( opt->y, opt->y );
+    f64 dg = f64MatDot( opt->d, opt->gNew );
+
+    f64 beta  = (gy - 2 * yy * dg / dy) / dy;
+    f64 dNorm = sqrt( f64MatDot( opt->d, opt->d ) );
+    f64 eta   = -1 / (dNorm * MIN( 0.01, sqrt( gg ) ));
+
+    return MAX( beta, eta );
+}
+
+
+/* Minimises f starting from x, x holds the minimiser on return. dir may be
+ * NULL, the line search then evaluates full gradients. */
+OptimResult CGMinimize(
+    CG *opt, OptimFun *f, OptimDirFun *dir, void *args, f64Mat x, OptimOptions opts
+)
+{
+    ASSERT( x.dim0 * x.dim1 == opt->n );
+
+    OptimResult res;
+    memset( &res, 0, sizeof(res) );
+
+    opt->f           = f;
+    opt->dir         = dir;
+    opt->args        = args;
+    opt->evaluations = 1;
+
+    optimCopy( x, opt->x );
+    f64 fx = f( args, opt->x, opt->g );
+    f64 gg = f64MatDot( opt->g, opt->g );
+
+    for ( u32 i=0; i<opt->n; ++i ) {
+        opt->d.data[i] = -opt->g.data[i];
+    }
+
+    f64 dphi0 = -gg;
+    f64 alpha = MIN( 1.0, 1 / sqrt( gg ) );
+    u32 sinceRestart = 0;
+
+    u32 iter = 0;
+    while ( iter < opts.maxIter ) {
+        if ( sqrt( gg ) <= opts.gradTol ) {
+            res.converged = 1;
+            break;
+        }
+
+        f64 step = OptimLineSearch( cgLine, opt, fx, dphi0, alpha, 0.1 );
+
+        if ( step == 0 ) {
+            if ( sinceRestart == 0 ) {
+                break;
+            }
+            /* retry along steepest descent */
+            for ( u32 i=0; i<opt->n; ++i ) {
+                opt->d.data[i] = -opt->g.data[i];
+            }
+            dphi0        = -gg;
+            alpha        = MIN( 1.0, 1 / sqrt( gg ) );
+            sinceRestart = 0;
+            continue;
+        }
+
+        if ( !opt->haveGrad ) {
+            opt->f( args, opt->xNew, opt->gNew );
+            opt->evaluations += 1;
+        }
+
+        for ( u32 i=0; i<opt->n; ++i ) {
+            opt->y.data[i] = opt->gNew.data[i] - opt->g.data[i];
+        }
+
+        f64 ggNew = f64MatDot( opt->gNew, opt->gNew );
+        f64 beta  = cgBeta( opt, gg );
+
+        ++sinceRestart;
+        if ( sinceRestart >= opt->restart ) {
+            beta         = 0;
+            sinceRestart = 0;
+        }
+
+        /* d = -gNew + beta d */
+        for ( u32 i=0; i<opt->n; ++i ) {
+            opt->d.data[i] = beta * opt->d.data[i] - opt->gNew.data[i];
+        }
+
+        f64 dphiNew = f64MatDot( opt->gNew, opt->d );
+        if ( dphiNew >= 0 ) {
+            for ( u32 i=0; i<opt->n; ++i ) {
+                opt->d.data[i] = -opt->gNew.data[i];
+            }
+            dphiNew      = -ggNew;
+            sinceRestart = 0;
+        }
+
+        /* initial step from the previous slope, Nocedal & Wright (3.60) */
+        alpha = MIN( 1.0, 1.01 * step * dphi0 / dphiNew );
+        if ( sinceRestart == 0 ) {
+            alpha = MIN( alpha, 1 / sqrt( ggNew ) );
+        }
+        dphi0 = dphiNew;
+
+        f64Mat tmp;
+        tmp = opt->x; opt->x = opt->xNew; opt->xNew = tmp;
+        tmp = opt->g; opt->g = opt->gNew; opt->gNew = tmp;
+
+        f64 fPrev = fx;
+        fx = opt->fNew;
+        gg = ggNew;
+        ++iter;
+
+        if ( fabs( fPrev - fx ) <= opts.fTol * MAX( 1.0, fabs( fx ) ) ) {
+            res.converged = 1;
+            break;
+        }
+    }
+
+    optimCopy( opt->x, x );
+
+    res.f           = fx;
+    res.gradNorm    = sqrt( gg );
+    res.iterations  = iter;
+    res.evaluations = opt->evaluations;
+
+    return res;
+}
+
+
+/* weighted sum of squares with a coupling term, tangent in one pass */
+f64FVar test_cg_quadratic( f64FVar x )
+{
+    /* sum_i (i + 1) (x_i - 1)^2 + (x_0 x_1)^2, elementwise on the dual parts */
+    static f64 r[1], rd[1];
+
+    f64 v  = 0;
+    f64 dv = 0;
+
+    for ( u32 i=0; i<x.dim0; ++i ) {
+        f64 e = x.val.data[i] - 1;
+        v  += (i + 1) * e * e;
+        dv += 2 * (i + 1) * e * x.dot.data[i];
+    }
+    f64 p  = x.val.data[0] * x.val.data[1];
+    f64 dp = x.dot.data[0] * x.val.data[1] + x.val.data[0] * x.dot.data[1];
+    v  += p * p;
+    dv += 2 * p * dp;
+
+    f64FVar out;
+    out.dim0 = 1; out.dim1 = 1;
+    out.val.dim0 = out.val.dim1 = out.dot.dim0 = out.dot.dim1 = 1;
+    out.val.data = r;
+    out.dot.data = rd;
+    r[0]  = v;
+    rd[0] = dv;
+
+    return out;
+}
+
+#if TEST
+void test_cg()
+{
+#define EPS 1E-5
+
+    u32 n = 10;
+
+    f64Mat x = f64MatMake( DefaultAllocator, n, 1 );
+
+    for ( u32 m=0; m<2; ++m ) {
+        for ( u32 i=0; i<n; ++i ) {
+            x.data[i] = i % 2 ? 1.0 : -1.2;
+        }
+
+        CG opt = CGMake( DefaultAllocator, n, m ? CG_HAGER_ZHANG : CG_PR_PLUS );
+
+        OptimOptions opts = OptimDefaultOptions();
+        opts.maxIter = 10000;
+
+        OptimResult res = CGMinimize( &opt, test_lbfgs_rosenbrock, NULL, NULL, x, opts );
+
+        TEST_ASSERT( res.converged );
+        for ( u32 i=0; i<n; ++i ) {
+            TEST_ASSERT( f64Equal( x.data[i], 1.0, EPS ) );
+        }
+
+        CGFree( DefaultAllocator, &opt );
+    }
+
+
+    /* dod objective, trial steps through single dual passes */
+    OptimFVArgs args;
+    args.al = DefaultAllocator;
+    args.f  = test_cg_quadratic;
+
+    for ( u32 i=0; i<n; ++i ) {
+        x.data[i] = 0;
+    }
+
+    CG opt = CGMake( DefaultAllocator, n, CG_HAGER_ZHANG );
+
+    OptimResult res = CGMinimize(
+        &opt, OptimFVGradient, OptimFVDirectional, &args, x, OptimDefaultOptions()
+    );
+
+    f64Mat grad = f64MatMake( DefaultAllocator, n, 1 );
+    OptimFVGradient( &args, x, grad );
+
+    TEST_ASSERT( res.converged );
+    TEST_ASSERT( sqrt( f64MatDot( grad, grad ) ) < EPS );
+
+    CGFree( DefaultAllocator, &opt );
+    f64MatFree( DefaultAllocator, &grad );
+    f64MatFree( DefaultAllocator, &x );
+
+#undef EPS
+}
+#endif
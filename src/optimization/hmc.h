@@ -0,0 +1,418 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Hamiltonian Monte Carlo. The target is given as an OptimFun returning
+// log p(q) and its gradient, e.g. OptimFVGradient for dod log densities.
+// Each chain owns its RNG stream and all of its buffers, the chains run on
+// the thread pool with one chain per chunk, so the draws do not depend on
+// the number of threads.
+//
+// The kinetic energy is K(p) = p' M^-1 p / 2 with a diagonal or dense mass
+// matrix M. During warmup the step size of each chain is tuned by dual
+// averaging (Hoffman & Gelman, 2014) towards a target acceptance rate. The
+// number of leapfrog steps is drawn uniformly from 1..numSteps for every
+// proposal, a fixed trajectory length can be close to a period of the
+// dynamics in some direction and then barely moves the chain there.
+//
+// logp must be safe to call from several threads at once.
+//
+
+typedef enum HMCMetric HMCMetric;
+enum HMCMetric {
+    HMC_DIAG,
+    HMC_DENSE,
+};
+
+
+typedef struct HMCOptions HMCOptions;
+struct HMCOptions {
+    u32 numWarmup;
+    u32 numSamples;     /* per chain */
+    u32 numSteps;       /* maximum leapfrog steps per proposal */
+    f64 stepSize;       /* initial step size */
+    f64 targetAccept;
+    u64 seed;
+};
+
+HMCOptions HMCDefaultOptions( void )
+{
+    HMCOptions o;
+    o.numWarmup    = 500;
+    o.numSamples   = 1000;
+    o.numSteps     = 16;
+    o.stepSize     = 0.1;
+    o.targetAccept = 0.65;
+    o.seed         = 8349;
+    return o;
+}
+
+
+typedef struct HMCChain HMCChain;
+struct HMCChain {
+    Xorshift1024 rng;
+
+    f64Mat q, p, grad;
+    f64Mat qNew, pNew, gradNew;
+    f64Mat v;                   /* M^-1 p */
+    f64    logp;
+
+    f64    stepSize;
+    u32    accepted;
+
+    /* dual averaging state */
+    f64    mu;
+    f64    hBar;
+    f64    logStepBar;
+};
+
+
+typedef struct HMC HMC;
+struct HMC {
+    u32       n;
+    u32       numChains;
+    HMCMetric metric;
+
+    f64Mat    massInv;      /* n x 1 (diagonal) or n x n */
+    f64Mat    massChol;     /* sqrt of the diagonal or lower Cholesky factor of M */
+
+    HMCChain *chains;
+};
+
+
+/* mass holds the diagonal (n x 1) or the full matrix (n x n) of M, with
+ * mass.data == NULL M is the identity */
+HMC HMCMake( Allocator al, u32 n, u32 numChains, HMCMetric metric, f64Mat mass )
+{
+    ASSERT( n > 0 && numChains > 0 );
+
+    HMC h;
+    h.n         = n;
+    h.numChains = numChains;
+    h.metric    = metric;
+
+    if ( metric == HMC_DIAG ) {
+        h.massInv  = f64MatMake( al, n, 1 );
+        h.massChol = f64MatMake( al, n, 1 );
+
+        for ( u32 i=0; i<n; ++i ) {
+            f64 m = mass.data ? mass.data[i] : 1.0;
+            ASSERT( m > 0 );
+            h.massInv.data[i]  = 1 / m;
+            h.massChol.data[i] = sqrt( m );
+        }
+    }
+    else {
+        h.massInv  = f64MatZeroMake( al, n, n );
+        h.massChol = f64MatZeroMake( al, n, n );
+
+        for ( u32 i=0; i<n; ++i ) {
+            for ( u32 j=0; j<n; ++j ) {
+                h.massChol.data[i*n + j] = mass.data ? mass.data[i*n + j] : (f64) (i == j);
+            }
+        }
+
+        b32 spd = f64MatCholesky( h.massChol );
+        ASSERT( spd );
+
+        for ( u32 i=0; i<n; ++i ) {
+            h.massInv.data[i*n + i] = 1;
+        }
+        f64MatCholeskySolve( h.massChol, h.massInv );
+    }
+
+    h.chains = (HMCChain *) Alloc( al, numChains * sizeof(HMCChain) );
+
+    for ( u32 c=0; c<numChains; ++c ) {
+        HMCChain *ch = &h.chains[c];
+        memset( ch, 0, sizeof(HMCChain) );
+
+        ch->q       = f64MatMake( al, n, 1 );
+        ch->p       = f64MatMake( al, n, 1 );
+        ch->grad    = f64MatMake( al, n, 1 );
+        ch->qNew    = f64MatMake( al, n, 1 );
+        ch->pNew    = f64MatMake( al, n, 1 );
+        ch->gradNew = f64MatMake( al, n, 1 );
+        ch->v       = f64MatMake( al, n, 1 );
+    }
+
+    return h;
+}
+
+void HMCFree( Allocator al, HMC *h )
+{
+    for ( u32 c=0; c<h->numChains; ++c ) {
+        HMCChain *ch = &h->chains[c];
+
+        f64MatFree( al, &ch->q );
+        f64MatFree( al, &ch->p );
+        f64MatFree( al, &ch->grad );
+        f64MatFree( al, &ch->qNew );
+        f64MatFree( al, &ch->pNew );
+        f64MatFree( al, &ch->gradNew );
+        f64MatFree( al, &ch->v );
+    }
+    Free( al, h->chains );
+
+    f64MatFree( al, &h->massInv );
+    f64MatFree( al, &h->massChol );
+}
+
+
+/* standard normal draw, Box-Muller */
+Inline
+f64 hmcNormal( Xorshift1024 *rng )
+{
+    f64 u1 = 1 - rngXorshift1024NextFloat( rng );
+    f64 u2 = rngXorshift1024NextFloat( rng );
+    return sqrt( -2 * log( u1 ) ) * cos( 2 * M_PI * u2 );
+}
+
+/* v = M^-1 p */
+Inline
+void hmcVelocity( HMC *h, f64Mat p, f64Mat v )
+{
+    if ( h->metric == HMC_DIAG ) {
+        for ( u32 i=0; i<h->n; ++i ) {
+            v.data[i] = h->massInv.data[i] * p.data[i];
+        }
+    }
+    else {
+        f64MatGemv( 0, 1.0, h->massInv, p, 0.0, v );
+    }
+}
+
+/* p ~ N(0, M) */
+void hmcMomentum( HMC *h, HMCChain *ch )
+{
+    u32 n = h->n;
+
+    if ( h->metric == HMC_DIAG ) {
+        for ( u32 i=0; i<n; ++i ) {
+            ch->p.data[i] = h->massChol.data[i] * hmcNormal( &ch->rng );
+        }
+    }
+    else {
+        for ( u32 i=0; i<n; ++i ) {
+            ch->v.data[i] = hmcNormal( &ch->rng );
+        }
+        f64MatGemv( 0, 1.0, h->massChol, ch->v, 0.0, ch->p );
+    }
+}
+
+
+/* one proposal, returns its acceptance probability */
+f64 hmcTransition( HMC *h, HMCChain *ch, OptimFun *logp, void *args, u32 maxSteps )
+{
+    f64 eps      = ch->stepSize;
+    u32 numSteps = 1 + (u32) (rngXorshift1024Next( &ch->rng ) % maxSteps);
+
+    hmcMomentum( h, ch );
+    hmcVelocity( h, ch->p, ch->v );
+
+    f64 H0 = -ch->logp + 0.5 * f64MatDot( ch->p, ch->v );
+
+    optimCopy( ch->q, ch->qNew );
+    optimCopy( ch->p, ch->pNew );
+    optimCopy( ch->grad, ch->gradNew );
+
+    f64 lpNew = ch->logp;
+
+    f64MatAxpy( 0.5 * eps, ch->gradNew, ch->pNew );
+
+    for ( u32 l=0; l<numSteps; ++l ) {
+        hmcVelocity( h, ch->pNew, ch->v );
+        f64MatAxpy( eps, ch->v, ch->qNew );
+
+        lpNew = logp( args, ch->qNew, ch->gradNew );
+
+        f64MatAxpy( l + 1 < numSteps ? eps : 0.5 * eps, ch->gradNew, ch->pNew );
+    }
+
+    hmcVelocity( h, ch->pNew, ch->v );
+    f64 H1 = -lpNew + 0.5 * f64MatDot( ch->pNew, ch->v );
+
+    f64 accept = isfinite( H1 ) ? MIN( 1.0, exp( H0 - H1 ) ) : 0.0;
+
+    if ( rngXorshift1024NextFloat( &ch->rng ) < accept ) {
+        f64Mat tmp;
+        tmp = ch->q;    ch->q    = ch->qNew;    ch->qNew    = tmp;
+        tmp = ch->grad; ch->grad = ch->gradNew; ch->gradNew = tmp;
+        ch->logp = lpNew;
+        ch->accepted += 1;
+    }
+
+    return accept;
+}
+
+
+typedef struct hmcArgs hmcArgs;
+struct hmcArgs {
+    HMC        *h;
+    OptimFun   *logp;
+    void       *args;
+    f64Mat      init;
+    f64Mat      samples;
+    HMCOptions  opts;
+};
+
+void hmcRunChains( void *args, u32 start, u32 end )
+{
+    hmcArgs   *a    = (hmcArgs *) args;
+    HMC       *h    = a->h;
+    HMCOptions opts = a->opts;
+    u32        n    = h->n;
+
+    for ( u32 c=start; c<end; ++c ) {
+        HMCChain *ch = &h->chains[c];
+
+        ch->rng        = Xorshift1024Init( opts.seed + 0x9E3779B97F4A7C15ull * (c + 1) );
+        ch->stepSize   = opts.stepSize;
+        ch->accepted   = 0;
+        ch->mu         = log( 10 * opts.stepSize );
+        ch->hBar       = 0;
+        ch->logStepBar = 0;
+
+        for ( u32 i=0; i<n; ++i ) {
+            ch->q.data[i] = a->init.data[(a->init.dim0 == h->numChains ? c : 0) * n + i];
+        }
+        ch->logp = a->logp( a->args, ch->q, ch->grad );
+
+        /* warmup with dual averaging, gamma = 0.05, t0 = 10, kappa = 0.75 */
+        for ( u32 t=1; t<=opts.numWarmup; ++t ) {
+            f64 accept = hmcTransition( h, ch, a->logp, a->args, opts.numSteps );
+
+            f64 w = 1.0 / (t + 10);
+            ch->hBar = (1 - w) * ch->hBar + w * (opts.targetAccept - accept);
+
+            f64 logStep = ch->mu - sqrt( (f64) t ) / 0.05 * ch->hBar;
+            f64 eta     = pow( (f64) t, -0.75 );
+
+            ch->logStepBar = eta * logStep + (1 - eta) * ch->logStepBar;
+            ch->stepSize   = exp( logStep );
+        }
+        if ( opts.numWarmup > 0 ) {
+            ch->stepSize = exp( ch->logStepBar );
+        }
+
+        ch->accepted = 0;
+
+        for ( u32 s=0; s<opts.numSamples; ++s ) {
+            hmcTransition( h, ch, a->logp, a->args, opts.numSteps );
+
+            f64 *row = a->samples.data + ((u64) c * opts.numSamples + s) * n;
+            memcpy( row, ch->q.data, n * sizeof(f64) );
+        }
+    }
+}
+
+
+/* Draws opts.numSamples states per chain into samples, a
+ * (numChains * numSamples) x n matrix with the rows of chain c starting at
+ * c * numSamples. init holds one starting point per chain (numChains x n)
+ * or a single one (1 x n). Returns the mean acceptance rate after warmup. */
+f64 HMCSample( HMC *h, OptimFun *logp, void *args, f64Mat init, f64Mat samples, HMCOptions opts )
+{
+    ASSERT( init.dim1 == h->n && (init.dim0 == h->numChains || init.dim0 == 1) );
+    ASSERT( samples.dim0 == h->numChains * opts.numSamples && samples.dim1 == h->n );
+    ASSERT( opts.numSteps > 0 && opts.stepSize > 0 );
+
+    hmcArgs a;
+    a.h       = h;
+    a.logp    = logp;
+    a.args    = args;
+    a.init    = init;
+    a.samples = samples;
+    a.opts    = opts;
+
+    ParallelFor( h->numChains, 1, hmcRunChains, &a );
+
+    f64 rate = 0;
+    for ( u32 c=0; c<h->numChains; ++c ) {
+        rate += h->chains[c].accepted;
+    }
+    return opts.numSamples ? rate / ((f64) h->numChains * opts.numSamples) : 0;
+}
+
+
+/* log density of a diagonal Gaussian and its gradient */
+f64 test_hmc_logp( void *args, f64Mat x, f64Mat grad )
+{
+    /* N((1, -2), diag(1, 4)) */
+    f64 e0 = x.data[0] - 1;
+    f64 e1 = x.data[1] + 2;
+
+    grad.data[0] = -e0;
+    grad.data[1] = -e1 / 4;
+
+    return -0.5 * (e0 * e0 + e1 * e1 / 4);
+}
+
+#if TEST
+void test_hmc()
+{
+    u32 numChains = 4;
+
+    b32 ownPool = FVThreadPool.numThreads == 0;
+    if ( ownPool ) {
+        InitializeParallel( 4 );
+    }
+
+    HMCOptions opts = HMCDefaultOptions();
+    opts.numSamples = 2000;
+
+    f64Mat init    = f64MatZeroMake( DefaultAllocator, 1, 2 );
+    f64Mat samples = f64MatMake( DefaultAllocator, numChains * opts.numSamples, 2 );
+    f64Mat first   = f64MatMake( DefaultAllocator, numChains * opts.numSamples, 2 );
+
+    /* M = Sigma^-1 as dense metric */
+    f64Mat mass = f64MatZeroMake( DefaultAllocator, 2, 2 );
+    mass.data[0] = 1;
+    mass.data[3] = 0.25;
+
+    for ( u32 m=0; m<2; ++m ) {
+        f64Mat noMass;
+        memset( &noMass, 0, sizeof(noMass) );
+
+        HMC h = m ? HMCMake( DefaultAllocator, 2, numChains, HMC_DENSE, mass )
+                  : HMCMake( DefaultAllocator, 2, numChains, HMC_DIAG, noMass );
+
+        f64 rate = HMCSample( &h, test_hmc_logp, NULL, init, samples, opts );
+
+        TEST_ASSERT( rate > 0.4 );
+
+        f64 mean[2] = {0, 0};
+        f64 var[2]  = {0, 0};
+        u32 N = samples.dim0;
+
+        for ( u32 s=0; s<N; ++s ) {
+            mean[0] += samples.data[2*s]     / N;
+            mean[1] += samples.data[2*s + 1] / N;
+        }
+        for ( u32 s=0; s<N; ++s ) {
+            var[0] += (samples.data[2*s]     - mean[0]) * (samples.data[2*s]     - mean[0]) / N;
+            var[1] += (samples.data[2*s + 1] - mean[1]) * (samples.data[2*s + 1] - mean[1]) / N;
+        }
+
+        TEST_ASSERT( fabs( mean[0] - 1 ) < 0.15 && fabs( mean[1] + 2 ) < 0.3 );
+        TEST_ASSERT( fabs( var[0] - 1 ) < 0.25 && fabs( var[1] - 4 ) < 1.0 );
+
+        /* the draws do not depend on the scheduling of the chains */
+        if ( m == 0 ) {
+            optimCopy( samples, first );
+            HMCSample( &h, test_hmc_logp, NULL, init, samples, opts );
+            TEST_ASSERT( memcmp( samples.data, first.data, N * 2 * sizeof(f64) ) == 0 );
+        }
+
+        HMCFree( DefaultAllocator, &h );
+    }
+
+    f64MatFree( DefaultAllocator, &mass );
+    f64MatFree( DefaultAllocator, &first );
+    f64MatFree( DefaultAllocator, &samples );
+    f64MatFree( DefaultAllocator, &init );
+
+    if ( ownPool ) {
+        TerminateParallel();
+    }
+}
+#endif
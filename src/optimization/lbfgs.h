@@ -0,0 +1,339 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Limited-memory BFGS. The inverse Hessian is never formed, it is applied
+// to the gradient by the two-loop recursion over the last m correction pairs
+//
+//     s_k = x_k+1 - x_k,    y_k = g_k+1 - g_k,
+//
+// which are kept as rows of two m x n ring buffers, so the memory is O(mn)
+// instead of the O(n^2) of dense BFGS.
+//
+
+typedef struct LBFGS LBFGS;
+struct LBFGS {
+    u32    n;
+    u32    m;
+    u32    head;    /* row the next pair is written to */
+    u32    count;   /* number of stored pairs, <= m */
+
+    f64Mat s;       /* m x n */
+    f64Mat y;       /* m x n */
+    f64Mat rho;     /* m x 1, 1 / (s_k' y_k) */
+    f64Mat alpha;   /* m x 1, two-loop coefficients */
+
+    f64Mat x, g, d, xNew, gNew;
+
+    /* state of the current line search */
+    OptimFun *f;
+    void     *args;
+    f64       fNew;
+    u32       evaluations;
+};
+
+
+LBFGS LBFGSMake( Allocator al, u32 n, u32 m )
+{
+    ASSERT( n > 0 && m > 0 );
+
+    LBFGS opt;
+    memset( &opt, 0, sizeof(opt) );
+
+    opt.n     = n;
+    opt.m     = m;
+    opt.s     = f64MatZeroMake( al, m, n );
+    opt.y     = f64MatZeroMake( al, m, n );
+    opt.rho   = f64MatZeroMake( al, m, 1 );
+    opt.alpha = f64MatZeroMake( al, m, 1 );
+    opt.x     = f64MatZeroMake( al, n, 1 );
+    opt.g     = f64MatZeroMake( al, n, 1 );
+    opt.d     = f64MatZeroMake( al, n, 1 );
+    opt.xNew  = f64MatZeroMake( al, n, 1 );
+    opt.gNew  = f64MatZeroMake( al, n, 1 );
+
+    return opt;
+}
+
+void LBFGSFree( Allocator al, LBFGS *opt )
+{
+    f64MatFree( al, &opt->s );
+    f64MatFree( al, &opt->y );
+    f64MatFree( al, &opt->rho );
+    f64MatFree( al, &opt->alpha );
+    f64MatFree( al, &opt->x );
+    f64MatFree( al, &opt->g );
+    f64MatFree( al, &opt->d );
+    f64MatFree( al, &opt->xNew );
+    f64MatFree( al, &opt->gNew );
+}
+
+
+/* d = -H g */
+void lbfgsDirection( LBFGS *opt )
+{
+    u32 m = opt->m;
+    f64Mat d = opt->d;
+
+    for ( u32 i=0; i<opt->n; ++i ) {
+        d.data[i] = -opt->g.data[i];
+    }
+
+    if ( opt->count == 0 ) {
+        return;
+    }
+
+    for ( u32 k=0; k<opt->count; ++k ) {
+        u32 j = (opt->head + m - 1 - k) % m;
+        f64 a = opt->rho.data[j] * f64MatDot( optimRow( opt->s, j ), d );
+        opt->alpha.data[j] = a;
+        f64MatAxpy( -a, optimRow( opt->y, j ), d );
+    }
+
+    /* initial Hessian gamma * I from the newest pair */
+    u32    last  = (opt->head + m - 1) % m;
+    f64Mat yLast = optimRow( opt->y, last );
+    f64    gamma = 1 / (opt->rho.data[last] * f64MatDot( yLast, yLast ));
+
+    for ( u32 i=0; i<opt->n; ++i ) {
+        d.data[i] *= gamma;
+    }
+
+    for ( u32 k=opt->count; k-- > 0; ) {
+        u32 j = (opt->head + m - 1 - k) % m;
+        f64 b = opt->rho.data[j] * f64MatDot( optimRow( opt->y, j ), d );
+        f64MatAxpy( opt->alpha.data[j] - b, optimRow( opt->s, j ), d );
+    }
+}
+
+/* stores the pair of the step from x to xNew */
+Inline
+b32 lbfgsUpdate( LBFGS *opt )
+{
+    return optimPushPair(
+        opt->s, opt->y, opt->rho, &opt->head, &opt->count,
+        opt->x, opt->xNew, opt->g, opt->gNew
+    );
+}
+
+/* evaluates f and its gradient at xNew = x + alpha * d */
+f64 lbfgsLine( void *args, f64 alpha, f64 *dphi )
+{
+    LBFGS *opt = (LBFGS *) args;
+
+    optimCopy( opt->x, opt->xNew );
+    f64MatAxpy( alpha, opt->d, opt->xNew );
+
+    opt->fNew = opt->f( opt->args, opt->xNew, opt->gNew );
+    opt->evaluations += 1;
+
+    *dphi = f64MatDot( opt->gNew, opt->d );
+    return opt->fNew;
+}
+
+
+/* Minimises f starting from x, x holds the minimiser on return. */
+OptimResult LBFGSMinimize( LBFGS *opt, OptimFun *f, void *args, f64Mat x, OptimOptions opts )
+{
+    ASSERT( x.dim0 * x.dim1 == opt->n );
+
+    OptimResult res;
+    memset( &res, 0, sizeof(res) );
+
+    opt->f           = f;
+    opt->args        = args;
+    opt->head        = 0;
+    opt->count       = 0;
+    opt->evaluations = 1;
+
+    optimCopy( x, opt->x );
+    f64 fx    = f( args, opt->x, opt->g );
+    f64 gNorm = sqrt( f64MatDot( opt->g, opt->g ) );
+
+    u32 iter = 0;
+    while ( iter < opts.maxIter ) {
+        if ( gNorm <= opts.gradTol ) {
+            res.converged = 1;
+            break;
+        }
+
+        lbfgsDirection( opt );
+
+        f64 dphi0 = f64MatDot( opt->g, opt->d );
+
+        if ( dphi0 >= 0 ) {
+            /* H lost positive definiteness numerically, restart */
+            opt->count = 0;
+            lbfgsDirection( opt );
+            dphi0 = -gNorm * gNorm;
+        }
+
+        f64 alpha0 = opt->count > 0 ? 1.0 : MIN( 1.0, 1 / gNorm );
+        f64 alpha  = OptimLineSearch( lbfgsLine, opt, fx, dphi0, alpha0, 0.9 );
+
+        if ( alpha == 0 ) {
+            if ( opt->count == 0 ) {
+                break;
+            }
+            opt->count = 0;
+            continue;
+        }
+
+        /* xNew and gNew hold the accepted point */
+        lbfgsUpdate( opt );
+
+        f64Mat tmp;
+        tmp = opt->x; opt->x = opt->xNew; opt->xNew = tmp;
+        tmp = opt->g; opt->g = opt->gNew; opt->gNew = tmp;
+
+        f64 fPrev = fx;
+        fx    = opt->fNew;
+        gNorm = sqrt( f64MatDot( opt->g, opt->g ) );
+        ++iter;
+
+        if ( fabs( fPrev - fx ) <= opts.fTol * MAX( 1.0, fabs( fx ) ) ) {
+            res.converged = 1;
+            break;
+        }
+    }
+
+    optimCopy( opt->x, x );
+
+    res.f           = fx;
+    res.gradNorm    = gNorm;
+    res.iterations  = iter;
+    res.evaluations = opt->evaluations;
+
+    return res;
+}
+
+
+/* chained Rosenbrock, sum_i 100 (x_i+1 - x_i^2)^2 + (1 - x_i)^2, and its gradient */
+f64 test_lbfgs_rosenbrock( void *args, f64Mat x, f64Mat grad )
+{
+    u32 n = x.dim0;
+    f64 f = 0;
+
+    for ( u32 i=0; i<n; ++i ) {
+        grad.data[i] = 0;
+    }
+    for ( u32 i=0; i+1<n; ++i ) {
+        f64 a = x.data[i+1] - x.data[i] * x.data[i];
+        f64 b = 1 - x.data[i];
+        f += 100 * a * a + b * b;
+        grad.data[i]   += -400 * a * x.data[i] - 2 * b;
+        grad.data[i+1] += 200 * a;
+    }
+    return f;
+}
+
+/* shifted sum of squares for the f64FVGradient adapter */
+f64FVar test_lbfgs_quadratic( f64FVar x )
+{
+    /* (x - c)' (x - c), c = (1 2 3 4)', through a 1 x 1 product with the
+     * transposed view, the result lives in static storage since the
+     * gradient driver does not free it */
+    static f64 r[1], rd[1];
+
+    f64FVar y = f64FVMake( DefaultAllocator, 4, 1 );
+    for ( u32 i=0; i<4; ++i ) {
+        y.val.data[i] = x.val.data[i] - (i + 1);
+        y.dot.data[i] = x.dot.data[i];
+    }
+
+    f64FVar yt = y;
+    yt.dim0 = yt.val.dim0 = yt.dot.dim0 = 1;
+    yt.dim1 = yt.val.dim1 = yt.dot.dim1 = 4;
+
+    f64FVar out;
+    out.dim0 = 1; out.dim1 = 1;
+    out.val.dim0 = out.val.dim1 = out.dot.dim0 = out.dot.dim1 = 1;
+    out.val.data = r;
+    out.dot.data = rd;
+
+    f64FVMatMul( yt, y, out );
+    f64FVFree( DefaultAllocator, &y );
+    return out;
+}
+
+#if TEST
+void test_lbfgs()
+{
+#define EPS 1E-6
+
+    u32 n = 10;
+
+    f64Mat x = f64MatMake( DefaultAllocator, n, 1 );
+    for ( u32 i=0; i<n; ++i ) {
+        x.data[i] = i % 2 ? 1.0 : -1.2;
+    }
+
+    LBFGS opt = LBFGSMake( DefaultAllocator, n, 5 );
+
+    OptimResult res = LBFGSMinimize( &opt, test_lbfgs_rosenbrock, NULL, x, OptimDefaultOptions() );
+
+    TEST_ASSERT( res.converged );
+    TEST_ASSERT( res.f < EPS );
+    for ( u32 i=0; i<n; ++i ) {
+        TEST_ASSERT( f64Equal( x.data[i], 1.0, EPS ) );
+    }
+
+    LBFGSFree( DefaultAllocator, &opt );
+    f64MatFree( DefaultAllocator, &x );
+
+
+    /* dod objective through f64FVGradient */
+    x   = f64MatZeroMake( DefaultAllocator, 4, 1 );
+    opt = LBFGSMake( DefaultAllocator, 4, 3 );
+
+    OptimFVArgs args;
+    args.al = DefaultAllocator;
+    args.f  = test_lbfgs_quadratic;
+
+    res = LBFGSMinimize( &opt, OptimFVGradient, &args, x, OptimDefaultOptions() );
+
+    TEST_ASSERT( res.converged );
+    for ( u32 i=0; i<4; ++i ) {
+        TEST_ASSERT( f64Equal( x.data[i], i + 1, EPS ) );
+    }
+
+    LBFGSFree( DefaultAllocator, &opt );
+    f64MatFree( DefaultAllocator, &x );
+
+
+    /* m = 1, a rejected pair must not overwrite the one in use */
+    opt = LBFGSMake( DefaultAllocator, 2, 1 );
+
+    f64 x0[2] = { 0, 0 },  g0[2] = { -1, -2 };
+    f64 x1[2] = { 1, 0.5 }, g1[2] = { 1, -1 };
+
+    memcpy( opt.x.data, x0, sizeof(x0) );
+    memcpy( opt.g.data, g0, sizeof(g0) );
+    memcpy( opt.xNew.data, x1, sizeof(x1) );
+    memcpy( opt.gNew.data, g1, sizeof(g1) );
+
+    /* s = (1 0.5), y = (2 1) */
+    TEST_ASSERT( lbfgsUpdate( &opt ) );
+    TEST_ASSERT( opt.count == 1 && opt.head == 0 );
+
+    f64 d[2];
+    lbfgsDirection( &opt );
+    memcpy( d, opt.d.data, sizeof(d) );
+
+    /* s = (1 0), y = (-1 0), negative curvature */
+    opt.xNew.data[0] = 1;    opt.xNew.data[1] = 0;
+    opt.gNew.data[0] = -2;   opt.gNew.data[1] = -2;
+
+    TEST_ASSERT( !lbfgsUpdate( &opt ) );
+    TEST_ASSERT( opt.count == 1 && opt.head == 0 );
+    TEST_ASSERT( opt.s.data[0] == 1 && opt.s.data[1] == 0.5 );
+    TEST_ASSERT( opt.y.data[0] == 2 && opt.y.data[1] == 1 );
+    TEST_ASSERT( opt.rho.data[0] == 1 / 2.5 );
+
+    lbfgsDirection( &opt );
+    TEST_ASSERT( opt.d.data[0] == d[0] && opt.d.data[1] == d[1] );
+
+    LBFGSFree( DefaultAllocator, &opt );
+
+#undef EPS
+}
+#endif
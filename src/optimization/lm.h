@@ -0,0 +1,501 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Levenberg-Marquardt for nonlinear least squares
+//
+//     min f(x) = |r(x)|^2 / 2,    r : R^n -> R^m.
+//
+// The residual is a dod function that writes r(x) and its tangent J x.dot
+// into a caller owned m x 1 FVar, so the Jacobian is assembled from n
+// forward passes with unit seeds. The columns are split into at most
+// LM_MAX_TASKS contiguous chunks that run on the thread pool, each with its
+// own seed and result buffers, the residual must therefore be safe to call
+// from several threads at once. J is kept transposed (n x m) so each pass
+// writes one contiguous row, J'J comes from f64MatSyrk and the damped system
+//
+//     (J'J + lambda D) dx = -J'r,    D = diag(J'J), running maximum (More, 1978),
+//
+// is solved by Cholesky. lambda follows Nielsen's update (Madsen et al.,
+// 2004). With geodesic set, the step gets the second order correction of
+// Transtrum & Sethna (2012), the directional second derivative of r along
+// the first order step is taken by a finite difference and the corrected
+// step is only used when it stays small relative to the first order one.
+//
+// All workspaces are allocated in LMMake.
+//
+
+#define LM_MAX_TASKS 16
+
+/* attempts to factor J'J + lambda D before giving up, lambda grows by a
+ * factor nu = 2, 4, 8, ... each time */
+#define LM_MAX_FACTOR_TRIES 16
+
+
+/* writes r(x) to r.val and J(x) x.dot to r.dot, r is m x 1 */
+typedef void LMResidualFun( void *args, f64FVar x, f64FVar r );
+
+
+typedef struct LM LM;
+struct LM {
+    u32      m;
+    u32      n;
+    f64      lambda0;       /* initial damping, relative to D */
+    b32      geodesic;
+    f64      geodesicH;     /* finite difference step along the velocity */
+    f64      geodesicAlpha; /* accept if 2 |acc| <= geodesicAlpha |vel| */
+
+    f64Mat   x, xNew;       /* n x 1 */
+    f64Mat   r, rNew, rvv;  /* m x 1 */
+    f64Mat   jt;            /* n x m, transposed Jacobian */
+    f64Mat   jtj, l;        /* n x n */
+    f64Mat   g, diag, vel, acc;
+
+    u32      numTasks;
+    f64FVar *xs;            /* per task seed, n x 1 */
+    f64FVar *rs;            /* per task result, m x 1 */
+
+    /* state of the current Jacobian evaluation */
+    LMResidualFun *f;
+    void          *args;
+};
+
+
+LM LMMake( Allocator al, u32 m, u32 n )
+{
+    ASSERT( m > 0 && n > 0 );
+
+    LM opt;
+    memset( &opt, 0, sizeof(opt) );
+
+    opt.m             = m;
+    opt.n             = n;
+    opt.lambda0       = 1E-3;
+    opt.geodesic      = 0;
+    opt.geodesicH     = 0.1;
+    opt.geodesicAlpha = 0.75;
+
+    opt.x    = f64MatZeroMake( al, n, 1 );
+    opt.xNew = f64MatZeroMake( al, n, 1 );
+    opt.r    = f64MatZeroMake( al, m, 1 );
+    opt.rNew = f64MatZeroMake( al, m, 1 );
+    opt.rvv  = f64MatZeroMake( al, m, 1 );
+    opt.jt   = f64MatZeroMake( al, n, m );
+    opt.jtj  = f64MatZeroMake( al, n, n );
+    opt.l    = f64MatZeroMake( al, n, n );
+    opt.g    = f64MatZeroMake( al, n, 1 );
+    opt.diag = f64MatZeroMake( al, n, 1 );
+    opt.vel  = f64MatZeroMake( al, n, 1 );
+    opt.acc  = f64MatZeroMake( al, n, 1 );
+
+    opt.numTasks = MIN( n, LM_MAX_TASKS );
+    opt.xs       = (f64FVar *) Alloc( al, opt.numTasks * sizeof(f64FVar) );
+    opt.rs       = (f64FVar *) Alloc( al, opt.numTasks * sizeof(f64FVar) );
+
+    for ( u32 t=0; t<opt.numTasks; ++t ) {
+        opt.xs[t] = f64FVMake( al, n, 1 );
+        opt.rs[t] = f64FVMake( al, m, 1 );
+    }
+
+    return opt;
+}
+
+void LMFree( Allocator al, LM *opt )
+{
+    f64MatFree( al, &opt->x );
+    f64MatFree( al, &opt->xNew );
+    f64MatFree( al, &opt->r );
+    f64MatFree( al, &opt->rNew );
+    f64MatFree( al, &opt->rvv );
+    f64MatFree( al, &opt->jt );
+    f64MatFree( al, &opt->jtj );
+    f64MatFree( al, &opt->l );
+    f64MatFree( al, &opt->g );
+    f64MatFree( al, &opt->diag );
+    f64MatFree( al, &opt->vel );
+    f64MatFree( al, &opt->acc );
+
+    for ( u32 t=0; t<opt->numTasks; ++t ) {
+        f64FVFree( al, &opt->xs[t] );
+        f64FVFree( al, &opt->rs[t] );
+    }
+    Free( al, opt->xs );
+    Free( al, opt->rs );
+}
+
+
+/* rows [start, end) of jt for the columns of the tasks start..end */
+void lmJacobianTasks( void *args, u32 start, u32 end )
+{
+    LM *opt = (LM *) args;
+
+    u32 n = opt->n;
+    u32 m = opt->m;
+
+    for ( u32 t=start; t<end; ++t ) {
+        f64FVar xs = opt->xs[t];
+        f64FVar rs = opt->rs[t];
+
+        u32 first = (u32) ((u64) n * t / opt->numTasks);
+        u32 last  = (u32) ((u64) n * (t + 1) / opt->numTasks);
+
+        memcpy( xs.val.data, opt->x.data, n * sizeof(f64) );
+        memset( xs.dot.data, 0, n * sizeof(f64) );
+
+        for ( u32 j=first; j<last; ++j ) {
+            xs.dot.data[j] = 1.0;
+            opt->f( opt->args, xs, rs );
+            xs.dot.data[j] = 0.0;
+
+            memcpy( opt->jt.data + (u64) j * m, rs.dot.data, m * sizeof(f64) );
+        }
+
+        if ( t == 0 ) {
+            memcpy( opt->r.data, rs.val.data, m * sizeof(f64) );
+        }
+    }
+}
+
+/* r = r(x) and jt = J(x)' at opt->x, returns |r|^2 / 2 */
+f64 LMJacobian( LM *opt, LMResidualFun *f, void *args )
+{
+    opt->f    = f;
+    opt->args = args;
+
+    ParallelFor( opt->numTasks, 1, lmJacobianTasks, opt );
+
+    return 0.5 * f64MatDot( opt->r, opt->r );
+}
+
+/* rNew = r(xNew) from a pass with a zero seed, returns |rNew|^2 / 2 */
+f64 lmResidual( LM *opt, f64Mat x, f64Mat r )
+{
+    f64FVar xs = opt->xs[0];
+    f64FVar rs = opt->rs[0];
+
+    memcpy( xs.val.data, x.data, opt->n * sizeof(f64) );
+    memset( xs.dot.data, 0, opt->n * sizeof(f64) );
+
+    opt->f( opt->args, xs, rs );
+
+    memcpy( r.data, rs.val.data, opt->m * sizeof(f64) );
+
+    return 0.5 * f64MatDot( r, r );
+}
+
+/* l = chol(J'J + lambda D), returns 0 if that fails */
+b32 lmFactor( LM *opt, f64 lambda )
+{
+    u32 n = opt->n;
+
+    optimCopy( opt->jtj, opt->l );
+    for ( u32 i=0; i<n; ++i ) {
+        opt->l.data[i*n + i] += lambda * opt->diag.data[i];
+    }
+
+    return f64MatCholesky( opt->l );
+}
+
+/* second order correction acc = -(J'J + lambda D)^-1 J' r_vv, returns 0 if
+ * it is rejected */
+b32 lmGeodesic( LM *opt )
+{
+    u32 m = opt->m;
+    f64 h = opt->geodesicH;
+
+    optimCopy( opt->x, opt->xNew );
+    f64MatAxpy( h, opt->vel, opt->xNew );
+    lmResidual( opt, opt->xNew, opt->rvv );
+
+    /* r_vv = 2/h ((r(x + h v) - r(x)) / h - J v) */
+    f64MatGemv( 1, 1.0, opt->jt, opt->vel, 0.0, opt->rNew );
+    for ( u32 i=0; i<m; ++i ) {
+        opt->rvv.data[i] = 2 / h * ((opt->rvv.data[i] - opt->r.data[i]) / h - opt->rNew.data[i]);
+    }
+
+    f64MatGemv( 0, -1.0, opt->jt, opt->rvv, 0.0, opt->acc );
+    f64MatCholeskySolve( opt->l, opt->acc );
+
+    f64 vv = f64MatDot( opt->vel, opt->vel );
+    f64 aa = f64MatDot( opt->acc, opt->acc );
+
+    return 4 * aa <= opt->geodesicAlpha * opt->geodesicAlpha * vv;
+}
+
+
+/* Minimises |r(x)|^2 / 2 starting from x, x holds the minimiser on return. */
+OptimResult LMMinimize( LM *opt, LMResidualFun *f, void *args, f64Mat x, OptimOptions opts )
+{
+    ASSERT( x.dim0 * x.dim1 == opt->n );
+
+    OptimResult res;
+    memset( &res, 0, sizeof(res) );
+
+    u32 n = opt->n;
+
+    optimCopy( x, opt->x );
+    memset( opt->diag.data, 0, n * sizeof(f64) );
+
+    f64 fx = LMJacobian( opt, f, args );
+    res.evaluations = 1;
+
+    f64 lambda = opt->lambda0;
+    f64 nu     = 2;
+    f64 gNorm  = 0;
+
+    u32 iter = 0;
+    for ( ;; ) {
+        /* g = J'r, J'J from the current Jacobian */
+        f64MatGemv( 0, 1.0, opt->jt, opt->r, 0.0, opt->g );
+        f64MatSyrk( 0, 1.0, opt->jt, 0.0, opt->jtj );
+        f64MatSymmetrize( opt->jtj );
+
+        f64 maxDiag = 0;
+        for ( u32 i=0; i<n; ++i ) {
+            opt->diag.data[i] = MAX( opt->diag.data[i], opt->jtj.data[i*n + i] );
+            maxDiag = MAX( maxDiag, opt->diag.data[i] );
+        }
+        for ( u32 i=0; i<n; ++i ) {
+            /* columns that vanished so far still get some damping */
+            opt->diag.data[i] = MAX( opt->diag.data[i], 1E-12 * MAX( maxDiag, 1.0 ) );
+        }
+
+        gNorm = sqrt( f64MatDot( opt->g, opt->g ) );
+
+        if ( gNorm <= opts.gradTol ) {
+            res.converged = 1;
+            break;
+        }
+        if ( iter >= opts.maxIter ) {
+            break;
+        }
+
+        /* inner loop until a step decreases f */
+        b32 accepted = 0;
+        f64 fNew     = fx;
+
+        while ( ! accepted && iter < opts.maxIter ) {
+            ++iter;
+
+            b32 factored = lmFactor( opt, lambda );
+            for ( u32 t=1; ! factored && t<LM_MAX_FACTOR_TRIES; ++t ) {
+                lambda  *= nu;
+                nu      *= 2;
+                factored = lmFactor( opt, lambda );
+            }
+
+            /* J'J is not finite, no damping helps */
+            if ( ! factored ) {
+                break;
+            }
+
+            for ( u32 i=0; i<n; ++i ) {
+                opt->vel.data[i] = -opt->g.data[i];
+            }
+            f64MatCholeskySolve( opt->l, opt->vel );
+
+            b32 useAcc = opt->geodesic && lmGeodesic( opt );
+            if ( opt->geodesic ) {
+                res.evaluations += 1;
+            }
+
+            optimCopy( opt->x, opt->xNew );
+            f64MatAxpy( 1.0, opt->vel, opt->xNew );
+            if ( useAcc ) {
+                f64MatAxpy( 0.5, opt->acc, opt->xNew );
+            }
+
+            fNew = lmResidual( opt, opt->xNew, opt->rNew );
+            res.evaluations += 1;
+
+            /* predicted reduction of the Gauss-Newton model for the step
+             * s = xNew - x, -g's - s'J'Js / 2 */
+            f64 pred = 0;
+            f64 step = 0;
+            for ( u32 i=0; i<n; ++i ) {
+                f64 s = opt->xNew.data[i] - opt->x.data[i];
+                opt->acc.data[i] = s;
+                pred -= opt->g.data[i] * s;
+                step += s * s;
+            }
+            f64MatGemv( 0, 1.0, opt->jtj, opt->acc, 0.0, opt->vel );
+            pred -= 0.5 * f64MatDot( opt->acc, opt->vel );
+
+            f64 rho = pred > 0 && isfinite( fNew ) ? (fx - fNew) / pred : -1;
+
+            if ( rho > 0 ) {
+                f64 c   = 2 * rho - 1;
+                lambda *= MAX( 1.0 / 3, 1 - c * c * c );
+                nu      = 2;
+                accepted = 1;
+            }
+            else {
+                lambda *= nu;
+                nu     *= 2;
+
+                if ( step <= 1E-30 * MAX( 1.0, f64MatDot( opt->x, opt->x ) ) ) {
+                    break;
+                }
+            }
+        }
+
+        if ( ! accepted ) {
+            break;
+        }
+
+        f64Mat tmp;
+        tmp = opt->x; opt->x = opt->xNew; opt->xNew = tmp;
+
+        f64 fPrev = fx;
+        fx = LMJacobian( opt, f, args );
+        res.evaluations += 1;
+
+        if ( fabs( fPrev - fx ) <= opts.fTol * MAX( 1.0, fabs( fx ) ) ) {
+            f64MatGemv( 0, 1.0, opt->jt, opt->r, 0.0, opt->g );
+            gNorm = sqrt( f64MatDot( opt->g, opt->g ) );
+            res.converged = gNorm <= sqrt( opts.gradTol ) || fx <= opts.fTol;
+            break;
+        }
+    }
+
+    optimCopy( opt->x, x );
+
+    res.f          = fx;
+    res.gradNorm   = gNorm;
+    res.iterations = iter;
+
+    return res;
+}
+
+
+/* samples of the exponential model fitted below */
+typedef struct test_lm_data test_lm_data;
+struct test_lm_data {
+    u32 m;
+    f64 t[64];
+    f64 y[64];
+};
+
+/* residuals of a exp(-b t) + c against the samples in args */
+void test_lm_expfit( void *args, f64FVar x, f64FVar r )
+{
+    /* r_i = a exp(-b t_i) + c - y_i */
+    test_lm_data *d = (test_lm_data *) args;
+
+    f64 a = x.val.data[0], da = x.dot.data[0];
+    f64 b = x.val.data[1], db = x.dot.data[1];
+    f64 c = x.val.data[2], dc = x.dot.data[2];
+
+    for ( u32 i=0; i<d->m; ++i ) {
+        f64 e = exp( -b * d->t[i] );
+        f64FVSetElement( r, i, 0, a * e + c - d->y[i], da * e - a * d->t[i] * e * db + dc );
+    }
+}
+
+/* Rosenbrock written as two residuals */
+void test_lm_rosenbrock( void *args, f64FVar x, f64FVar r )
+{
+    /* r = (10 (x1 - x0^2), 1 - x0) */
+    f64 x0 = x.val.data[0], d0 = x.dot.data[0];
+    f64 x1 = x.val.data[1], d1 = x.dot.data[1];
+
+    f64FVSetElement( r, 0, 0, 10 * (x1 - x0 * x0), 10 * (d1 - 2 * x0 * d0) );
+    f64FVSetElement( r, 1, 0, 1 - x0, -d0 );
+}
+
+/* r = (sqrt(x0), x1), not defined for the negative x0 it starts from */
+void test_lm_nan( void *args, f64FVar x, f64FVar r )
+{
+    f64 x0 = x.val.data[0], d0 = x.dot.data[0];
+    f64 x1 = x.val.data[1], d1 = x.dot.data[1];
+
+    f64FVSetElement( r, 0, 0, sqrt( x0 ), 0.5 * d0 / sqrt( x0 ) );
+    f64FVSetElement( r, 1, 0, x1, d1 );
+}
+
+#if TEST
+void test_lm()
+{
+    b32 ownPool = FVThreadPool.numThreads == 0;
+    if ( ownPool ) {
+        InitializeParallel( 4 );
+    }
+
+    OptimOptions opts = OptimDefaultOptions();
+    opts.gradTol      = 1E-10;
+
+    test_lm_data d;
+    d.m = 40;
+    for ( u32 i=0; i<d.m; ++i ) {
+        d.t[i] = 0.1 * i;
+        d.y[i] = 2.5 * exp( -1.3 * d.t[i] ) + 0.5;
+    }
+
+    for ( u32 geo=0; geo<2; ++geo ) {
+
+        /* exponential fit with a zero residual solution */
+        LM opt = LMMake( DefaultAllocator, d.m, 3 );
+        opt.geodesic = geo;
+
+        f64Mat x = f64MatZeroMake( DefaultAllocator, 3, 1 );
+        x.data[0] = 1.0;
+        x.data[1] = 0.1;
+
+        OptimResult res = LMMinimize( &opt, test_lm_expfit, &d, x, opts );
+
+        TEST_ASSERT( res.converged );
+        TEST_ASSERT( fabs( x.data[0] - 2.5 ) < 1E-7 );
+        TEST_ASSERT( fabs( x.data[1] - 1.3 ) < 1E-7 );
+        TEST_ASSERT( fabs( x.data[2] - 0.5 ) < 1E-7 );
+        TEST_ASSERT( res.f < 1E-16 );
+
+        /* forward-mode Jacobian against the analytic one */
+        f64 fx = LMJacobian( &opt, test_lm_expfit, &d );
+        TEST_ASSERT( fx == res.f );
+        for ( u32 i=0; i<d.m; ++i ) {
+            f64 e = exp( -x.data[1] * d.t[i] );
+            TEST_ASSERT( opt.jt.data[i] == e );
+            TEST_ASSERT( fabs( opt.jt.data[d.m + i] + x.data[0] * d.t[i] * e ) < 1E-14 );
+            TEST_ASSERT( opt.jt.data[2*d.m + i] == 1.0 );
+        }
+
+        LMFree( DefaultAllocator, &opt );
+        f64MatFree( DefaultAllocator, &x );
+
+        /* Rosenbrock as a least squares problem */
+        opt = LMMake( DefaultAllocator, 2, 2 );
+        opt.geodesic = geo;
+
+        x = f64MatMake( DefaultAllocator, 2, 1 );
+        x.data[0] = -1.2;
+        x.data[1] = 1.0;
+
+        res = LMMinimize( &opt, test_lm_rosenbrock, NULL, x, opts );
+
+        TEST_ASSERT( res.converged );
+        TEST_ASSERT( fabs( x.data[0] - 1 ) < 1E-8 && fabs( x.data[1] - 1 ) < 1E-8 );
+        TEST_ASSERT( res.iterations < 100 );
+
+        LMFree( DefaultAllocator, &opt );
+        f64MatFree( DefaultAllocator, &x );
+    }
+
+    /* a NaN Jacobian never factors, LMMinimize has to give up */
+    LM opt = LMMake( DefaultAllocator, 2, 2 );
+
+    f64Mat x = f64MatMake( DefaultAllocator, 2, 1 );
+    x.data[0] = -1.0;
+    x.data[1] = 1.0;
+
+    OptimResult res = LMMinimize( &opt, test_lm_nan, NULL, x, opts );
+
+    TEST_ASSERT( ! res.converged );
+    TEST_ASSERT( res.iterations == 1 );
+
+    LMFree( DefaultAllocator, &opt );
+    f64MatFree( DefaultAllocator, &x );
+
+    if ( ownPool ) {
+        TerminateParallel();
+    }
+}
+#endif
@@ -0,0 +1,451 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Truncated Newton (line search Newton-CG, Nocedal & Wright, Alg. 7.1). The
+// Newton system H d = -g is solved approximately by preconditioned CG that
+// only touches H through Hessian-vector products, e.g. OptimRVHessVec, whose
+// forward-over-reverse product costs a few evaluations of f for any n. H is
+// never formed, the solver itself needs O(n) memory. CG stops at the
+// relative residual min(0.5, sqrt|g|), which gives superlinear convergence,
+// or when it meets a direction of nonpositive curvature.
+//
+// The preconditioner approximates H^-1 from the last m steps s_k and
+// gradient changes y_k of the outer iteration, either by the L-BFGS
+// two-loop recursion or by the diagonal D_i = sum y_ki s_ki / sum s_ki^2
+// that best fits the secant equations. All workspaces are allocated in
+// NewtonCGMake.
+//
+
+typedef enum NCGPrecond NCGPrecond;
+enum NCGPrecond {
+    NCG_NONE,
+    NCG_DIAG,
+    NCG_LBFGS,
+};
+
+
+typedef struct NewtonCG NewtonCG;
+struct NewtonCG {
+    u32        n;
+    u32        m;
+    NCGPrecond precond;
+    u32        maxCG;       /* inner iterations per Newton step */
+    u32        head;
+    u32        count;
+
+    f64Mat     s, y;        /* m x n correction pairs */
+    f64Mat     rho;         /* m x 1, 1 / (s_k' y_k) */
+    f64Mat     alpha;       /* m x 1 */
+    f64Mat     diag;        /* n x 1, inverse of D */
+
+    f64Mat     x, g, d, xNew, gNew;
+    f64Mat     r, z, p, hp; /* CG residual, preconditioned residual, direction, H p */
+
+    /* state of the current line search */
+    OptimFun  *f;
+    void      *args;
+    f64        fNew;
+    u32        evaluations;
+    u32        hessVecs;
+};
+
+
+NewtonCG NewtonCGMake( Allocator al, u32 n, u32 m, NCGPrecond precond )
+{
+    ASSERT( n > 0 && m > 0 );
+
+    NewtonCG opt;
+    memset( &opt, 0, sizeof(opt) );
+
+    opt.n       = n;
+    opt.m       = m;
+    opt.precond = precond;
+    opt.maxCG   = MAX( n, 10 );
+    opt.s       = f64MatZeroMake( al, m, n );
+    opt.y       = f64MatZeroMake( al, m, n );
+    opt.rho     = f64MatZeroMake( al, m, 1 );
+    opt.alpha   = f64MatZeroMake( al, m, 1 );
+    opt.diag    = f64MatZeroMake( al, n, 1 );
+    opt.x       = f64MatZeroMake( al, n, 1 );
+    opt.g       = f64MatZeroMake( al, n, 1 );
+    opt.d       = f64MatZeroMake( al, n, 1 );
+    opt.xNew    = f64MatZeroMake( al, n, 1 );
+    opt.gNew    = f64MatZeroMake( al, n, 1 );
+    opt.r       = f64MatZeroMake( al, n, 1 );
+    opt.z       = f64MatZeroMake( al, n, 1 );
+    opt.p       = f64MatZeroMake( al, n, 1 );
+    opt.hp      = f64MatZeroMake( al, n, 1 );
+
+    return opt;
+}
+
+void NewtonCGFree( Allocator al, NewtonCG *opt )
+{
+    f64MatFree( al, &opt->s );
+    f64MatFree( al, &opt->y );
+    f64MatFree( al, &opt->rho );
+    f64MatFree( al, &opt->alpha );
+    f64MatFree( al, &opt->diag );
+    f64MatFree( al, &opt->x );
+    f64MatFree( al, &opt->g );
+    f64MatFree( al, &opt->d );
+    f64MatFree( al, &opt->xNew );
+    f64MatFree( al, &opt->gNew );
+    f64MatFree( al, &opt->r );
+    f64MatFree( al, &opt->z );
+    f64MatFree( al, &opt->p );
+    f64MatFree( al, &opt->hp );
+}
+
+
+/* stores the pair of the last step and refreshes the diagonal */
+void ncgUpdate( NewtonCG *opt )
+{
+    u32 n = opt->n;
+    u32 m = opt->m;
+
+    b32 stored = optimPushPair(
+        opt->s, opt->y, opt->rho, &opt->head, &opt->count,
+        opt->x, opt->xNew, opt->g, opt->gNew
+    );
+
+    if ( !stored || opt->precond != NCG_DIAG ) {
+        return;
+    }
+
+    /* newest pair's scaling for entries without curvature information */
+    u32    last  = (opt->head + m - 1) % m;
+    f64Mat sLast = optimRow( opt->s, last );
+    f64    gamma = 1 / (opt->rho.data[last] * f64MatDot( sLast, sLast ));
+
+    for ( u32 i=0; i<n; ++i ) {
+        f64 num = 0, den = 0;
+        for ( u32 k=0; k<opt->count; ++k ) {
+            u32 j = (opt->head + m - 1 - k) % m;
+            num += opt->y.data[j*n + i] * opt->s.data[j*n + i];
+            den += opt->s.data[j*n + i] * opt->s.data[j*n + i];
+        }
+        f64 dI = den > 0 && num > 0 ? num / den : gamma;
+        opt->diag.data[i] = 1 / MIN( MAX( dI, 1E-4 * gamma ), 1E4 * gamma );
+    }
+}
+
+/* z = M^-1 r */
+void ncgPrecondition( NewtonCG *opt )
+{
+    u32 n = opt->n;
+    u32 m = opt->m;
+    f64Mat z = opt->z;
+
+    optimCopy( opt->r, z );
+
+    if ( opt->count == 0 || opt->precond == NCG_NONE ) {
+        return;
+    }
+
+    if ( opt->precond == NCG_DIAG ) {
+        for ( u32 i=0; i<n; ++i ) {
+            z.data[i] *= opt->diag.data[i];
+        }
+        return;
+    }
+
+    for ( u32 k=0; k<opt->count; ++k ) {
+        u32 j = (opt->head + m - 1 - k) % m;
+        f64 a = opt->rho.data[j] * f64MatDot( optimRow( opt->s, j ), z );
+        opt->alpha.data[j] = a;
+        f64MatAxpy( -a, optimRow( opt->y, j ), z );
+    }
+
+    u32    last  = (opt->head + m - 1) % m;
+    f64Mat yLast = optimRow( opt->y, last );
+    f64    gamma = 1 / (opt->rho.data[last] * f64MatDot( yLast, yLast ));
+
+    for ( u32 i=0; i<n; ++i ) {
+        z.data[i] *= gamma;
+    }
+
+    for ( u32 k=opt->count; k-- > 0; ) {
+        u32 j = (opt->head + m - 1 - k) % m;
+        f64 b = opt->rho.data[j] * f64MatDot( optimRow( opt->y, j ), z );
+        f64MatAxpy( opt->alpha.data[j] - b, optimRow( opt->s, j ), z );
+    }
+}
+
+/* d ~ -H^-1 g by preconditioned CG, returns the number of inner iterations */
+u32 ncgDirection( NewtonCG *opt, OptimHessVecFun *hv, void *args, f64 gNorm )
+{
+    u32 n = opt->n;
+
+    f64 tol = MIN( 0.5, sqrt( gNorm ) ) * gNorm;
+
+    memset( opt->d.data, 0, n * sizeof(f64) );
+    for ( u32 i=0; i<n; ++i ) {
+        opt->r.data[i] = -opt->g.data[i];
+    }
+    ncgPrecondition( opt );
+    optimCopy( opt->z, opt->p );
+
+    f64 rz = f64MatDot( opt->r, opt->z );
+
+    u32 j = 0;
+    while ( j < opt->maxCG ) {
+        hv( args, opt->x, opt->p, opt->hp );
+        opt->hessVecs += 1;
+
+        f64 pHp = f64MatDot( opt->p, opt->hp );
+
+        if ( pHp <= 1E-14 * f64MatDot( opt->p, opt->p ) ) {
+            /* negative curvature, the preconditioned steepest descent
+             * direction if nothing better is known yet */
+            if ( j == 0 ) {
+                optimCopy( opt->p, opt->d );
+            }
+            break;
+        }
+
+        f64 a = rz / pHp;
+        f64MatAxpy( a, opt->p, opt->d );
+        f64MatAxpy( -a, opt->hp, opt->r );
+        ++j;
+
+        if ( sqrt( f64MatDot( opt->r, opt->r ) ) <= tol ) {
+            break;
+        }
+
+        ncgPrecondition( opt );
+
+        f64 rzNew = f64MatDot( opt->r, opt->z );
+        f64 beta  = rzNew / rz;
+        rz        = rzNew;
+
+        for ( u32 i=0; i<n; ++i ) {
+            opt->p.data[i] = opt->z.data[i] + beta * opt->p.data[i];
+        }
+    }
+
+    return j;
+}
+
+/* evaluates f and its gradient at xNew = x + alpha * d */
+f64 ncgLine( void *args, f64 alpha, f64 *dphi )
+{
+    NewtonCG *opt = (NewtonCG *) args;
+
+    optimCopy( opt->x, opt->xNew );
+    f64MatAxpy( alpha, opt->d, opt->xNew );
+
+    opt->fNew = opt->f( opt->args, opt->xNew, opt->gNew );
+    opt->evaluations += 1;
+
+    *dphi = f64MatDot( opt->gNew, opt->d );
+    return opt->fNew;
+}
+
+
+/* Minimises f starting from x, x holds the minimiser on return. f and hv
+ * share args. */
+OptimResult NewtonCGMinimize(
+    NewtonCG *opt, OptimFun *f, OptimHessVecFun *hv, void *args, f64Mat x, OptimOptions opts
+)
+{
+    ASSERT( x.dim0 * x.dim1 == opt->n );
+
+    OptimResult res;
+    memset( &res, 0, sizeof(res) );
+
+    opt->f           = f;
+    opt->args        = args;
+    opt->head        = 0;
+    opt->count       = 0;
+    opt->evaluations = 1;
+    opt->hessVecs    = 0;
+
+    optimCopy( x, opt->x );
+    f64 fx    = f( args, opt->x, opt->g );
+    f64 gNorm = sqrt( f64MatDot( opt->g, opt->g ) );
+
+    u32 iter = 0;
+    while ( iter < opts.maxIter ) {
+        if ( gNorm <= opts.gradTol ) {
+            res.converged = 1;
+            break;
+        }
+
+        ncgDirection( opt, hv, args, gNorm );
+
+        f64 dphi0 = f64MatDot( opt->g, opt->d );
+
+        if ( dphi0 >= 0 ) {
+            for ( u32 i=0; i<opt->n; ++i ) {
+                opt->d.data[i] = -opt->g.data[i];
+            }
+            dphi0 = -gNorm * gNorm;
+        }
+
+        f64 alpha = OptimLineSearch( ncgLine, opt, fx, dphi0, 1.0, 0.9 );
+
+        if ( alpha == 0 ) {
+            break;
+        }
+
+        ncgUpdate( opt );
+
+        f64Mat tmp;
+        tmp = opt->x; opt->x = opt->xNew; opt->xNew = tmp;
+        tmp = opt->g; opt->g = opt->gNew; opt->gNew = tmp;
+
+        f64 fPrev = fx;
+        fx    = opt->fNew;
+        gNorm = sqrt( f64MatDot( opt->g, opt->g ) );
+        ++iter;
+
+        if ( fabs( fPrev - fx ) <= opts.fTol * MAX( 1.0, fabs( fx ) ) ) {
+            res.converged = gNorm <= sqrt( opts.gradTol );
+            break;
+        }
+    }
+
+    optimCopy( opt->x, x );
+
+    res.f           = fx;
+    res.gradNorm    = gNorm;
+    res.iterations  = iter;
+    res.evaluations = opt->evaluations;
+
+    return res;
+}
+
+
+/* chained Rosenbrock, sum_i 100 (x_i+1 - x_i^2)^2 + (1 - x_i)^2 */
+f64 test_ncg_rosenbrock( void *args, f64Mat x, f64Mat grad )
+{
+    u32 n = x.dim0;
+    f64 f = 0;
+
+    memset( grad.data, 0, n * sizeof(f64) );
+
+    for ( u32 i=0; i+1<n; ++i ) {
+        f64 a = x.data[i+1] - x.data[i] * x.data[i];
+        f64 b = 1 - x.data[i];
+        f += 100 * a * a + b * b;
+        grad.data[i]   += -400 * a * x.data[i] - 2 * b;
+        grad.data[i+1] += 200 * a;
+    }
+
+    return f;
+}
+
+/* its tridiagonal Hessian times v */
+void test_ncg_rosenbrock_hv( void *args, f64Mat x, f64Mat v, f64Mat hv )
+{
+    u32 n = x.dim0;
+
+    memset( hv.data, 0, n * sizeof(f64) );
+
+    for ( u32 i=0; i+1<n; ++i ) {
+        f64 xi  = x.data[i];
+        f64 hii = 1200 * xi * xi - 400 * x.data[i+1] + 2;
+        f64 hij = -400 * xi;
+
+        hv.data[i]   += hii * v.data[i] + hij * v.data[i+1];
+        hv.data[i+1] += hij * v.data[i] + 200 * v.data[i+1];
+    }
+}
+
+#if TEST
+void test_newton_cg()
+{
+    u32 N = 100;
+
+    f64Mat x = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat g = f64MatMake( DefaultAllocator, N, 1 );
+
+    OptimOptions opts = OptimDefaultOptions();
+    u32 hessVecs = 0;
+
+    for ( NCGPrecond pc=NCG_NONE; pc<=NCG_LBFGS; ++pc ) {
+        NewtonCG opt = NewtonCGMake( DefaultAllocator, N, 5, pc );
+
+        for ( u32 i=0; i<N; ++i ) {
+            x.data[i] = i % 2 ? 1.0 : -1.2;
+        }
+
+        OptimResult res = NewtonCGMinimize(
+            &opt, test_ncg_rosenbrock, test_ncg_rosenbrock_hv, NULL, x, opts
+        );
+
+        TEST_ASSERT( res.converged );
+        TEST_ASSERT( res.iterations < 500 );
+
+        /* the L-BFGS preconditioner saves inner iterations */
+        if ( pc == NCG_NONE ) {
+            hessVecs = opt.hessVecs;
+        }
+        else if ( pc == NCG_LBFGS ) {
+            TEST_ASSERT( opt.hessVecs < hessVecs / 2 );
+        }
+
+        for ( u32 i=0; i<N; ++i ) {
+            TEST_ASSERT( fabs( x.data[i] - 1 ) < 1E-6 );
+        }
+
+        test_ncg_rosenbrock( NULL, x, g );
+        TEST_ASSERT( sqrt( f64MatDot( g, g ) ) <= 1E-6 );
+
+        NewtonCGFree( DefaultAllocator, &opt );
+    }
+
+    /* gradient and products from the reverse tape */
+    RVTape tape = RVTapeMake( DefaultAllocator );
+    OptimRVArgs args = { .al = DefaultAllocator, .tape = &tape, .f = test_trust_rv_rosenbrock };
+
+    NewtonCG opt = NewtonCGMake( DefaultAllocator, N, 5, NCG_LBFGS );
+
+    for ( u32 i=0; i<N; ++i ) {
+        x.data[i] = i % 2 ? 1.0 : -1.2;
+    }
+
+    OptimResult res = NewtonCGMinimize( &opt, OptimRVGradient, OptimRVHessVec, &args, x, opts );
+
+    TEST_ASSERT( res.converged );
+    TEST_ASSERT( opt.hessVecs < hessVecs / 2 );
+    for ( u32 i=0; i<N; ++i ) {
+        TEST_ASSERT( fabs( x.data[i] - 1 ) < 1E-6 );
+    }
+
+    /* products at one point share a recording, a new point replaces it */
+    f64Mat v   = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat hv  = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat ref = f64MatMake( DefaultAllocator, N, 1 );
+
+    for ( u32 k=0; k<4; ++k ) {
+        if ( k == 2 ) {
+            for ( u32 i=0; i<N; ++i ) {
+                x.data[i] += 0.01 * i;
+            }
+        }
+        for ( u32 i=0; i<N; ++i ) {
+            v.data[i] = sin( i + k );
+        }
+
+        OptimRVHessVec( &args, x, v, hv );
+        test_ncg_rosenbrock_hv( NULL, x, v, ref );
+
+        for ( u32 i=0; i<N; ++i ) {
+            TEST_ASSERT( fabs( hv.data[i] - ref.data[i] ) < 1E-8 * MAX( 1.0, fabs( ref.data[i] ) ) );
+        }
+    }
+
+    f64MatFree( DefaultAllocator, &v );
+    f64MatFree( DefaultAllocator, &hv );
+    f64MatFree( DefaultAllocator, &ref );
+
+    NewtonCGFree( DefaultAllocator, &opt );
+    OptimRVArgsFree( &args );
+    RVTapeFree( &tape );
+
+    f64MatFree( DefaultAllocator, &x );
+    f64MatFree( DefaultAllocator, &g );
+}
+#endif
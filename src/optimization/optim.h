@@ -1,10 +1,372 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Unconstrained minimisation of f : R^n -> R. The solvers take the objective
+// as an OptimFun that returns f(x) and writes its gradient, either hand
+// written or through OptimFVGradient, which wraps f64FVGradient. Solvers
+// that only need slopes along a search direction additionally take an
+// OptimDirFun, for dod objectives OptimFVDirectional gets both from a single
+// dual pass. Second order solvers take Hessians or Hessian-vector products,
+// OptimRVHessian and OptimRVHessVec get them by forward-over-reverse from
+// objectives written with the scalar reverse mode type f64RVar.
+//
+// Solvers allocate their workspaces once in their Make function, minimising
+// itself does not allocate.
+//
+
+typedef f64 OptimFun( void *args, f64Mat x, f64Mat grad );
+
+/* returns f(x) and writes the directional derivative grad f(x)' d */
+typedef f64 OptimDirFun( void *args, f64Mat x, f64Mat d, f64 *deriv );
+
+/* returns f(x) and writes its gradient and n x n Hessian. grad and hess
+ * have NULL data when only f(x) is needed. */
+typedef f64 OptimHessFun( void *args, f64Mat x, f64Mat grad, f64Mat hess );
+
+/* writes the Hessian-vector product H(x) v */
+typedef void OptimHessVecFun( void *args, f64Mat x, f64Mat v, f64Mat hv );
+
+
+typedef struct OptimOptions OptimOptions;
+struct OptimOptions {
+    u32 maxIter;
+    f64 gradTol;    /* stop when |grad f| <= gradTol */
+    f64 fTol;       /* stop when |f_k - f_k+1| <= fTol * max(1, |f_k+1|) */
+};
+
+OptimOptions OptimDefaultOptions( void )
+{
+    OptimOptions o;
+    o.maxIter = 1000;
+    o.gradTol = 1E-8;
+    o.fTol    = 1E-14;
+    return o;
+}
+
+
+typedef struct OptimResult OptimResult;
+struct OptimResult {
+    f64 f;
+    f64 gradNorm;
+    u32 iterations;
+    u32 evaluations;
+    b32 converged;
+};
+
+
+/* column view of row i of a, used for the solvers' histories */
+Inline
+f64Mat optimRow( f64Mat a, u32 i )
+{
+    f64Mat r;
+    r.dim0 = a.dim1;
+    r.dim1 = 1;
+    r.data = a.data + (u64) i * a.dim1;
+    return r;
+}
+
+Inline
+void optimCopy( f64Mat src, f64Mat dst )
+{
+    ASSERT( src.dim0 * src.dim1 == dst.dim0 * dst.dim1 );
+    memcpy( dst.data, src.data, src.dim0 * src.dim1 * sizeof(f64) );
+}
+
+/* Appends the pair s = xNew - x, y = gNew - g of the last step to the m x n
+ * ring buffers s and y, rho receives 1 / s'y. A pair without enough positive
+ * curvature is rejected before anything is written, so once the buffers are
+ * full the oldest pair in use is never overwritten by a pair that has no
+ * rho. Returns whether the pair was stored. */
+b32 optimPushPair(
+    f64Mat s, f64Mat y, f64Mat rho, u32 *head, u32 *count,
+    f64Mat x, f64Mat xNew, f64Mat g, f64Mat gNew
+)
+{
+    u32 n = s.dim1;
+    u32 m = s.dim0;
+
+    f64 sy = 0, ss = 0, yy = 0;
+    for ( u32 i=0; i<n; ++i ) {
+        f64 si = xNew.data[i] - x.data[i];
+        f64 yi = gNew.data[i] - g.data[i];
+        sy += si * yi;
+        ss += si * si;
+        yy += yi * yi;
+    }
+
+    /* also rejects NaN */
+    if ( !(sy > 1E-12 * sqrt( ss * yy )) ) {
+        return 0;
+    }
+
+    f64 *rs = s.data + (u64) *head * n;
+    f64 *ry = y.data + (u64) *head * n;
+    for ( u32 i=0; i<n; ++i ) {
+        rs[i] = xNew.data[i] - x.data[i];
+        ry[i] = gNew.data[i] - g.data[i];
+    }
+
+    rho.data[*head] = 1 / sy;
+    *head  = (*head + 1) % m;
+    *count = MIN( *count + 1, m );
+
+    return 1;
+}
+
+
+/* Adapter for objectives written with the dod types, the gradient is
+ * computed by f64FVGradient with args->al. */
+typedef struct OptimFVArgs OptimFVArgs;
+struct OptimFVArgs {
+    Allocator al;
+    f64FVar (*f)( f64FVar );
+};
+
+f64 OptimFVGradient( void *args, f64Mat x, f64Mat grad )
+{
+    OptimFVArgs *a = (OptimFVArgs *) args;
+    return f64FVGradient( a->al, a->f, x, grad );
+}
+
+f64 OptimFVDirectional( void *args, f64Mat x, f64Mat d, f64 *deriv )
+{
+    OptimFVArgs *a = (OptimFVArgs *) args;
+    return f64FVDirectional( a->al, a->f, x, d, deriv );
+}
+
+
+/* Adapter for objectives written with f64RVar, recorded on args->tape. The
+ * gradient costs one reverse sweep, the dense Hessian n / RV_HESS_BATCH
+ * batched forward-over-reverse sweeps of one recording. OptimRVHessVec
+ * records f and sweeps it once per point, every further product at the
+ * same x only costs one forward-over-reverse sweep. The recording lives on
+ * args->tape until another adapter call or a different x replaces it, its
+ * workspaces are released by OptimRVArgsFree. */
+typedef struct OptimRVArgs OptimRVArgs;
+struct OptimRVArgs {
+    Allocator al;
+    RVTape   *tape;
+    f64RVar (*f)( f64RVarMat );
+
+    /* recording of OptimRVHessVec */
+    b32        recorded;
+    f64Mat     at;          /* point of the recording */
+    f64RVarMat x;
+    f64RVar    y;
+    f64Mat     tan, dadj;   /* sweep workspaces, grown as the tape grows */
+};
+
+void OptimRVArgsFree( OptimRVArgs *a )
+{
+    if ( a->at.data ) {
+        f64MatFree( a->al, &a->at );
+        f64RVarMatFree( a->al, &a->x );
+    }
+    if ( a->tan.data ) {
+        f64MatFree( a->al, &a->tan );
+        f64MatFree( a->al, &a->dadj );
+    }
+    a->at.data  = NULL;
+    a->tan.data = NULL;
+    a->recorded = 0;
+}
+
+f64 OptimRVGradient( void *args, f64Mat x, f64Mat grad )
+{
+    OptimRVArgs *a = (OptimRVArgs *) args;
+    a->recorded = 0;
+    return f64RVGradient( a->al, a->tape, a->f, x, grad );
+}
+
+f64 OptimRVHessian( void *args, f64Mat x, f64Mat grad, f64Mat hess )
+{
+    OptimRVArgs *a = (OptimRVArgs *) args;
+    a->recorded = 0;
+
+    if ( ! grad.data ) {
+        return f64RVValue( a->al, a->tape, a->f, x );
+    }
+    return f64RVHessian( a->al, a->tape, a->f, x, grad, hess );
+}
+
+/* records f at x with second partials and sweeps it */
+void optimRVRecord( OptimRVArgs *a, f64Mat x )
+{
+    u32 N = x.dim0;
+
+    if ( a->at.data && a->at.dim0 != N ) {
+        f64MatFree( a->al, &a->at );
+        f64RVarMatFree( a->al, &a->x );
+    }
+    if ( ! a->at.data ) {
+        a->at = f64MatMake( a->al, N, 1 );
+        a->x  = f64RVarMatMake( a->al, N, 1 );
+    }
+
+    RVTape *prev = RVActiveTape;
+
+    optimCopy( x, a->at );
+    a->y = rvHessRecord( a->tape, a->f, x, a->x );
+
+    RVActiveTape = prev;
+
+    u32 size = a->y.idx + 1;
+    if ( a->tan.data && a->tan.dim0 < size ) {
+        f64MatFree( a->al, &a->tan );
+        f64MatFree( a->al, &a->dadj );
+    }
+    if ( ! a->tan.data ) {
+        a->tan  = f64MatMake( a->al, size, 1 );
+        a->dadj = f64MatMake( a->al, size, 1 );
+    }
+
+    a->recorded = 1;
+}
+
+void OptimRVHessVec( void *args, f64Mat x, f64Mat v, f64Mat hv )
+{
+    OptimRVArgs *a = (OptimRVArgs *) args;
+    u32 N = x.dim0;
+
+    if ( ! a->recorded || a->at.dim0 != N
+         || memcmp( a->at.data, x.data, N * sizeof(f64) ) != 0 ) {
+        optimRVRecord( a, x );
+    }
+
+    f64Mat seeds = { .dim0 = N, .dim1 = 1, .data = v.data };
+    f64Mat out   = { .dim0 = N, .dim1 = 1, .data = hv.data };
+
+    f64RVHessVecSweep( a->tape, a->x, a->y, seeds, a->tan, a->dadj, out );
+}
+
+
+/* Line search.
+ *
+ * phi(alpha) = f(x + alpha * d), returns phi(alpha) and writes phi'(alpha). */
+typedef f64 OptimLineFun( void *args, f64 alpha, f64 *dphi );
+
+#define OPTIM_C1        1E-4
+#define OPTIM_ALPHA_MAX 1E10
+#define OPTIM_MAX_LS    40
+
+/* minimiser of the cubic interpolating phi and phi' at a and b, safeguarded
+ * to stay in the inner 80% of the interval */
+f64 optimCubicMin( f64 a, f64 fa, f64 da, f64 b, f64 fb, f64 db )
+{
+    f64 lo = MIN( a, b );
+    f64 hi = MAX( a, b );
+    f64 w  = hi - lo;
+
+    f64 d1 = da + db - 3 * (fa - fb) / (a - b);
+    f64 r  = d1 * d1 - da * db;
+
+    f64 c = 0.5 * (lo + hi);
+
+    if ( r >= 0 ) {
+        f64 d2 = sqrt( r );
+        if ( b < a ) {
+            d2 = -d2;
+        }
+        f64 den = db - da + 2 * d2;
+        if ( den != 0 ) {
+            c = b - (b - a) * (db + d2 - d1) / den;
+        }
+    }
+
+    if ( !(c >= lo + 0.1 * w && c <= hi - 0.1 * w) ) {
+        c = 0.5 * (lo + hi);
+    }
+    return c;
+}
+
+f64 optimZoom(
+    OptimLineFun *phi, void *args, f64 phi0, f64 dphi0, f64 c2,
+    f64 aLo, f64 fLo, f64 dLo, f64 aHi, f64 fHi, f64 dHi, u32 budget
+)
+{
+    for ( u32 i=0; i<budget; ++i ) {
+        f64 a  = optimCubicMin( aLo, fLo, dLo, aHi, fHi, dHi );
+        f64 da;
+        f64 fa = phi( args, a, &da );
+
+        if ( fa > phi0 + OPTIM_C1 * a * dphi0 || fa >= fLo ) {
+            aHi = a; fHi = fa; dHi = da;
+        }
+        else {
+            if ( fabs( da ) <= -c2 * dphi0 ) {
+                return a;
+            }
+            if ( da * (aHi - aLo) >= 0 ) {
+                aHi = aLo; fHi = fLo; dHi = dLo;
+            }
+            aLo = a; fLo = fa; dLo = da;
+        }
+
+        if ( fabs( aHi - aLo ) <= 1E-16 * MAX( 1.0, aHi ) ) {
+            break;
+        }
+    }
+    return 0;
+}
+
+/* Strong Wolfe line search (Nocedal & Wright, Alg. 3.5/3.6) starting at
+ * alpha0 > 0 with phi0 = phi(0) and dphi0 = phi'(0) < 0. Returns the
+ * accepted step, which is always the last one phi was evaluated at, or 0 if
+ * none was found. */
+f64 OptimLineSearch( OptimLineFun *phi, void *args, f64 phi0, f64 dphi0, f64 alpha0, f64 c2 )
+{
+    ASSERT( alpha0 > 0 && dphi0 < 0 );
+
+    f64 aPrev = 0;
+    f64 fPrev = phi0;
+    f64 dPrev = dphi0;
+    f64 a     = alpha0;
+
+    for ( u32 i=0; i<OPTIM_MAX_LS; ++i ) {
+        f64 da;
+        f64 fa = phi( args, a, &da );
+        u32 budget = OPTIM_MAX_LS - i - 1;
+
+        if ( fa > phi0 + OPTIM_C1 * a * dphi0 || (i > 0 && fa >= fPrev) ) {
+            return optimZoom( phi, args, phi0, dphi0, c2, aPrev, fPrev, dPrev, a, fa, da, budget );
+        }
+        if ( fabs( da ) <= -c2 * dphi0 ) {
+            return a;
+        }
+        if ( da >= 0 ) {
+            return optimZoom( phi, args, phi0, dphi0, c2, a, fa, da, aPrev, fPrev, dPrev, budget );
+        }
+
+        aPrev = a; fPrev = fa; dPrev = da;
+        a     = MIN( 2 * a, OPTIM_ALPHA_MAX );
+    }
+    return 0;
+}
+
 
 /* BFGS Method with Linesearch */
+#include "lbfgs.h"
 
 
 /* Conjugate Gradient Method */
+#include "cg.h"
+
+
+/* Trust-Region Newton Method */
+#include "trust.h"
+
+
+/* Truncated Newton Method */
+#include "newtoncg.h"
+
+
+/* Levenberg-Marquardt Least Squares */
+#include "lm.h"
 
 
 /* Hamiltonian Monte Carlo */
+#include "hmc.h"
 
 
+/* Stochastic Gradient Methods */
+#include "sgd.h"
@@ -0,0 +1,291 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Stochastic gradient methods for objectives that are sums over data too
+// large to hold in memory or to evaluate in full at every step,
+//
+//     f(x) = sum_i l( x, obs_i ).
+//
+// The data comes from an SGDSourceFun that hands out one mini-batch at a
+// time, e.g. read from a file into a buffer it owns, and the gradient of the
+// batch loss from an SGDGradFun, which can use f64FVGradient, the GLM kernels
+// or a hand written gradient. The parameters are updated in place by the
+// fused SIMD kernels
+//
+//     SGD_PLAIN     x -= lr g
+//     SGD_MOMENTUM  v  = mu v + g,  x -= lr v
+//     SGD_ADAM      Kingma & Ba (2015) with bias correction,
+//
+// with lr = learningRate / (1 + decay * t) after t steps. All state is
+// allocated in SGDMake, stepping does not allocate.
+//
+
+typedef enum SGDMethod SGDMethod;
+enum SGDMethod {
+    SGD_PLAIN,
+    SGD_MOMENTUM,
+    SGD_ADAM,
+};
+
+
+/* points *batch to the next mini-batch and returns its number of
+ * observations. Returning 0 ends the epoch, the source rewinds itself so
+ * that the following call starts the next one. */
+typedef u32 SGDSourceFun( void *source, const void **batch );
+
+/* returns the loss of the count observations at batch and writes its gradient */
+typedef f64 SGDGradFun( void *args, const void *batch, u32 count, f64Mat x, f64Mat grad );
+
+
+typedef struct SGDOptions SGDOptions;
+struct SGDOptions {
+    u32 maxEpochs;
+    f64 learningRate;
+    f64 decay;        /* lr = learningRate / (1 + decay * t) */
+    f64 momentum;     /* mu, and beta1 for Adam */
+    f64 beta2;
+    f64 eps;
+    f64 fTol;         /* stop when the mean epoch loss changes by at most fTol * max(1, |f|) */
+};
+
+SGDOptions SGDDefaultOptions( SGDMethod method )
+{
+    SGDOptions o;
+    o.maxEpochs    = 100;
+    o.learningRate = method == SGD_ADAM ? 1E-3 : 1E-2;
+    o.decay        = 0;
+    o.momentum     = 0.9;
+    o.beta2        = 0.999;
+    o.eps          = 1E-8;
+    o.fTol         = 1E-10;
+    return o;
+}
+
+
+typedef struct SGD SGD;
+struct SGD {
+    u32       n;
+    SGDMethod method;
+    u64       step;   /* updates since the last reset, for decay and bias correction */
+
+    f64Mat    g;
+    f64Mat    m;      /* velocity or first moment */
+    f64Mat    v;      /* second moment */
+};
+
+
+SGD SGDMake( Allocator al, u32 n, SGDMethod method )
+{
+    ASSERT( n > 0 );
+
+    SGD opt;
+    memset( &opt, 0, sizeof(opt) );
+
+    opt.n      = n;
+    opt.method = method;
+    opt.g      = f64MatZeroMake( al, n, 1 );
+    opt.m      = f64MatZeroMake( al, n, 1 );
+    opt.v      = f64MatZeroMake( al, n, 1 );
+
+    return opt;
+}
+
+void SGDFree( Allocator al, SGD *opt )
+{
+    f64MatFree( al, &opt->g );
+    f64MatFree( al, &opt->m );
+    f64MatFree( al, &opt->v );
+}
+
+void SGDReset( SGD *opt )
+{
+    opt->step = 0;
+    memset( opt->m.data, 0, opt->n * sizeof(f64) );
+    memset( opt->v.data, 0, opt->n * sizeof(f64) );
+}
+
+
+/* one update of x with the gradient in opt->g */
+void SGDStep( SGD *opt, f64Mat x, SGDOptions opts )
+{
+    ASSERT( x.dim0 * x.dim1 == opt->n );
+
+    simdEnsureKernels();
+
+    opt->step += 1;
+
+    f64 lr = opts.learningRate / (1 + opts.decay * (opt->step - 1));
+
+    switch ( opt->method ) {
+        case SGD_PLAIN:
+            FVSimd.axpy( opt->n, -lr, opt->g.data, x.data );
+            break;
+
+        case SGD_MOMENTUM:
+            FVSimd.momentum( opt->n, lr, opts.momentum, opt->g.data, opt->m.data, x.data );
+            break;
+
+        default: {
+            f64 c1 = 1 - pow( opts.momentum, (f64) opt->step );
+            f64 c2 = 1 - pow( opts.beta2, (f64) opt->step );
+
+            /* lr sqrt(c2) / c1 with eps scaled along, as in the paper's
+             * efficient form */
+            FVSimd.adam(
+                opt->n, lr * sqrt( c2 ) / c1, opts.momentum, opts.beta2, opts.eps * sqrt( c2 ),
+                opt->g.data, opt->m.data, opt->v.data, x.data
+            );
+            break;
+        }
+    }
+}
+
+
+/* Runs up to opts.maxEpochs passes over the source, x is updated in place.
+ * res.f is the mean batch loss of the last epoch, measured along the way. */
+OptimResult SGDMinimize(
+    SGD *opt, SGDSourceFun *source, void *srcArgs, SGDGradFun *grad, void *args,
+    f64Mat x, SGDOptions opts
+)
+{
+    ASSERT( x.dim0 * x.dim1 == opt->n );
+
+    OptimResult res;
+    memset( &res, 0, sizeof(res) );
+
+    simdEnsureKernels();
+    SGDReset( opt );
+
+    f64 fPrev = INFINITY;
+
+    for ( u32 epoch=0; epoch<opts.maxEpochs; ++epoch ) {
+        const void *batch;
+        u32 count;
+
+        f64 loss    = 0;
+        u32 batches = 0;
+
+        while ( (count = source( srcArgs, &batch )) > 0 ) {
+            loss += grad( args, batch, count, x, opt->g );
+            SGDStep( opt, x, opts );
+            batches += 1;
+        }
+
+        res.iterations  = epoch + 1;
+        res.evaluations += batches;
+
+        if ( batches == 0 ) {
+            break;
+        }
+
+        res.f        = loss / batches;
+        res.gradNorm = sqrt( FVSimd.dot( opt->n, opt->g.data, opt->g.data ) );
+
+        if ( fabs( fPrev - res.f ) <= opts.fTol * MAX( 1.0, fabs( res.f ) ) ) {
+            res.converged = 1;
+            break;
+        }
+        fPrev = res.f;
+    }
+
+    return res;
+}
+
+
+/* in-memory source handing out consecutive rows of data */
+typedef struct test_sgd_source test_sgd_source;
+struct test_sgd_source {
+    f64Mat data;    /* N x 4, three features and the response */
+    u32    batch;
+    u32    next;
+};
+
+u32 test_sgd_next( void *source, const void **batch )
+{
+    test_sgd_source *s = (test_sgd_source *) source;
+
+    if ( s->next >= s->data.dim0 ) {
+        s->next = 0;
+        return 0;
+    }
+
+    u32 count = MIN( s->batch, s->data.dim0 - s->next );
+    *batch    = s->data.data + (u64) s->next * 4;
+    s->next  += count;
+
+    return count;
+}
+
+/* least-squares loss of a linear model over the batch, and its gradient */
+f64 test_sgd_grad( void *args, const void *batch, u32 count, f64Mat x, f64Mat grad )
+{
+    const f64 *obs = (const f64 *) batch;
+
+    f64 loss = 0;
+    memset( grad.data, 0, 3 * sizeof(f64) );
+
+    /* mean squared error / 2 */
+    for ( u32 k=0; k<count; ++k ) {
+        const f64 *o = obs + 4 * k;
+        f64 r = o[0] * x.data[0] + o[1] * x.data[1] + o[2] * x.data[2] - o[3];
+        loss += 0.5 * r * r / count;
+        for ( u32 j=0; j<3; ++j ) {
+            grad.data[j] += r * o[j] / count;
+        }
+    }
+
+    return loss;
+}
+
+#if TEST
+void test_sgd()
+{
+    u32 N = 2000;
+    f64 beta[3] = { 1.5, -2.0, 0.5 };
+
+    Xorshift1024 rng = Xorshift1024Init( 17 );
+
+    test_sgd_source src;
+    src.data  = f64MatMake( DefaultAllocator, N, 4 );
+    src.batch = 32;
+    src.next  = 0;
+
+    for ( u32 i=0; i<N; ++i ) {
+        f64 *o = src.data.data + 4 * i;
+        o[0] = 1.0;
+        o[1] = 2 * rngXorshift1024NextFloat( &rng ) - 1;
+        o[2] = 2 * rngXorshift1024NextFloat( &rng ) - 1;
+        o[3] = beta[0] * o[0] + beta[1] * o[1] + beta[2] * o[2]
+             + 0.01 * (rngXorshift1024NextFloat( &rng ) - 0.5);
+    }
+
+    f64Mat x = f64MatMake( DefaultAllocator, 3, 1 );
+
+    for ( SGDMethod method=SGD_PLAIN; method<=SGD_ADAM; ++method ) {
+        SGD opt = SGDMake( DefaultAllocator, 3, method );
+
+        SGDOptions opts   = SGDDefaultOptions( method );
+        opts.learningRate = method == SGD_ADAM ? 0.02 : 0.1;
+        opts.decay        = method == SGD_PLAIN ? 0 : 1E-3;
+        opts.maxEpochs    = 200;
+        opts.fTol         = 1E-6;
+
+        memset( x.data, 0, 3 * sizeof(f64) );
+
+        OptimResult res = SGDMinimize( &opt, test_sgd_next, &src, test_sgd_grad, NULL, x, opts );
+
+        TEST_ASSERT( res.converged );
+        TEST_ASSERT( res.evaluations == res.iterations * (N / 32 + 1) );
+        TEST_ASSERT( res.f < 1E-4 );
+
+        for ( u32 j=0; j<3; ++j ) {
+            TEST_ASSERT( fabs( x.data[j] - beta[j] ) < 1E-2 );
+        }
+
+        SGDFree( DefaultAllocator, &opt );
+    }
+
+    f64MatFree( DefaultAllocator, &x );
+    f64MatFree( DefaultAllocator, &src.data );
+}
+#endif
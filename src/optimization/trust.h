@@ -0,0 +1,367 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Trust-region Newton method with dogleg steps. The objective returns f, its
+// gradient and its Hessian from one call, e.g. OptimRVHessian, which gets
+// all three from one recording on the scalar reverse tape. Trial points
+// only ask for f, gradient and Hessian are evaluated once a step is
+// accepted.
+//
+// The Newton step solves (H + tau I) p = -g with the blocked Cholesky of
+// linalg.h, tau = 0 whenever H is positive definite and otherwise increased
+// until the factorization succeeds (Nocedal & Wright, Alg. 3.3). It only
+// depends on the current point and is computed once per accepted step. All
+// workspaces are allocated in TrustMake.
+//
+
+/* shifts tau tried before a Hessian is given up on */
+#define TRUST_MAX_SHIFTS 64
+
+
+typedef struct Trust Trust;
+struct Trust {
+    u32    n;
+    f64    radius;      /* initial trust region radius */
+    f64    maxRadius;
+
+    f64Mat x, g, h;     /* current point */
+    f64Mat xNew;
+    f64Mat l;           /* n x n Cholesky factor */
+    f64Mat pN, pU, p, hp;
+};
+
+
+Trust TrustMake( Allocator al, u32 n )
+{
+    ASSERT( n > 0 );
+
+    Trust opt;
+
+    opt.n         = n;
+    opt.radius    = 1.0;
+    opt.maxRadius = 1E3;
+    opt.x         = f64MatZeroMake( al, n, 1 );
+    opt.g         = f64MatZeroMake( al, n, 1 );
+    opt.h         = f64MatZeroMake( al, n, n );
+    opt.xNew      = f64MatZeroMake( al, n, 1 );
+    opt.l         = f64MatZeroMake( al, n, n );
+    opt.pN        = f64MatZeroMake( al, n, 1 );
+    opt.pU        = f64MatZeroMake( al, n, 1 );
+    opt.p         = f64MatZeroMake( al, n, 1 );
+    opt.hp        = f64MatZeroMake( al, n, 1 );
+
+    return opt;
+}
+
+void TrustFree( Allocator al, Trust *opt )
+{
+    f64MatFree( al, &opt->x );
+    f64MatFree( al, &opt->g );
+    f64MatFree( al, &opt->h );
+    f64MatFree( al, &opt->xNew );
+    f64MatFree( al, &opt->l );
+    f64MatFree( al, &opt->pN );
+    f64MatFree( al, &opt->pU );
+    f64MatFree( al, &opt->p );
+    f64MatFree( al, &opt->hp );
+}
+
+
+/* pN = -(H + tau I)^-1 g with the smallest tau of the sequence that makes
+ * the shifted Hessian positive definite, returns 0 if g or H are not finite
+ * or no shift in TRUST_MAX_SHIFTS does */
+b32 trustNewtonStep( Trust *opt )
+{
+    u32 n = opt->n;
+
+    for ( u32 i=0; i<n*n; ++i ) {
+        if ( ! isfinite( opt->h.data[i] ) ) {
+            return 0;
+        }
+    }
+    for ( u32 i=0; i<n; ++i ) {
+        if ( ! isfinite( opt->g.data[i] ) ) {
+            return 0;
+        }
+    }
+
+    f64 minDiag = opt->h.data[0];
+    f64 maxDiag = fabs( opt->h.data[0] );
+    for ( u32 i=1; i<n; ++i ) {
+        minDiag = MIN( minDiag, opt->h.data[i*n + i] );
+        maxDiag = MAX( maxDiag, fabs( opt->h.data[i*n + i] ) );
+    }
+
+    f64 beta = 1E-3 * MAX( maxDiag, 1.0 );
+    f64 tau  = minDiag > 0 ? 0 : beta - minDiag;
+
+    b32 factored = 0;
+
+    for ( u32 k=0; k<TRUST_MAX_SHIFTS && ! factored; ++k ) {
+        optimCopy( opt->h, opt->l );
+        for ( u32 i=0; i<n; ++i ) {
+            opt->l.data[i*n + i] += tau;
+        }
+        factored = f64MatCholesky( opt->l );
+        tau      = MAX( 2 * tau, beta );
+    }
+
+    if ( ! factored ) {
+        return 0;
+    }
+
+    for ( u32 i=0; i<n; ++i ) {
+        opt->pN.data[i] = -opt->g.data[i];
+    }
+    f64MatCholeskySolve( opt->l, opt->pN );
+
+    return 1;
+}
+
+/* dogleg step into p from the Newton step in pN, returns the predicted
+ * reduction -(g'p + p'Hp / 2) */
+f64 trustDogleg( Trust *opt, f64 radius )
+{
+    u32 n = opt->n;
+
+    f64 nN = sqrt( f64MatDot( opt->pN, opt->pN ) );
+
+    if ( nN <= radius ) {
+        optimCopy( opt->pN, opt->p );
+    }
+    else {
+        f64 gg  = f64MatDot( opt->g, opt->g );
+        f64 gN  = sqrt( gg );
+
+        f64MatGemv( 0, 1.0, opt->h, opt->g, 0.0, opt->hp );
+        f64 gHg = f64MatDot( opt->g, opt->hp );
+
+        /* Cauchy point along -g */
+        f64 t = gHg > 0 ? gg / gHg : INFINITY;
+
+        if ( t * gN >= radius ) {
+            for ( u32 i=0; i<n; ++i ) {
+                opt->p.data[i] = -radius / gN * opt->g.data[i];
+            }
+        }
+        else {
+            for ( u32 i=0; i<n; ++i ) {
+                opt->pU.data[i] = -t * opt->g.data[i];
+            }
+
+            /* |pU + s (pN - pU)| = radius */
+            f64 a = 0, b = 0, c = -radius * radius;
+            for ( u32 i=0; i<n; ++i ) {
+                f64 dI = opt->pN.data[i] - opt->pU.data[i];
+                a += dI * dI;
+                b += 2 * dI * opt->pU.data[i];
+                c += opt->pU.data[i] * opt->pU.data[i];
+            }
+            f64 s = (-b + sqrt( b * b - 4 * a * c )) / (2 * a);
+
+            for ( u32 i=0; i<n; ++i ) {
+                opt->p.data[i] = opt->pU.data[i] + s * (opt->pN.data[i] - opt->pU.data[i]);
+            }
+        }
+    }
+
+    f64MatGemv( 0, 1.0, opt->h, opt->p, 0.0, opt->hp );
+
+    return -(f64MatDot( opt->g, opt->p ) + 0.5 * f64MatDot( opt->p, opt->hp ));
+}
+
+
+/* Minimises f starting from x, x holds the minimiser on return. */
+OptimResult TrustMinimize( Trust *opt, OptimHessFun *f, void *args, f64Mat x, OptimOptions opts )
+{
+    ASSERT( x.dim0 * x.dim1 == opt->n );
+
+    OptimResult res;
+    memset( &res, 0, sizeof(res) );
+
+    f64Mat none = { 0 };
+
+    optimCopy( x, opt->x );
+    f64 fx     = f( args, opt->x, opt->g, opt->h );
+    f64 gNorm  = sqrt( f64MatDot( opt->g, opt->g ) );
+    f64 radius = opt->radius;
+    b32 newton = 0;
+
+    res.evaluations = 1;
+
+    u32 iter = 0;
+    while ( iter < opts.maxIter ) {
+        if ( gNorm <= opts.gradTol ) {
+            res.converged = 1;
+            break;
+        }
+
+        if ( ! newton ) {
+            if ( ! trustNewtonStep( opt ) ) {
+                break;
+            }
+            newton = 1;
+        }
+
+        f64 pred  = trustDogleg( opt, radius );
+        f64 pNorm = sqrt( f64MatDot( opt->p, opt->p ) );
+
+        optimCopy( opt->x, opt->xNew );
+        f64MatAxpy( 1.0, opt->p, opt->xNew );
+
+        f64 fNew = f( args, opt->xNew, none, none );
+        res.evaluations += 1;
+
+        f64 rho = pred > 0 && isfinite( fNew ) ? (fx - fNew) / pred : -1;
+
+        if ( rho < 0.25 ) {
+            radius = 0.25 * pNorm;
+        }
+        else if ( rho > 0.75 && pNorm >= 0.99 * radius ) {
+            radius = MIN( 2 * radius, opt->maxRadius );
+        }
+
+        ++iter;
+
+        if ( rho > 1E-4 ) {
+            f64Mat tmp;
+            tmp = opt->x; opt->x = opt->xNew; opt->xNew = tmp;
+
+            f64 fPrev = fx;
+            fx     = f( args, opt->x, opt->g, opt->h );
+            gNorm  = sqrt( f64MatDot( opt->g, opt->g ) );
+            newton = 0;
+
+            res.evaluations += 1;
+
+            if ( fabs( fPrev - fx ) <= opts.fTol * MAX( 1.0, fabs( fx ) ) ) {
+                res.converged = gNorm <= sqrt( opts.gradTol );
+                break;
+            }
+        }
+
+        if ( radius <= 1E-15 * MAX( 1.0, sqrt( f64MatDot( opt->x, opt->x ) ) ) ) {
+            break;
+        }
+    }
+
+    optimCopy( opt->x, x );
+
+    res.f          = fx;
+    res.gradNorm   = gNorm;
+    res.iterations = iter;
+
+    return res;
+}
+
+
+/* chained Rosenbrock with the Hessian written out */
+f64 test_trust_rosenbrock( void *args, f64Mat x, f64Mat grad, f64Mat hess )
+{
+    u32 n = x.dim0;
+
+    if ( ! grad.data ) {
+        f64 f = 0;
+        for ( u32 i=0; i+1<n; ++i ) {
+            f64 a = x.data[i+1] - x.data[i] * x.data[i];
+            f64 b = 1 - x.data[i];
+            f += 100 * a * a + b * b;
+        }
+        return f;
+    }
+
+    memset( hess.data, 0, n * n * sizeof(f64) );
+
+    for ( u32 i=0; i+1<n; ++i ) {
+        hess.data[i*n + i]         += 1200 * x.data[i] * x.data[i] - 400 * x.data[i+1] + 2;
+        hess.data[i*n + i + 1]     += -400 * x.data[i];
+        hess.data[(i+1)*n + i]     += -400 * x.data[i];
+        hess.data[(i+1)*n + i + 1] += 200;
+    }
+
+    return test_lbfgs_rosenbrock( args, x, grad );
+}
+
+/* the same with f64RVar, for OptimRVHessian */
+f64RVar test_trust_rv_rosenbrock( f64RVarMat x )
+{
+    f64RVar f = f64RVConst( 0.0 );
+
+    for ( u32 i=0; i+1<x.dim0; ++i ) {
+        f64RVar a = f64RVSub( x.data[i+1], f64RVMul( x.data[i], x.data[i] ) );
+        f64RVar b = f64RVf64Add( 1.0, f64RVNeg( x.data[i] ) );
+        f = f64RVAdd( f, f64RVAdd( f64RVMulf64( f64RVMul( a, a ), 100.0 ), f64RVMul( b, b ) ) );
+    }
+
+    return f;
+}
+
+/* a Hessian that is NaN everywhere */
+f64 test_trust_nan( void *args, f64Mat x, f64Mat grad, f64Mat hess )
+{
+    u32 n = x.dim0;
+
+    if ( grad.data ) {
+        for ( u32 i=0; i<n; ++i ) {
+            grad.data[i] = 1.0;
+        }
+        for ( u32 i=0; i<n*n; ++i ) {
+            hess.data[i] = NAN;
+        }
+    }
+
+    return 0;
+}
+
+#if TEST
+void test_trust()
+{
+#define EPS 1E-8
+
+    u32 n = 10;
+
+    /* for n >= 4 there is a second local minimum near x0 = -1, start in the
+     * basin of the global one */
+    f64Mat x = f64MatZeroMake( DefaultAllocator, n, 1 );
+
+    Trust opt = TrustMake( DefaultAllocator, n );
+
+    OptimResult res = TrustMinimize( &opt, test_trust_rosenbrock, NULL, x, OptimDefaultOptions() );
+
+    TEST_ASSERT( res.converged );
+    TEST_ASSERT( res.iterations < 100 );
+    for ( u32 i=0; i<n; ++i ) {
+        TEST_ASSERT( f64Equal( x.data[i], 1.0, EPS ) );
+    }
+
+    /* the same through the reverse mode Hessian, which has to take the
+     * same steps */
+    RVTape tape = RVTapeMake( DefaultAllocator );
+    OptimRVArgs args = { .al = DefaultAllocator, .tape = &tape, .f = test_trust_rv_rosenbrock };
+
+    memset( x.data, 0, n * sizeof(f64) );
+
+    OptimResult rv = TrustMinimize( &opt, OptimRVHessian, &args, x, OptimDefaultOptions() );
+
+    TEST_ASSERT( rv.converged );
+    TEST_ASSERT( rv.iterations == res.iterations );
+    TEST_ASSERT( rv.evaluations == res.evaluations );
+    for ( u32 i=0; i<n; ++i ) {
+        TEST_ASSERT( f64Equal( x.data[i], 1.0, EPS ) );
+    }
+
+    OptimRVArgsFree( &args );
+    RVTapeFree( &tape );
+
+    /* no finite Hessian, no step */
+    res = TrustMinimize( &opt, test_trust_nan, NULL, x, OptimDefaultOptions() );
+
+    TEST_ASSERT( ! res.converged );
+    TEST_ASSERT( res.iterations == 0 );
+
+    TrustFree( DefaultAllocator, &opt );
+    f64MatFree( DefaultAllocator, &x );
+
+#undef EPS
+}
+#endif
@@ -0,0 +1,251 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Persistent worker pool for the data-parallel kernels. Work is handed out
+// in fixed-size chunks, so the partitioning of a range never depends on the
+// number of threads that happen to execute it.
+//
+
+#include <pthread.h>
+
+
+#define PARALLEL_MAX_THREADS 64
+
+
+/* processes the half-open index range [start, end) */
+typedef void ParallelFun( void *args, u32 start, u32 end );
+
+
+typedef struct ThreadPool ThreadPool;
+struct ThreadPool {
+    pthread_t       threads[PARALLEL_MAX_THREADS];
+    u32             numThreads;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t  wake;
+    pthread_cond_t  done;
+
+    ParallelFun    *fun;
+    void           *args;
+    u32             count;
+    u32             chunk;
+    u32             numChunks;
+    u32             nextChunk;
+
+    u32             generation;
+    u32             busyWorkers;
+    b32             quit;
+};
+
+static ThreadPool FVThreadPool;
+
+/* set inside a parallel region, nested calls run serially */
+static __thread b32 InParallelRegion;
+
+
+Inline
+u32 ParallelNumThreads( void )
+{
+    return FVThreadPool.numThreads ? FVThreadPool.numThreads : 1;
+}
+
+
+Inline
+void parallelRunChunks( ThreadPool *pool )
+{
+    u32 c;
+    while ( (c = __atomic_fetch_add( &pool->nextChunk, 1, __ATOMIC_RELAXED )) < pool->numChunks ) {
+        u32 start = c * pool->chunk;
+        u32 end   = MIN( start + pool->chunk, pool->count );
+        pool->fun( pool->args, start, end );
+    }
+}
+
+
+void *parallelWorker( void *arg )
+{
+    ThreadPool *pool = (ThreadPool *) arg;
+    u32 seen = 0;
+
+    InParallelRegion = 1;
+
+    pthread_mutex_lock( &pool->mutex );
+
+    for ( ;; ) {
+        while ( pool->generation == seen && ! pool->quit ) {
+            pthread_cond_wait( &pool->wake, &pool->mutex );
+        }
+        if ( pool->quit ) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock( &pool->mutex );
+
+        parallelRunChunks( pool );
+
+        pthread_mutex_lock( &pool->mutex );
+        if ( --pool->busyWorkers == 0 ) {
+            pthread_cond_signal( &pool->done );
+        }
+    }
+
+    pthread_mutex_unlock( &pool->mutex );
+
+    return NULL;
+}
+
+
+void InitializeParallel( u32 numThreads )
+{
+    ThreadPool *pool = &FVThreadPool;
+
+    ASSERT( pool->numThreads == 0 );
+
+    numThreads = MAX( 1, MIN( numThreads, PARALLEL_MAX_THREADS ) );
+
+    memset( pool, 0, sizeof(ThreadPool) );
+
+    pthread_mutex_init( &pool->mutex, NULL );
+    pthread_cond_init( &pool->wake, NULL );
+    pthread_cond_init( &pool->done, NULL );
+
+    pool->numThreads = numThreads;
+
+    /* the calling thread is worker 0 */
+    for ( u32 i=1; i<numThreads; ++i ) {
+        i32 pStatus = pthread_create( &pool->threads[i], NULL, parallelWorker, pool );
+        if ( pStatus ) {
+            fprintf( stderr, "error: pthread_create, pStatus: %d\n", pStatus );
+            pool->numThreads = i;
+            break;
+        }
+    }
+}
+
+
+void TerminateParallel( void )
+{
+    ThreadPool *pool = &FVThreadPool;
+
+    if ( pool->numThreads == 0 ) {
+        return;
+    }
+
+    pthread_mutex_lock( &pool->mutex );
+    pool->quit = 1;
+    pthread_cond_broadcast( &pool->wake );
+    pthread_mutex_unlock( &pool->mutex );
+
+    for ( u32 i=1; i<pool->numThreads; ++i ) {
+        pthread_join( pool->threads[i], NULL );
+    }
+
+    pthread_mutex_destroy( &pool->mutex );
+    pthread_cond_destroy( &pool->wake );
+    pthread_cond_destroy( &pool->done );
+
+    pool->numThreads = 0;
+}
+
+
+/* number of chunks ParallelFor splits count into for a given chunk size */
+Inline
+u32 ParallelNumChunks( u32 count, u32 chunk )
+{
+    ASSERT( chunk > 0 );
+    return (count + chunk - 1) / chunk;
+}
+
+
+/* calls fun on consecutive ranges of at most chunk indices covering [0, count) */
+void ParallelFor( u32 count, u32 chunk, ParallelFun *fun, void *args )
+{
+    ThreadPool *pool = &FVThreadPool;
+
+    if ( count == 0 ) {
+        return;
+    }
+
+    u32 numChunks = ParallelNumChunks( count, chunk );
+
+    if ( numChunks == 1 || pool->numThreads <= 1 || InParallelRegion ) {
+        for ( u32 c=0; c<numChunks; ++c ) {
+            fun( args, c * chunk, MIN( (c + 1) * chunk, count ) );
+        }
+        return;
+    }
+
+    pthread_mutex_lock( &pool->mutex );
+
+    pool->fun         = fun;
+    pool->args        = args;
+    pool->count       = count;
+    pool->chunk       = chunk;
+    pool->numChunks   = numChunks;
+    pool->nextChunk   = 0;
+    pool->busyWorkers = pool->numThreads - 1;
+    pool->generation += 1;
+
+    pthread_cond_broadcast( &pool->wake );
+    pthread_mutex_unlock( &pool->mutex );
+
+    InParallelRegion = 1;
+    parallelRunChunks( pool );
+    InParallelRegion = 0;
+
+    pthread_mutex_lock( &pool->mutex );
+    while ( pool->busyWorkers > 0 ) {
+        pthread_cond_wait( &pool->done, &pool->mutex );
+    }
+    pthread_mutex_unlock( &pool->mutex );
+}
+
+
+/* chunk size splitting count into roughly perThread pieces per worker */
+Inline
+u32 ParallelChunkSize( u32 count, u32 minChunk, u32 perThread )
+{
+    u32 pieces = ParallelNumThreads() * MAX( perThread, 1 );
+    u32 chunk  = (count + pieces - 1) / pieces;
+    return MAX( chunk, MAX( minChunk, 1 ) );
+}
+
+
+/* counts how often each index in [start, end) is visited */
+void test_parallel_fun( void *args, u32 start, u32 end )
+{
+    u32 *hits = (u32 *) args;
+    for ( u32 i=start; i<end; ++i ) {
+        hits[i] += 1;
+    }
+}
+
+#if TEST
+void test_parallel_for()
+{
+    u32 N = 1000;
+
+    b32 ownPool = FVThreadPool.numThreads == 0;
+    if ( ownPool ) {
+        InitializeParallel( 4 );
+    }
+
+    u32 *hits = (u32 *) Alloc( DefaultAllocator, N * sizeof(u32) );
+    memset( hits, 0, N * sizeof(u32) );
+
+    ParallelFor( N, 7, test_parallel_fun, hits );
+    ParallelFor( N, N + 1, test_parallel_fun, hits );
+
+    for ( u32 i=0; i<N; ++i ) {
+        TEST_ASSERT( hits[i] == 2 );
+    }
+
+    TEST_ASSERT( ParallelNumChunks( N, 7 ) == 143 );
+
+    Free( DefaultAllocator, hits );
+
+    if ( ownPool ) {
+        TerminateParallel();
+    }
+}
+#endif
@@ -0,0 +1,483 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Reverse mode on whole matrices, the adjoint counterpart of fw_dod.h. Each
+// operation evaluates its value, appends a node to the active tape and
+// registers the rule that pulls the node's adjoint back to its arguments,
+// e.g. for C = A * B
+//
+//     dA += dC * B'
+//     dB += A' * dC
+//
+// so the gradient of a scalar loss w.r.t. a weight matrix costs a few GEMMs
+// instead of dim0 * dim1 forward passes.
+//
+// Values and adjoints are allocated from the tape's allocator and released
+// when the tape is reset.
+//
+
+typedef struct RMTape RMTape;
+typedef struct RMNode RMNode;
+
+/* accumulates n's adjoint into the adjoints of its arguments */
+typedef void RMAdjointFun( RMTape *t, RMNode *n );
+
+struct RMNode {
+    RMAdjointFun *adjoint;  /* NULL for inputs */
+    u32           arg[2];
+    f64           scalar;
+    f64Mat        val;
+    f64Mat        adj;      /* allocated on first use in the sweep */
+};
+
+struct RMTape {
+    Allocator al;
+    RMNode   *nodes;
+    u32       size;
+    u32       cap;
+};
+
+
+typedef struct f64RMVar f64RMVar;
+struct f64RMVar {
+    u32    idx;
+    f64Mat val;
+};
+
+
+/* tape recorded to by the f64RM functions of the calling thread */
+static __thread RMTape *RMActiveTape;
+
+
+RMTape RMTapeMake( Allocator al )
+{
+    RMTape t;
+    t.al    = al;
+    t.nodes = NULL;
+    t.size  = 0;
+    t.cap   = 0;
+    return t;
+}
+
+
+/* releases all values and adjoints, the node array is kept */
+void RMTapeReset( RMTape *t )
+{
+    for ( u32 i=0; i<t->size; ++i ) {
+        RMNode *n = &t->nodes[i];
+        if ( n->val.data ) {
+            f64MatFree( t->al, &n->val );
+        }
+        if ( n->adj.data ) {
+            f64MatFree( t->al, &n->adj );
+        }
+    }
+    t->size = 0;
+}
+
+
+void RMTapeFree( RMTape *t )
+{
+    RMTapeReset( t );
+
+    if ( t->nodes ) {
+        Free( t->al, t->nodes );
+    }
+
+    if ( RMActiveTape == t ) {
+        RMActiveTape = NULL;
+    }
+
+    *t = RMTapeMake( t->al );
+}
+
+
+Inline
+void RMTapeActivate( RMTape *t )
+{
+    RMActiveTape = t;
+}
+
+
+f64RMVar rmPush( u32 dim0, u32 dim1, RMAdjointFun *adjoint, u32 arg0, u32 arg1, f64 scalar )
+{
+    RMTape *t = RMActiveTape;
+
+    ASSERT( t );
+
+    if ( t->size == t->cap ) {
+        u32 newCap = t->cap ? 2 * t->cap : 64;
+
+        RMNode *nodes = (RMNode *) Alloc( t->al, newCap * sizeof(RMNode) );
+        if ( t->nodes ) {
+            memcpy( nodes, t->nodes, t->size * sizeof(RMNode) );
+            Free( t->al, t->nodes );
+        }
+        t->nodes = nodes;
+        t->cap   = newCap;
+    }
+
+    RMNode *n = &t->nodes[ t->size ];
+
+    n->adjoint  = adjoint;
+    n->arg[0]   = arg0;
+    n->arg[1]   = arg1;
+    n->scalar   = scalar;
+    n->val      = f64MatMake( t->al, dim0, dim1 );
+    n->adj.data = NULL;
+
+    f64RMVar r;
+    r.idx = t->size++;
+    r.val = n->val;
+    return r;
+}
+
+
+/* adjoint of node idx, zero-initialized on first access */
+f64Mat rmAdj( RMTape *t, u32 idx )
+{
+    RMNode *n = &t->nodes[idx];
+
+    if ( ! n->adj.data ) {
+        n->adj = f64MatMake( t->al, n->val.dim0, n->val.dim1 );
+        memset( n->adj.data, 0, n->val.dim0 * n->val.dim1 * sizeof(f64) );
+    }
+
+    return n->adj;
+}
+
+
+/* adjoint rules */
+
+void rmAdjMatAdd( RMTape *t, RMNode *n )
+{
+    f64MatAxpy( 1.0, n->adj, rmAdj( t, n->arg[0] ) );
+    f64MatAxpy( 1.0, n->adj, rmAdj( t, n->arg[1] ) );
+}
+
+void rmAdjMatSub( RMTape *t, RMNode *n )
+{
+    f64MatAxpy(  1.0, n->adj, rmAdj( t, n->arg[0] ) );
+    f64MatAxpy( -1.0, n->adj, rmAdj( t, n->arg[1] ) );
+}
+
+void rmAdjMatMul( RMTape *t, RMNode *n )
+{
+    f64Mat a = t->nodes[ n->arg[0] ].val;
+    f64Mat b = t->nodes[ n->arg[1] ].val;
+
+    f64MatGemm( 0, 1, 1.0, n->adj, b, 1.0, rmAdj( t, n->arg[0] ) );
+    f64MatGemm( 1, 0, 1.0, a, n->adj, 1.0, rmAdj( t, n->arg[1] ) );
+}
+
+void rmAdjMul( RMTape *t, RMNode *n )
+{
+    f64Mat a  = t->nodes[ n->arg[0] ].val;
+    f64Mat b  = t->nodes[ n->arg[1] ].val;
+    f64Mat da = rmAdj( t, n->arg[0] );
+    f64Mat db = rmAdj( t, n->arg[1] );
+
+    for ( u32 i=0; i<(a.dim0*a.dim1); ++i ) {
+        f64 dc = n->adj.data[i];
+        da.data[i] += dc * b.data[i];
+        db.data[i] += dc * a.data[i];
+    }
+}
+
+void rmAdjDiv( RMTape *t, RMNode *n )
+{
+    f64Mat b  = t->nodes[ n->arg[1] ].val;
+    f64Mat da = rmAdj( t, n->arg[0] );
+    f64Mat db = rmAdj( t, n->arg[1] );
+
+    for ( u32 i=0; i<(b.dim0*b.dim1); ++i ) {
+        f64 q = n->adj.data[i] / b.data[i];
+        da.data[i] += q;
+        db.data[i] -= q * n->val.data[i];
+    }
+}
+
+void rmAdjExp( RMTape *t, RMNode *n )
+{
+    f64Mat da = rmAdj( t, n->arg[0] );
+
+    for ( u32 i=0; i<(da.dim0*da.dim1); ++i ) {
+        da.data[i] += n->adj.data[i] * n->val.data[i];
+    }
+}
+
+void rmAdjLog( RMTape *t, RMNode *n )
+{
+    f64Mat a  = t->nodes[ n->arg[0] ].val;
+    f64Mat da = rmAdj( t, n->arg[0] );
+
+    for ( u32 i=0; i<(da.dim0*da.dim1); ++i ) {
+        da.data[i] += n->adj.data[i] / a.data[i];
+    }
+}
+
+/* covers negation, scaling and adding a constant */
+void rmAdjScale( RMTape *t, RMNode *n )
+{
+    f64MatAxpy( n->scalar, n->adj, rmAdj( t, n->arg[0] ) );
+}
+
+void rmAdjSum( RMTape *t, RMNode *n )
+{
+    f64Mat da = rmAdj( t, n->arg[0] );
+    f64 dc = n->adj.data[0];
+
+    for ( u32 i=0; i<(da.dim0*da.dim1); ++i ) {
+        da.data[i] += dc;
+    }
+}
+
+
+/* recorded operations */
+
+/* new independent variable holding a copy of val */
+f64RMVar f64RMMake( f64Mat val )
+{
+    f64RMVar r = rmPush( val.dim0, val.dim1, NULL, 0, 0, 0.0 );
+    memcpy( r.val.data, val.data, val.dim0 * val.dim1 * sizeof(f64) );
+    return r;
+}
+
+f64RMVar f64RMMatAdd( f64RMVar a, f64RMVar b )
+{
+    ASSERT( a.val.dim0 == b.val.dim0 && a.val.dim1 == b.val.dim1 );
+
+    f64RMVar r = rmPush( a.val.dim0, a.val.dim1, rmAdjMatAdd, a.idx, b.idx, 0.0 );
+    f64MatAdd( a.val, b.val, r.val );
+    return r;
+}
+
+f64RMVar f64RMMatSub( f64RMVar a, f64RMVar b )
+{
+    ASSERT( a.val.dim0 == b.val.dim0 && a.val.dim1 == b.val.dim1 );
+
+    f64RMVar r = rmPush( a.val.dim0, a.val.dim1, rmAdjMatSub, a.idx, b.idx, 0.0 );
+    f64MatSub( a.val, b.val, r.val );
+    return r;
+}
+
+f64RMVar f64RMMatMul( f64RMVar a, f64RMVar b )
+{
+    ASSERT( a.val.dim1 == b.val.dim0 );
+
+    f64RMVar r = rmPush( a.val.dim0, b.val.dim1, rmAdjMatMul, a.idx, b.idx, 0.0 );
+    f64BlasMul( a.val, b.val, r.val );
+    return r;
+}
+
+/* element-wise product */
+f64RMVar f64RMMul( f64RMVar a, f64RMVar b )
+{
+    ASSERT( a.val.dim0 == b.val.dim0 && a.val.dim1 == b.val.dim1 );
+
+    f64RMVar r = rmPush( a.val.dim0, a.val.dim1, rmAdjMul, a.idx, b.idx, 0.0 );
+    for ( u32 i=0; i<(a.val.dim0*a.val.dim1); ++i ) {
+        r.val.data[i] = a.val.data[i] * b.val.data[i];
+    }
+    return r;
+}
+
+/* element-wise a / b */
+f64RMVar f64RMDiv( f64RMVar a, f64RMVar b )
+{
+    ASSERT( a.val.dim0 == b.val.dim0 && a.val.dim1 == b.val.dim1 );
+
+    f64RMVar r = rmPush( a.val.dim0, a.val.dim1, rmAdjDiv, a.idx, b.idx, 0.0 );
+    for ( u32 i=0; i<(a.val.dim0*a.val.dim1); ++i ) {
+        r.val.data[i] = a.val.data[i] / b.val.data[i];
+    }
+    return r;
+}
+
+f64RMVar f64RMExp( f64RMVar a )
+{
+    f64RMVar r = rmPush( a.val.dim0, a.val.dim1, rmAdjExp, a.idx, a.idx, 0.0 );
+    for ( u32 i=0; i<(a.val.dim0*a.val.dim1); ++i ) {
+        r.val.data[i] = exp( a.val.data[i] );
+    }
+    return r;
+}
+
+f64RMVar f64RMLog( f64RMVar a )
+{
+    f64RMVar r = rmPush( a.val.dim0, a.val.dim1, rmAdjLog, a.idx, a.idx, 0.0 );
+    for ( u32 i=0; i<(a.val.dim0*a.val.dim1); ++i ) {
+        r.val.data[i] = log( a.val.data[i] );
+    }
+    return r;
+}
+
+f64RMVar f64RMMulf64( f64RMVar a, f64 s )
+{
+    f64RMVar r = rmPush( a.val.dim0, a.val.dim1, rmAdjScale, a.idx, a.idx, s );
+    for ( u32 i=0; i<(a.val.dim0*a.val.dim1); ++i ) {
+        r.val.data[i] = s * a.val.data[i];
+    }
+    return r;
+}
+
+f64RMVar f64RMNeg( f64RMVar a )
+{
+    return f64RMMulf64( a, -1.0 );
+}
+
+f64RMVar f64RMAddf64( f64RMVar a, f64 s )
+{
+    f64RMVar r = rmPush( a.val.dim0, a.val.dim1, rmAdjScale, a.idx, a.idx, 1.0 );
+    for ( u32 i=0; i<(a.val.dim0*a.val.dim1); ++i ) {
+        r.val.data[i] = a.val.data[i] + s;
+    }
+    return r;
+}
+
+/* 1 x 1 sum of all elements */
+f64RMVar f64RMSum( f64RMVar a )
+{
+    f64RMVar r = rmPush( 1, 1, rmAdjSum, a.idx, a.idx, 0.0 );
+
+    f64 sum = 0;
+    for ( u32 i=0; i<(a.val.dim0*a.val.dim1); ++i ) {
+        sum += a.val.data[i];
+    }
+    r.val.data[0] = sum;
+    return r;
+}
+
+
+/* reverse sweep from the scalar (1 x 1) node y */
+void f64RMSweep( RMTape *t, f64RMVar y )
+{
+    ASSERT( y.val.dim0 == 1 && y.val.dim1 == 1 );
+
+    for ( u32 i=0; i<t->size; ++i ) {
+        RMNode *n = &t->nodes[i];
+        if ( n->adj.data ) {
+            memset( n->adj.data, 0, n->adj.dim0 * n->adj.dim1 * sizeof(f64) );
+        }
+    }
+
+    rmAdj( t, y.idx ).data[0] = 1.0;
+
+    for ( u32 i=y.idx+1; i-- > 0; ) {
+        RMNode *n = &t->nodes[i];
+
+        if ( n->adjoint && n->adj.data ) {
+            n->adjoint( t, n );
+        }
+    }
+}
+
+
+/* d y / d x after f64RMSweep( t, y ), NULL data if y does not depend on x */
+Inline
+f64Mat f64RMAdjoint( RMTape *t, f64RMVar x )
+{
+    return t->nodes[ x.idx ].adj;
+}
+
+
+/* gradient of a scalar loss w.r.t. the matrix input, returns the loss */
+f64 f64RMGradient( RMTape *tape, f64RMVar f( f64RMVar ), f64Mat input, f64Mat grad )
+{
+    ASSERT( input.dim0 == grad.dim0 && input.dim1 == grad.dim1 );
+
+    RMTape *prev = RMActiveTape;
+
+    RMTapeReset( tape );
+    RMTapeActivate( tape );
+
+    f64RMVar x = f64RMMake( input );
+    f64RMVar y = f( x );
+
+    f64RMSweep( tape, y );
+
+    f64Mat dx = f64RMAdjoint( tape, x );
+
+    if ( dx.data ) {
+        memcpy( grad.data, dx.data, grad.dim0 * grad.dim1 * sizeof(f64) );
+    }
+    else {
+        memset( grad.data, 0, grad.dim0 * grad.dim1 * sizeof(f64) );
+    }
+
+    f64 val = y.val.data[0];
+
+    RMActiveTape = prev;
+
+    return val;
+}
+
+
+/* softplus regression loss with an L2 penalty on the weights w, see below */
+f64RMVar test_rm_f( f64RMVar w )
+{
+    u32 n = w.val.dim1;
+
+    f64Mat x = f64MatMake( DefaultAllocator, n, 2 );
+    f64Mat y = f64MatMake( DefaultAllocator, w.val.dim0, 2 );
+
+    for ( u32 i=0; i<n*2; ++i ) {
+        x.data[i] = cos( 0.3 * i );
+    }
+    for ( u32 i=0; i<w.val.dim0*2; ++i ) {
+        y.data[i] = 1.0 + 0.1 * i;
+    }
+
+    f64RMVar X = f64RMMake( x );
+    f64RMVar Y = f64RMMake( y );
+
+    /* sum( log( 1 + exp(W X) ) / Y ) + 0.5 * sum( W o W ) */
+    f64RMVar z = f64RMMatMul( w, X );
+    f64RMVar l = f64RMDiv( f64RMLog( f64RMAddf64( f64RMExp( z ), 1.0 ) ), Y );
+    f64RMVar r = f64RMMulf64( f64RMSum( f64RMMul( w, w ) ), 0.5 );
+
+    f64MatFree( DefaultAllocator, &x );
+    f64MatFree( DefaultAllocator, &y );
+
+    return f64RMMatSub( f64RMSum( l ), f64RMNeg( r ) );
+}
+
+#if TEST
+void test_rm_gradient()
+{
+#define EPS 1E-6
+
+    RMTape tape = RMTapeMake( DefaultAllocator );
+
+    f64Mat w    = f64MatMake( DefaultAllocator, 3, 4 );
+    f64Mat grad = f64MatMake( DefaultAllocator, 3, 4 );
+    f64Mat tmp  = f64MatMake( DefaultAllocator, 3, 4 );
+
+    for ( u32 i=0; i<12; ++i ) {
+        w.data[i] = sin( 1.0 + i );
+    }
+
+    f64RMGradient( &tape, test_rm_f, w, grad );
+
+    f64 h = 1E-6;
+    for ( u32 i=0; i<12; ++i ) {
+        f64 wi = w.data[i];
+
+        w.data[i] = wi + h;
+        f64 fp = f64RMGradient( &tape, test_rm_f, w, tmp );
+        w.data[i] = wi - h;
+        f64 fm = f64RMGradient( &tape, test_rm_f, w, tmp );
+        w.data[i] = wi;
+
+        TEST_ASSERT( f64Equal( grad.data[i], (fp - fm) / (2*h), EPS ) );
+    }
+
+    RMTapeFree( &tape );
+
+    f64MatFree( DefaultAllocator, &w );
+    f64MatFree( DefaultAllocator, &grad );
+    f64MatFree( DefaultAllocator, &tmp );
+
+#undef EPS
+}
+#endif
@@ -0,0 +1,314 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Second derivatives by forward-over-reverse on the scalar tape. f is
+// recorded once on a tape with second partials (RVTapeEnableSecond) and
+// swept once for the adjoints a = dy/dn of all nodes. The tangent of that
+// sweep along a direction v,
+//
+//     t_k  = sum_p dk/dp t_p                               (f64RVPushForward)
+//     b_p += dk/dp b_k + a_k sum_q d^2k/dp dq t_q          (reverse)
+//
+// ends with b = H v on the inputs. One product costs a forward and a
+// reverse pass over the tape, independent of the number of inputs, and any
+// number of products at the same point share the recording. K directions
+// run together as K lanes, the dense Hessian is N / K such batches.
+//
+
+#define RV_HESS_BATCH 8
+
+
+/* H seeds for the K = seeds.dim1 directions in seeds (row i for input
+ * x.data[i]) into hv (N x K). t holds f with second partials and the
+ * adjoints of y from f64RVSweep, tan and dadj are workspaces with at least
+ * y.idx + 1 rows and K columns. */
+void f64RVHessVecSweep(
+    RVTape *t, f64RVarMat x, f64RVar y, f64Mat seeds, f64Mat tan, f64Mat dadj, f64Mat hv
+)
+{
+    u32 K    = seeds.dim1;
+    u32 last = y.idx;
+
+    ASSERT( t->second );
+    ASSERT( hv.dim0 == seeds.dim0 && hv.dim1 == K );
+    ASSERT( dadj.dim1 == K && dadj.dim0 > last );
+
+    f64RVPushForward( t, x, seeds, last, tan );
+
+    memset( dadj.data, 0, (u64) (last + 1) * K * sizeof(f64) );
+
+    for ( u32 k=last+1; k-- > 0; ) {
+        RVNode *n = RVTapeNode( t, k );
+        RVCurv *c = RVTapeCurv( t, k );
+
+        f64 d0  = n->partial[0];
+        f64 d1  = n->partial[1];
+        f64 adj = n->adj;
+
+        /* inputs and constants */
+        if ( d0 == 0.0 && d1 == 0.0 && c->d[0] == 0.0 && c->d[1] == 0.0 && c->d[2] == 0.0 ) {
+            continue;
+        }
+
+        const f64 *b  = dadj.data + (u64) k * K;
+        const f64 *t0 = tan.data + (u64) n->parent[0] * K;
+        const f64 *t1 = tan.data + (u64) n->parent[1] * K;
+        f64       *b0 = dadj.data + (u64) n->parent[0] * K;
+        f64       *b1 = dadj.data + (u64) n->parent[1] * K;
+
+        f64 c00 = adj * c->d[0];
+        f64 c01 = adj * c->d[1];
+        f64 c11 = adj * c->d[2];
+
+        for ( u32 j=0; j<K; ++j ) {
+            f64 bj  = b[j];
+            f64 t0j = t0[j];
+            f64 t1j = t1[j];
+            b0[j] += d0 * bj + c00 * t0j + c01 * t1j;
+            b1[j] += d1 * bj + c01 * t0j + c11 * t1j;
+        }
+    }
+
+    for ( u32 i=0; i<seeds.dim0; ++i ) {
+        u32 idx = x.data[i].idx;
+        for ( u32 j=0; j<K; ++j ) {
+            hv.data[i*K + j] = idx <= last ? dadj.data[(u64) idx * K + j] : 0.0;
+        }
+    }
+}
+
+
+/* records f at input on tape and sweeps it once, x receives the inputs */
+f64RVar rvHessRecord( RVTape *tape, f64RVar f( f64RVarMat ), f64Mat input, f64RVarMat x )
+{
+    RVTapeEnableSecond( tape );
+    RVTapeActivate( tape );
+
+    for ( u32 i=0; i<input.dim0; ++i ) {
+        x.data[i] = f64RVMake( input.data[i] );
+    }
+
+    f64RVar y = f( x );
+
+    f64RVSweep( tape, y );
+
+    return y;
+}
+
+
+/* H(input) v and the gradient of f, returns f(input). grad may have NULL
+ * data. Costs one recording, one reverse sweep and one forward-over-reverse
+ * sweep whatever the size of input. */
+f64 f64RVHessVec(
+    Allocator al, RVTape *tape, f64RVar f( f64RVarMat ), f64Mat input, f64Mat v, f64Mat grad, f64Mat hv
+)
+{
+    ASSERT( input.dim1 == 1 && v.dim0 == input.dim0 && hv.dim0 == input.dim0 );
+
+    u32 N = input.dim0;
+
+    RVTape *prev = RVActiveTape;
+
+    f64RVarMat x = f64RVarMatMake( al, N, 1 );
+    f64RVar    y = rvHessRecord( tape, f, input, x );
+
+    if ( grad.data ) {
+        for ( u32 i=0; i<N; ++i ) {
+            grad.data[i] = f64RVAdjoint( tape, x.data[i] );
+        }
+    }
+
+    f64Mat seeds = { .dim0 = N, .dim1 = 1, .data = v.data };
+    f64Mat out   = { .dim0 = N, .dim1 = 1, .data = hv.data };
+
+    f64Mat tan  = f64MatMake( al, y.idx + 1, 1 );
+    f64Mat dadj = f64MatMake( al, y.idx + 1, 1 );
+
+    f64RVHessVecSweep( tape, x, y, seeds, tan, dadj, out );
+
+    f64MatFree( al, &tan );
+    f64MatFree( al, &dadj );
+    f64RVarMatFree( al, &x );
+
+    RVActiveTape = prev;
+
+    return y.val;
+}
+
+
+/* Dense N x N Hessian and the gradient of f, returns f(input). One
+ * recording and N / RV_HESS_BATCH batched forward-over-reverse sweeps. */
+f64 f64RVHessian(
+    Allocator al, RVTape *tape, f64RVar f( f64RVarMat ), f64Mat input, f64Mat grad, f64Mat hess
+)
+{
+    ASSERT( input.dim1 == 1 && grad.dim0 == input.dim0 );
+    ASSERT( hess.dim0 == input.dim0 && hess.dim1 == input.dim0 );
+
+    u32 N = input.dim0;
+    u32 K = MIN( RV_HESS_BATCH, N );
+
+    RVTape *prev = RVActiveTape;
+
+    f64RVarMat x = f64RVarMatMake( al, N, 1 );
+    f64RVar    y = rvHessRecord( tape, f, input, x );
+
+    for ( u32 i=0; i<N; ++i ) {
+        grad.data[i] = f64RVAdjoint( tape, x.data[i] );
+    }
+
+    f64Mat seeds = f64MatMake( al, N, K );
+    f64Mat hv    = f64MatMake( al, N, K );
+    f64Mat tan   = f64MatMake( al, y.idx + 1, K );
+    f64Mat dadj  = f64MatMake( al, y.idx + 1, K );
+
+    for ( u32 c=0; c<N; c+=K ) {
+        u32 k = MIN( K, N - c );
+
+        memset( seeds.data, 0, (u64) N * K * sizeof(f64) );
+        for ( u32 j=0; j<k; ++j ) {
+            seeds.data[(c + j) * K + j] = 1.0;
+        }
+
+        f64RVHessVecSweep( tape, x, y, seeds, tan, dadj, hv );
+
+        for ( u32 i=0; i<N; ++i ) {
+            for ( u32 j=0; j<k; ++j ) {
+                hess.data[i*N + c + j] = hv.data[i*K + j];
+            }
+        }
+    }
+
+    f64MatFree( al, &seeds );
+    f64MatFree( al, &hv );
+    f64MatFree( al, &tan );
+    f64MatFree( al, &dadj );
+    f64RVarMatFree( al, &x );
+
+    RVActiveTape = prev;
+
+    return y.val;
+}
+
+
+/* every elementary function with curvature, against its analytic Hessian
+ * below */
+f64RVar test_rh_f( f64RVarMat x )
+{
+    f64RVar x0 = x.data[0], x1 = x.data[1], x2 = x.data[2];
+
+    /* x0 x1 / x2 + sin(x0) cos(x1) + exp(x2) log(x1) + sqrt(x0) x2^3
+     * + 2 / x1 + tanh(x0 x2) */
+    f64RVar s = f64RVDiv( f64RVMul( x0, x1 ), x2 );
+    s = f64RVAdd( s, f64RVMul( f64RVSin( x0 ), f64RVCos( x1 ) ) );
+    s = f64RVAdd( s, f64RVMul( f64RVExp( x2 ), f64RVLog( x1 ) ) );
+    s = f64RVAdd( s, f64RVMul( f64RVSqrt( x0 ), f64RVPow( x2, 3.0 ) ) );
+    s = f64RVAdd( s, f64RVf64Div( 2.0, x1 ) );
+    return f64RVAdd( s, f64RVTanh( f64RVMul( x0, x2 ) ) );
+}
+
+#if TEST
+void test_rv_hessian()
+{
+#define EPS 1E-12
+
+    u32 N = 3;
+
+    f64Mat input = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat grad  = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat hess  = f64MatMake( DefaultAllocator, N, N );
+    f64Mat v     = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat hv    = f64MatMake( DefaultAllocator, N, 1 );
+
+    f64 a = 0.7, b = 1.3, c = 0.4;
+    input.data[0] = a;
+    input.data[1] = b;
+    input.data[2] = c;
+
+    RVTape tape = RVTapeMake( DefaultAllocator );
+
+    f64 val = f64RVHessian( DefaultAllocator, &tape, test_rh_f, input, grad, hess );
+
+    f64 th = tanh( a * c );
+    f64 se = 1 - th * th;
+
+    f64 e[9];
+    e[0] = -sin( a ) * cos( b ) - 0.25 * pow( a, -1.5 ) * c * c * c - 2 * th * se * c * c;
+    e[1] = 1 / c - cos( a ) * sin( b );
+    e[2] = -b / (c * c) + 1.5 / sqrt( a ) * c * c + se - 2 * th * se * a * c;
+    e[4] = -sin( a ) * cos( b ) - exp( c ) / (b * b) + 4 / (b * b * b);
+    e[5] = -a / (c * c) + exp( c ) / b;
+    e[8] = 2 * a * b / (c * c * c) + exp( c ) * log( b ) + 6 * sqrt( a ) * c - 2 * th * se * a * a;
+    e[3] = e[1];
+    e[6] = e[2];
+    e[7] = e[5];
+
+    f64 fval = a * b / c + sin( a ) * cos( b ) + exp( c ) * log( b ) + sqrt( a ) * c * c * c
+             + 2 / b + th;
+
+    TEST_ASSERT( f64Equal( val, fval, EPS ) );
+    TEST_ASSERT( f64Equal( grad.data[0], b / c + cos( a ) * cos( b ) + 0.5 / sqrt( a ) * c * c * c + se * c, EPS ) );
+
+    for ( u32 i=0; i<9; ++i ) {
+        TEST_ASSERT( f64Equal( hess.data[i], e[i], EPS ) );
+    }
+
+    /* product against the analytic Hessian, without the gradient */
+    v.data[0] = 0.3;
+    v.data[1] = -1.1;
+    v.data[2] = 2.0;
+
+    f64Mat none = { 0 };
+    f64RVHessVec( DefaultAllocator, &tape, test_rh_f, input, v, none, hv );
+
+    for ( u32 i=0; i<N; ++i ) {
+        f64 r = 0;
+        for ( u32 j=0; j<N; ++j ) {
+            r += e[i*N + j] * v.data[j];
+        }
+        TEST_ASSERT( f64Equal( hv.data[i], r, EPS ) );
+    }
+
+    f64MatFree( DefaultAllocator, &input );
+    f64MatFree( DefaultAllocator, &grad );
+    f64MatFree( DefaultAllocator, &hess );
+    f64MatFree( DefaultAllocator, &v );
+    f64MatFree( DefaultAllocator, &hv );
+
+    /* chain of N = 19 > RV_HESS_BATCH inputs, dense against products */
+    N = 19;
+
+    input = f64MatMake( DefaultAllocator, N, 1 );
+    grad  = f64MatMake( DefaultAllocator, N, 1 );
+    hess  = f64MatMake( DefaultAllocator, N, N );
+    v     = f64MatZeroMake( DefaultAllocator, N, 1 );
+    hv    = f64MatMake( DefaultAllocator, N, 1 );
+
+    for ( u32 i=0; i<N; ++i ) {
+        input.data[i] = 0.2 + 0.05 * i;
+    }
+
+    f64RVHessian( DefaultAllocator, &tape, test_rv_f, input, grad, hess );
+
+    for ( u32 j=0; j<N; ++j ) {
+        v.data[j] = 1.0;
+        f64RVHessVec( DefaultAllocator, &tape, test_rv_f, input, v, grad, hv );
+        v.data[j] = 0.0;
+
+        for ( u32 i=0; i<N; ++i ) {
+            TEST_ASSERT( f64Equal( hv.data[i], hess.data[i*N + j], EPS ) );
+            TEST_ASSERT( f64Equal( hess.data[i*N + j], hess.data[j*N + i], 1E-10 ) );
+        }
+    }
+
+    RVTapeFree( &tape );
+
+    f64MatFree( DefaultAllocator, &input );
+    f64MatFree( DefaultAllocator, &grad );
+    f64MatFree( DefaultAllocator, &hess );
+    f64MatFree( DefaultAllocator, &v );
+    f64MatFree( DefaultAllocator, &hv );
+
+#undef EPS
+}
+#endif
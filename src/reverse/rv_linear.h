@@ -0,0 +1,215 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Linearize once, push forward many. A single evaluation on an RVTape
+// records the local partial derivatives of every operation, i.e. the
+// linearization of f at the input. Tangents for any number of seed
+// directions are then obtained by replaying
+//
+//     t_k += d_k0 * t_p0 + d_k1 * t_p1
+//
+// over the tape, without recomputing any primal values or calling any
+// transcendental functions. K directions are replayed together, the inner
+// loop over the K lanes of a node is a plain axpy.
+//
+
+/* Pushes the K = seeds.dim1 directions in seeds (row i for input x.data[i])
+ * through the nodes 0..last of t. Row k of tan receives the tangents of
+ * node k, tan must have at least last + 1 rows and K columns. Seeds of
+ * inputs recorded after node last are ignored. */
+void f64RVPushForward( RVTape *t, f64RVarMat x, f64Mat seeds, u32 last, f64Mat tan )
+{
+    u32 K = seeds.dim1;
+
+    ASSERT( last < t->size );
+    ASSERT( seeds.dim0 == x.dim0 * x.dim1 );
+    ASSERT( tan.dim1 == K && tan.dim0 > last );
+
+    memset( tan.data, 0, (u64) (last + 1) * K * sizeof(f64) );
+
+    for ( u32 i=0; i<seeds.dim0; ++i ) {
+        /* inputs recorded after last do not reach the nodes 0..last */
+        if ( x.data[i].idx > last ) {
+            continue;
+        }
+
+        f64 *r = tan.data + (u64) x.data[i].idx * K;
+        for ( u32 j=0; j<K; ++j ) {
+            r[j] += seeds.data[i*K + j];
+        }
+    }
+
+    for ( u32 k=0; k<=last; ++k ) {
+        RVNode *n = RVTapeNode( t, k );
+
+        f64 d0 = n->partial[0];
+        f64 d1 = n->partial[1];
+
+        if ( d0 == 0.0 && d1 == 0.0 ) {
+            continue;
+        }
+
+        f64       *r = tan.data + (u64) k * K;
+        const f64 *a = tan.data + (u64) n->parent[0] * K;
+        const f64 *b = tan.data + (u64) n->parent[1] * K;
+
+        for ( u32 j=0; j<K; ++j ) {
+            r[j] += d0 * a[j] + d1 * b[j];
+        }
+    }
+}
+
+
+/* Jacobian of f : R^N -> R^M, f writes its M outputs into y. f is
+ * evaluated once, the N unit directions are pushed forward in batches of
+ * at most batch lanes. The values of f are written to output (M x 1). */
+void f64RVJacobian(
+    Allocator al, RVTape *tape, void f( f64RVarMat, f64RVarMat ),
+    f64Mat input, f64Mat output, f64Mat jac, u32 batch
+)
+{
+    u32 N = input.dim0;
+    u32 M = output.dim0;
+
+    ASSERT( input.dim1 == 1 && output.dim1 == 1 );
+    ASSERT( jac.dim0 == M && jac.dim1 == N );
+    ASSERT( batch > 0 );
+
+    RVTape *prev = RVActiveTape;
+
+    RVTapeReset( tape );
+    RVTapeActivate( tape );
+
+    f64RVarMat x = f64RVarMatMake( al, N, 1 );
+    f64RVarMat y = f64RVarMatMake( al, M, 1 );
+
+    for ( u32 i=0; i<N; ++i ) {
+        x.data[i] = f64RVMake( input.data[i] );
+    }
+
+    f( x, y );
+
+    u32 last = 0;
+    for ( u32 i=0; i<M; ++i ) {
+        output.data[i] = y.data[i].val;
+        last = MAX( last, y.data[i].idx );
+    }
+
+    u32 K = MIN( batch, N );
+
+    f64Mat seeds = f64MatMake( al, N, K );
+    f64Mat tan   = f64MatMake( al, last + 1, K );
+
+    for ( u32 c=0; c<N; c+=K ) {
+        u32 k = MIN( K, N - c );
+
+        memset( seeds.data, 0, (u64) N * K * sizeof(f64) );
+        for ( u32 j=0; j<k; ++j ) {
+            seeds.data[(c + j) * K + j] = 1.0;
+        }
+
+        f64RVPushForward( tape, x, seeds, last, tan );
+
+        for ( u32 i=0; i<M; ++i ) {
+            const f64 *r = tan.data + (u64) y.data[i].idx * K;
+            for ( u32 j=0; j<k; ++j ) {
+                jac.data[i*N + c + j] = r[j];
+            }
+        }
+    }
+
+    f64MatFree( al, &seeds );
+    f64MatFree( al, &tan );
+    f64RVarMatFree( al, &x );
+    f64RVarMatFree( al, &y );
+
+    RVActiveTape = prev;
+}
+
+
+/* three outputs of mixed structure, the last one is test_rv_f */
+void test_rl_f( f64RVarMat x, f64RVarMat y )
+{
+    /* y0 = x0 sin(x1) + exp(x2), y1 = x0 x1 x2 / (1 + x2^2), y2 = test_rv_f */
+    y.data[0] = f64RVAdd( f64RVMul( x.data[0], f64RVSin( x.data[1] ) ), f64RVExp( x.data[2] ) );
+    y.data[1] = f64RVDiv(
+        f64RVMul( f64RVMul( x.data[0], x.data[1] ), x.data[2] ),
+        f64RVf64Add( 1.0, f64RVMul( x.data[2], x.data[2] ) )
+    );
+    y.data[2] = test_rv_f( x );
+}
+
+/* y0 = x0, only the first input is recorded before the last output */
+void test_rl_first( f64RVarMat x, f64RVarMat y )
+{
+    y.data[0] = x.data[0];
+}
+
+#if TEST
+void test_rv_jacobian()
+{
+#define EPS 1E-10
+
+    u32 N = 11;
+    u32 M = 3;
+
+    f64Mat input = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat out   = f64MatMake( DefaultAllocator, M, 1 );
+    f64Mat jac   = f64MatMake( DefaultAllocator, M, N );
+    f64Mat grad  = f64MatMake( DefaultAllocator, N, 1 );
+
+    for ( u32 i=0; i<N; ++i ) {
+        input.data[i] = 0.3 + 0.1 * i;
+    }
+
+    RVTape tape = RVTapeMake( DefaultAllocator );
+
+    /* a batch that does not divide N */
+    f64RVJacobian( DefaultAllocator, &tape, test_rl_f, input, out, jac, 4 );
+
+    f64 x0 = input.data[0], x1 = input.data[1], x2 = input.data[2];
+    f64 q  = 1 + x2 * x2;
+
+    TEST_ASSERT( f64Equal( out.data[0], x0 * sin( x1 ) + exp( x2 ), EPS ) );
+    TEST_ASSERT( f64Equal( jac.data[0], sin( x1 ), EPS ) );
+    TEST_ASSERT( f64Equal( jac.data[1], x0 * cos( x1 ), EPS ) );
+    TEST_ASSERT( f64Equal( jac.data[2], exp( x2 ), EPS ) );
+    TEST_ASSERT( f64Equal( jac.data[3], 0, EPS ) );
+
+    TEST_ASSERT( f64Equal( jac.data[N + 0], x1 * x2 / q, EPS ) );
+    TEST_ASSERT( f64Equal( jac.data[N + 1], x0 * x2 / q, EPS ) );
+    TEST_ASSERT( f64Equal( jac.data[N + 2], x0 * x1 * (1 - x2 * x2) / (q * q), EPS ) );
+
+    /* last row against the reverse sweep */
+    f64 val = f64RVGradient( DefaultAllocator, &tape, test_rv_f, input, grad );
+
+    TEST_ASSERT( f64Equal( out.data[2], val, EPS ) );
+    for ( u32 i=0; i<N; ++i ) {
+        TEST_ASSERT( f64Equal( jac.data[2*N + i], grad.data[i], EPS ) );
+    }
+
+    /* seeds of inputs recorded after the last output are dropped */
+    f64Mat one = f64MatMake( DefaultAllocator, 1, 1 );
+    f64Mat row = f64MatMake( DefaultAllocator, 1, N );
+
+    f64RVJacobian( DefaultAllocator, &tape, test_rl_first, input, one, row, 4 );
+
+    TEST_ASSERT( f64Equal( one.data[0], x0, EPS ) );
+    TEST_ASSERT( f64Equal( row.data[0], 1, EPS ) );
+    for ( u32 i=1; i<N; ++i ) {
+        TEST_ASSERT( row.data[i] == 0 );
+    }
+
+    f64MatFree( DefaultAllocator, &one );
+    f64MatFree( DefaultAllocator, &row );
+
+    RVTapeFree( &tape );
+
+    f64MatFree( DefaultAllocator, &input );
+    f64MatFree( DefaultAllocator, &out );
+    f64MatFree( DefaultAllocator, &jac );
+    f64MatFree( DefaultAllocator, &grad );
+
+#undef EPS
+}
+#endif
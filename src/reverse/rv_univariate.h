@@ -0,0 +1,653 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Reverse mode AD on scalars. Every elementary operation appends a node with
+// the indices of its (at most two) arguments and the local partial
+// derivatives to the active tape; one reverse sweep over the tape then
+// yields the adjoints of all recorded variables, i.e. the full gradient at a
+// small constant multiple of the cost of one function evaluation.
+//
+// Nodes are stored in fixed-size blocks taken from the tape's allocator
+// (typically an arena), resetting the tape keeps the blocks for reuse.
+//
+// A tape with second set additionally records the second partials of every
+// node w.r.t. its arguments in a parallel set of blocks, which is what the
+// forward-over-reverse Hessian drivers of rv_hessian.h sweep over. First
+// order tapes do not allocate or write them.
+//
+
+#define RV_BLOCK_SHIFT 12
+#define RV_BLOCK_SIZE  (1u << RV_BLOCK_SHIFT)
+#define RV_BLOCK_MASK  (RV_BLOCK_SIZE - 1)
+
+
+typedef struct f64RVar f64RVar;
+struct f64RVar {
+    f64 val;
+    u32 idx;
+};
+
+
+typedef struct RVNode RVNode;
+struct RVNode {
+    u32 parent[2];
+    f64 partial[2];
+    f64 adj;
+};
+
+
+/* d^2 n / dp0^2, d^2 n / dp0 dp1 and d^2 n / dp1^2 */
+typedef struct RVCurv RVCurv;
+struct RVCurv {
+    f64 d[3];
+};
+
+
+typedef struct RVTape RVTape;
+struct RVTape {
+    Allocator al;
+    RVNode  **blocks;
+    RVCurv  **curv;         /* NULL unless second is set */
+    u32       numBlocks;
+    u32       capBlocks;
+    u32       size;
+    b32       second;
+};
+
+
+/* tape recorded to by the f64RV functions of the calling thread */
+static __thread RVTape *RVActiveTape;
+
+
+RVTape RVTapeMake( Allocator al )
+{
+    RVTape t;
+    t.al        = al;
+    t.blocks    = NULL;
+    t.curv      = NULL;
+    t.numBlocks = 0;
+    t.capBlocks = 0;
+    t.size      = 0;
+    t.second    = 0;
+    return t;
+}
+
+
+void RVTapeFree( RVTape *t )
+{
+    for ( u32 i=0; i<t->numBlocks; ++i ) {
+        Free( t->al, t->blocks[i] );
+        if ( t->curv ) {
+            Free( t->al, t->curv[i] );
+        }
+    }
+    if ( t->blocks ) {
+        Free( t->al, t->blocks );
+    }
+    if ( t->curv ) {
+        Free( t->al, t->curv );
+    }
+
+    if ( RVActiveTape == t ) {
+        RVActiveTape = NULL;
+    }
+
+    *t = RVTapeMake( t->al );
+}
+
+
+/* forget all recorded operations, the node storage is kept */
+Inline
+void RVTapeReset( RVTape *t )
+{
+    t->size = 0;
+}
+
+
+Inline
+void RVTapeActivate( RVTape *t )
+{
+    RVActiveTape = t;
+}
+
+
+Inline
+RVNode *RVTapeNode( RVTape *t, u32 idx )
+{
+    return &t->blocks[ idx >> RV_BLOCK_SHIFT ][ idx & RV_BLOCK_MASK ];
+}
+
+/* second partials of node idx, only on tapes with second set */
+Inline
+RVCurv *RVTapeCurv( RVTape *t, u32 idx )
+{
+    return &t->curv[ idx >> RV_BLOCK_SHIFT ][ idx & RV_BLOCK_MASK ];
+}
+
+
+/* makes t record second partials from now on, drops what it recorded */
+void RVTapeEnableSecond( RVTape *t )
+{
+    if ( t->second ) {
+        RVTapeReset( t );
+        return;
+    }
+
+    b32 active = RVActiveTape == t;
+
+    RVTapeFree( t );
+    t->second = 1;
+
+    if ( active ) {
+        RVTapeActivate( t );
+    }
+}
+
+
+void rvTapeGrow( RVTape *t )
+{
+    if ( t->numBlocks == t->capBlocks ) {
+        u32 newCap = t->capBlocks ? 2 * t->capBlocks : 16;
+
+        RVNode **blocks = (RVNode **) Alloc( t->al, newCap * sizeof(RVNode *) );
+        if ( t->blocks ) {
+            memcpy( blocks, t->blocks, t->numBlocks * sizeof(RVNode *) );
+            Free( t->al, t->blocks );
+        }
+        t->blocks = blocks;
+
+        if ( t->second ) {
+            RVCurv **curv = (RVCurv **) Alloc( t->al, newCap * sizeof(RVCurv *) );
+            if ( t->curv ) {
+                memcpy( curv, t->curv, t->numBlocks * sizeof(RVCurv *) );
+                Free( t->al, t->curv );
+            }
+            t->curv = curv;
+        }
+
+        t->capBlocks = newCap;
+    }
+
+    if ( t->second ) {
+        t->curv[ t->numBlocks ] = (RVCurv *) Alloc( t->al, RV_BLOCK_SIZE * sizeof(RVCurv) );
+    }
+    t->blocks[ t->numBlocks++ ] = (RVNode *) Alloc( t->al, RV_BLOCK_SIZE * sizeof(RVNode) );
+}
+
+
+Inline
+u32 rvPush( u32 p0, f64 d0, u32 p1, f64 d1 )
+{
+    RVTape *t = RVActiveTape;
+
+    ASSERT( t );
+
+    if ( t->size == t->numBlocks * RV_BLOCK_SIZE ) {
+        rvTapeGrow( t );
+    }
+
+    u32 idx = t->size++;
+
+    RVNode *n = RVTapeNode( t, idx );
+    n->parent[0]  = p0;
+    n->parent[1]  = p1;
+    n->partial[0] = d0;
+    n->partial[1] = d1;
+
+    if ( t->second ) {
+        RVCurv *c = RVTapeCurv( t, idx );
+        c->d[0] = 0.0;
+        c->d[1] = 0.0;
+        c->d[2] = 0.0;
+    }
+
+    return idx;
+}
+
+/* rvPush for a node with nonzero second partials */
+Inline
+u32 rvPushCurv( u32 p0, f64 d0, u32 p1, f64 d1, f64 d00, f64 d01, f64 d11 )
+{
+    u32 idx = rvPush( p0, d0, p1, d1 );
+
+    RVTape *t = RVActiveTape;
+
+    if ( t->second ) {
+        RVCurv *c = RVTapeCurv( t, idx );
+        c->d[0] = d00;
+        c->d[1] = d01;
+        c->d[2] = d11;
+    }
+
+    return idx;
+}
+
+
+Inline
+f64RVar rvUnary( f64 val, f64RVar x, f64 dx )
+{
+    f64RVar r;
+    r.val = val;
+    r.idx = rvPush( x.idx, dx, x.idx, 0.0 );
+    return r;
+}
+
+
+Inline
+f64RVar rvBinary( f64 val, f64RVar x, f64 dx, f64RVar y, f64 dy )
+{
+    f64RVar r;
+    r.val = val;
+    r.idx = rvPush( x.idx, dx, y.idx, dy );
+    return r;
+}
+
+/* the same with the second partials dxx, dxy and dyy */
+
+Inline
+f64RVar rvUnaryCurv( f64 val, f64RVar x, f64 dx, f64 dxx )
+{
+    f64RVar r;
+    r.val = val;
+    r.idx = rvPushCurv( x.idx, dx, x.idx, 0.0, dxx, 0.0, 0.0 );
+    return r;
+}
+
+Inline
+f64RVar rvBinaryCurv( f64 val, f64RVar x, f64 dx, f64RVar y, f64 dy, f64 dxx, f64 dxy, f64 dyy )
+{
+    f64RVar r;
+    r.val = val;
+    r.idx = rvPushCurv( x.idx, dx, y.idx, dy, dxx, dxy, dyy );
+    return r;
+}
+
+
+/* new independent variable (or constant) on the active tape */
+f64RVar f64RVMake( f64 val )
+{
+    f64RVar r;
+    r.val = val;
+    r.idx = rvPush( 0, 0.0, 0, 0.0 );
+    return r;
+}
+
+#define f64RVConst(val) f64RVMake( val )
+
+
+void f64RVPrint( f64RVar x, const char* name )
+{
+    printf("RVar (%s): {\n", name);
+    printf("\t.val = %.4f\n", x.val);
+    printf("\t.idx = %u\n", x.idx);
+    printf("}\n");
+}
+
+
+/* arithmetic */
+
+Inline f64RVar f64RVAdd( f64RVar x, f64RVar y )   { return rvBinary( x.val + y.val, x, 1.0, y, 1.0 ); }
+Inline f64RVar f64RVAddf64( f64RVar x, f64 a )    { return rvUnary( x.val + a, x, 1.0 ); }
+Inline f64RVar f64RVf64Add( f64 a, f64RVar x )    { return rvUnary( a + x.val, x, 1.0 ); }
+Inline f64RVar f64RVSub( f64RVar x, f64RVar y )   { return rvBinary( x.val - y.val, x, 1.0, y, -1.0 ); }
+Inline f64RVar f64RVMul( f64RVar x, f64RVar y )   { return rvBinaryCurv( x.val * y.val, x, y.val, y, x.val, 0.0, 1.0, 0.0 ); }
+Inline f64RVar f64RVMulf64( f64RVar x, f64 a )    { return rvUnary( x.val * a, x, a ); }
+Inline f64RVar f64RVf64Mul( f64 a, f64RVar x )    { return rvUnary( a * x.val, x, a ); }
+Inline f64RVar f64RVDivf64( f64RVar x, f64 a )    { return rvUnary( x.val / a, x, 1.0 / a ); }
+Inline f64RVar f64RVNeg( f64RVar x )              { return rvUnary( -x.val, x, -1.0 ); }
+
+Inline
+f64RVar f64RVDiv( f64RVar x, f64RVar y )
+{
+    f64 inv = 1.0 / y.val;
+    f64 val = x.val * inv;
+    return rvBinaryCurv( val, x, inv, y, -val * inv, 0.0, -inv * inv, 2 * val * inv * inv );
+}
+
+Inline
+f64RVar f64RVf64Div( f64 a, f64RVar x )
+{
+    f64 val = a / x.val;
+    return rvUnaryCurv( val, x, -val / x.val, 2 * val / (x.val * x.val) );
+}
+
+
+/* elementary functions */
+
+Inline
+f64RVar f64RVSqrt( f64RVar x )
+{
+    f64 tmp = sqrt( x.val );
+    return rvUnaryCurv( tmp, x, 0.5 / tmp, -0.25 / (tmp * x.val) );
+}
+
+Inline
+f64RVar f64RVPow( f64RVar x, f64 a )
+{
+    f64 tmp = pow( x.val, a - 1.0 );
+    f64 dxx = x.val != 0 ? (a - 1.0) * a * tmp / x.val : a * (a - 1.0) * pow( x.val, a - 2.0 );
+    return rvUnaryCurv( tmp * x.val, x, a * tmp, dxx );
+}
+
+Inline
+f64RVar f64RVSin( f64RVar x )
+{
+    f64 tmp = sin( x.val );
+    return rvUnaryCurv( tmp, x, cos( x.val ), -tmp );
+}
+
+Inline
+f64RVar f64RVCos( f64RVar x )
+{
+    f64 tmp = cos( x.val );
+    return rvUnaryCurv( tmp, x, -sin( x.val ), -tmp );
+}
+
+Inline
+f64RVar f64RVTan( f64RVar x )
+{
+    f64 tmp = cos( x.val );
+    f64 val = tan( x.val );
+    f64 d   = 1.0 / (tmp * tmp);
+    return rvUnaryCurv( val, x, d, 2 * val * d );
+}
+
+Inline
+f64RVar f64RVAtan( f64RVar x )
+{
+    f64 d = 1.0 / (1.0 + x.val * x.val);
+    return rvUnaryCurv( atan( x.val ), x, d, -2 * x.val * d * d );
+}
+
+Inline
+f64RVar f64RVExp( f64RVar x )
+{
+    f64 tmp = exp( x.val );
+    return rvUnaryCurv( tmp, x, tmp, tmp );
+}
+
+Inline
+f64RVar f64RVLog( f64RVar x )
+{
+    f64 d = 1.0 / x.val;
+    return rvUnaryCurv( log( x.val ), x, d, -d * d );
+}
+
+Inline
+f64RVar f64RVLogAbs( f64RVar x )
+{
+    f64 d = 1.0 / x.val;
+    return rvUnaryCurv( log( fabs( x.val ) ), x, d, -d * d );
+}
+
+Inline
+f64RVar f64RVSinh( f64RVar x )
+{
+    f64 tmp = sinh( x.val );
+    return rvUnaryCurv( tmp, x, cosh( x.val ), tmp );
+}
+
+Inline
+f64RVar f64RVCosh( f64RVar x )
+{
+    f64 tmp = cosh( x.val );
+    return rvUnaryCurv( tmp, x, sinh( x.val ), tmp );
+}
+
+Inline
+f64RVar f64RVTanh( f64RVar x )
+{
+    f64 tmp = tanh( x.val );
+    f64 d   = 1.0 - tmp * tmp;
+    return rvUnaryCurv( tmp, x, d, -2 * tmp * d );
+}
+
+Inline
+f64RVar f64RVAtanh( f64RVar x )
+{
+    f64 d = 1.0 / (1.0 - x.val * x.val);
+    return rvUnaryCurv( atanh( x.val ), x, d, 2 * x.val * d * d );
+}
+
+
+/* reverse sweep */
+
+/* propagates the adjoint of y to every node recorded before it */
+void f64RVSweep( RVTape *t, f64RVar y )
+{
+    ASSERT( y.idx < t->size );
+
+    u32 numBlocks = (t->size + RV_BLOCK_MASK) >> RV_BLOCK_SHIFT;
+
+    for ( u32 b=0; b<numBlocks; ++b ) {
+        RVNode *block = t->blocks[b];
+        u32 len = MIN( RV_BLOCK_SIZE, t->size - (b << RV_BLOCK_SHIFT) );
+        for ( u32 i=0; i<len; ++i ) {
+            block[i].adj = 0.0;
+        }
+    }
+
+    RVTapeNode( t, y.idx )->adj = 1.0;
+
+    for ( u32 i=y.idx+1; i-- > 0; ) {
+        RVNode *n = RVTapeNode( t, i );
+        f64 adj = n->adj;
+
+        if ( adj == 0.0 ) {
+            continue;
+        }
+
+        RVTapeNode( t, n->parent[0] )->adj += n->partial[0] * adj;
+        RVTapeNode( t, n->parent[1] )->adj += n->partial[1] * adj;
+    }
+}
+
+
+/* d y / d x after f64RVSweep( t, y ) */
+Inline
+f64 f64RVAdjoint( RVTape *t, f64RVar x )
+{
+    return RVTapeNode( t, x.idx )->adj;
+}
+
+
+/* vectors of reverse variables */
+
+typedef struct f64RVarMat f64RVarMat;
+struct f64RVarMat {
+    u32      dim0;
+    u32      dim1;
+    f64RVar *data;
+};
+
+f64RVarMat f64RVarMatMake( Allocator al, u32 dim0, u32 dim1 )
+{
+    f64RVarMat m;
+    m.dim0 = dim0;
+    m.dim1 = dim1;
+    m.data = (f64RVar *) Alloc( al, dim0 * dim1 * sizeof(f64RVar) );
+    return m;
+}
+
+void f64RVarMatFree( Allocator al, f64RVarMat *m )
+{
+    ASSERT( m->data );
+    Free( al, m->data );
+}
+
+
+/* f(input) recorded on tape but not swept, e.g. for the trial points of an
+ * optimizer that only needs the value there */
+f64 f64RVValue( Allocator al, RVTape *tape, f64RVar f( f64RVarMat ), f64Mat input )
+{
+    ASSERT( input.dim1 == 1 );
+
+    u32 N = input.dim0;
+
+    RVTape *prev = RVActiveTape;
+
+    RVTapeReset( tape );
+    RVTapeActivate( tape );
+
+    f64RVarMat x = f64RVarMatMake( al, N, 1 );
+
+    for ( u32 i=0; i<N; ++i ) {
+        x.data[i] = f64RVMake( input.data[i] );
+    }
+
+    f64RVar y = f( x );
+
+    f64RVarMatFree( al, &x );
+
+    RVActiveTape = prev;
+
+    return y.val;
+}
+
+
+/* AD gradient with one forward evaluation and one reverse sweep, returns f(input) */
+f64 f64RVGradient( Allocator al, RVTape *tape, f64RVar f( f64RVarMat ), f64Mat input, f64Mat grad )
+{
+    ASSERT( input.dim0 == grad.dim0 && input.dim1 == grad.dim1 && input.dim1 == 1 );
+
+    u32 N = input.dim0;
+
+    RVTape *prev = RVActiveTape;
+
+    RVTapeReset( tape );
+    RVTapeActivate( tape );
+
+    f64RVarMat x = f64RVarMatMake( al, N, 1 );
+
+    for ( u32 i=0; i<N; ++i ) {
+        x.data[i] = f64RVMake( input.data[i] );
+    }
+
+    f64RVar y = f( x );
+
+    f64RVSweep( tape, y );
+
+    for ( u32 i=0; i<N; ++i ) {
+        grad.data[i] = f64RVAdjoint( tape, x.data[i] );
+    }
+
+    f64RVarMatFree( al, &x );
+
+    RVActiveTape = prev;
+
+    return y.val;
+}
+
+
+/* chained sum of smooth terms over neighbouring inputs, less log sqrt(1 + x0^2) */
+f64RVar test_rv_f( f64RVarMat x )
+{
+    f64RVar s = f64RVConst( 0.0 );
+
+    for ( u32 i=0; i+1<x.dim0; ++i ) {
+        /* x_i * exp(x_{i+1}) / (1 + x_i^2) + tanh(x_i) * sin(x_{i+1}) */
+        f64RVar a = f64RVDiv(
+            f64RVMul( x.data[i], f64RVExp( x.data[i+1] ) ),
+            f64RVf64Add( 1.0, f64RVPow( x.data[i], 2.0 ) )
+        );
+        f64RVar b = f64RVMul( f64RVTanh( x.data[i] ), f64RVSin( x.data[i+1] ) );
+        s = f64RVAdd( s, f64RVAdd( a, b ) );
+    }
+
+    return f64RVSub( s, f64RVLog( f64RVSqrt( f64RVAddf64( f64RVMul( x.data[0], x.data[0] ), 1.0 ) ) ) );
+}
+
+#if TEST
+void test_rv_gradient()
+{
+#define EPS 1E-6
+
+    u32 N = 5000;
+
+    Arena arena;
+    ArenaInit( &arena, DefaultAllocator, MB(1) );
+
+    RVTape tape = RVTapeMake( ArenaAllocatorMake( &arena ) );
+
+    f64Mat input = f64MatMake( DefaultAllocator, N, 1 );
+    f64Mat grad  = f64MatMake( DefaultAllocator, N, 1 );
+
+    for ( u32 i=0; i<N; ++i ) {
+        input.data[i] = sin( 0.1 * i );
+    }
+
+    f64 val = f64RVGradient( DefaultAllocator, &tape, test_rv_f, input, grad );
+
+    /* spans several node blocks */
+    TEST_ASSERT( tape.numBlocks > 1 );
+
+    /* central differences on a few coordinates */
+    f64 h = 1E-6;
+    for ( u32 k=0; k<N; k+=997 ) {
+        f64 tmp = input.data[k];
+
+        input.data[k] = tmp + h;
+        f64 fp = f64RVGradient( DefaultAllocator, &tape, test_rv_f, input, grad );
+        input.data[k] = tmp - h;
+        f64 fm = f64RVGradient( DefaultAllocator, &tape, test_rv_f, input, grad );
+        input.data[k] = tmp;
+
+        f64RVGradient( DefaultAllocator, &tape, test_rv_f, input, grad );
+
+        TEST_ASSERT( f64Equal( grad.data[k], (fp - fm) / (2*h), EPS ) );
+    }
+
+    TEST_ASSERT( f64Equal( f64RVGradient( DefaultAllocator, &tape, test_rv_f, input, grad ), val, 1E-12 ) );
+
+    RVTapeFree( &tape );
+    ArenaDestroy( &arena );
+
+    f64MatFree( DefaultAllocator, &input );
+    f64MatFree( DefaultAllocator, &grad );
+
+#undef EPS
+}
+#endif
+
+#if TEST
+void test_rv_elementary_functions()
+{
+#define EPS 1E-10
+
+    RVTape tape = RVTapeMake( DefaultAllocator );
+    RVTapeActivate( &tape );
+
+    f64RVar a = f64RVMake( 2.0 );
+    f64RVar b = f64RVMake( 0.5 );
+
+#define CHECK_RV(expr, value, deriv, x) do { \
+        f64RVar y = expr; \
+        f64RVSweep( &tape, y ); \
+        TEST_ASSERT( f64Equal( y.val, value, EPS ) ); \
+        TEST_ASSERT( f64Equal( f64RVAdjoint( &tape, x ), deriv, EPS ) ); \
+    } while (0)
+
+    CHECK_RV( f64RVSqrt( a ),       sqrt( 2.0 ),  1 / (2 * sqrt( 2.0 )), a );
+    CHECK_RV( f64RVPow( a, 3 ),     8.0,          12.0,                  a );
+    CHECK_RV( f64RVSin( a ),        sin( 2.0 ),   cos( 2.0 ),            a );
+    CHECK_RV( f64RVCos( a ),        cos( 2.0 ),   -sin( 2.0 ),           a );
+    CHECK_RV( f64RVTan( a ),        tan( 2.0 ),   1 / (cos( 2.0 ) * cos( 2.0 )), a );
+    CHECK_RV( f64RVAtan( a ),       atan( 2.0 ),  1 / 5.0,               a );
+    CHECK_RV( f64RVExp( a ),        exp( 2.0 ),   exp( 2.0 ),            a );
+    CHECK_RV( f64RVLog( a ),        log( 2.0 ),   0.5,                   a );
+    CHECK_RV( f64RVLogAbs( f64RVNeg( a ) ), log( 2.0 ), 0.5,             a );
+    CHECK_RV( f64RVSinh( a ),       sinh( 2.0 ),  cosh( 2.0 ),           a );
+    CHECK_RV( f64RVCosh( a ),       cosh( 2.0 ),  sinh( 2.0 ),           a );
+    CHECK_RV( f64RVTanh( a ),       tanh( 2.0 ),  1 - tanh( 2.0 ) * tanh( 2.0 ), a );
+    CHECK_RV( f64RVAtanh( b ),      atanh( 0.5 ), 1 / 0.75,              b );
+    CHECK_RV( f64RVDiv( a, b ),     4.0,          -8.0,                  b );
+    CHECK_RV( f64RVf64Div( 1, b ),  2.0,          -4.0,                  b );
+    CHECK_RV( f64RVMul( a, a ),     4.0,          4.0,                   a );
+
+#undef CHECK_RV
+
+    RVTapeFree( &tape );
+
+#undef EPS
+}
+#endif
@@ -0,0 +1,925 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Array kernels compiled once per instruction set and selected at runtime
+// from the host CPU's features, so one binary runs at full width on every
+// x86-64 machine without -march=native. The kernel bodies are plain loops,
+// vectorization is left to the compiler for each target. Every variant
+// rounds like the SSE2 one, so results do not depend on the host.
+//
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define SIMD_X86 1
+#else
+    #define SIMD_X86 0
+#endif
+
+
+typedef enum SimdIsa SimdIsa;
+enum SimdIsa {
+    SIMD_GENERIC,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_AVX512,
+    SIMD_NUM_ISAS,
+};
+
+
+/* C += alpha * op(A) * op(B) restricted to a range of rows of C */
+typedef struct blasGemmArgs blasGemmArgs;
+struct blasGemmArgs {
+    b32        transA;
+    b32        transB;
+    u32        p;
+    u32        m;
+    f64        alpha;
+    const f64 *a;
+    u32        lda;
+    const f64 *b;
+    u32        ldb;
+    f64       *c;
+    u32        ldc;
+};
+
+#define BLAS_KC 256  /* depth of a block of A columns / B rows */
+#define BLAS_NC 512  /* width of a block of B columns */
+
+
+/* y = alpha * x + y */
+typedef void SimdAxpyFun( u32 n, f64 alpha, const f64 *x, f64 *y );
+
+/* x' * y */
+typedef f64 SimdDotFun( u32 n, const f64 *x, const f64 *y );
+
+/* dual number arrays, dst = dst (op) src on .val and .dot */
+typedef void SimdDualFun( u32 n, const f64 *srcVal, const f64 *srcDot, f64 *dstVal, f64 *dstDot );
+
+/* dual number arrays, (val, dot) *= a */
+typedef void SimdDualScaleFun( u32 n, f64 a, f64 *val, f64 *dot );
+
+/* y = alpha * x + beta * y */
+typedef void SimdAxpbyFun( u32 n, f64 alpha, const f64 *x, f64 beta, f64 *y );
+
+/* x *= a */
+typedef void SimdScalFun( u32 n, f64 a, f64 *x );
+
+/* sum |x_i| */
+typedef f64 SimdAsumFun( u32 n, const f64 *x );
+
+/* sum x_i */
+typedef f64 SimdSumFun( u32 n, const f64 *x );
+
+/* sum v_i of a dual array, sum d_i goes to dot */
+typedef f64 SimdDualSumFun( u32 n, const f64 *v, const f64 *d, f64 *dot );
+
+/* y = exp(x) */
+typedef void SimdExpFun( u32 n, const f64 *x, f64 *y );
+
+/* x' a and x' b in one pass over x, x' b goes to xb */
+typedef f64 SimdDot2Fun( u32 n, const f64 *x, const f64 *a, const f64 *b, f64 *xb );
+
+/* log sum exp v_i of a dual array, the derivative goes to dot */
+typedef f64 SimdDualLseFun( u32 n, const f64 *v, const f64 *d, f64 *dot );
+
+/* elementwise maps of dual arrays, (ov, od) = f(v, d), may alias */
+typedef void SimdDualMapFun( u32 n, const f64 *v, const f64 *d, f64 *ov, f64 *od );
+
+/* (yv, yd) = alpha * (xv, xd) + beta * (yv, yd) */
+typedef void SimdDualAxpbyFun(
+    u32 n, f64 alpha, const f64 *xv, const f64 *xd, f64 beta, f64 *yv, f64 *yd
+);
+
+/* x' * y of dual arrays in one pass, the derivative goes to dot */
+typedef f64 SimdDualDotFun(
+    u32 n, const f64 *xv, const f64 *xd, const f64 *yv, const f64 *yd, f64 *dot
+);
+
+/* sum |v_i| of a dual array, the derivative sum sign(v_i) d_i goes to dot */
+typedef f64 SimdDualAsumFun( u32 n, const f64 *v, const f64 *d, f64 *dot );
+
+/* heavy ball step, v = mu * v + g, x -= lr * v */
+typedef void SimdMomentumFun( u32 n, f64 lr, f64 mu, const f64 *g, f64 *v, f64 *x );
+
+/* Adam step, m = b1 * m + (1 - b1) g, v = b2 * v + (1 - b2) g^2,
+ * x -= lr * m / (sqrt(v) + eps), lr includes the bias correction */
+typedef void SimdAdamFun(
+    u32 n, f64 lr, f64 b1, f64 b2, f64 eps, const f64 *g, f64 *m, f64 *v, f64 *x
+);
+
+
+typedef struct SimdKernels SimdKernels;
+struct SimdKernels {
+    SimdIsa           isa;
+    const char       *name;
+    ParallelFun      *gemmRows;
+    SimdAxpyFun      *axpy;
+    SimdDotFun       *dot;
+    SimdDualFun      *dualAdd;
+    SimdDualFun      *dualSub;
+    SimdDualFun      *dualMul;
+    SimdDualFun      *dualDiv;
+    SimdDualScaleFun *dualScale;
+    SimdAxpbyFun     *axpby;
+    SimdScalFun      *scal;
+    SimdAsumFun      *asum;
+    SimdSumFun       *sum;
+    SimdDualSumFun   *dualSum;
+    SimdExpFun       *exp;
+    SimdDot2Fun      *dot2;
+    SimdDualLseFun   *dualLse;
+    SimdDualMapFun   *dualSoftmax;
+    SimdDualMapFun   *dualLogSoftmax;
+    SimdDualMapFun   *dualLogSigmoid;
+    SimdDualAxpbyFun *dualAxpby;
+    SimdDualDotFun   *dualDot;
+    SimdDualAsumFun  *dualAsum;
+    SimdMomentumFun  *momentum;
+    SimdAdamFun      *adam;
+};
+
+static SimdKernels FVSimd;
+
+
+#define SIMD_KERNELS(suffix, isaEnum, target) \
+    target void \
+    simdGemmRows_##suffix( void *args, u32 start, u32 end ) \
+    { \
+        blasGemmArgs *g = (blasGemmArgs *) args; \
+        u32 m = g->m; \
+        u32 p = g->p; \
+        \
+        if ( ! g->transB ) { \
+            for ( u32 kk = 0; kk < m; kk += BLAS_KC ) { \
+                u32 kEnd = MIN( kk + BLAS_KC, m ); \
+                \
+                for ( u32 jj = 0; jj < p; jj += BLAS_NC ) { \
+                    u32 jEnd = MIN( jj + BLAS_NC, p ); \
+                    \
+                    for ( u32 i = start; i < end; ++i ) { \
+                        f64 *restrict rc = g->c + i * g->ldc; \
+                        \
+                        for ( u32 k = kk; k < kEnd; ++k ) { \
+                            f64 aik = g->alpha * ( g->transA ? g->a[k * g->lda + i] : g->a[i * g->lda + k] ); \
+                            const f64 *restrict rb = g->b + k * g->ldb; \
+                            \
+                            for ( u32 j = jj; j < jEnd; ++j ) { \
+                                rc[j] += aik * rb[j]; \
+                            } \
+                        } \
+                    } \
+                } \
+            } \
+        } \
+        else { \
+            /* B is stored p x m, each C(i, j) is a contiguous dot product */ \
+            for ( u32 i = start; i < end; ++i ) { \
+                f64 *restrict rc = g->c + i * g->ldc; \
+                \
+                for ( u32 j = 0; j < p; ++j ) { \
+                    const f64 *restrict rb = g->b + j * g->ldb; \
+                    f64 sum = 0; \
+                    \
+                    if ( g->transA ) { \
+                        for ( u32 k = 0; k < m; ++k ) { \
+                            sum += g->a[k * g->lda + i] * rb[k]; \
+                        } \
+                    } \
+                    else { \
+                        sum = simdDot_##suffix( m, g->a + i * g->lda, rb ); \
+                    } \
+                    rc[j] += g->alpha * sum; \
+                } \
+            } \
+        } \
+    } \
+    \
+    target void \
+    simdAxpy_##suffix( u32 n, f64 alpha, const f64 *restrict x, f64 *restrict y ) \
+    { \
+        for ( u32 i = 0; i < n; ++i ) { \
+            y[i] += alpha * x[i]; \
+        } \
+    } \
+    \
+    /* dual kernels read each element before writing it, src may alias dst */ \
+    target void \
+    simdDualAdd_##suffix( u32 n, const f64 *sv, const f64 *sd, f64 *dv, f64 *dd ) \
+    { \
+        for ( u32 i = 0; i < n; ++i ) { \
+            f64 v = sv[i]; \
+            f64 d = sd[i]; \
+            dv[i] += v; \
+            dd[i] += d; \
+        } \
+    } \
+    \
+    target void \
+    simdDualSub_##suffix( u32 n, const f64 *sv, const f64 *sd, f64 *dv, f64 *dd ) \
+    { \
+        for ( u32 i = 0; i < n; ++i ) { \
+            f64 v = sv[i]; \
+            f64 d = sd[i]; \
+            dv[i] -= v; \
+            dd[i] -= d; \
+        } \
+    } \
+    \
+    target void \
+    simdDualMul_##suffix( u32 n, const f64 *sv, const f64 *sd, f64 *dv, f64 *dd ) \
+    { \
+        for ( u32 i = 0; i < n; ++i ) { \
+            f64 v   = sv[i]; \
+            f64 d   = sd[i]; \
+            f64 tmp = dv[i]; \
+            f64 dot = dd[i]; \
+            dv[i] = v * tmp; \
+            dd[i] = v * dot + d * tmp; \
+        } \
+    } \
+    \
+    target void \
+    simdDualDiv_##suffix( u32 n, const f64 *sv, const f64 *sd, f64 *dv, f64 *dd ) \
+    { \
+        for ( u32 i = 0; i < n; ++i ) { \
+            f64 v   = sv[i]; \
+            f64 d   = sd[i]; \
+            f64 tmp = dv[i]; \
+            f64 dot = dd[i]; \
+            dv[i] = v / tmp; \
+            dd[i] = ( d * tmp - v * dot ) / ( tmp * tmp ); \
+        } \
+    } \
+    \
+    target void \
+    simdDualScale_##suffix( u32 n, f64 a, f64 *restrict val, f64 *restrict dot ) \
+    { \
+        for ( u32 i = 0; i < n; ++i ) { \
+            val[i] *= a; \
+            dot[i] *= a; \
+        } \
+    } \
+    \
+    target void \
+    simdAxpby_##suffix( u32 n, f64 alpha, const f64 *restrict x, f64 beta, f64 *restrict y ) \
+    { \
+        for ( u32 i = 0; i < n; ++i ) { \
+            y[i] = alpha * x[i] + beta * y[i]; \
+        } \
+    } \
+    \
+    target void \
+    simdScal_##suffix( u32 n, f64 a, f64 *restrict x ) \
+    { \
+        for ( u32 i = 0; i < n; ++i ) { \
+            x[i] *= a; \
+        } \
+    } \
+    \
+    target void \
+    simdDualAxpby_##suffix( \
+        u32 n, f64 alpha, const f64 *restrict xv, const f64 *restrict xd, \
+        f64 beta, f64 *restrict yv, f64 *restrict yd \
+    ) \
+    { \
+        for ( u32 i = 0; i < n; ++i ) { \
+            yv[i] = alpha * xv[i] + beta * yv[i]; \
+            yd[i] = alpha * xd[i] + beta * yd[i]; \
+        } \
+    } \
+    \
+    target void \
+    simdMomentum_##suffix( \
+        u32 n, f64 lr, f64 mu, const f64 *restrict g, f64 *restrict v, f64 *restrict x \
+    ) \
+    { \
+        for ( u32 i = 0; i < n; ++i ) { \
+            f64 vi = mu * v[i] + g[i]; \
+            v[i]   = vi; \
+            x[i]  -= lr * vi; \
+        } \
+    } \
+    \
+    target void \
+    simdAdam_##suffix( \
+        u32 n, f64 lr, f64 b1, f64 b2, f64 eps, const f64 *restrict g, \
+        f64 *restrict m, f64 *restrict v, f64 *restrict x \
+    ) \
+    { \
+        for ( u32 i = 0; i < n; ++i ) { \
+            f64 gi = g[i]; \
+            f64 mi = b1 * m[i] + (1 - b1) * gi; \
+            f64 vi = b2 * v[i] + (1 - b2) * gi * gi; \
+            m[i]   = mi; \
+            v[i]   = vi; \
+            x[i]  -= lr * mi / (sqrt( vi ) + eps); \
+        } \
+    } \
+    \
+    SimdKernels simdKernels_##suffix( void ) \
+    { \
+        return (SimdKernels) { \
+            .isa       = isaEnum, \
+            .name      = #suffix, \
+            .gemmRows  = simdGemmRows_##suffix, \
+            .axpy      = simdAxpy_##suffix, \
+            .dot       = simdDot_##suffix, \
+            .dualAdd   = simdDualAdd_##suffix, \
+            .dualSub   = simdDualSub_##suffix, \
+            .dualMul   = simdDualMul_##suffix, \
+            .dualDiv   = simdDualDiv_##suffix, \
+            .dualScale = simdDualScale_##suffix, \
+            .axpby     = simdAxpby_##suffix, \
+            .scal      = simdScal_##suffix, \
+            .asum      = simdAsum_##suffix, \
+            .sum       = simdSum_##suffix, \
+            .dualSum   = simdDualSum_##suffix, \
+            .exp            = simdExp_##suffix, \
+            .dot2           = simdDot2_##suffix, \
+            .dualLse        = simdDualLse_##suffix, \
+            .dualSoftmax    = simdDualSoftmax_##suffix, \
+            .dualLogSoftmax = simdDualLogSoftmax_##suffix, \
+            .dualLogSigmoid = simdDualLogSigmoid_##suffix, \
+            .dualAxpby = simdDualAxpby_##suffix, \
+            .dualDot   = simdDualDot_##suffix, \
+            .dualAsum  = simdDualAsum_##suffix, \
+            .momentum  = simdMomentum_##suffix, \
+            .adam      = simdAdam_##suffix, \
+        }; \
+    }
+
+/* exp without calls into libm so that the loops around it vectorize.
+ * x = k ln2 + r with |r| <= ln2 / 2 (Cody-Waite), e^r by its degree 13
+ * Taylor polynomial and 2^k assembled in the exponent bits. Accurate to a
+ * few ulp, results below e^-708 are flushed to zero. */
+#define SIMD_EXP_MAGIC 6755399441055744.0  /* 1.5 * 2^52 */
+
+#define SIMD_EXP(suffix, target) \
+    target static inline f64 \
+    simdExp1_##suffix( f64 x ) \
+    { \
+        f64 xc = x < -708.0 ? -708.0 : (x > 710.0 ? 710.0 : x); \
+        f64 t  = xc * 1.4426950408889634 + SIMD_EXP_MAGIC; \
+        f64 kf = t - SIMD_EXP_MAGIC; \
+        f64 r  = (xc - kf * 6.93147180369123816490E-01) - kf * 1.90821492927058770002E-10; \
+        \
+        f64 p = 1.0 / 6227020800.0; \
+        p = p * r + 1.0 / 479001600.0; \
+        p = p * r + 1.0 / 39916800.0; \
+        p = p * r + 1.0 / 3628800.0; \
+        p = p * r + 1.0 / 362880.0; \
+        p = p * r + 1.0 / 40320.0; \
+        p = p * r + 1.0 / 5040.0; \
+        p = p * r + 1.0 / 720.0; \
+        p = p * r + 1.0 / 120.0; \
+        p = p * r + 1.0 / 24.0; \
+        p = p * r + 1.0 / 6.0; \
+        p = p * r + 0.5; \
+        p = p * r + 1.0; \
+        p = p * r + 1.0; \
+        \
+        /* the low bits of t hold k, scale = 2^(k-1) stays normal for k = 1024 */ \
+        u64 bits; \
+        memcpy( &bits, &t, sizeof(f64) ); \
+        bits = (bits - 0x4338000000000000ull + 1022) << 52; \
+        f64 scale; \
+        memcpy( &scale, &bits, sizeof(f64) ); \
+        \
+        return x < -708.0 ? 0.0 : p * scale * 2.0; \
+    } \
+    \
+    target void \
+    simdExp_##suffix( u32 n, const f64 *restrict x, f64 *restrict y ) \
+    { \
+        for ( u32 i = 0; i < n; ++i ) { \
+            y[i] = simdExp1_##suffix( x[i] ); \
+        } \
+    } \
+    \
+    target static inline f64 \
+    simdMax_##suffix( u32 n, const f64 *v ) \
+    { \
+        f64 m[8] = { -INFINITY, -INFINITY, -INFINITY, -INFINITY, \
+                     -INFINITY, -INFINITY, -INFINITY, -INFINITY }; \
+        u32 i = 0; \
+        for ( ; i + 8 <= n; i += 8 ) { \
+            for ( u32 l = 0; l < 8; ++l ) { \
+                m[l] = v[i + l] > m[l] ? v[i + l] : m[l]; \
+            } \
+        } \
+        for ( ; i < n; ++i ) { \
+            m[0] = v[i] > m[0] ? v[i] : m[0]; \
+        } \
+        for ( u32 l = 1; l < 8; ++l ) { \
+            m[0] = m[l] > m[0] ? m[l] : m[0]; \
+        } \
+        return m[0]; \
+    } \
+    \
+    /* shifted by the maximum, the sums are s = sum e_i and t = sum e_i d_i */ \
+    target f64 \
+    simdDualLse_##suffix( u32 n, const f64 *restrict v, const f64 *restrict d, f64 *dot ) \
+    { \
+        f64 mx = simdMax_##suffix( n, v ); \
+        if ( mx == -INFINITY || mx == INFINITY ) { \
+            *dot = 0; \
+            return mx; \
+        } \
+        f64 s[8] = {0}; \
+        f64 t[8] = {0}; \
+        u32 i = 0; \
+        for ( ; i + 8 <= n; i += 8 ) { \
+            for ( u32 l = 0; l < 8; ++l ) { \
+                f64 e = simdExp1_##suffix( v[i + l] - mx ); \
+                s[l] += e; \
+                t[l] += e * d[i + l]; \
+            } \
+        } \
+        for ( ; i < n; ++i ) { \
+            f64 e = simdExp1_##suffix( v[i] - mx ); \
+            s[0] += e; \
+            t[0] += e * d[i]; \
+        } \
+        f64 ss = ((s[0] + s[4]) + (s[1] + s[5])) + ((s[2] + s[6]) + (s[3] + s[7])); \
+        f64 tt = ((t[0] + t[4]) + (t[1] + t[5])) + ((t[2] + t[6]) + (t[3] + t[7])); \
+        *dot = tt / ss; \
+        return mx + log( ss ); \
+    } \
+    \
+    /* p = e / s, dp = p (d - t / s) */ \
+    target void \
+    simdDualSoftmax_##suffix( u32 n, const f64 *v, const f64 *d, f64 *ov, f64 *od ) \
+    { \
+        f64 mx = simdMax_##suffix( n, v ); \
+        f64 s  = 0; \
+        f64 t  = 0; \
+        for ( u32 i = 0; i < n; ++i ) { \
+            f64 e = simdExp1_##suffix( v[i] - mx ); \
+            t    += e * d[i]; \
+            s    += e; \
+            ov[i] = e; \
+        } \
+        f64 inv = 1.0 / s; \
+        f64 mu  = t * inv; \
+        for ( u32 i = 0; i < n; ++i ) { \
+            f64 p = ov[i] * inv; \
+            ov[i] = p; \
+            od[i] = p * (d[i] - mu); \
+        } \
+    } \
+    \
+    target void \
+    simdDualLogSoftmax_##suffix( u32 n, const f64 *v, const f64 *d, f64 *ov, f64 *od ) \
+    { \
+        f64 mu; \
+        f64 lse = simdDualLse_##suffix( n, v, d, &mu ); \
+        for ( u32 i = 0; i < n; ++i ) { \
+            ov[i] = v[i] - lse; \
+            od[i] = d[i] - mu; \
+        } \
+    } \
+    \
+    /* log sigmoid(v) = min(v, 0) - log(1 + e^-|v|), the derivative is sigmoid(-v) */ \
+    target void \
+    simdDualLogSigmoid_##suffix( u32 n, const f64 *v, const f64 *d, f64 *ov, f64 *od ) \
+    { \
+        for ( u32 i = 0; i < n; ++i ) { \
+            f64 x = v[i]; \
+            f64 e = simdExp1_##suffix( -fabs( x ) ); \
+            f64 q = 1.0 / (1.0 + e); \
+            ov[i] = (x < 0 ? x : 0.0) - log1p( e ); \
+            od[i] = d[i] * (x >= 0 ? e * q : q); \
+        } \
+    }
+
+
+/* eight independent partial sums so the reductions vectorize without reassociation */
+#define SIMD_DOT(suffix, target) \
+    target f64 \
+    simdDot_##suffix( u32 n, const f64 *restrict x, const f64 *restrict y ) \
+    { \
+        f64 s[8] = {0}; \
+        u32 i = 0; \
+        for ( ; i + 8 <= n; i += 8 ) { \
+            for ( u32 l = 0; l < 8; ++l ) { \
+                s[l] += x[i + l] * y[i + l]; \
+            } \
+        } \
+        for ( ; i < n; ++i ) { \
+            s[0] += x[i] * y[i]; \
+        } \
+        return ((s[0] + s[4]) + (s[1] + s[5])) + ((s[2] + s[6]) + (s[3] + s[7])); \
+    } \
+    \
+    target f64 \
+    simdDot2_##suffix( \
+        u32 n, const f64 *restrict x, const f64 *restrict a, const f64 *restrict b, f64 *xb \
+    ) \
+    { \
+        f64 s[8] = {0}; \
+        f64 t[8] = {0}; \
+        u32 i = 0; \
+        for ( ; i + 8 <= n; i += 8 ) { \
+            for ( u32 l = 0; l < 8; ++l ) { \
+                s[l] += x[i + l] * a[i + l]; \
+                t[l] += x[i + l] * b[i + l]; \
+            } \
+        } \
+        for ( ; i < n; ++i ) { \
+            s[0] += x[i] * a[i]; \
+            t[0] += x[i] * b[i]; \
+        } \
+        *xb = ((t[0] + t[4]) + (t[1] + t[5])) + ((t[2] + t[6]) + (t[3] + t[7])); \
+        return ((s[0] + s[4]) + (s[1] + s[5])) + ((s[2] + s[6]) + (s[3] + s[7])); \
+    } \
+    \
+    target f64 \
+    simdSum_##suffix( u32 n, const f64 *restrict x ) \
+    { \
+        f64 s[8] = {0}; \
+        u32 i = 0; \
+        for ( ; i + 8 <= n; i += 8 ) { \
+            for ( u32 l = 0; l < 8; ++l ) { \
+                s[l] += x[i + l]; \
+            } \
+        } \
+        for ( ; i < n; ++i ) { \
+            s[0] += x[i]; \
+        } \
+        return ((s[0] + s[4]) + (s[1] + s[5])) + ((s[2] + s[6]) + (s[3] + s[7])); \
+    } \
+    \
+    target f64 \
+    simdDualSum_##suffix( u32 n, const f64 *restrict v, const f64 *restrict d, f64 *dot ) \
+    { \
+        *dot = simdSum_##suffix( n, d ); \
+        return simdSum_##suffix( n, v ); \
+    } \
+    \
+    target f64 \
+    simdAsum_##suffix( u32 n, const f64 *restrict x ) \
+    { \
+        f64 s[8] = {0}; \
+        u32 i = 0; \
+        for ( ; i + 8 <= n; i += 8 ) { \
+            for ( u32 l = 0; l < 8; ++l ) { \
+                s[l] += fabs( x[i + l] ); \
+            } \
+        } \
+        for ( ; i < n; ++i ) { \
+            s[0] += fabs( x[i] ); \
+        } \
+        return ((s[0] + s[4]) + (s[1] + s[5])) + ((s[2] + s[6]) + (s[3] + s[7])); \
+    } \
+    \
+    target f64 \
+    simdDualDot_##suffix( \
+        u32 n, const f64 *restrict xv, const f64 *restrict xd, \
+        const f64 *restrict yv, const f64 *restrict yd, f64 *dot \
+    ) \
+    { \
+        f64 s[8] = {0}; \
+        f64 t[8] = {0}; \
+        u32 i = 0; \
+        for ( ; i + 8 <= n; i += 8 ) { \
+            for ( u32 l = 0; l < 8; ++l ) { \
+                s[l] += xv[i + l] * yv[i + l]; \
+                t[l] += xd[i + l] * yv[i + l] + xv[i + l] * yd[i + l]; \
+            } \
+        } \
+        for ( ; i < n; ++i ) { \
+            s[0] += xv[i] * yv[i]; \
+            t[0] += xd[i] * yv[i] + xv[i] * yd[i]; \
+        } \
+        *dot = ((t[0] + t[4]) + (t[1] + t[5])) + ((t[2] + t[6]) + (t[3] + t[7])); \
+        return ((s[0] + s[4]) + (s[1] + s[5])) + ((s[2] + s[6]) + (s[3] + s[7])); \
+    } \
+    \
+    target f64 \
+    simdDualAsum_##suffix( u32 n, const f64 *restrict v, const f64 *restrict d, f64 *dot ) \
+    { \
+        f64 s[8] = {0}; \
+        f64 t[8] = {0}; \
+        u32 i = 0; \
+        for ( ; i + 8 <= n; i += 8 ) { \
+            for ( u32 l = 0; l < 8; ++l ) { \
+                s[l] += fabs( v[i + l] ); \
+                t[l] += v[i + l] < 0 ? -d[i + l] : d[i + l]; \
+            } \
+        } \
+        for ( ; i < n; ++i ) { \
+            s[0] += fabs( v[i] ); \
+            t[0] += v[i] < 0 ? -d[i] : d[i]; \
+        } \
+        *dot = ((t[0] + t[4]) + (t[1] + t[5])) + ((t[2] + t[6]) + (t[3] + t[7])); \
+        return ((s[0] + s[4]) + (s[1] + s[5])) + ((s[2] + s[6]) + (s[3] + s[7])); \
+    }
+
+
+/* The kernels are compiled without contracting a * b + c into fused
+ * multiply-adds. FMA rounds once where SSE2 rounds twice, so a contracted
+ * AVX2 kernel would not reproduce the SSE2 results bit for bit. */
+#if defined(__clang__)
+    #pragma float_control(push)
+    #pragma clang fp contract(off)
+#elif defined(__GNUC__)
+    #pragma GCC push_options
+    #pragma GCC optimize("fp-contract=off")
+#endif
+
+#if SIMD_X86
+    #define SIMD_TARGET_SSE2   __attribute__((target("sse2")))
+    #define SIMD_TARGET_AVX2   __attribute__((target("avx2,fma")))
+    #define SIMD_TARGET_AVX512 __attribute__((target("avx512f,avx512dq,avx2,fma")))
+
+    SIMD_EXP(sse2, SIMD_TARGET_SSE2)
+    SIMD_DOT(sse2, SIMD_TARGET_SSE2)
+    SIMD_KERNELS(sse2, SIMD_SSE2, SIMD_TARGET_SSE2)
+
+    SIMD_EXP(avx2, SIMD_TARGET_AVX2)
+    SIMD_DOT(avx2, SIMD_TARGET_AVX2)
+    SIMD_KERNELS(avx2, SIMD_AVX2, SIMD_TARGET_AVX2)
+
+    SIMD_EXP(avx512, SIMD_TARGET_AVX512)
+    SIMD_DOT(avx512, SIMD_TARGET_AVX512)
+    SIMD_KERNELS(avx512, SIMD_AVX512, SIMD_TARGET_AVX512)
+#else
+    SIMD_EXP(generic, )
+    SIMD_DOT(generic, )
+    SIMD_KERNELS(generic, SIMD_GENERIC, )
+#endif
+
+#if defined(__clang__)
+    #pragma float_control(pop)
+#elif defined(__GNUC__)
+    #pragma GCC pop_options
+#endif
+
+
+/* widest instruction set supported by the host CPU and OS */
+SimdIsa SimdDetectIsa( void )
+{
+#if SIMD_X86
+    __builtin_cpu_init();
+
+    if ( __builtin_cpu_supports( "avx512f" ) && __builtin_cpu_supports( "avx512dq" ) ) {
+        return SIMD_AVX512;
+    }
+    if ( __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" ) ) {
+        return SIMD_AVX2;
+    }
+    return SIMD_SSE2;
+#else
+    return SIMD_GENERIC;
+#endif
+}
+
+
+/* returns 0 and keeps the current kernels if the host cannot run isa */
+b32 SimdSetIsa( SimdIsa isa )
+{
+#if SIMD_X86
+    if ( isa == SIMD_GENERIC || isa > SimdDetectIsa() ) {
+        return 0;
+    }
+
+    switch ( isa ) {
+        case SIMD_SSE2:   FVSimd = simdKernels_sse2();   break;
+        case SIMD_AVX2:   FVSimd = simdKernels_avx2();   break;
+        case SIMD_AVX512: FVSimd = simdKernels_avx512(); break;
+        default: return 0;
+    }
+#else
+    if ( isa != SIMD_GENERIC ) {
+        return 0;
+    }
+    FVSimd = simdKernels_generic();
+#endif
+
+    return 1;
+}
+
+
+/* resolves the kernel table once, FV_ISA=sse2|avx2|avx512 caps the choice */
+void InitializeSimd( void )
+{
+    SimdIsa isa = SimdDetectIsa();
+
+    const char *env = getenv( "FV_ISA" );
+    if ( env ) {
+        if      ( strcmp( env, "sse2" )   == 0 ) isa = MIN( isa, SIMD_SSE2 );
+        else if ( strcmp( env, "avx2" )   == 0 ) isa = MIN( isa, SIMD_AVX2 );
+        else if ( strcmp( env, "avx512" ) == 0 ) isa = MIN( isa, SIMD_AVX512 );
+    }
+
+    SimdSetIsa( isa );
+}
+
+
+Inline
+void simdEnsureKernels( void )
+{
+    if ( ! FVSimd.gemmRows ) {
+        InitializeSimd();
+    }
+}
+
+
+/* runs the kernels of k on x and y (n >= 512) and writes every result to
+ * out, which holds 20 n + 160 values */
+void test_simd_run( SimdKernels k, u32 n, const f64 *x, const f64 *y, f64 *out )
+{
+    f64 *o = out;
+    f64  t;
+
+    *o++ = k.dot( n, x, y );
+    *o++ = k.dot2( n, x, y, x, &t );           *o++ = t;
+    *o++ = k.sum( n, y );
+    *o++ = k.asum( n, y );
+    *o++ = k.dualSum( n, x, y, &t );           *o++ = t;
+    *o++ = k.dualDot( n, x, y, y, x, &t );     *o++ = t;
+    *o++ = k.dualAsum( n, y, x, &t );          *o++ = t;
+    *o++ = k.dualLse( n, x, y, &t );           *o++ = t;
+
+    k.exp( n, x, o );                          o += n;
+    k.dualSoftmax( n, x, y, o, o + n );        o += 2*n;
+    k.dualLogSoftmax( n, x, y, o, o + n );     o += 2*n;
+    k.dualLogSigmoid( n, y, x, o, o + n );     o += 2*n;
+
+    memcpy( o, y, n * sizeof(f64) );
+    k.axpby( n, 0.3, x, -1.7, o );             o += n;
+    memcpy( o, y, n * sizeof(f64) );
+    k.axpy( n, 0.3, x, o );                    o += n;
+
+    memcpy( o, x, n * sizeof(f64) );
+    memcpy( o + n, y, n * sizeof(f64) );
+    k.dualMul( n, y, x, o, o + n );            o += 2*n;
+    memcpy( o, x, n * sizeof(f64) );
+    memcpy( o + n, y, n * sizeof(f64) );
+    k.dualDiv( n, y, x, o, o + n );            o += 2*n;
+    memcpy( o, x, n * sizeof(f64) );
+    memcpy( o + n, y, n * sizeof(f64) );
+    k.dualAxpby( n, 0.3, y, x, -1.7, o, o + n ); o += 2*n;
+
+    memcpy( o, y, n * sizeof(f64) );
+    memcpy( o + n, x, n * sizeof(f64) );
+    k.momentum( n, 0.1, 0.9, x, o, o + n );    o += 2*n;
+
+    for ( u32 i=0; i<n; ++i ) {
+        o[i]       = y[i];
+        o[n + i]   = y[i] * y[i];
+        o[2*n + i] = x[i];
+    }
+    k.adam( n, 0.01, 0.9, 0.999, 1E-8, x, o, o + n, o + 2*n );
+    o += 3*n;
+
+    /* 8 x 64 times 64 x 8, then times the transpose of an 8 x 64 */
+    for ( u32 transB=0; transB<2; ++transB ) {
+        blasGemmArgs g = {
+            .transA = 0, .transB = transB, .p = 8, .m = 64, .alpha = 0.7,
+            .a = x, .lda = 64, .b = y, .ldb = transB ? 64 : 8, .c = o, .ldc = 8
+        };
+        memset( o, 0, 64 * sizeof(f64) );
+        k.gemmRows( &g, 0, 8 );
+        o += 64;
+    }
+}
+
+#if TEST
+void test_simd_dispatch()
+{
+#define EPS 1E-12
+
+    u32 N = 37;
+
+    f64 x[37];
+    f64 y[37];
+    f64 v[37];
+    f64 d[37];
+
+    f64 ref = 0;
+    for ( u32 i=0; i<N; ++i ) {
+        x[i] = 0.5 + i;
+        y[i] = 1.0 / (i + 1);
+        ref += x[i] * y[i];
+    }
+
+    /* every variant the host can run agrees with the scalar reference */
+    for ( u32 isa=0; isa<SIMD_NUM_ISAS; ++isa ) {
+
+        if ( ! SimdSetIsa( isa ) ) {
+            continue;
+        }
+
+        TEST_ASSERT( FVSimd.isa == isa );
+        TEST_ASSERT( f64Equal( FVSimd.dot( N, x, y ), ref, EPS ) );
+
+        for ( u32 i=0; i<N; ++i ) {
+            v[i] = y[i];
+            d[i] = 1.0;
+        }
+
+        FVSimd.dualMul( N, x, x, v, d );
+
+        for ( u32 i=0; i<N; ++i ) {
+            TEST_ASSERT( f64Equal( v[i], x[i] * y[i], EPS ) );
+            TEST_ASSERT( f64Equal( d[i], x[i] + x[i] * y[i], EPS ) );
+        }
+
+        /* d(x'v) = x'd + x'v with dx = x */
+        f64 dDot;
+        f64 vDot = FVSimd.dualDot( N, x, x, v, d, &dDot );
+        f64 dRef = 0;
+        for ( u32 i=0; i<N; ++i ) {
+            dRef += x[i] * v[i] + x[i] * d[i];
+        }
+        TEST_ASSERT( f64Equal( vDot, FVSimd.dot( N, x, v ), EPS ) );
+        TEST_ASSERT( f64Equal( dDot, dRef, EPS ) );
+
+        FVSimd.dualAxpby( N, -1.0, x, x, 2.0, v, d );
+        FVSimd.scal( N, 0.5, v );
+
+        for ( u32 i=0; i<N; ++i ) {
+            TEST_ASSERT( f64Equal( v[i], x[i] * y[i] - 0.5 * x[i], EPS ) );
+            TEST_ASSERT( f64Equal( d[i], x[i] + 2 * x[i] * y[i], EPS ) );
+        }
+
+        f64 aDot;
+        TEST_ASSERT( f64Equal( FVSimd.asum( N, v ), FVSimd.dualAsum( N, v, d, &aDot ), EPS ) );
+
+        /* optimizer steps with gradient y from zero state */
+        f64 mo[37] = {0};
+        f64 vo[37] = {0};
+        for ( u32 i=0; i<N; ++i ) {
+            v[i] = x[i];
+            d[i] = x[i];
+        }
+
+        FVSimd.momentum( N, 0.1, 0.9, y, mo, v );
+        FVSimd.momentum( N, 0.1, 0.9, y, mo, v );
+        FVSimd.adam( N, 0.01, 0.9, 0.999, 0.0, y, mo, vo, d );
+
+        for ( u32 i=0; i<N; ++i ) {
+            TEST_ASSERT( f64Equal( v[i], x[i] - 0.29 * y[i], EPS ) );
+            TEST_ASSERT( f64Equal( mo[i], 1.9 * 0.9 * y[i] + 0.1 * y[i], EPS ) );
+            TEST_ASSERT( f64Equal( vo[i], 0.001 * y[i] * y[i], EPS ) );
+            TEST_ASSERT( f64Equal( d[i], x[i] - 0.01 * mo[i] / sqrt( vo[i] ), EPS ) );
+        }
+
+        /* exp over the whole range against libm, relative error */
+        f64 ex[9] = { -745.0, -708.5, -300.25, -1.0, 0.0, 1E-10, 0.3465, 42.0, 709.7 };
+        f64 ey[9];
+        FVSimd.exp( 9, ex, ey );
+
+        TEST_ASSERT( ey[0] == 0.0 );
+        for ( u32 i=2; i<9; ++i ) {
+            TEST_ASSERT( fabs( ey[i] - exp( ex[i] ) ) <= 4E-16 * exp( ex[i] ) );
+        }
+        ex[0] = 710.0;
+        FVSimd.exp( 1, ex, ey );
+        TEST_ASSERT( ey[0] == INFINITY );
+    }
+
+    InitializeSimd();
+
+    TEST_ASSERT( FVSimd.gemmRows && FVSimd.isa <= SimdDetectIsa() );
+
+#undef EPS
+}
+#endif
+
+
+#if TEST
+void test_simd_bitwise()
+{
+#if SIMD_X86
+    u32 N = 1003;
+
+    f64 *x   = (f64 *) Alloc( DefaultAllocator, N * sizeof(f64) );
+    f64 *y   = (f64 *) Alloc( DefaultAllocator, N * sizeof(f64) );
+    f64 *ref = (f64 *) Alloc( DefaultAllocator, (20 * N + 160) * sizeof(f64) );
+    f64 *out = (f64 *) Alloc( DefaultAllocator, (20 * N + 160) * sizeof(f64) );
+
+    for ( u32 i=0; i<N; ++i ) {
+        x[i] = 3 * sin( 0.7 * i ) + 0.1;
+        y[i] = cos( 1.3 * i ) / 3;
+    }
+
+    /* wider kernels give the SSE2 results bit for bit, no contraction */
+    test_simd_run( simdKernels_sse2(), N, x, y, ref );
+
+    if ( SimdDetectIsa() >= SIMD_AVX2 ) {
+        test_simd_run( simdKernels_avx2(), N, x, y, out );
+        TEST_ASSERT( memcmp( out, ref, (20 * N + 160) * sizeof(f64) ) == 0 );
+    }
+    if ( SimdDetectIsa() >= SIMD_AVX512 ) {
+        test_simd_run( simdKernels_avx512(), N, x, y, out );
+        TEST_ASSERT( memcmp( out, ref, (20 * N + 160) * sizeof(f64) ) == 0 );
+    }
+
+    Free( DefaultAllocator, x );
+    Free( DefaultAllocator, y );
+    Free( DefaultAllocator, ref );
+    Free( DefaultAllocator, out );
+#endif
+}
+#endif
@@ -0,0 +1,219 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Compressed sparse row matrices of the dod build, the generic SPMAT_*
+// macros are in spmat.h and instantiated for f64 here. A sparse dod
+// variable f64FVSpMat shares one sparsity pattern between its value and
+// tangent parts.
+//
+
+#include "spmat.h"
+
+
+SPMAT_DECL(f64);
+SPMAT_MAKE(f64);
+SPMAT_FREE(f64);
+SPMAT_FROM_DENSE(f64);
+SPMAT_TO_DENSE(f64);
+SPMAT_TRANSPOSE(f64);
+SPMAT_MUL(f64, f64Add, f64Mul);
+SPMAT_TMUL(f64, f64Add, f64Mul);
+
+
+/* sparse dod variable, val and dot share rowPtr and colIdx */
+
+typedef struct f64FVSpMat f64FVSpMat;
+struct f64FVSpMat {
+    u32  dim0;
+    u32  dim1;
+    u32  nnz;
+    u32 *rowPtr;
+    u32 *colIdx;
+    f64 *val;
+    f64 *dot;
+};
+
+/* takes the pattern of s, val is copied from s and dot is zeroed */
+f64FVSpMat f64FVSpMatMake( Allocator al, f64SpMat s )
+{
+    f64FVSpMat m;
+    m.dim0   = s.dim0;
+    m.dim1   = s.dim1;
+    m.nnz    = s.nnz;
+    m.rowPtr = (u32 *) Alloc( al, (s.dim0 + 1) * sizeof(u32) );
+    m.colIdx = (u32 *) Alloc( al, MAX( s.nnz, 1 ) * sizeof(u32) );
+    m.val    = (f64 *) Alloc( al, MAX( s.nnz, 1 ) * sizeof(f64) );
+    m.dot    = (f64 *) Alloc( al, MAX( s.nnz, 1 ) * sizeof(f64) );
+
+    memcpy( m.rowPtr, s.rowPtr, (s.dim0 + 1) * sizeof(u32) );
+    memcpy( m.colIdx, s.colIdx, s.nnz * sizeof(u32) );
+    memcpy( m.val, s.data, s.nnz * sizeof(f64) );
+    memset( m.dot, 0, s.nnz * sizeof(f64) );
+
+    return m;
+}
+
+void f64FVSpMatFree( Allocator al, f64FVSpMat *m )
+{
+    Free( al, m->rowPtr );
+    Free( al, m->colIdx );
+    Free( al, m->val );
+    Free( al, m->dot );
+}
+
+/* f64SpMat views of the two parts */
+Inline
+f64SpMat f64FVSpMatPart( f64FVSpMat m, f64 *data )
+{
+    f64SpMat s;
+    s.dim0   = m.dim0;
+    s.dim1   = m.dim1;
+    s.nnz    = m.nnz;
+    s.rowPtr = m.rowPtr;
+    s.colIdx = m.colIdx;
+    s.data   = data;
+    return s;
+}
+
+/* dst = a * b */
+void f64FVSpMatMul( f64FVSpMat a, f64FVar b, f64FVar dst )
+{
+    ASSERT( a.dim0 == dst.dim0 && a.dim1 == b.dim0 && b.dim1 == dst.dim1 );
+
+    f64SpMat av = f64FVSpMatPart( a, a.val );
+    f64SpMat ad = f64FVSpMatPart( a, a.dot );
+
+    f64SpMatMul(   ad, b.val, dst.dot );
+    f64SpMatMulIP( av, b.dot, dst.dot );
+
+    f64SpMatMul( av, b.val, dst.val );
+}
+
+/* dst = a' * b */
+void f64FVSpMatTMul( f64FVSpMat a, f64FVar b, f64FVar dst )
+{
+    ASSERT( a.dim1 == dst.dim0 && a.dim0 == b.dim0 && b.dim1 == dst.dim1 );
+
+    f64SpMat av = f64FVSpMatPart( a, a.val );
+    f64SpMat ad = f64FVSpMatPart( a, a.dot );
+
+    f64SpMatTMul(   ad, b.val, dst.dot );
+    f64SpMatTMulIP( av, b.dot, dst.dot );
+
+    f64SpMatTMul( av, b.val, dst.val );
+}
+
+
+#if TEST
+void test_sparse()
+{
+#define EPS 1E-10
+
+    u32 N = 300;
+    u32 M = 200;
+    u32 P = 70;
+
+    b32 ownPool = FVThreadPool.numThreads == 0;
+    if ( ownPool ) {
+        InitializeParallel( 4 );
+    }
+
+    Xorshift1024 rng = Xorshift1024Init( 11 );
+
+    f64Mat dense = f64MatZeroMake( DefaultAllocator, N, M );
+    for ( u32 i=0; i<N*M; ++i ) {
+        if ( rngXorshift1024NextFloat( &rng ) < 0.05 ) {
+            dense.data[i] = rngXorshift1024NextFloat( &rng ) - 0.5;
+        }
+    }
+
+    f64SpMat a  = f64SpMatFromDense( DefaultAllocator, dense );
+    f64SpMat at = f64SpMatTranspose( DefaultAllocator, a );
+
+    f64Mat back = f64MatMake( DefaultAllocator, N, M );
+    f64SpMatToDense( a, back );
+    TEST_ASSERT( f64MatEqual( back, dense, EPS ) );
+
+    f64FVar b  = f64FVMake( DefaultAllocator, M, P );
+    f64FVar bt = f64FVMake( DefaultAllocator, N, P );
+    for ( u32 i=0; i<M*P; ++i ) {
+        b.val.data[i] = rngXorshift1024NextFloat( &rng );
+        b.dot.data[i] = rngXorshift1024NextFloat( &rng );
+    }
+    for ( u32 i=0; i<N*P; ++i ) {
+        bt.val.data[i] = rngXorshift1024NextFloat( &rng );
+        bt.dot.data[i] = rngXorshift1024NextFloat( &rng );
+    }
+
+    f64Mat c   = f64MatMake( DefaultAllocator, N, P );
+    f64Mat ref = f64MatMake( DefaultAllocator, N, P );
+    f64Mat ct  = f64MatMake( DefaultAllocator, M, P );
+    f64Mat rt  = f64MatMake( DefaultAllocator, M, P );
+
+    /* large enough to be split into several chunks on the pool */
+    TEST_ASSERT( (u64) a.nnz * P >= SPMAT_MIN_PARALLEL_NNZ );
+    TEST_ASSERT( ParallelNumChunks( N, ParallelChunkSize( N, 16, 8 ) ) > 1 );
+    TEST_ASSERT( ParallelNumChunks( P, ParallelChunkSize( P, 8, 1 ) ) > 1 );
+
+    f64SpMatMul( a, b.val, c );
+    f64BlasMul( dense, b.val, ref );
+    TEST_ASSERT( f64MatEqual( c, ref, EPS ) );
+
+    /* a' b directly and through the transposed pattern */
+    f64SpMatTMul( a, bt.val, ct );
+    f64SpMatMul( at, bt.val, rt );
+    TEST_ASSERT( f64MatEqual( ct, rt, EPS ) );
+
+    f64MatGemm( 1, 0, 1.0, dense, bt.val, 0.0, rt );
+    TEST_ASSERT( f64MatEqual( ct, rt, EPS ) );
+
+    /* dual products against the dense dod product */
+    f64FVSpMat fa = f64FVSpMatMake( DefaultAllocator, a );
+    f64FVar    fd = f64FVMake( DefaultAllocator, N, M );
+
+    for ( u32 k=0; k<fa.nnz; ++k ) {
+        fa.dot[k] = rngXorshift1024NextFloat( &rng );
+    }
+    f64SpMatToDense( a, fd.val );
+    f64SpMatToDense( f64FVSpMatPart( fa, fa.dot ), fd.dot );
+
+    f64FVar y  = f64FVMake( DefaultAllocator, N, P );
+    f64FVar yr = f64FVMake( DefaultAllocator, N, P );
+
+    f64FVSpMatMul( fa, b, y );
+    f64FVMatMul( fd, b, yr );
+    TEST_ASSERT( f64FVEqual( y, yr, EPS ) );
+
+    f64FVar z  = f64FVMake( DefaultAllocator, M, P );
+    f64FVar zr = f64FVMake( DefaultAllocator, M, P );
+
+    f64FVSpMatTMul( fa, bt, z );
+    f64MatGemm( 1, 0, 1.0, fd.val, bt.val, 0.0, zr.val );
+    f64MatGemm( 1, 0, 1.0, fd.dot, bt.val, 0.0, zr.dot );
+    f64MatGemm( 1, 0, 1.0, fd.val, bt.dot, 1.0, zr.dot );
+    TEST_ASSERT( f64FVEqual( z, zr, EPS ) );
+
+    f64FVFree( DefaultAllocator, &z );
+    f64FVFree( DefaultAllocator, &zr );
+    f64FVFree( DefaultAllocator, &y );
+    f64FVFree( DefaultAllocator, &yr );
+    f64FVFree( DefaultAllocator, &fd );
+    f64FVSpMatFree( DefaultAllocator, &fa );
+    f64MatFree( DefaultAllocator, &c );
+    f64MatFree( DefaultAllocator, &ref );
+    f64MatFree( DefaultAllocator, &ct );
+    f64MatFree( DefaultAllocator, &rt );
+    f64FVFree( DefaultAllocator, &b );
+    f64FVFree( DefaultAllocator, &bt );
+    f64MatFree( DefaultAllocator, &back );
+    f64SpMatFree( DefaultAllocator, &at );
+    f64SpMatFree( DefaultAllocator, &a );
+    f64MatFree( DefaultAllocator, &dense );
+
+    if ( ownPool ) {
+        TerminateParallel();
+    }
+
+#undef EPS
+}
+#endif
@@ -0,0 +1,218 @@
+// Author:  https://github.com/Tuxonomics
+// Created: Oct, 2018
+//
+// Compressed sparse row matrices for any element type with an add and a
+// multiply function and a dense type##Mat counterpart. The SPMAT_* macros
+// follow the MAT_* macros of the dense types, they are instantiated in
+// sparse.h for the dod build and in forward_normal/fw_sparse.h for the
+// scalar forward mode. parallel.h has to be included first.
+//
+// Products against dense matrices are partitioned over the rows of the
+// output and run on the thread pool, the CSR of the transpose (i.e. the CSC
+// of the matrix) is built by SpMatTranspose.
+//
+
+#define SPMAT_MIN_PARALLEL_NNZ 16384
+
+
+#define SPMAT_DECL(type) typedef struct type##SpMat type##SpMat; \
+    struct type##SpMat { \
+        u32   dim0; \
+        u32   dim1; \
+        u32   nnz; \
+        u32  *rowPtr;   /* dim0 + 1 offsets into colIdx and data */ \
+        u32  *colIdx; \
+        type *data; \
+    };
+
+#define SPMAT_MAKE(type) type##SpMat \
+    type##SpMatMake( Allocator al, u32 dim0, u32 dim1, u32 nnz ) \
+    { \
+        type##SpMat m; \
+        m.dim0   = dim0; \
+        m.dim1   = dim1; \
+        m.nnz    = nnz; \
+        m.rowPtr = (u32 *)  Alloc( al, (dim0 + 1) * sizeof(u32) ); \
+        m.colIdx = (u32 *)  Alloc( al, MAX( nnz, 1 ) * sizeof(u32) ); \
+        m.data   = (type *) Alloc( al, MAX( nnz, 1 ) * sizeof(type) ); \
+        m.rowPtr[0] = 0; \
+        return m; \
+    }
+
+#define SPMAT_FREE(type) void \
+    type##SpMatFree( Allocator al, type##SpMat *m ) \
+    { \
+        Free( al, m->rowPtr ); \
+        Free( al, m->colIdx ); \
+        Free( al, m->data ); \
+    }
+
+/* entries of m equal to zero (memcmp against a zeroed value) are dropped */
+#define SPMAT_FROM_DENSE(type) type##SpMat \
+    type##SpMatFromDense( Allocator al, type##Mat m ) \
+    { \
+        type zero; \
+        memset( &zero, 0, sizeof(type) ); \
+        u32 nnz = 0; \
+        for ( u32 i=0; i<m.dim0 * m.dim1; ++i ) { \
+            nnz += memcmp( &m.data[i], &zero, sizeof(type) ) != 0; \
+        } \
+        type##SpMat s = type##SpMatMake( al, m.dim0, m.dim1, nnz ); \
+        u32 k = 0; \
+        for ( u32 i=0; i<m.dim0; ++i ) { \
+            for ( u32 j=0; j<m.dim1; ++j ) { \
+                type v = m.data[i*m.dim1 + j]; \
+                if ( memcmp( &v, &zero, sizeof(type) ) != 0 ) { \
+                    s.colIdx[k] = j; \
+                    s.data[k]   = v; \
+                    ++k; \
+                } \
+            } \
+            s.rowPtr[i+1] = k; \
+        } \
+        return s; \
+    }
+
+#define SPMAT_TO_DENSE(type) void \
+    type##SpMatToDense( type##SpMat s, type##Mat m ) \
+    { \
+        ASSERT( s.dim0 == m.dim0 && s.dim1 == m.dim1 ); \
+        memset( m.data, 0, m.dim0 * m.dim1 * sizeof(type) ); \
+        for ( u32 i=0; i<s.dim0; ++i ) { \
+            for ( u32 k=s.rowPtr[i]; k<s.rowPtr[i+1]; ++k ) { \
+                m.data[i*m.dim1 + s.colIdx[k]] = s.data[k]; \
+            } \
+        } \
+    }
+
+/* CSR of the transpose, column indices stay sorted */
+#define SPMAT_TRANSPOSE(type) type##SpMat \
+    type##SpMatTranspose( Allocator al, type##SpMat a ) \
+    { \
+        type##SpMat t = type##SpMatMake( al, a.dim1, a.dim0, a.nnz ); \
+        memset( t.rowPtr, 0, (a.dim1 + 1) * sizeof(u32) ); \
+        for ( u32 k=0; k<a.nnz; ++k ) { \
+            t.rowPtr[a.colIdx[k] + 1] += 1; \
+        } \
+        for ( u32 j=0; j<a.dim1; ++j ) { \
+            t.rowPtr[j+1] += t.rowPtr[j]; \
+        } \
+        u32 *next = (u32 *) Alloc( al, MAX( a.dim1, 1 ) * sizeof(u32) ); \
+        memcpy( next, t.rowPtr, a.dim1 * sizeof(u32) ); \
+        for ( u32 i=0; i<a.dim0; ++i ) { \
+            for ( u32 k=a.rowPtr[i]; k<a.rowPtr[i+1]; ++k ) { \
+                u32 dst = next[a.colIdx[k]]++; \
+                t.colIdx[dst] = i; \
+                t.data[dst]   = a.data[k]; \
+            } \
+        } \
+        Free( al, next ); \
+        return t; \
+    }
+
+/* c (+)= a * b with b, c dense, rows of c are independent */
+#define SPMAT_MUL(type, addFun, mulFun) \
+    typedef struct type##spMulArgs type##spMulArgs; \
+    struct type##spMulArgs { \
+        type##SpMat a; \
+        type##Mat   b; \
+        type##Mat   c; \
+        b32         accumulate; \
+    }; \
+    \
+    void type##spMulRows( void *args, u32 start, u32 end ) \
+    { \
+        type##spMulArgs *x = (type##spMulArgs *) args; \
+        u32 p = x->b.dim1; \
+        for ( u32 i=start; i<end; ++i ) { \
+            type *rc = x->c.data + (u64) i * p; \
+            if ( !x->accumulate ) { \
+                memset( rc, 0, p * sizeof(type) ); \
+            } \
+            for ( u32 k=x->a.rowPtr[i]; k<x->a.rowPtr[i+1]; ++k ) { \
+                type        v  = x->a.data[k]; \
+                const type *rb = x->b.data + (u64) x->a.colIdx[k] * p; \
+                for ( u32 j=0; j<p; ++j ) { \
+                    rc[j] = addFun( rc[j], mulFun( v, rb[j] ) ); \
+                } \
+            } \
+        } \
+    } \
+    \
+    void type##spMul( type##SpMat a, type##Mat b, type##Mat c, b32 accumulate ) \
+    { \
+        ASSERT( a.dim1 == b.dim0 && a.dim0 == c.dim0 && b.dim1 == c.dim1 ); \
+        type##spMulArgs args = { a, b, c, accumulate }; \
+        if ( (u64) a.nnz * b.dim1 < SPMAT_MIN_PARALLEL_NNZ ) { \
+            type##spMulRows( &args, 0, a.dim0 ); \
+        } \
+        else { \
+            ParallelFor( a.dim0, ParallelChunkSize( a.dim0, 16, 8 ), type##spMulRows, &args ); \
+        } \
+    } \
+    \
+    /* c = a * b */ \
+    void type##SpMatMul( type##SpMat a, type##Mat b, type##Mat c ) \
+    { \
+        type##spMul( a, b, c, 0 ); \
+    } \
+    \
+    /* c += a * b */ \
+    void type##SpMatMulIP( type##SpMat a, type##Mat b, type##Mat c ) \
+    { \
+        type##spMul( a, b, c, 1 ); \
+    }
+
+/* c (+)= a' * b, scatters into the rows of c; parallel over the columns of
+ * b, for repeated products with a single column transpose a once instead */
+#define SPMAT_TMUL(type, addFun, mulFun) \
+    typedef struct type##spTMulArgs type##spTMulArgs; \
+    struct type##spTMulArgs { \
+        type##SpMat a; \
+        type##Mat   b; \
+        type##Mat   c; \
+    }; \
+    \
+    void type##spTMulCols( void *args, u32 start, u32 end ) \
+    { \
+        type##spTMulArgs *x = (type##spTMulArgs *) args; \
+        u32 p = x->b.dim1; \
+        for ( u32 i=0; i<x->a.dim0; ++i ) { \
+            const type *rb = x->b.data + (u64) i * p; \
+            for ( u32 k=x->a.rowPtr[i]; k<x->a.rowPtr[i+1]; ++k ) { \
+                type  v  = x->a.data[k]; \
+                type *rc = x->c.data + (u64) x->a.colIdx[k] * p; \
+                for ( u32 j=start; j<end; ++j ) { \
+                    rc[j] = addFun( rc[j], mulFun( v, rb[j] ) ); \
+                } \
+            } \
+        } \
+    } \
+    \
+    void type##spTMul( type##SpMat a, type##Mat b, type##Mat c, b32 accumulate ) \
+    { \
+        ASSERT( a.dim0 == b.dim0 && a.dim1 == c.dim0 && b.dim1 == c.dim1 ); \
+        if ( !accumulate ) { \
+            memset( c.data, 0, (u64) c.dim0 * c.dim1 * sizeof(type) ); \
+        } \
+        type##spTMulArgs args = { a, b, c }; \
+        if ( (u64) a.nnz * b.dim1 < SPMAT_MIN_PARALLEL_NNZ ) { \
+            type##spTMulCols( &args, 0, b.dim1 ); \
+        } \
+        else { \
+            ParallelFor( b.dim1, ParallelChunkSize( b.dim1, 8, 1 ), type##spTMulCols, &args ); \
+        } \
+    } \
+    \
+    /* c = a' * b */ \
+    void type##SpMatTMul( type##SpMat a, type##Mat b, type##Mat c ) \
+    { \
+        type##spTMul( a, b, c, 0 ); \
+    } \
+    \
+    /* c += a' * b */ \
+    void type##SpMatTMulIP( type##SpMat a, type##Mat b, type##Mat c ) \
+    { \
+        type##spTMul( a, b, c, 1 ); \
+    }
+